@@ -1407,6 +1407,12 @@ function test_mon_osd_pool_set()
   ceph osd pool set $TEST_POOL_GETSET deep_scrub_interval 0
   expect_false "ceph osd pool get $TEST_POOL_GETSET deep_scrub_interval | grep '.'"
 
+  expect_false "ceph osd pool get $TEST_POOL_GETSET compression_algorithm | grep '.'"
+  ceph osd pool set $TEST_POOL_GETSET compression_algorithm snappy
+  ceph osd pool get $TEST_POOL_GETSET compression_algorithm | grep 'compression_algorithm: snappy'
+  ceph osd pool set $TEST_POOL_GETSET compression_algorithm ''
+  expect_false "ceph osd pool get $TEST_POOL_GETSET compression_algorithm | grep '.'"
+
   ceph osd pool set $TEST_POOL_GETSET nopgchange 1
   expect_false ceph osd pool set $TEST_POOL_GETSET pg_num 10
   expect_false ceph osd pool set $TEST_POOL_GETSET pgp_num 10
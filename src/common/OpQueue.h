@@ -0,0 +1,63 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2015 Red Hat
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef OP_QUEUE_H
+#define OP_QUEUE_H
+
+#include "common/Formatter.h"
+
+#include <functional>
+#include <list>
+
+/**
+ * Abstract interface for an op queue
+ *
+ * Items queued with enqueue_strict and enqueue_strict_front are
+ * served in strict priority order ahead of everything else; how the
+ * rest are scheduled (priority, cost, class K) is up to the
+ * implementation.
+ */
+template <typename T, typename K>
+class OpQueue {
+public:
+  virtual ~OpQueue() {}
+
+  /// Number of queued items
+  virtual unsigned length() const = 0;
+
+  /// Remove (and optionally return, in queue order) items matching f
+  virtual void remove_by_filter(
+    std::function<bool (T)> f, std::list<T> *removed = 0) = 0;
+
+  /// Remove (and optionally return) all items of class k
+  virtual void remove_by_class(K k, std::list<T> *out = 0) = 0;
+
+  virtual void enqueue_strict(K cl, unsigned priority, T item) = 0;
+  virtual void enqueue_strict_front(K cl, unsigned priority, T item) = 0;
+  virtual void enqueue(K cl, unsigned priority, unsigned cost, T item) = 0;
+  virtual void enqueue_front(K cl, unsigned priority, unsigned cost,
+			     T item) = 0;
+
+  virtual bool empty() const = 0;
+
+  /// Next item to serve; the queue must not be empty
+  virtual T dequeue() = 0;
+
+  virtual void dump(Formatter *f) const = 0;
+
+  /// Re-read any parameters the implementation caches from the config
+  virtual void update_params() {}
+};
+
+#endif
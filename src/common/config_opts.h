@@ -381,6 +381,7 @@ OPTION(objecter_inflight_op_bytes, OPT_U64, 1024*1024*100) // max in-flight data
 OPTION(objecter_inflight_ops, OPT_U64, 1024)               // max in-flight ios
 OPTION(objecter_completion_locks_per_session, OPT_U64, 32) // num of completion locks per each session, for serializing same object responses
 OPTION(objecter_inject_no_watch_ping, OPT_BOOL, false)   // suppress watch pings
+OPTION(objecter_mapping_table, OPT_BOOL, false)  // precompute pg mappings for each new map
 
 // Max number of deletes at once in a single Filer::purge call
 OPTION(filer_max_purge_ops, OPT_U32, 10)
@@ -535,6 +536,9 @@ OPTION(osd_agent_delay_time, OPT_FLOAT, 5.0)
 // osd ignore history.last_epoch_started in find_best_info
 OPTION(osd_find_best_info_ignore_history_les, OPT_BOOL, false)
 
+// keep only the epoch range of past intervals that cannot have gone rw
+OPTION(osd_summarize_past_intervals, OPT_BOOL, true)
+
 // decay atime and hist histograms after how many objects go by
 OPTION(osd_agent_hist_halflife, OPT_INT, 1000)
 
@@ -607,6 +611,8 @@ OPTION(osd_map_dedup, OPT_BOOL, true)
 OPTION(osd_map_max_advance, OPT_INT, 150) // make this < cache_size!
 OPTION(osd_map_cache_size, OPT_INT, 200)
 OPTION(osd_map_message_max, OPT_INT, 100)  // max maps per MOSDMap message
+OPTION(osd_map_mapping_table, OPT_BOOL, false)  // precompute pg mappings for each new map (at startup)
+OPTION(osd_map_mapping_threads, OPT_INT, 4)  // threads used to build them
 OPTION(osd_map_share_max_epochs, OPT_INT, 100)  // cap on # of inc maps we send to peers, clients
 OPTION(osd_inject_bad_map_crc_probability, OPT_FLOAT, 0)
 OPTION(osd_inject_failure_on_pg_removal, OPT_BOOL, false)
@@ -614,6 +620,25 @@ OPTION(osd_op_threads, OPT_INT, 2)    // 0 == no threading
 OPTION(osd_peering_wq_batch_size, OPT_U64, 20)
 OPTION(osd_op_pq_max_tokens_per_priority, OPT_U64, 4194304)
 OPTION(osd_op_pq_min_cost, OPT_U64, 65536)
+OPTION(osd_op_queue, OPT_STR, "prio") // op queue per shard: prio or mclock
+// mclock: reservation and limit are in ios/sec (0 for none), where an io
+// of cost c counts as 1 + c/osd_op_queue_mclock_cost_unit
+OPTION(osd_op_queue_mclock_cost_unit, OPT_U64, 65536)
+OPTION(osd_op_queue_mclock_client_op_res, OPT_DOUBLE, 0) // per client
+OPTION(osd_op_queue_mclock_client_op_wgt, OPT_DOUBLE, 100)
+OPTION(osd_op_queue_mclock_client_op_lim, OPT_DOUBLE, 0)
+OPTION(osd_op_queue_mclock_osd_subop_res, OPT_DOUBLE, 0) // per peer osd
+OPTION(osd_op_queue_mclock_osd_subop_wgt, OPT_DOUBLE, 500)
+OPTION(osd_op_queue_mclock_osd_subop_lim, OPT_DOUBLE, 0)
+OPTION(osd_op_queue_mclock_recov_res, OPT_DOUBLE, 1)
+OPTION(osd_op_queue_mclock_recov_wgt, OPT_DOUBLE, 10)
+OPTION(osd_op_queue_mclock_recov_lim, OPT_DOUBLE, 0)
+OPTION(osd_op_queue_mclock_scrub_res, OPT_DOUBLE, 0)
+OPTION(osd_op_queue_mclock_scrub_wgt, OPT_DOUBLE, 5)
+OPTION(osd_op_queue_mclock_scrub_lim, OPT_DOUBLE, 0)
+OPTION(osd_op_queue_mclock_snap_res, OPT_DOUBLE, 0)
+OPTION(osd_op_queue_mclock_snap_wgt, OPT_DOUBLE, 5)
+OPTION(osd_op_queue_mclock_snap_lim, OPT_DOUBLE, 0)
 OPTION(osd_disk_threads, OPT_INT, 1)
 OPTION(osd_disk_thread_ioprio_class, OPT_STR, "") // rt realtime be best effort idle
 OPTION(osd_disk_thread_ioprio_priority, OPT_INT, -1) // 0-7
@@ -631,6 +656,12 @@ OPTION(osd_read_ec_check_for_errors, OPT_BOOL, false) // return error if any ec
 // osd_recover_clone_overlap_limit entries in the overlap set
 OPTION(osd_recover_clone_overlap_limit, OPT_INT, 10)
 
+// Record the extents each write dirties in the pg log, and push only
+// those to a replica that already has the object's prior version
+OPTION(osd_recover_dirty_extents, OPT_BOOL, true)
+// entries dirtying more intervals than this are logged without them
+OPTION(osd_recover_dirty_extents_limit, OPT_INT, 32)
+
 OPTION(osd_backfill_scan_min, OPT_INT, 64)
 OPTION(osd_backfill_scan_max, OPT_INT, 512)
 OPTION(osd_op_thread_timeout, OPT_INT, 15)
@@ -766,6 +797,11 @@ OPTION(keyvaluestore_rocksdb_options, OPT_STR, "")
 OPTION(filestore_rocksdb_options, OPT_STR, "")
 // rocksdb options that will be used in monstore
 OPTION(mon_rocksdb_options, OPT_STR, "cache_size=536870912,write_buffer_size=33554432,block_size=65536,compression=kNoCompression")
+// space separated list of key prefixes that get their own rocksdb column
+// family, each optionally followed by "=" and rocksdb column family
+// options (e.g. "L=compaction_style=kCompactionStyleUniversal O").  Only
+// applied when a db is created; existing dbs keep their layout.
+OPTION(rocksdb_column_families, OPT_STR, "")
 
 /**
  * osd_*_priority adjust the relative priority of client io, recovery io,
@@ -813,9 +849,12 @@ OPTION(osd_bench_duration, OPT_U32, 30) // duration of 'osd bench', capped at 30
 OPTION(memstore_device_bytes, OPT_U64, 1024*1024*1024)
 OPTION(memstore_page_set, OPT_BOOL, true)
 OPTION(memstore_page_size, OPT_U64, 64 << 10)
+OPTION(memstore_page_arena, OPT_BOOL, true) // allocate pages from mmap slabs instead of the heap
+OPTION(memstore_finisher_threads, OPT_INT, 1) // completion threads; sequencers are spread across them
 
 OPTION(newstore_max_dir_size, OPT_U32, 1000000)
-OPTION(newstore_onode_map_size, OPT_U32, 1024)   // onodes per collection
+OPTION(newstore_onode_cache_bytes, OPT_U64, 256*1024*1024)  // memory for cached onodes, shared by all collections
+OPTION(newstore_onode_cache_shards, OPT_INT, 0)  // lru shards; 0 = osd_op_num_shards
 OPTION(newstore_backend, OPT_STR, "rocksdb")
 OPTION(newstore_rocksdb_options, OPT_STR, "compression=kNoCompression,max_write_buffer_number=16,min_write_buffer_number_to_merge=6")
 OPTION(newstore_fail_eio, OPT_BOOL, true)
@@ -842,6 +881,16 @@ OPTION(newstore_o_direct, OPT_BOOL, true)
 OPTION(newstore_aio, OPT_BOOL, true)
 OPTION(newstore_aio_poll_ms, OPT_INT, 250)  // milliseconds
 OPTION(newstore_aio_max_queue_depth, OPT_INT, 4096)
+OPTION(newstore_aio_engine, OPT_STR, "libaio")  // libaio or io_uring (falls back to libaio if unavailable)
+OPTION(newstore_block_path, OPT_STR, "")   // raw device or file for object data; empty means use fragment files
+OPTION(newstore_block_create_size, OPT_U64, 10ull*1024*1024*1024)  // size of block file to create at mkfs if it does not exist
+OPTION(newstore_block_size, OPT_U32, 4096)  // allocation unit on the block device
+OPTION(newstore_block_max_extent_size, OPT_U32, 8*1024*1024)
+OPTION(newstore_csum_type, OPT_STR, "crc32c")  // checksum for block extents: none, crc32c
+OPTION(newstore_compression, OPT_STR, "none")  // default for block extents: none, snappy; collections may override
+OPTION(newstore_compression_min_blob_size, OPT_U32, 8192)  // do not bother compressing smaller writes
+OPTION(newstore_compression_max_blob_size, OPT_U32, 65536)  // largest unit compressed (and decompressed on read) together
+OPTION(newstore_compression_required_ratio, OPT_DOUBLE, .875)  // keep compressed data only if allocated size shrinks to this fraction
 
 OPTION(filestore_omap_backend, OPT_STR, "leveldb")
 
@@ -860,18 +909,27 @@ OPTION(filestore_wbthrottle_xfs_ios_start_flusher, OPT_U64, 500)
 OPTION(filestore_wbthrottle_xfs_ios_hard_limit, OPT_U64, 5000)
 OPTION(filestore_wbthrottle_xfs_inodes_start_flusher, OPT_U64, 500)
 
+// derive the bytes and ios limits from the measured writeback rate,
+// within the static limits above
+OPTION(filestore_wbthrottle_adaptive, OPT_BOOL, false)
+OPTION(filestore_wbthrottle_adaptive_target, OPT_DOUBLE, 1) // seconds of writeback allowed below the hard limit
+OPTION(filestore_wbthrottle_flush_batch, OPT_INT, 16) // objects written back together, in inode order
+
 /// These must be less than the fd limit
 OPTION(filestore_wbthrottle_btrfs_inodes_hard_limit, OPT_U64, 5000)
 OPTION(filestore_wbthrottle_xfs_inodes_hard_limit, OPT_U64, 5000)
 
 // Tests index failure paths
 OPTION(filestore_index_retry_probability, OPT_DOUBLE, 0)
+OPTION(filestore_lfn_cache_size, OPT_INT, 128) // long name lookups cached per collection, 0 to disable
 
 // Allow object read error injection
 OPTION(filestore_debug_inject_read_err, OPT_BOOL, false)
 
 OPTION(filestore_debug_omap_check, OPT_BOOL, 0) // Expensive debugging check on sync
 OPTION(filestore_omap_header_cache_size, OPT_INT, 1024)
+OPTION(filestore_omap_seq_reserve, OPT_U64, 1024) // header seqs persisted per State write
+OPTION(filestore_omap_range_delete_min_keys, OPT_INT, 1024) // range delete an object's omap when it has this many keys (0 = never)
 
 // Use omap for xattrs for attrs over
 // filestore_max_inline_xattr_size or
@@ -900,6 +958,9 @@ OPTION(filestore_fsync_flushes_journal_data, OPT_BOOL, false)
 OPTION(filestore_fiemap, OPT_BOOL, false)     // (try to) use fiemap
 OPTION(filestore_seek_data_hole, OPT_BOOL, false)     // (try to) use seek_data/hole
 OPTION(filestore_fadvise, OPT_BOOL, true)
+OPTION(filestore_readahead_trigger_requests, OPT_INT, 4)  // sequential reads of an object before we prefetch
+OPTION(filestore_readahead_min_bytes, OPT_U64, 128*1024)
+OPTION(filestore_readahead_max_bytes, OPT_U64, 2*1024*1024)  // 0 disables readahead
 
 // (try to) use extsize for alloc hint NOTE: extsize seems to trigger
 // data corruption in xfs prior to kernel 3.5.  filestore will
@@ -921,6 +982,10 @@ OPTION(filestore_commit_timeout, OPT_FLOAT, 600)
 OPTION(filestore_fiemap_threshold, OPT_INT, 4096)
 OPTION(filestore_merge_threshold, OPT_INT, 10)
 OPTION(filestore_split_multiple, OPT_INT, 2)
+// split full leaf directories in a background thread instead of inline
+OPTION(filestore_split_background, OPT_BOOL, false)
+OPTION(filestore_split_background_batch, OPT_INT, 128)   // objects linked or removed per batch
+OPTION(filestore_split_background_delay, OPT_DOUBLE, .01) // seconds to sleep between batches
 OPTION(filestore_update_to, OPT_INT, 1000)
 OPTION(filestore_blackhole, OPT_BOOL, false)     // drop any new transactions on the floor
 OPTION(filestore_fd_cache_size, OPT_INT, 128)    // FD lru size
@@ -935,9 +1000,14 @@ OPTION(filestore_debug_verify_split, OPT_BOOL, false)
 OPTION(journal_dio, OPT_BOOL, true)
 OPTION(journal_aio, OPT_BOOL, true)
 OPTION(journal_force_aio, OPT_BOOL, false)
+OPTION(journal_dax, OPT_BOOL, false)  // mmap the journal file and persist entries with cache flushes (pmem)
+OPTION(journal_aio_engine, OPT_STR, "libaio")  // libaio or io_uring (falls back to libaio if unavailable)
 
 OPTION(keyvaluestore_queue_max_ops, OPT_INT, 50)
 OPTION(keyvaluestore_queue_max_bytes, OPT_INT, 100 << 20)
+// apply up to this many queued ops of a sequencer in one kv transaction
+OPTION(keyvaluestore_op_batch_max_ops, OPT_INT, 16)
+OPTION(keyvaluestore_op_batch_max_bytes, OPT_U64, 4 << 20)
 OPTION(keyvaluestore_debug_check_backend, OPT_BOOL, 0) // Expensive debugging check on sync
 OPTION(keyvaluestore_op_threads, OPT_INT, 2)
 OPTION(keyvaluestore_op_thread_timeout, OPT_INT, 60)
@@ -954,6 +1024,7 @@ OPTION(journal_block_align, OPT_BOOL, true)
 OPTION(journal_write_header_frequency, OPT_U64, 0)
 OPTION(journal_max_write_bytes, OPT_INT, 10 << 20)
 OPTION(journal_max_write_entries, OPT_INT, 100)
+OPTION(journal_group_commit_max_wait_us, OPT_INT, 0)  // max time to hold a write open for more entries (0 = off)
 OPTION(journal_queue_max_ops, OPT_INT, 300)
 OPTION(journal_queue_max_bytes, OPT_INT, 32 << 20)
 OPTION(journal_align_min_size, OPT_INT, 64 << 10)  // align data payloads >= this.
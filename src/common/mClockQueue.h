@@ -0,0 +1,464 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2015 Red Hat
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef MCLOCK_QUEUE_H
+#define MCLOCK_QUEUE_H
+
+#include "common/OpQueue.h"
+#include "common/Clock.h"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <list>
+#include <map>
+#include <utility>
+
+/**
+ * Tag based QoS queue, after mClock (Gulati et al, OSDI '10)
+ *
+ * Every item belongs to a client, identified by its class K and a
+ * scheduling class (client io, recovery, scrub, ...) chosen by the
+ * classify function.  Each client has
+ *
+ *  reservation: cost units/sec it is guaranteed (0 for none)
+ *  weight:      its share of whatever is left over
+ *  limit:       cost units/sec it is capped at (0 for none)
+ *
+ * and each queued item carries three tags computed on arrival, e.g.
+ * R = max(R_prev + cost/reservation, now).  dequeue() first serves
+ * the smallest R tag that is due, so that reservations are met; then
+ * the smallest weight tag among clients under their limit.  When
+ * everyone is at their limit the smallest weight tag is served anyway:
+ * limits shape the share a client gets while others wait, but idle
+ * capacity is never left unused, because our callers expect an item
+ * whenever the queue is not empty.
+ *
+ * An item's cost is counted as 1 + cost/cost_unit, so that the
+ * parameters read as ios/sec with large ios charged extra.
+ *
+ * Strict items bypass all of this, exactly as with PrioritizedQueue.
+ *
+ * Only clients with queued items are kept.  A client that runs dry
+ * leaves its reservation and limit tags behind until the clock passes
+ * them (so that it can't reset its limit by pausing), at most max_idle
+ * of them; its weight tag is dropped, and it starts level with the
+ * active clients when it returns.
+ */
+template <typename T, typename K>
+class mClockQueue : public OpQueue<T, K> {
+public:
+  struct ClientInfo {
+    double reservation;
+    double weight;
+    double limit;
+    ClientInfo(double r = 0, double w = 1, double l = 0)
+      : reservation(r), weight(w), limit(l) {}
+  };
+
+  /// scheduling class of an item
+  typedef std::function<unsigned (const K&, const T&)> classify_func;
+  /// parameters of a client
+  typedef std::function<ClientInfo (unsigned, const K&)> info_func;
+  /// current time in seconds
+  typedef std::function<double ()> clock_func;
+
+private:
+  struct Request {
+    T item;
+    double cost;
+    double r_tag, p_tag, l_tag;
+    Request(const T &item, double cost) : item(item), cost(cost),
+      r_tag(0), p_tag(0), l_tag(0) {}
+  };
+
+  struct Client {
+    ClientInfo info;
+    double prev_r, prev_p, prev_l;   ///< tags of the last arrival
+    std::list<Request> requests;
+    Client()
+      : prev_r(-std::numeric_limits<double>::infinity()),
+	prev_p(-std::numeric_limits<double>::infinity()),
+	prev_l(-std::numeric_limits<double>::infinity()) {}
+
+    /// when the remembered r and l tags stop mattering
+    double expires() const {
+      return std::max(prev_r, prev_l);
+    }
+
+    void tag(Request *r, double now, double p_floor) {
+      r->r_tag = info.reservation > 0 ?
+	std::max(prev_r + r->cost / info.reservation, now) : 0;
+      r->p_tag = std::max(prev_p + r->cost / info.weight, p_floor);
+      r->l_tag = info.limit > 0 ?
+	std::max(prev_l + r->cost / info.limit, now) : 0;
+      prev_r = r->r_tag;
+      prev_p = r->p_tag;
+      prev_l = r->l_tag;
+    }
+  };
+
+  typedef std::pair<unsigned, K> ClientKey;
+  typedef std::map<ClientKey, Client> Clients;
+
+  /// r and l tags left behind by a client that ran dry
+  typedef std::multimap<double, ClientKey> IdleByExpiry;
+  struct Idle {
+    double prev_r, prev_l;
+    typename IdleByExpiry::iterator expiry;
+  };
+  typedef std::map<ClientKey, Idle> IdleClients;
+  typedef std::list<std::pair<K, T> > StrictList;
+  typedef std::map<unsigned, StrictList> StrictQueues;
+
+  classify_func classify;
+  info_func get_info;
+  clock_func now;
+  unsigned cost_unit;
+  unsigned max_idle;
+  Clients clients;         ///< clients with queued items
+  IdleClients idle;
+  IdleByExpiry idle_by_expiry;
+  StrictQueues high_queue;
+  unsigned size;
+
+  static double default_now() {
+    return (double)ceph_clock_now(NULL);
+  }
+
+  double to_cost(unsigned cost) const {
+    return 1.0 + (cost_unit ? (double)cost / cost_unit : 0);
+  }
+
+  void set_info(const ClientKey &key, Client *c) {
+    c->info = get_info(key.first, key.second);
+    if (c->info.weight <= 0)
+      c->info.weight = 1;
+  }
+
+  Client &get_client(const K &cl, const T &item) {
+    ClientKey key(classify(cl, item), cl);
+    typename Clients::iterator p = clients.find(key);
+    if (p == clients.end()) {
+      p = clients.insert(std::make_pair(key, Client())).first;
+      set_info(key, &p->second);
+      typename IdleClients::iterator i = idle.find(key);
+      if (i != idle.end()) {
+	p->second.prev_r = i->second.prev_r;
+	p->second.prev_l = i->second.prev_l;
+	idle_by_expiry.erase(i->second.expiry);
+	idle.erase(i);
+      }
+    }
+    return p->second;
+  }
+
+  /// forget tags the clock has passed, and the oldest beyond max_idle
+  void trim_idle(double t) {
+    while (!idle_by_expiry.empty() &&
+	   (idle_by_expiry.begin()->first <= t || idle.size() > max_idle)) {
+      idle.erase(idle_by_expiry.begin()->second);
+      idle_by_expiry.erase(idle_by_expiry.begin());
+    }
+  }
+
+  /// drop a client that ran dry, remembering its tags if they matter
+  void retire(typename Clients::iterator p, double t) {
+    assert(p->second.requests.empty());
+    double expires = p->second.expires();
+    if (expires > t) {
+      Idle &i = idle[p->first];
+      i.prev_r = p->second.prev_r;
+      i.prev_l = p->second.prev_l;
+      i.expiry = idle_by_expiry.insert(std::make_pair(expires, p->first));
+    }
+    clients.erase(p);
+    trim_idle(t);
+  }
+
+  /// weight tags of backlogged clients run ahead of the clock; start a
+  /// newly active client level with them rather than at now
+  double min_active_p(double t) const {
+    double m = 0;
+    bool any = false;
+    for (typename Clients::const_iterator i = clients.begin();
+	 i != clients.end();
+	 ++i) {
+      if (i->second.requests.empty())
+	continue;  // just created by get_client()
+      double p = i->second.requests.front().p_tag;
+      if (!any || p < m)
+	m = p;
+      any = true;
+    }
+    return any ? std::max(m, t) : t;
+  }
+
+  T pop(typename Clients::iterator p, bool by_weight, double t) {
+    Client &c = p->second;
+    Request r = c.requests.front();
+    c.requests.pop_front();
+    --size;
+    if (by_weight && c.info.reservation > 0) {
+      // served out of the weight share: don't count it against the
+      // reservation as well
+      double adj = r.cost / c.info.reservation;
+      for (typename std::list<Request>::iterator i = c.requests.begin();
+	   i != c.requests.end();
+	   ++i)
+	i->r_tag -= adj;
+      c.prev_r -= adj;
+    }
+    if (c.requests.empty())
+      retire(p, t);
+    return r.item;
+  }
+
+  void filter_list(std::list<Request> *l, std::function<bool (T)> f,
+		   std::list<T> *out) {
+    for (typename std::list<Request>::iterator i = l->begin();
+	 i != l->end(); ) {
+      if (f(i->item)) {
+	if (out)
+	  out->push_back(i->item);
+	l->erase(i++);
+	--size;
+      } else {
+	++i;
+      }
+    }
+  }
+
+public:
+  mClockQueue(classify_func classify, info_func get_info,
+	      unsigned cost_unit, clock_func now = default_now,
+	      unsigned max_idle = 1024)
+    : classify(classify), get_info(get_info), now(now),
+      cost_unit(cost_unit), max_idle(max_idle), size(0) {}
+
+  void update_params() {
+    update_client_info();
+  }
+
+  /// re-read every queued client's parameters with get_info
+  void update_client_info() {
+    for (typename Clients::iterator i = clients.begin();
+	 i != clients.end();
+	 ++i)
+      set_info(i->first, &i->second);
+  }
+
+  unsigned length() const {
+    unsigned total = size;
+    for (typename StrictQueues::const_iterator i = high_queue.begin();
+	 i != high_queue.end();
+	 ++i)
+      total += i->second.size();
+    return total;
+  }
+
+  void remove_by_filter(std::function<bool (T)> f, std::list<T> *removed = 0) {
+    double t = now();
+    for (typename Clients::iterator i = clients.begin(); i != clients.end(); ) {
+      filter_list(&i->second.requests, f, removed);
+      if (i->second.requests.empty())
+	retire(i++, t);
+      else
+	++i;
+    }
+    for (typename StrictQueues::iterator i = high_queue.begin();
+	 i != high_queue.end(); ) {
+      for (typename StrictList::iterator j = i->second.begin();
+	   j != i->second.end(); ) {
+	if (f(j->second)) {
+	  if (removed)
+	    removed->push_back(j->second);
+	  i->second.erase(j++);
+	} else {
+	  ++j;
+	}
+      }
+      if (i->second.empty())
+	high_queue.erase(i++);
+      else
+	++i;
+    }
+  }
+
+  void remove_by_class(K k, std::list<T> *out = 0) {
+    for (typename Clients::iterator i = clients.begin(); i != clients.end(); ) {
+      if (i->first.second == k) {
+	for (typename std::list<Request>::iterator j =
+	       i->second.requests.begin();
+	     j != i->second.requests.end();
+	     ++j) {
+	  if (out)
+	    out->push_back(j->item);
+	  --size;
+	}
+	clients.erase(i++);
+      } else {
+	++i;
+      }
+    }
+    for (typename StrictQueues::iterator i = high_queue.begin();
+	 i != high_queue.end(); ) {
+      for (typename StrictList::iterator j = i->second.begin();
+	   j != i->second.end(); ) {
+	if (j->first == k) {
+	  if (out)
+	    out->push_back(j->second);
+	  i->second.erase(j++);
+	} else {
+	  ++j;
+	}
+      }
+      if (i->second.empty())
+	high_queue.erase(i++);
+      else
+	++i;
+    }
+  }
+
+  void enqueue_strict(K cl, unsigned priority, T item) {
+    high_queue[priority].push_back(std::make_pair(cl, item));
+  }
+
+  void enqueue_strict_front(K cl, unsigned priority, T item) {
+    high_queue[priority].push_front(std::make_pair(cl, item));
+  }
+
+  void enqueue(K cl, unsigned priority, unsigned cost, T item) {
+    Client &c = get_client(cl, item);
+    Request r(item, to_cost(cost));
+    double t = now();
+    c.tag(&r, t, c.requests.empty() ? min_active_p(t) : t);
+    c.requests.push_back(r);
+    ++size;
+  }
+
+  void enqueue_front(K cl, unsigned priority, unsigned cost, T item) {
+    // a requeue: put it back at the head with the head's tags, or
+    // fresh ones if the client has nothing else queued
+    Client &c = get_client(cl, item);
+    Request r(item, to_cost(cost));
+    if (c.requests.empty()) {
+      double t = now();
+      r.r_tag = c.info.reservation > 0 ? t : 0;
+      r.p_tag = t;
+      r.l_tag = c.info.limit > 0 ? t : 0;
+    } else {
+      const Request &head = c.requests.front();
+      r.r_tag = head.r_tag;
+      r.p_tag = head.p_tag;
+      r.l_tag = head.l_tag;
+    }
+    c.requests.push_front(r);
+    ++size;
+  }
+
+  bool empty() const {
+    return size == 0 && high_queue.empty();
+  }
+
+  /// clients with queued items
+  unsigned num_clients() const {
+    return clients.size();
+  }
+
+  /// clients that ran dry but whose tags we still remember
+  unsigned num_idle_clients() const {
+    return idle.size();
+  }
+
+  T dequeue() {
+    assert(!empty());
+
+    if (!high_queue.empty()) {
+      StrictList &l = high_queue.rbegin()->second;
+      T ret = l.front().second;
+      l.pop_front();
+      if (l.empty())
+	high_queue.erase(high_queue.rbegin()->first);
+      return ret;
+    }
+
+    double t = now();
+    typename Clients::iterator best_r = clients.end();
+    typename Clients::iterator best_p = clients.end();
+    typename Clients::iterator best_any = clients.end();
+    for (typename Clients::iterator i = clients.begin();
+	 i != clients.end();
+	 ++i) {
+      if (i->second.requests.empty())
+	continue;
+      const Request &head = i->second.requests.front();
+      if (i->second.info.reservation > 0 && head.r_tag <= t &&
+	  (best_r == clients.end() ||
+	   head.r_tag < best_r->second.requests.front().r_tag))
+	best_r = i;
+      if ((i->second.info.limit <= 0 || head.l_tag <= t) &&
+	  (best_p == clients.end() ||
+	   head.p_tag < best_p->second.requests.front().p_tag))
+	best_p = i;
+      if (best_any == clients.end() ||
+	  head.p_tag < best_any->second.requests.front().p_tag)
+	best_any = i;
+    }
+    assert(best_any != clients.end());
+
+    // reservations first, then weights among those under their limit
+    if (best_r != clients.end())
+      return pop(best_r, false, t);
+    if (best_p != clients.end())
+      return pop(best_p, true, t);
+    return pop(best_any, true, t);
+  }
+
+  void dump(Formatter *f) const {
+    f->dump_int("size", size);
+    f->dump_int("num_clients", clients.size());
+    f->dump_int("num_idle_clients", idle.size());
+    f->dump_int("cost_unit", cost_unit);
+    f->open_array_section("high_queues");
+    for (typename StrictQueues::const_iterator p = high_queue.begin();
+	 p != high_queue.end();
+	 ++p) {
+      f->open_object_section("subqueue");
+      f->dump_int("priority", p->first);
+      f->dump_int("size", p->second.size());
+      f->close_section();
+    }
+    f->close_section();
+    f->open_array_section("clients");
+    for (typename Clients::const_iterator p = clients.begin();
+	 p != clients.end();
+	 ++p) {
+      const Request &head = p->second.requests.front();
+      f->open_object_section("client");
+      f->dump_int("class", p->first.first);
+      f->dump_float("reservation", p->second.info.reservation);
+      f->dump_float("weight", p->second.info.weight);
+      f->dump_float("limit", p->second.info.limit);
+      f->dump_int("size", p->second.requests.size());
+      f->dump_float("r_tag", head.r_tag);
+      f->dump_float("p_tag", head.p_tag);
+      f->dump_float("l_tag", head.l_tag);
+      f->close_section();
+    }
+    f->close_section();
+  }
+};
+
+#endif
@@ -58,6 +58,9 @@
 /* Defined if you don't have atomic_ops */
 #cmakedefine HAVE_LIBAIO
 
+/* Define to 1 if you have the <linux/io_uring.h> header file. */
+#cmakedefine HAVE_LINUX_IO_URING_H 1
+
 /* Define to 1 if you have the `boost_system' library (-lboost_system). */
 #cmakedefine HAVE_LIBBOOST_SYSTEM 1
 
@@ -93,10 +93,58 @@ public:
       const std::string &prefix ///< [in] Prefix by which to remove keys
       ) = 0;
 
+    /// Removes keys in [start, end) of prefix, without visiting them if
+    /// the backend can help it
+    virtual void rm_range_keys(
+      const std::string &prefix,   ///< [in] Prefix of the keys
+      const std::string &start,    ///< [in] First key to remove
+      const std::string &end       ///< [in] Key to stop at (kept)
+      ) = 0;
+
+    /// Merge operand into key, without reading the current value
+    virtual void merge(
+      const std::string &prefix,   ///< [in] Prefix; must have a merge operator
+      const std::string &k,	   ///< [in] Key to merge into
+      const bufferlist &bl	   ///< [in] Operand
+      ) {
+      assert(0 == "merge not supported by this backend");
+    }
+
     virtual ~TransactionImpl() {}
   };
   typedef ceph::shared_ptr< TransactionImpl > Transaction;
 
+  /**
+   * Merge operator for the keys of one prefix
+   *
+   * A merge combines an operand with the current value of a key inside
+   * the backend, so a counter bump or an append does not need a get()
+   * first.  Operands may be combined with each other before they meet
+   * the stored value, so merge() must be associative: merging a and b
+   * and then c must give the same result as merging a with the merge
+   * of b and c.
+   */
+  class MergeOperator {
+  public:
+    /// merge operand into a key that does not exist (yet)
+    virtual void merge_nonexistent(
+      const char *rdata, size_t rlen, std::string *new_value) = 0;
+    /// merge operand into an existing value
+    virtual void merge(
+      const char *ldata, size_t llen,
+      const char *rdata, size_t rlen,
+      std::string *new_value) = 0;
+    /// name, recorded by backends that check for a mismatch on reopen
+    virtual std::string name() const = 0;
+    virtual ~MergeOperator() {}
+  };
+
+  /// register the merge operator for prefix; must be called before open
+  virtual int set_merge_operator(const std::string& prefix,
+				 ceph::shared_ptr<MergeOperator> mop) {
+    return -EOPNOTSUPP;
+  }
+
   /// create a new instance
   static KeyValueDB *create(CephContext *cct, const std::string& type,
 			    const std::string& dir);
@@ -236,7 +284,7 @@ public:
 
   Iterator get_iterator(const std::string &prefix) {
     return ceph::shared_ptr<IteratorImpl>(
-      new IteratorImpl(prefix, get_iterator())
+      new IteratorImpl(prefix, _get_prefix_iterator(prefix))
     );
   }
 
@@ -246,7 +294,7 @@ public:
 
   Iterator get_snapshot_iterator(const std::string &prefix) {
     return ceph::shared_ptr<IteratorImpl>(
-      new IteratorImpl(prefix, get_snapshot_iterator())
+      new IteratorImpl(prefix, _get_prefix_snapshot_iterator(prefix))
     );
   }
 
@@ -272,6 +320,15 @@ public:
 protected:
   virtual WholeSpaceIterator _get_iterator() = 0;
   virtual WholeSpaceIterator _get_snapshot_iterator() = 0;
+
+  /// whole space iterators that only need to cover keys of prefix
+  virtual WholeSpaceIterator _get_prefix_iterator(const std::string &prefix) {
+    return _get_iterator();
+  }
+  virtual WholeSpaceIterator _get_prefix_snapshot_iterator(
+    const std::string &prefix) {
+    return _get_snapshot_iterator();
+  }
 };
 
 #endif
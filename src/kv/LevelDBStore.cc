@@ -137,7 +137,12 @@ int LevelDBStore::submit_transaction(KeyValueDB::Transaction t)
   utime_t start = ceph_clock_now(g_ceph_context);
   LevelDBTransactionImpl * _t =
     static_cast<LevelDBTransactionImpl *>(t.get());
+  if (!_t->merged.empty())
+    merge_lock.Lock();
+  _t->resolve_merges();
   leveldb::Status s = db->Write(leveldb::WriteOptions(), &(_t->bat));
+  if (!_t->merged.empty())
+    merge_lock.Unlock();
   utime_t lat = ceph_clock_now(g_ceph_context) - start;
   logger->inc(l_leveldb_txns);
   logger->tinc(l_leveldb_submit_latency, lat);
@@ -151,7 +156,12 @@ int LevelDBStore::submit_transaction_sync(KeyValueDB::Transaction t)
     static_cast<LevelDBTransactionImpl *>(t.get());
   leveldb::WriteOptions options;
   options.sync = true;
+  if (!_t->merged.empty())
+    merge_lock.Lock();
+  _t->resolve_merges();
   leveldb::Status s = db->Write(options, &(_t->bat));
+  if (!_t->merged.empty())
+    merge_lock.Unlock();
   utime_t lat = ceph_clock_now(g_ceph_context) - start;
   logger->inc(l_leveldb_txns);
   logger->tinc(l_leveldb_submit_sync_latency, lat);
@@ -165,6 +175,12 @@ void LevelDBStore::LevelDBTransactionImpl::set(
 {
   string key = combine_strings(prefix, k);
   size_t bllen = to_set_bl.length();
+  if (db->merge_ops.count(prefix)) {
+    merge_key_t &m = merged[key];
+    m.resolved = m.exists = true;
+    m.value.clear();
+    to_set_bl.copy(0, bllen, m.value);
+  }
   // bufferlist::c_str() is non-constant, so we can't call c_str()
   if (to_set_bl.is_contiguous() && bllen > 0) {
     // bufferlist contains just one ptr or they're contiguous
@@ -194,6 +210,16 @@ void LevelDBStore::LevelDBTransactionImpl::rmkey(const string &prefix,
 {
   string key = combine_strings(prefix, k);
   bat.Delete(leveldb::Slice(key));
+  if (db->merge_ops.count(prefix))
+    removed_merge_key(key);
+}
+
+void LevelDBStore::LevelDBTransactionImpl::removed_merge_key(const string &key)
+{
+  merge_key_t &m = merged[key];
+  m.resolved = true;
+  m.exists = false;
+  m.value.clear();
 }
 
 void LevelDBStore::LevelDBTransactionImpl::rmkeys_by_prefix(const string &prefix)
@@ -204,6 +230,98 @@ void LevelDBStore::LevelDBTransactionImpl::rmkeys_by_prefix(const string &prefix
        it->next()) {
     string key = combine_strings(prefix, it->key());
     bat.Delete(key);
+    if (db->merge_ops.count(prefix))
+      removed_merge_key(key);
+  }
+}
+
+// leveldb has no range tombstones; delete the keys one by one
+void LevelDBStore::LevelDBTransactionImpl::rm_range_keys(
+  const string &prefix,
+  const string &start,
+  const string &end)
+{
+  KeyValueDB::Iterator it = db->get_iterator(prefix);
+  for (it->lower_bound(start);
+       it->valid() && it->key() < end;
+       it->next()) {
+    string key = combine_strings(prefix, it->key());
+    bat.Delete(key);
+    if (db->merge_ops.count(prefix))
+      removed_merge_key(key);
+  }
+}
+
+void LevelDBStore::LevelDBTransactionImpl::merge(
+  const string &prefix,
+  const string &k,
+  const bufferlist &to_merge_bl)
+{
+  map<string, ceph::shared_ptr<MergeOperator> >::iterator mop =
+    db->merge_ops.find(prefix);
+  assert(mop != db->merge_ops.end());
+
+  string key = combine_strings(prefix, k);
+  bufferlist operand = to_merge_bl;
+  const char *rdata = operand.c_str();
+  size_t rlen = operand.length();
+
+  map<string, merge_key_t>::iterator p = merged.find(key);
+  if (p == merged.end()) {
+    // the stored value is only read at submit, under merge_lock
+    merge_key_t &m = merged[key];
+    m.value.assign(rdata, rlen);
+    return;
+  }
+  merge_key_t &m = p->second;
+  string new_value;
+  if (!m.resolved) {
+    // operands are associative; fold them together
+    mop->second->merge(m.value.data(), m.value.length(), rdata, rlen,
+		       &new_value);
+    m.value.swap(new_value);
+    return;
+  }
+  // start from what this transaction already wrote
+  if (m.exists)
+    mop->second->merge(m.value.data(), m.value.length(), rdata, rlen,
+		       &new_value);
+  else
+    mop->second->merge_nonexistent(rdata, rlen, &new_value);
+  bat.Put(leveldb::Slice(key), leveldb::Slice(new_value));
+  m.exists = true;
+  m.value.swap(new_value);
+}
+
+void LevelDBStore::LevelDBTransactionImpl::resolve_merges()
+{
+  assert(merged.empty() || db->merge_lock.is_locked());
+  for (map<string, merge_key_t>::iterator p = merged.begin();
+       p != merged.end();
+       ++p) {
+    merge_key_t &m = p->second;
+    if (m.resolved)
+      continue;
+    // nothing in the batch touched this key before, so the Put can go
+    // at the end
+    string prefix;
+    int r = split_key(leveldb::Slice(p->first), &prefix, NULL);
+    assert(r == 0);
+    map<string, ceph::shared_ptr<MergeOperator> >::iterator mop =
+      db->merge_ops.find(prefix);
+    assert(mop != db->merge_ops.end());
+    string cur, new_value;
+    leveldb::Status s = db->db->Get(leveldb::ReadOptions(),
+				    leveldb::Slice(p->first), &cur);
+    if (s.ok())
+      mop->second->merge(cur.data(), cur.length(), m.value.data(),
+			 m.value.length(), &new_value);
+    else
+      mop->second->merge_nonexistent(m.value.data(), m.value.length(),
+				     &new_value);
+    bat.Put(leveldb::Slice(p->first), leveldb::Slice(new_value));
+    m.resolved = m.exists = true;
+    m.value.swap(new_value);
   }
 }
 
@@ -214,14 +332,31 @@ int LevelDBStore::get(
 {
   utime_t start = ceph_clock_now(g_ceph_context);
   KeyValueDB::Iterator it = get_iterator(prefix);
+  bool positioned = false;
   for (std::set<string>::const_iterator i = keys.begin();
        i != keys.end();
        ++i) {
-    it->lower_bound(*i);
-    if (it->valid() && it->key() == *i) {
-      out->insert(make_pair(*i, it->value()));
-    } else if (!it->valid())
+    // keys come sorted; when the next one is close to the last, stepping
+    // forward is cheaper than a fresh seek
+    string cur;
+    if (positioned) {
+      for (unsigned steps = 0; it->valid() && steps < 8; ++steps) {
+	cur = it->key();
+	if (cur >= *i)
+	  break;
+	it->next();
+      }
+    }
+    if (!positioned || (it->valid() && cur < *i)) {
+      it->lower_bound(*i);
+      positioned = true;
+      if (it->valid())
+	cur = it->key();
+    }
+    if (!it->valid())
       break;
+    if (cur == *i)
+      out->insert(make_pair(*i, it->value()));
   }
   utime_t lat = ceph_clock_now(g_ceph_context) - start;
   logger->inc(l_leveldb_gets);
@@ -58,6 +58,13 @@ class LevelDBStore : public KeyValueDB {
 #endif
   boost::scoped_ptr<leveldb::DB> db;
 
+  // leveldb has no merge support.  merges are resolved against the
+  // stored value at submit time, under merge_lock, which every
+  // transaction that writes a merge prefix takes so none of them can
+  // slip in between our read and our write.
+  map<string, ceph::shared_ptr<MergeOperator> > merge_ops;
+  Mutex merge_lock;
+
   int do_open(ostream &out, bool create_if_missing);
 
   // manage async compactions
@@ -153,6 +160,7 @@ public:
 #ifdef HAVE_LEVELDB_FILTER_POLICY
     filterpolicy(NULL),
 #endif
+    merge_lock("LevelDBStore::merge_lock"),
     compact_queue_lock("LevelDBStore::compact_thread_lock"),
     compact_queue_stop(false),
     compact_thread(this),
@@ -179,7 +187,18 @@ public:
   public:
     leveldb::WriteBatch bat;
     LevelDBStore *db;
+    /// a merge-prefix key written by this transaction
+    struct merge_key_t {
+      bool resolved;  ///< we know the value: set, removed, or merged into
+      bool exists;    ///< if resolved
+      string value;   ///< value if resolved, else the combined operands
+      merge_key_t() : resolved(false), exists(false) {}
+    };
+    map<string, merge_key_t> merged;
     LevelDBTransactionImpl(LevelDBStore *db) : db(db) {}
+    void removed_merge_key(const string &key);
+    /// Put the merges that need the stored value; merge_lock held
+    void resolve_merges();
     void set(
       const string &prefix,
       const string &k,
@@ -190,8 +209,22 @@ public:
     void rmkeys_by_prefix(
       const string &prefix
       );
+    void rm_range_keys(
+      const string &prefix,
+      const string &start,
+      const string &end);
+    void merge(
+      const string &prefix,
+      const string &k,
+      const bufferlist &bl);
   };
 
+  int set_merge_operator(const string& prefix,
+			 ceph::shared_ptr<MergeOperator> mop) {
+    merge_ops[prefix] = mop;
+    return 0;
+  }
+
   KeyValueDB::Transaction get_transaction() {
     return ceph::shared_ptr< LevelDBTransactionImpl >(
       new LevelDBTransactionImpl(this));
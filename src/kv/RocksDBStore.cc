@@ -17,6 +17,8 @@
 #include "rocksdb/slice.h"
 #include "rocksdb/cache.h"
 #include "rocksdb/filter_policy.h"
+#include "rocksdb/merge_operator.h"
+#include "rocksdb/version.h"
 #include "rocksdb/utilities/convenience.h"
 using std::string;
 #include "common/perf_counters.h"
@@ -25,6 +27,11 @@ using std::string;
 #include "KeyValueDB.h"
 #include "RocksDBStore.h"
 
+// range tombstones (WriteBatch::DeleteRange) arrived in rocksdb 5.0
+#if ROCKSDB_MAJOR >= 5
+#define HAVE_ROCKSDB_DELETE_RANGE
+#endif
+
 int string2bool(string val, bool &b_val)
 {
   if (strcasecmp(val.c_str(), "false") == 0) {
@@ -98,6 +105,57 @@ int RocksDBStore::ParseOptionsFromString(const string opt_str, rocksdb::Options
   return 0;
 }
 
+// rocksdb takes a single merge operator per db; route each merge to the
+// operator registered for the key's prefix
+class RocksDBStore::MergeOperatorRouter
+  : public rocksdb::AssociativeMergeOperator {
+  RocksDBStore& store;
+  string name;
+public:
+  MergeOperatorRouter(RocksDBStore &_store) : store(_store), name("ceph") {
+    for (map<string, ceph::shared_ptr<KeyValueDB::MergeOperator> >::iterator p =
+	   store.merge_ops.begin();
+	 p != store.merge_ops.end(); ++p)
+      name += "." + p->first + ":" + p->second->name();
+  }
+
+  const char *Name() const {
+    return name.c_str();
+  }
+
+  bool Merge(const rocksdb::Slice& key,
+	     const rocksdb::Slice* existing_value,
+	     const rocksdb::Slice& value,
+	     std::string* new_value,
+	     rocksdb::Logger* logger) const {
+    for (map<string, ceph::shared_ptr<KeyValueDB::MergeOperator> >::const_iterator p =
+	   store.merge_ops.begin();
+	 p != store.merge_ops.end(); ++p) {
+      const string &prefix = p->first;
+      if (key.size() > prefix.length() &&
+	  key.data()[prefix.length()] == 0 &&
+	  memcmp(key.data(), prefix.data(), prefix.length()) == 0) {
+	if (existing_value)
+	  p->second->merge(existing_value->data(), existing_value->size(),
+			   value.data(), value.size(), new_value);
+	else
+	  p->second->merge_nonexistent(value.data(), value.size(), new_value);
+	return true;
+      }
+    }
+    return false;
+  }
+};
+
+int RocksDBStore::set_merge_operator(const string& prefix,
+				     ceph::shared_ptr<MergeOperator> mop)
+{
+  // must be registered before the db is opened
+  assert(db == NULL);
+  merge_ops[prefix] = mop;
+  return 0;
+}
+
 int RocksDBStore::init(string _options_str)
 {
   options_str = _options_str;
@@ -130,6 +188,48 @@ int RocksDBStore::create_and_open(ostream &out)
   return do_open(out, true);
 }
 
+// parse rocksdb_column_families: "prefix[=cf options] ..."
+static int parse_column_families(
+  const string &spec,
+  const rocksdb::ColumnFamilyOptions &base,
+  map<string, rocksdb::ColumnFamilyOptions> *cfs)
+{
+  size_t pos = 0;
+  while (pos < spec.length()) {
+    size_t end = spec.find_first_of(" \t\n", pos);
+    if (end == string::npos)
+      end = spec.length();
+    string entry = spec.substr(pos, end - pos);
+    pos = end + 1;
+    if (entry.empty())
+      continue;
+
+    string prefix = entry, opts;
+    size_t eq = entry.find('=');
+    if (eq != string::npos) {
+      prefix = entry.substr(0, eq);
+      opts = entry.substr(eq + 1);
+    }
+    if (prefix.empty() || prefix == rocksdb::kDefaultColumnFamilyName) {
+      derr << __func__ << " invalid column family prefix '" << prefix << "'"
+	   << dendl;
+      return -EINVAL;
+    }
+    rocksdb::ColumnFamilyOptions cf_opt = base;
+    if (opts.length()) {
+      rocksdb::Status status =
+	rocksdb::GetColumnFamilyOptionsFromString(base, opts, &cf_opt);
+      if (!status.ok()) {
+	derr << __func__ << " column family " << prefix << ": "
+	     << status.ToString() << dendl;
+	return -EINVAL;
+      }
+    }
+    (*cfs)[prefix] = cf_opt;
+  }
+  return 0;
+}
+
 int RocksDBStore::do_open(ostream &out, bool create_if_missing)
 {
   rocksdb::Options opt;
@@ -141,8 +241,66 @@ int RocksDBStore::do_open(ostream &out, bool create_if_missing)
   }
   opt.create_if_missing = create_if_missing;
   opt.wal_dir = path + ".wal";
+  if (!merge_ops.empty())
+    opt.merge_operator.reset(new MergeOperatorRouter(*this));
 
-  status = rocksdb::DB::Open(opt, path, &db);
+  map<string, rocksdb::ColumnFamilyOptions> cf_opts;
+  r = parse_column_families(g_conf->rocksdb_column_families,
+			    rocksdb::ColumnFamilyOptions(opt), &cf_opts);
+  if (r < 0)
+    return r;
+
+  // the families recorded in the db decide the layout; the configured
+  // ones are only created along with a new db
+  vector<string> existing;
+  status = rocksdb::DB::ListColumnFamilies(rocksdb::DBOptions(opt), path,
+					   &existing);
+  bool fresh = !status.ok() && create_if_missing;
+  vector<rocksdb::ColumnFamilyDescriptor> cfds;
+  cfds.push_back(rocksdb::ColumnFamilyDescriptor(
+		   rocksdb::kDefaultColumnFamilyName,
+		   rocksdb::ColumnFamilyOptions(opt)));
+  if (fresh) {
+    for (map<string, rocksdb::ColumnFamilyOptions>::iterator p =
+	   cf_opts.begin();
+	 p != cf_opts.end(); ++p)
+      cfds.push_back(rocksdb::ColumnFamilyDescriptor(p->first, p->second));
+    opt.create_missing_column_families = true;
+  } else {
+    for (vector<string>::iterator p = existing.begin();
+	 p != existing.end(); ++p) {
+      if (*p == rocksdb::kDefaultColumnFamilyName)
+	continue;
+      map<string, rocksdb::ColumnFamilyOptions>::iterator o =
+	cf_opts.find(*p);
+      if (o != cf_opts.end()) {
+	cfds.push_back(rocksdb::ColumnFamilyDescriptor(*p, o->second));
+	cf_opts.erase(o);
+      } else {
+	cfds.push_back(rocksdb::ColumnFamilyDescriptor(
+			 *p, rocksdb::ColumnFamilyOptions(opt)));
+      }
+    }
+    for (map<string, rocksdb::ColumnFamilyOptions>::iterator p =
+	   cf_opts.begin();
+	 p != cf_opts.end(); ++p)
+      derr << __func__ << " existing db has no column family for prefix "
+	   << p->first << ", keeping it in the default one" << dendl;
+  }
+
+  if (cfds.size() == 1) {
+    status = rocksdb::DB::Open(opt, path, &db);
+  } else {
+    vector<rocksdb::ColumnFamilyHandle*> handles;
+    status = rocksdb::DB::Open(rocksdb::DBOptions(opt), path, cfds,
+			       &handles, &db);
+    if (status.ok()) {
+      // the default family is reached without a handle
+      delete handles[0];
+      for (unsigned i = 1; i < handles.size(); ++i)
+	_add_cf(cfds[i].name, handles[i]);
+    }
+  }
   if (!status.ok()) {
     derr << status.ToString() << dendl;
     return -EINVAL;
@@ -179,11 +337,44 @@ int RocksDBStore::_test_init(const string& dir)
   return status.ok() ? 0 : -EIO;
 }
 
+void RocksDBStore::_add_cf(const string &prefix,
+			  rocksdb::ColumnFamilyHandle *h)
+{
+  ColumnFamily *cf = new ColumnFamily(prefix, h);
+  PerfCountersBuilder plb(g_ceph_context, "rocksdb_cf_" + prefix,
+			  l_rocksdb_cf_first, l_rocksdb_cf_last);
+  plb.add_u64_counter(l_rocksdb_cf_gets, "rocksdb_get", "Gets");
+  plb.add_time_avg(l_rocksdb_cf_get_latency, "rocksdb_get_latency", "Get latency");
+  plb.add_u64_counter(l_rocksdb_cf_writes, "rocksdb_write", "Keys written or removed");
+  plb.add_u64_counter(l_rocksdb_cf_write_bytes, "rocksdb_write_bytes", "Bytes written");
+  plb.add_u64_counter(l_rocksdb_cf_compact_range, "rocksdb_compact_range", "Compactions by range");
+  cf->logger = plb.create_perf_counters();
+  cct->get_perfcounters_collection()->add(cf->logger);
+  cf_map[prefix] = cf;
+  lgeneric_dout(cct, 1) << __func__ << " prefix " << prefix
+			<< " in its own column family" << dendl;
+}
+
+void RocksDBStore::_close_cfs()
+{
+  for (map<string, ColumnFamily*>::iterator p = cf_map.begin();
+       p != cf_map.end(); ++p) {
+    cct->get_perfcounters_collection()->remove(p->second->logger);
+    delete p->second->logger;
+    delete p->second->handle;
+    delete p->second;
+  }
+  cf_map.clear();
+}
+
 RocksDBStore::~RocksDBStore()
 {
   close();
   delete logger;
 
+  // column family handles go before the db
+  _close_cfs();
+
   // Ensure db is destroyed before dependent db_cache and filterpolicy
   delete db;
 }
@@ -216,6 +407,12 @@ int RocksDBStore::submit_transaction(KeyValueDB::Transaction t)
   utime_t lat = ceph_clock_now(g_ceph_context) - start;
   logger->inc(l_rocksdb_txns);
   logger->tinc(l_rocksdb_submit_latency, lat);
+  for (map<ColumnFamily*, pair<uint64_t, uint64_t> >::iterator p =
+	 _t->cf_writes.begin();
+       p != _t->cf_writes.end(); ++p) {
+    p->first->logger->inc(l_rocksdb_cf_writes, p->second.first);
+    p->first->logger->inc(l_rocksdb_cf_write_bytes, p->second.second);
+  }
   return s.ok() ? 0 : -1;
 }
 
@@ -231,6 +428,12 @@ int RocksDBStore::submit_transaction_sync(KeyValueDB::Transaction t)
   utime_t lat = ceph_clock_now(g_ceph_context) - start;
   logger->inc(l_rocksdb_txns);
   logger->tinc(l_rocksdb_submit_sync_latency, lat);
+  for (map<ColumnFamily*, pair<uint64_t, uint64_t> >::iterator p =
+	 _t->cf_writes.begin();
+       p != _t->cf_writes.end(); ++p) {
+    p->first->logger->inc(l_rocksdb_cf_writes, p->second.first);
+    p->first->logger->inc(l_rocksdb_cf_write_bytes, p->second.second);
+  }
   return s.ok() ? 0 : -1;
 }
 int RocksDBStore::get_info_log_level(string info_log_level)
@@ -265,56 +468,163 @@ void RocksDBStore::RocksDBTransactionImpl::set(
   const bufferlist &to_set_bl)
 {
   string key = combine_strings(prefix, k);
+  ColumnFamily *cf = db->get_cf(prefix);
 
   // bufferlist::c_str() is non-constant, so we can't call c_str()
   if (to_set_bl.is_contiguous() && to_set_bl.length() > 0) {
-    bat->Put(rocksdb::Slice(key),
-	     rocksdb::Slice(to_set_bl.buffers().front().c_str(),
-			    to_set_bl.length()));
+    rocksdb::Slice v(to_set_bl.buffers().front().c_str(), to_set_bl.length());
+    if (cf)
+      bat->Put(cf->handle, rocksdb::Slice(key), v);
+    else
+      bat->Put(rocksdb::Slice(key), v);
   } else {
     // make a copy
     bufferlist val = to_set_bl;
-    bat->Put(rocksdb::Slice(key),
-	     rocksdb::Slice(val.c_str(), val.length()));
+    rocksdb::Slice v(val.c_str(), val.length());
+    if (cf)
+      bat->Put(cf->handle, rocksdb::Slice(key), v);
+    else
+      bat->Put(rocksdb::Slice(key), v);
   }
+  if (cf)
+    count_cf_write(cf, key.length() + to_set_bl.length());
 }
 
 void RocksDBStore::RocksDBTransactionImpl::rmkey(const string &prefix,
 					         const string &k)
 {
-  bat->Delete(combine_strings(prefix, k));
+  ColumnFamily *cf = db->get_cf(prefix);
+  if (cf) {
+    bat->Delete(cf->handle, combine_strings(prefix, k));
+    count_cf_write(cf, 0);
+  } else {
+    bat->Delete(combine_strings(prefix, k));
+  }
+}
+
+void RocksDBStore::RocksDBTransactionImpl::merge(
+  const string &prefix,
+  const string &k,
+  const bufferlist &to_merge_bl)
+{
+  assert(db->merge_ops.count(prefix));
+  string key = combine_strings(prefix, k);
+  ColumnFamily *cf = db->get_cf(prefix);
+
+  // bufferlist::c_str() is non-constant, so we can't call c_str()
+  if (to_merge_bl.is_contiguous() && to_merge_bl.length() > 0) {
+    rocksdb::Slice v(to_merge_bl.buffers().front().c_str(),
+		     to_merge_bl.length());
+    if (cf)
+      bat->Merge(cf->handle, rocksdb::Slice(key), v);
+    else
+      bat->Merge(rocksdb::Slice(key), v);
+  } else {
+    // make a copy
+    bufferlist val = to_merge_bl;
+    rocksdb::Slice v(val.c_str(), val.length());
+    if (cf)
+      bat->Merge(cf->handle, rocksdb::Slice(key), v);
+    else
+      bat->Merge(rocksdb::Slice(key), v);
+  }
+  if (cf)
+    count_cf_write(cf, key.length() + to_merge_bl.length());
 }
 
 void RocksDBStore::RocksDBTransactionImpl::rmkeys_by_prefix(const string &prefix)
 {
+  ColumnFamily *cf = db->get_cf(prefix);
   KeyValueDB::Iterator it = db->get_iterator(prefix);
   for (it->seek_to_first();
        it->valid();
        it->next()) {
-    bat->Delete(combine_strings(prefix, it->key()));
+    if (cf) {
+      bat->Delete(cf->handle, combine_strings(prefix, it->key()));
+      count_cf_write(cf, 0);
+    } else {
+      bat->Delete(combine_strings(prefix, it->key()));
+    }
   }
 }
 
+void RocksDBStore::RocksDBTransactionImpl::rm_range_keys(
+  const string &prefix,
+  const string &start,
+  const string &end)
+{
+  ColumnFamily *cf = db->get_cf(prefix);
+#ifdef HAVE_ROCKSDB_DELETE_RANGE
+  string s = combine_strings(prefix, start);
+  string e = combine_strings(prefix, end);
+  if (cf) {
+    bat->DeleteRange(cf->handle, rocksdb::Slice(s), rocksdb::Slice(e));
+    count_cf_write(cf, 0);
+  } else {
+    bat->DeleteRange(rocksdb::Slice(s), rocksdb::Slice(e));
+  }
+#else
+  KeyValueDB::Iterator it = db->get_iterator(prefix);
+  for (it->lower_bound(start);
+       it->valid() && it->key() < end;
+       it->next()) {
+    if (cf) {
+      bat->Delete(cf->handle, combine_strings(prefix, it->key()));
+      count_cf_write(cf, 0);
+    } else {
+      bat->Delete(combine_strings(prefix, it->key()));
+    }
+  }
+#endif
+}
+
 int RocksDBStore::get(
     const string &prefix,
     const std::set<string> &keys,
     std::map<string, bufferlist> *out)
 {
   utime_t start = ceph_clock_now(g_ceph_context);
-  KeyValueDB::Iterator it = get_iterator(prefix);
-  for (std::set<string>::const_iterator i = keys.begin();
-       i != keys.end();
-       ++i) {
-    it->lower_bound(*i);
-    if (it->valid() && it->key() == *i) {
-      out->insert(make_pair(*i, it->value()));
-    } else if (!it->valid())
-      break;
+  int r = 0;
+  ColumnFamily *cf = get_cf(prefix);
+  if (!keys.empty()) {
+    // point lookups, unlike iterator seeks, can skip files by bloom
+    // filter; MultiGet also takes one snapshot and version ref for all
+    vector<string> db_keys;
+    db_keys.reserve(keys.size());
+    for (std::set<string>::const_iterator i = keys.begin();
+	 i != keys.end();
+	 ++i)
+      db_keys.push_back(combine_strings(prefix, *i));
+    vector<rocksdb::Slice> slices(db_keys.begin(), db_keys.end());
+    vector<string> values;
+    vector<rocksdb::Status> status;
+    if (cf) {
+      vector<rocksdb::ColumnFamilyHandle*> handles(slices.size(), cf->handle);
+      status = db->MultiGet(rocksdb::ReadOptions(), handles, slices, &values);
+    } else {
+      status = db->MultiGet(rocksdb::ReadOptions(), slices, &values);
+    }
+    std::set<string>::const_iterator i = keys.begin();
+    for (unsigned n = 0; n < status.size(); ++n, ++i) {
+      if (status[n].ok()) {
+	bufferlist bl;
+	bl.append(values[n]);
+	out->insert(make_pair(*i, bl));
+      } else if (!status[n].IsNotFound()) {
+	derr << __func__ << " " << prefix << " " << *i << ": "
+	     << status[n].ToString() << dendl;
+	r = -EIO;
+      }
+    }
   }
   utime_t lat = ceph_clock_now(g_ceph_context) - start;
   logger->inc(l_rocksdb_gets);
   logger->tinc(l_rocksdb_get_latency, lat);
-  return 0;
+  if (cf) {
+    cf->logger->inc(l_rocksdb_cf_gets);
+    cf->logger->tinc(l_rocksdb_cf_get_latency, lat);
+  }
+  return r;
 }
 
 int RocksDBStore::get(
@@ -324,16 +634,31 @@ int RocksDBStore::get(
 {
   utime_t start = ceph_clock_now(g_ceph_context);
   int r = 0;
-  KeyValueDB::Iterator it = get_iterator(prefix);
-  it->lower_bound(key);
-  if (it->valid() && it->key() == key) {
-    *out = it->value();
-  } else {
+  ColumnFamily *cf = get_cf(prefix);
+  string k = combine_strings(prefix, key);
+  string value;
+  rocksdb::Status s;
+  if (cf)
+    s = db->Get(rocksdb::ReadOptions(), cf->handle, rocksdb::Slice(k), &value);
+  else
+    s = db->Get(rocksdb::ReadOptions(), rocksdb::Slice(k), &value);
+  if (s.ok()) {
+    out->clear();
+    out->append(value);
+  } else if (s.IsNotFound()) {
     r = -ENOENT;
+  } else {
+    derr << __func__ << " " << prefix << " " << key << ": " << s.ToString()
+	 << dendl;
+    r = -EIO;
   }
   utime_t lat = ceph_clock_now(g_ceph_context) - start;
   logger->inc(l_rocksdb_gets);
   logger->tinc(l_rocksdb_get_latency, lat);
+  if (cf) {
+    cf->logger->inc(l_rocksdb_cf_gets);
+    cf->logger->tinc(l_rocksdb_cf_get_latency, lat);
+  }
   return r;
 }
 
@@ -376,6 +701,9 @@ void RocksDBStore::compact()
 {
   logger->inc(l_rocksdb_compact);
   db->CompactRange(NULL, NULL);
+  for (map<string, ColumnFamily*>::iterator p = cf_map.begin();
+       p != cf_map.end(); ++p)
+    db->CompactRange(p->second->handle, NULL, NULL);
 }
 
 
@@ -451,6 +779,14 @@ void RocksDBStore::compact_range(const string& start, const string& end)
     rocksdb::Slice cstart(start);
     rocksdb::Slice cend(end);
     db->CompactRange(&cstart, &cend);
+    // and any family whose prefix overlaps the range
+    for (map<string, ColumnFamily*>::iterator p = cf_map.begin();
+	 p != cf_map.end(); ++p) {
+      if (start < past_prefix(p->first) && end > p->first) {
+	p->second->logger->inc(l_rocksdb_cf_compact_range);
+	db->CompactRange(p->second->handle, &cstart, &cend);
+      }
+    }
 }
 RocksDBStore::RocksDBWholeSpaceIteratorImpl::~RocksDBWholeSpaceIteratorImpl()
 {
@@ -558,8 +894,25 @@ string RocksDBStore::past_prefix(const string &prefix)
 }
 
 
+rocksdb::Iterator *RocksDBStore::new_iterator(const rocksdb::ReadOptions &opts,
+					      ColumnFamily *cf)
+{
+  if (cf)
+    return db->NewIterator(opts, cf->handle);
+  return db->NewIterator(opts);
+}
+
 RocksDBStore::WholeSpaceIterator RocksDBStore::_get_iterator()
 {
+  if (!cf_map.empty()) {
+    vector<rocksdb::Iterator*> iters;
+    iters.push_back(db->NewIterator(rocksdb::ReadOptions()));
+    for (map<string, ColumnFamily*>::iterator p = cf_map.begin();
+	 p != cf_map.end(); ++p)
+      iters.push_back(new_iterator(rocksdb::ReadOptions(), p->second));
+    return std::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
+      new RocksDBMergeIteratorImpl(db, NULL, iters));
+  }
   return std::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
     new RocksDBWholeSpaceIteratorImpl(
       db->NewIterator(rocksdb::ReadOptions())
@@ -575,13 +928,215 @@ RocksDBStore::WholeSpaceIterator RocksDBStore::_get_snapshot_iterator()
   snapshot = db->GetSnapshot();
   options.snapshot = snapshot;
 
+  if (!cf_map.empty()) {
+    vector<rocksdb::Iterator*> iters;
+    iters.push_back(db->NewIterator(options));
+    for (map<string, ColumnFamily*>::iterator p = cf_map.begin();
+	 p != cf_map.end(); ++p)
+      iters.push_back(new_iterator(options, p->second));
+    return std::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
+      new RocksDBMergeIteratorImpl(db, snapshot, iters));
+  }
   return std::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
     new RocksDBSnapshotIteratorImpl(db, snapshot,
       db->NewIterator(options))
   );
 }
 
+// a prefix lives entirely in one family, so one family's iterator will do
+RocksDBStore::WholeSpaceIterator RocksDBStore::_get_prefix_iterator(
+  const string &prefix)
+{
+  return std::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
+    new RocksDBWholeSpaceIteratorImpl(
+      new_iterator(rocksdb::ReadOptions(), get_cf(prefix))
+    )
+  );
+}
+
+RocksDBStore::WholeSpaceIterator RocksDBStore::_get_prefix_snapshot_iterator(
+  const string &prefix)
+{
+  const rocksdb::Snapshot *snapshot;
+  rocksdb::ReadOptions options;
+
+  snapshot = db->GetSnapshot();
+  options.snapshot = snapshot;
+
+  return std::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
+    new RocksDBSnapshotIteratorImpl(db, snapshot,
+      new_iterator(options, get_cf(prefix)))
+  );
+}
+
 RocksDBStore::RocksDBSnapshotIteratorImpl::~RocksDBSnapshotIteratorImpl()
 {
   db->ReleaseSnapshot(snapshot);
 }
+
+RocksDBStore::RocksDBMergeIteratorImpl::~RocksDBMergeIteratorImpl()
+{
+  for (vector<rocksdb::Iterator*>::iterator p = iters.begin();
+       p != iters.end(); ++p)
+    delete *p;
+  if (snapshot)
+    db->ReleaseSnapshot(snapshot);
+}
+void RocksDBStore::RocksDBMergeIteratorImpl::find_smallest()
+{
+  cur = -1;
+  for (unsigned i = 0; i < iters.size(); ++i) {
+    if (iters[i]->Valid() &&
+	(cur < 0 || iters[i]->key().compare(iters[cur]->key()) < 0))
+      cur = i;
+  }
+}
+void RocksDBStore::RocksDBMergeIteratorImpl::find_largest()
+{
+  cur = -1;
+  for (unsigned i = 0; i < iters.size(); ++i) {
+    if (iters[i]->Valid() &&
+	(cur < 0 || iters[i]->key().compare(iters[cur]->key()) > 0))
+      cur = i;
+  }
+}
+int RocksDBStore::RocksDBMergeIteratorImpl::seek_to_first()
+{
+  for (unsigned i = 0; i < iters.size(); ++i)
+    iters[i]->SeekToFirst();
+  forward = true;
+  find_smallest();
+  return status();
+}
+int RocksDBStore::RocksDBMergeIteratorImpl::seek_to_first(const string &prefix)
+{
+  rocksdb::Slice slice_prefix(prefix);
+  for (unsigned i = 0; i < iters.size(); ++i)
+    iters[i]->Seek(slice_prefix);
+  forward = true;
+  find_smallest();
+  return status();
+}
+int RocksDBStore::RocksDBMergeIteratorImpl::seek_to_last()
+{
+  for (unsigned i = 0; i < iters.size(); ++i)
+    iters[i]->SeekToLast();
+  forward = false;
+  find_largest();
+  return status();
+}
+int RocksDBStore::RocksDBMergeIteratorImpl::seek_to_last(const string &prefix)
+{
+  string limit = past_prefix(prefix);
+  rocksdb::Slice slice_limit(limit);
+  for (unsigned i = 0; i < iters.size(); ++i) {
+    iters[i]->Seek(slice_limit);
+    if (!iters[i]->Valid())
+      iters[i]->SeekToLast();
+    else
+      iters[i]->Prev();
+  }
+  forward = false;
+  find_largest();
+  return status();
+}
+int RocksDBStore::RocksDBMergeIteratorImpl::upper_bound(const string &prefix, const string &after)
+{
+  lower_bound(prefix, after);
+  if (valid()) {
+    pair<string,string> key = raw_key();
+    if (key.first == prefix && key.second == after)
+      next();
+  }
+  return status();
+}
+int RocksDBStore::RocksDBMergeIteratorImpl::lower_bound(const string &prefix, const string &to)
+{
+  string bound = combine_strings(prefix, to);
+  rocksdb::Slice slice_bound(bound);
+  for (unsigned i = 0; i < iters.size(); ++i)
+    iters[i]->Seek(slice_bound);
+  forward = true;
+  find_smallest();
+  return status();
+}
+bool RocksDBStore::RocksDBMergeIteratorImpl::valid()
+{
+  return cur >= 0 && iters[cur]->Valid();
+}
+int RocksDBStore::RocksDBMergeIteratorImpl::next()
+{
+  if (!valid())
+    return status();
+  if (!forward) {
+    // the others sit before the current key; move them past it
+    string k = iters[cur]->key().ToString();
+    rocksdb::Slice slice_k(k);
+    for (unsigned i = 0; i < iters.size(); ++i) {
+      if ((int)i == cur)
+	continue;
+      iters[i]->Seek(slice_k);
+      if (iters[i]->Valid() && iters[i]->key().compare(slice_k) == 0)
+	iters[i]->Next();
+    }
+    forward = true;
+  }
+  iters[cur]->Next();
+  find_smallest();
+  return status();
+}
+int RocksDBStore::RocksDBMergeIteratorImpl::prev()
+{
+  if (!valid())
+    return status();
+  if (forward) {
+    // the others sit past the current key; move them before it
+    string k = iters[cur]->key().ToString();
+    rocksdb::Slice slice_k(k);
+    for (unsigned i = 0; i < iters.size(); ++i) {
+      if ((int)i == cur)
+	continue;
+      iters[i]->Seek(slice_k);
+      if (iters[i]->Valid())
+	iters[i]->Prev();
+      else
+	iters[i]->SeekToLast();
+    }
+    forward = false;
+  }
+  iters[cur]->Prev();
+  find_largest();
+  return status();
+}
+string RocksDBStore::RocksDBMergeIteratorImpl::key()
+{
+  string out_key;
+  split_key(iters[cur]->key(), 0, &out_key);
+  return out_key;
+}
+pair<string,string> RocksDBStore::RocksDBMergeIteratorImpl::raw_key()
+{
+  string prefix, key;
+  split_key(iters[cur]->key(), &prefix, &key);
+  return make_pair(prefix, key);
+}
+bool RocksDBStore::RocksDBMergeIteratorImpl::raw_key_is_prefixed(const string &prefix)
+{
+  rocksdb::Slice key = iters[cur]->key();
+  if ((key.size() > prefix.length()) && (key[prefix.length()] == '\0')) {
+    return memcmp(key.data(), prefix.c_str(), prefix.length()) == 0;
+  } else {
+    return false;
+  }
+}
+bufferlist RocksDBStore::RocksDBMergeIteratorImpl::value()
+{
+  return to_bufferlist(iters[cur]->value());
+}
+int RocksDBStore::RocksDBMergeIteratorImpl::status()
+{
+  for (unsigned i = 0; i < iters.size(); ++i)
+    if (!iters[i]->status().ok())
+      return -1;
+  return 0;
+}
@@ -36,6 +36,17 @@ enum {
   l_rocksdb_last,
 };
 
+// per column family
+enum {
+  l_rocksdb_cf_first = 34350,
+  l_rocksdb_cf_gets,
+  l_rocksdb_cf_get_latency,
+  l_rocksdb_cf_writes,
+  l_rocksdb_cf_write_bytes,
+  l_rocksdb_cf_compact_range,
+  l_rocksdb_cf_last,
+};
+
 namespace rocksdb{
   class DB;
   class Cache;
@@ -44,7 +55,9 @@ namespace rocksdb{
   class Slice;
   class WriteBatch;
   class Iterator;
+  class ColumnFamilyHandle;
   struct Options;
+  struct ReadOptions;
 }
 /**
  * Uses RocksDB to implement the KeyValueDB interface
@@ -57,6 +70,35 @@ class RocksDBStore : public KeyValueDB {
   string options_str;
   int do_open(ostream &out, bool create_if_missing);
 
+  // merge operators by prefix, all served by one rocksdb operator
+  class MergeOperatorRouter;
+  friend class MergeOperatorRouter;
+  map<string, ceph::shared_ptr<MergeOperator> > merge_ops;
+
+  // prefixes kept in their own column family; their keys keep the
+  // usual prefix encoding, everything else lives in the default family
+  struct ColumnFamily {
+    string prefix;
+    rocksdb::ColumnFamilyHandle *handle;
+    PerfCounters *logger;
+    ColumnFamily(const string &p, rocksdb::ColumnFamilyHandle *h)
+      : prefix(p), handle(h), logger(NULL) {}
+  };
+  map<string, ColumnFamily*> cf_map;
+
+  ColumnFamily *get_cf(const string &prefix) {
+    if (cf_map.empty())
+      return NULL;
+    map<string, ColumnFamily*>::iterator p = cf_map.find(prefix);
+    if (p == cf_map.end())
+      return NULL;
+    return p->second;
+  }
+  void _add_cf(const string &prefix, rocksdb::ColumnFamilyHandle *h);
+  void _close_cfs();
+  rocksdb::Iterator *new_iterator(const rocksdb::ReadOptions &opts,
+				  ColumnFamily *cf);
+
   // manage async compactions
   Mutex compact_queue_lock;
   Cond compact_queue_cond;
@@ -132,6 +174,13 @@ public:
   public:
     rocksdb::WriteBatch *bat;
     RocksDBStore *db;
+    /// keys and bytes written per column family, counted on submit
+    map<ColumnFamily*, pair<uint64_t, uint64_t> > cf_writes;
+    void count_cf_write(ColumnFamily *cf, uint64_t bytes) {
+      pair<uint64_t, uint64_t> &w = cf_writes[cf];
+      ++w.first;
+      w.second += bytes;
+    }
 
     RocksDBTransactionImpl(RocksDBStore *_db);
     ~RocksDBTransactionImpl();
@@ -145,8 +194,19 @@ public:
     void rmkeys_by_prefix(
       const string &prefix
       );
+    void rm_range_keys(
+      const string &prefix,
+      const string &start,
+      const string &end);
+    void merge(
+      const string &prefix,
+      const string &k,
+      const bufferlist &bl);
   };
 
+  int set_merge_operator(const string& prefix,
+			 ceph::shared_ptr<MergeOperator> mop);
+
   KeyValueDB::Transaction get_transaction() {
     return std::shared_ptr< RocksDBTransactionImpl >(
       new RocksDBTransactionImpl(this));
@@ -202,6 +262,39 @@ public:
     ~RocksDBSnapshotIteratorImpl();
   };
 
+  /// walks the default and all other column families in key order
+  class RocksDBMergeIteratorImpl :
+    public KeyValueDB::WholeSpaceIteratorImpl {
+    rocksdb::DB *db;
+    const rocksdb::Snapshot *snapshot;  ///< released on destruction, if any
+    vector<rocksdb::Iterator*> iters;
+    int cur;       ///< iterator at the current key, or -1
+    bool forward;  ///< others are past cur (true) or before it (false)
+
+    void find_smallest();
+    void find_largest();
+  public:
+    RocksDBMergeIteratorImpl(rocksdb::DB *db, const rocksdb::Snapshot *s,
+			     const vector<rocksdb::Iterator*> &i) :
+      db(db), snapshot(s), iters(i), cur(-1), forward(true) { }
+    ~RocksDBMergeIteratorImpl();
+
+    int seek_to_first();
+    int seek_to_first(const string &prefix);
+    int seek_to_last();
+    int seek_to_last(const string &prefix);
+    int upper_bound(const string &prefix, const string &after);
+    int lower_bound(const string &prefix, const string &to);
+    bool valid();
+    int next();
+    int prev();
+    string key();
+    pair<string,string> raw_key();
+    bool raw_key_is_prefixed(const string &prefix);
+    bufferlist value();
+    int status();
+  };
+
   /// Utility
   static string combine_strings(const string &prefix, const string &value);
   static int split_key(rocksdb::Slice in, string *prefix, string *key);
@@ -280,6 +373,10 @@ protected:
 
   WholeSpaceIterator _get_snapshot_iterator();
 
+  WholeSpaceIterator _get_prefix_iterator(const string &prefix);
+
+  WholeSpaceIterator _get_prefix_snapshot_iterator(const string &prefix);
+
 };
 
 #endif
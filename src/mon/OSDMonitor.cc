@@ -2907,7 +2907,8 @@ namespace {
     ERASURE_CODE_PROFILE, MIN_READ_RECENCY_FOR_PROMOTE,
     MIN_WRITE_RECENCY_FOR_PROMOTE, FAST_READ,
     HIT_SET_GRADE_DECAY_RATE, HIT_SET_SEARCH_LAST_N,
-    SCRUB_MIN_INTERVAL, SCRUB_MAX_INTERVAL, DEEP_SCRUB_INTERVAL};
+    SCRUB_MIN_INTERVAL, SCRUB_MAX_INTERVAL, DEEP_SCRUB_INTERVAL,
+    COMPRESSION_ALGORITHM};
 
   std::set<osd_pool_get_choices>
     subtract_second_from_first(const std::set<osd_pool_get_choices>& first,
@@ -3386,7 +3387,8 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
       ("hit_set_search_last_n", HIT_SET_SEARCH_LAST_N)
       ("scrub_min_interval", SCRUB_MIN_INTERVAL)
       ("scrub_max_interval", SCRUB_MAX_INTERVAL)
-      ("deep_scrub_interval", DEEP_SCRUB_INTERVAL);
+      ("deep_scrub_interval", DEEP_SCRUB_INTERVAL)
+      ("compression_algorithm", COMPRESSION_ALGORITHM);
 
     typedef std::set<osd_pool_get_choices> choices_set_t;
 
@@ -3568,6 +3570,7 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
 	  case SCRUB_MIN_INTERVAL:
 	  case SCRUB_MAX_INTERVAL:
 	  case DEEP_SCRUB_INTERVAL:
+	  case COMPRESSION_ALGORITHM:
 	    for (i = ALL_CHOICES.begin(); i != ALL_CHOICES.end(); ++i) {
 	      if (i->second == *it)
 		break;
@@ -3699,6 +3702,7 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
 	  case SCRUB_MIN_INTERVAL:
 	  case SCRUB_MAX_INTERVAL:
 	  case DEEP_SCRUB_INTERVAL:
+	  case COMPRESSION_ALGORITHM:
 	    for (i = ALL_CHOICES.begin(); i != ALL_CHOICES.end(); ++i) {
 	      if (i->second == *it)
 		break;
@@ -4962,6 +4966,27 @@ int OSDMonitor::prepare_command_pool_set(map<string,cmd_vartype> &cmdmap,
       ss << "expecting value 'true', 'false', '0', or '1'";
       return -EINVAL;
     }
+  } else if (var == "ec_overwrites") {
+    if (!p.is_erasure()) {
+      ss << "ec overwrites can only be enabled for an erasure coded pool";
+      return -EINVAL;
+    }
+    if (val == "true" || (interr.empty() && n == 1)) {
+      int err = check_cluster_features(CEPH_FEATURE_OSD_EC_OVERWRITES, ss);
+      if (err)
+	return err;
+      p.set_flag(pg_pool_t::FLAG_EC_OVERWRITES);
+    } else if (val == "false" || (interr.empty() && n == 0)) {
+      // objects may already have been overwritten in place and have
+      // rollback info in the pg logs
+      if (p.has_flag(pg_pool_t::FLAG_EC_OVERWRITES)) {
+	ss << "ec overwrites cannot be disabled once enabled";
+	return -EINVAL;
+      }
+    } else {
+      ss << "expecting value 'true', 'false', '0', or '1'";
+      return -EINVAL;
+    }
   } else if (var == "hit_set_type") {
     if (val == "none")
       p.hit_set_params = HitSet::Params();
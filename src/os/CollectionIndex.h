@@ -176,6 +176,18 @@ protected:
   /// Call prior to removing directory
   virtual int prep_delete() { return 0; }
 
+  /// True if there is deferred work for do_background_work()
+  virtual bool has_background_work() { return false; }
+
+  /**
+   * Do deferred index maintenance, e.g. a background directory split
+   *
+   * Must be called without access_lock held; takes it as needed.
+   *
+   * @return Error Code, 0 for success
+   */
+  virtual int do_background_work() { return 0; }
+
   CollectionIndex(coll_t collection):
     access_lock_name ("CollectionIndex::access_lock::" + collection.to_str()), 
     access_lock(access_lock_name.c_str()) {}
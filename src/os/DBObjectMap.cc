@@ -785,6 +785,11 @@ int DBObjectMap::scan(Header header,
 		      set<string> *out_keys,
 		      map<string, bufferlist> *out_values)
 {
+  if (!header->parent && out_values && !out_keys) {
+    // nothing to merge with a parent; look the keys up in one batch
+    return db->get(user_prefix(header), in_keys, out_values);
+  }
+
   ObjectMapIterator db_iter = _get_iterator(header);
   for (set<string>::const_iterator key_iter = in_keys.begin();
        key_iter != in_keys.end();
@@ -1026,6 +1031,7 @@ int DBObjectMap::init(bool do_upgrade)
     state.v = 2;
     state.seq = 1;
   }
+  seq_reserved = state.seq;
   dout(20) << "(init)dbobjectmap: seq is " << state.seq << dendl;
   return 0;
 }
@@ -1062,10 +1068,14 @@ int DBObjectMap::sync(const ghobject_t *oid,
 
 int DBObjectMap::write_state(KeyValueDB::Transaction _t) {
   assert(header_lock.is_locked_by_me());
-  dout(20) << "dbobjectmap: seq is " << state.seq << dendl;
+  // never persist less than we may already have handed out
+  State to_write_state(state);
+  to_write_state.seq = MAX(state.seq, seq_reserved);
+  dout(20) << "dbobjectmap: seq is " << state.seq
+	   << " persisting " << to_write_state.seq << dendl;
   KeyValueDB::Transaction t = _t ? _t : db->get_transaction();
   bufferlist bl;
-  state.encode(bl);
+  to_write_state.encode(bl);
   map<string, bufferlist> to_write;
   to_write[GLOBAL_STATE_KEY] = bl;
   t->set(SYS_PREFIX, to_write);
@@ -1124,7 +1134,11 @@ DBObjectMap::Header DBObjectMap::_generate_new_header(const ghobject_t &oid,
   assert(!in_use.count(header->seq));
   in_use.insert(header->seq);
 
-  write_state();
+  if (state.seq > seq_reserved) {
+    // reserve a run of seqs up front; a crash just skips the unused ones
+    seq_reserved = state.seq + g_conf->filestore_omap_seq_reserve;
+    write_state();
+  }
   return header;
 }
 
@@ -1176,15 +1190,39 @@ DBObjectMap::Header DBObjectMap::lookup_create_map_header(
 void DBObjectMap::clear_header(Header header, KeyValueDB::Transaction t)
 {
   dout(20) << "clear_header: clearing seq " << header->seq << dendl;
-  t->rmkeys_by_prefix(user_prefix(header));
-  t->rmkeys_by_prefix(sys_prefix(header));
-  t->rmkeys_by_prefix(complete_prefix(header));
-  t->rmkeys_by_prefix(xattr_prefix(header));
+  clear_prefix(user_prefix(header), t);
+  clear_prefix(sys_prefix(header), t);
+  clear_prefix(complete_prefix(header), t);
+  clear_prefix(xattr_prefix(header), t);
   set<string> keys;
   keys.insert(header_key(header->seq));
   t->rmkeys(USER_PREFIX, keys);
 }
 
+void DBObjectMap::clear_prefix(const string &prefix,
+			       KeyValueDB::Transaction t)
+{
+  // Most objects have few or no keys here; deleting those one by one
+  // is cheaper than leaving a range tombstone that every later lookup
+  // has to step over.  Only big ranges are worth a range delete.
+  unsigned max = g_conf->filestore_omap_range_delete_min_keys;
+  KeyValueDB::Iterator iter = db->get_iterator(prefix);
+  set<string> keys;
+  for (iter->seek_to_first(); iter->valid(); iter->next()) {
+    if (max && keys.size() >= max) {
+      string first = *keys.begin();
+      iter->seek_to_last();
+      dout(20) << "clear_prefix: range delete of " << prefix << dendl;
+      // the smallest key past the last one
+      t->rm_range_keys(prefix, first, iter->key() + string(1, '\0'));
+      return;
+    }
+    keys.insert(iter->key());
+  }
+  if (!keys.empty())
+    t->rmkeys(prefix, keys);
+}
+
 void DBObjectMap::set_header(Header header, KeyValueDB::Transaction t)
 {
   dout(20) << "set_header: setting seq " << header->seq << dendl;
@@ -114,6 +114,7 @@ public:
   };
 
   DBObjectMap(KeyValueDB *db) : db(db), header_lock("DBOBjectMap"),
+                                seq_reserved(0),
                                 cache_lock("DBObjectMap::CacheLock"),
                                 caches(g_conf->filestore_omap_header_cache_size)
     {}
@@ -268,6 +269,15 @@ public:
     }
   } state;
 
+  /**
+   * seq last persisted in the on-disk State
+   *
+   * Seqs below this may be handed out without writing State again, so
+   * a run of new headers costs one State write rather than one each.
+   * Protected by header_lock.
+   */
+  uint64_t seq_reserved;
+
   struct _Header {
     uint64_t seq;
     uint64_t parent;
@@ -419,6 +429,9 @@ private:
   /// Removes node corresponding to header
   void clear_header(Header header, KeyValueDB::Transaction t);
 
+  /// Removes all keys of prefix, with a range delete if there are many
+  void clear_prefix(const string &prefix, KeyValueDB::Transaction t);
+
   /// Set node containing input to new contents
   void set_header(Header input, KeyValueDB::Transaction t);
 
@@ -449,7 +462,8 @@ private:
   /**
    * Generate new header for c oid with new seq number
    *
-   * Has the side effect of syncronously saving the new DBObjectMap state
+   * Has the side effect of saving the new DBObjectMap state when the
+   * seq runs past seq_reserved
    */
   Header _generate_new_header(const ghobject_t &oid, Header parent);
   Header generate_new_header(const ghobject_t &oid, Header parent) {
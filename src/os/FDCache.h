@@ -22,6 +22,7 @@
 #include "common/Mutex.h"
 #include "common/Cond.h"
 #include "common/shared_cache.hpp"
+#include "common/Readahead.h"
 #include "include/compat.h"
 #include "include/intarith.h"
 
@@ -38,7 +39,20 @@ public:
   class FD {
   public:
     const int fd;
-    FD(int _fd) : fd(_fd) {
+
+    /// sequential read detection, and the prefetch window it last opened
+    Readahead readahead;
+    Mutex ra_lock;
+    bool ra_init;      ///< readahead has been configured
+    uint64_t ra_pos;   ///< first prefetched byte not read yet
+    uint64_t ra_end;   ///< end of the prefetched range
+
+    FD(int _fd)
+      : fd(_fd),
+	ra_lock("FDCache::FD::ra_lock"),
+	ra_init(false),
+	ra_pos(0),
+	ra_end(0) {
       assert(_fd >= 0);
     }
     int operator*() const {
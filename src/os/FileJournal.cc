@@ -31,6 +31,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mount.h>
+#include <sys/mman.h>
 
 #include "common/blkdev.h"
 #include "common/linux_version.h"
@@ -50,6 +51,21 @@ int FileJournal::_open(bool forwrite, bool create)
 {
   int flags, ret;
 
+  if (dax) {
+    // dax only works on a file; decide before we pick the open flags
+    struct stat st;
+    if (::stat(fn.c_str(), &st) == 0 && S_ISBLK(st.st_mode)) {
+      derr << "FileJournal::_open: dax journal needs a file on a DAX-capable "
+	   << "filesystem, not a block device; disabling dax" << dendl;
+      dax = false;
+    } else if (directio || aio) {
+      derr << "FileJournal::_open: dax journal does its own flushing; "
+	   << "disabling directio and aio" << dendl;
+      directio = false;
+      aio = false;
+    }
+  }
+
   if (forwrite) {
     flags = O_RDWR;
     if (directio)
@@ -60,6 +76,7 @@ int FileJournal::_open(bool forwrite, bool create)
   if (create)
     flags |= O_CREAT;
   
+  _dax_unmap();
   if (fd >= 0) {
     if (TEMP_FAILURE_RETRY(::close(fd))) {
       int err = errno;
@@ -85,6 +102,12 @@ int FileJournal::_open(bool forwrite, bool create)
   }
 
   if (S_ISBLK(st.st_mode)) {
+    if (dax) {
+      // it became a block device since we looked
+      derr << "FileJournal::_open: dax journal on a block device" << dendl;
+      ret = -EINVAL;
+      goto out_fd;
+    }
     ret = _open_block_device();
   } else {
     if (aio && !force_aio) {
@@ -99,26 +122,33 @@ int FileJournal::_open(bool forwrite, bool create)
     goto out_fd;
 
 #ifdef HAVE_LIBAIO
-  if (aio) {
-    aio_ctx = 0;
-    ret = io_setup(128, &aio_ctx);
+  if (aio && !aio_ctx) {
+    ret = FS::create_aio_queue(g_conf->journal_aio_engine, 128, &aio_ctx);
     if (ret < 0) {
-      ret = errno;
       derr << "FileJournal::_open: unable to setup io_context " << cpp_strerror(ret) << dendl;
-      ret = -ret;
       goto out_fd;
     }
+    if (g_conf->journal_aio_engine != aio_ctx->get_name())
+      derr << "FileJournal::_open: " << g_conf->journal_aio_engine
+	   << " unavailable, using " << aio_ctx->get_name() << dendl;
   }
 #endif
 
   /* We really want max_size to be a multiple of block_size. */
   max_size -= max_size % block_size;
 
+  if (dax && forwrite && !create) {
+    ret = _dax_map();
+    if (ret < 0)
+      goto out_fd;
+  }
+
   dout(1) << "_open " << fn << " fd " << fd
 	  << ": " << max_size 
 	  << " bytes, block size " << block_size
 	  << " bytes, directio = " << directio
 	  << ", aio = " << aio
+	  << ", dax = " << (dax_base ? (dax_map_sync ? "sync" : "msync") : "off")
 	  << dendl;
   return 0;
 
@@ -554,6 +584,74 @@ int FileJournal::open(uint64_t fs_op_seq)
   return 0;
 }
 
+int FileJournal::_dax_map()
+{
+  assert(!dax_base);
+  void *p = MAP_FAILED;
+#ifdef MAP_SYNC
+  // with MAP_SYNC, stores are durable once they leave the cpu cache
+  p = ::mmap(NULL, max_size, PROT_READ | PROT_WRITE,
+	     MAP_SHARED_VALIDATE | MAP_SYNC, fd, 0);
+  dax_map_sync = (p != MAP_FAILED);
+#endif
+  if (p == MAP_FAILED) {
+    // not DAX (e.g. tmpfs or a test file); fall back to msync
+    p = ::mmap(NULL, max_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      int r = -errno;
+      derr << "FileJournal::_dax_map: mmap failed: " << cpp_strerror(r)
+	   << dendl;
+      return r;
+    }
+  }
+  dax_base = static_cast<char*>(p);
+  return 0;
+}
+
+void FileJournal::_dax_unmap()
+{
+  if (!dax_base)
+    return;
+  ::munmap(dax_base, max_size);
+  dax_base = NULL;
+  dax_map_sync = false;
+}
+
+static void dax_flush_cache(const char *p, size_t len)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  const size_t line = 64;
+  const char *end = p + len;
+  for (p = (const char *)((uintptr_t)p & ~(line - 1)); p < end; p += line)
+    asm volatile("clflush %0" : : "m" (*p) : "memory");
+  asm volatile("sfence" ::: "memory");
+#else
+  __sync_synchronize();
+#endif
+}
+
+int FileJournal::dax_write(off64_t pos, bufferlist& bl)
+{
+  assert(dax_base);
+  assert(pos + bl.length() <= (uint64_t)max_size);
+  char *start = dax_base + pos;
+  char *dst = start;
+  for (std::list<bufferptr>::const_iterator p = bl.buffers().begin();
+       p != bl.buffers().end();
+       ++p) {
+    memcpy(dst, p->c_str(), p->length());
+    dst += p->length();
+  }
+  if (dax_map_sync) {
+    dax_flush_cache(start, bl.length());
+    return 0;
+  }
+  uintptr_t page_start = (uintptr_t)start & CEPH_PAGE_MASK;
+  if (::msync((void *)page_start, (uintptr_t)dst - page_start, MS_SYNC) < 0)
+    return -errno;
+  return 0;
+}
+
 void FileJournal::_close(int fd) const
 {
   VOID_TEMP_FAILURE_RETRY(::close(fd));
@@ -570,6 +668,7 @@ void FileJournal::close()
   assert(writeq_empty());
   assert(!must_write_header);
   assert(fd >= 0);
+  _dax_unmap();
   _close(fd);
   fd = -1;
 }
@@ -1040,16 +1139,24 @@ int FileJournal::write_bl(off64_t& pos, bufferlist& bl)
 {
   int ret;
 
-  off64_t spos = ::lseek64(fd, pos, SEEK_SET);
-  if (spos < 0) {
-    ret = -errno;
-    derr << "FileJournal::write_bl : lseek64 failed " << cpp_strerror(ret) << dendl;
-    return ret;
-  }
-  ret = bl.write_fd(fd);
-  if (ret) {
-    derr << "FileJournal::write_bl : write_fd failed: " << cpp_strerror(ret) << dendl;
-    return ret;
+  if (dax_base) {
+    ret = dax_write(pos, bl);
+    if (ret) {
+      derr << "FileJournal::write_bl : dax_write failed: " << cpp_strerror(ret) << dendl;
+      return ret;
+    }
+  } else {
+    off64_t spos = ::lseek64(fd, pos, SEEK_SET);
+    if (spos < 0) {
+      ret = -errno;
+      derr << "FileJournal::write_bl : lseek64 failed " << cpp_strerror(ret) << dendl;
+      return ret;
+    }
+    ret = bl.write_fd(fd);
+    if (ret) {
+      derr << "FileJournal::write_bl : write_fd failed: " << cpp_strerror(ret) << dendl;
+      return ret;
+    }
   }
   pos += bl.length();
   if (pos == header.max_size)
@@ -1131,7 +1238,16 @@ void FileJournal::do_write(bufferlist& bl)
     assert(first_pos == get_top());
   } else {
     // header too?
-    if (hbp.length()) {
+    if (hbp.length() && dax_base) {
+      bufferlist hbl;
+      hbl.push_back(hbp);
+      int r = dax_write(0, hbl);
+      if (r < 0) {
+	derr << "FileJournal::do_write: dax_write of header failed: "
+	     << cpp_strerror(r) << dendl;
+	ceph_abort();
+      }
+    } else if (hbp.length()) {
       if (TEMP_FAILURE_RETRY(::pwrite(fd, hbp.c_str(), hbp.length(), 0)) < 0) {
 	int err = errno;
 	derr << "FileJournal::do_write: pwrite(fd=" << fd
@@ -1148,7 +1264,7 @@ void FileJournal::do_write(bufferlist& bl)
     }
   }
 
-  if (!directio) {
+  if (!directio && !dax_base) {
     dout(20) << "do_write fsync" << dendl;
 
     /*
@@ -1225,6 +1341,58 @@ void FileJournal::flush()
 }
 
 
+/*
+ * Hold the next write open briefly so that entries arriving close
+ * together share one aligned write instead of each paying for its own
+ * IO.  We only wait when the recent arrival rate says another entry is
+ * likely to show up within the window, so an idle or lightly loaded
+ * journal keeps its single-entry latency.
+ */
+void FileJournal::group_commit_wait()
+{
+  int max_wait = g_conf->journal_group_commit_max_wait_us;
+  if (max_wait <= 0)
+    return;
+
+  utime_t start = ceph_clock_now(g_ceph_context);
+  Mutex::Locker locker(writeq_lock);
+  if (write_stop || must_write_header || writeq.empty() ||
+      writeq.size() >= (unsigned)g_conf->journal_max_write_entries)
+    return;
+  if (submit_interval_us <= 0 || submit_interval_us >= max_wait) {
+    dout(20) << __func__ << " arrivals every " << submit_interval_us
+	     << "us, not waiting" << dendl;
+    return;
+  }
+
+  // long enough for a couple more entries at the current rate
+  double wait_us = MIN((double)max_wait, submit_interval_us * 2);
+  utime_t deadline = start;
+  deadline += wait_us / 1000000.0;
+  size_t orig = writeq.size();
+  dout(20) << __func__ << " " << orig << " queued, arrivals every "
+	   << submit_interval_us << "us, waiting up to " << wait_us
+	   << "us" << dendl;
+
+  group_commit_waiting = true;
+  while (!write_stop &&
+	 writeq.size() < (unsigned)g_conf->journal_max_write_entries) {
+    if (writeq_cond.WaitUntil(writeq_lock, deadline) == ETIMEDOUT)
+      break;
+  }
+  group_commit_waiting = false;
+  // nobody else showed up.  the submitter may have been blocked on
+  // this very write, so the next gap says nothing about the arrival rate.
+  if (writeq.size() == orig)
+    group_commit_missed = true;
+
+  utime_t waited = ceph_clock_now(g_ceph_context) - start;
+  dout(20) << __func__ << " waited " << waited << ", now " << writeq.size()
+	   << " queued (was " << orig << ")" << dendl;
+  if (logger)
+    logger->tinc(l_os_j_group_wait, waited);
+}
+
 void FileJournal::write_thread_entry()
 {
   dout(10) << "write_thread_entry start" << dendl;
@@ -1273,6 +1441,8 @@ void FileJournal::write_thread_entry()
     }
 #endif
 
+    group_commit_wait();
+
     Mutex::Locker locker(write_lock);
     uint64_t orig_ops = 0;
     uint64_t orig_bytes = 0;
@@ -1412,26 +1582,23 @@ int FileJournal::write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq)
   
   while (bl.length() > 0) {
     int max = MIN(bl.buffers().size(), IOV_MAX-1);
-    iovec *iov = new iovec[max];
     int n = 0;
     unsigned len = 0;
     for (std::list<buffer::ptr>::const_iterator p = bl.buffers().begin();
 	 n < max;
 	 ++p, ++n) {
       assert(p != bl.buffers().end());
-      iov[n].iov_base = (void *)p->c_str();
-      iov[n].iov_len = p->length();
       len += p->length();
     }
 
     bufferlist tbl;
     bl.splice(0, len, &tbl);  // move bytes from bl -> tbl
 
-    aio_queue.push_back(aio_info(tbl, pos, bl.length() > 0 ? 0 : seq));
+    aio_queue.push_back(aio_info(fd, tbl, pos, bl.length() > 0 ? 0 : seq));
     aio_info& aio = aio_queue.back();
-    aio.iov = iov;
-
-    io_prep_pwritev(&aio.iocb, fd, aio.iov, n, pos);
+    aio.aio.priv = &aio;
+    aio.bl.prepare_iov(&aio.aio.iov);
+    aio.aio.pwritev(pos);
 
     dout(20) << "write_aio_bl .. " << aio.off << "~" << aio.len
 	     << " in " << n << dendl;
@@ -1439,22 +1606,16 @@ int FileJournal::write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq)
     aio_num++;
     aio_bytes += aio.len;
 
-    iocb *piocb = &aio.iocb;
-    int attempts = 10;
-    do {
-      int r = io_submit(aio_ctx, 1, &piocb);
-      if (r < 0) {
-	derr << "io_submit to " << aio.off << "~" << aio.len
-	     << " got " << cpp_strerror(r) << dendl;
-	if (r == -EAGAIN && attempts-- > 0) {
-	  usleep(500);
-	  continue;
-	}
-	assert(0 == "io_submit got unexpected error");
-      } else {
-	break;
-      }
-    } while (true);
+    int retries = 0;
+    int r = aio_ctx->submit(aio.aio, &retries);
+    if (retries)
+      derr << "io_submit to " << aio.off << "~" << aio.len
+	   << " retried " << retries << " times" << dendl;
+    if (r < 0) {
+      derr << "io_submit to " << aio.off << "~" << aio.len
+	   << " got " << cpp_strerror(r) << dendl;
+      assert(0 == "io_submit got unexpected error");
+    }
     pos += aio.len;
   }
   write_finish_cond.Signal();
@@ -1479,8 +1640,8 @@ void FileJournal::write_finish_thread_entry()
     }
     
     dout(20) << "write_finish_thread_entry waiting for aio(s)" << dendl;
-    io_event event[16];
-    int r = io_getevents(aio_ctx, 1, 16, event, NULL);
+    FS::aio_t *paio[16];
+    int r = aio_ctx->get_next_completed(-1, paio, 16);
     if (r < 0) {
       if (r == -EINTR) {
 	dout(0) << "io_getevents got " << cpp_strerror(r) << dendl;
@@ -1493,10 +1654,10 @@ void FileJournal::write_finish_thread_entry()
     {
       Mutex::Locker locker(aio_lock);
       for (int i=0; i<r; i++) {
-	aio_info *ai = (aio_info *)event[i].obj;
-	if (event[i].res != ai->len) {
+	aio_info *ai = (aio_info *)paio[i]->priv;
+	if (paio[i]->rval != (long)ai->len) {
 	  derr << "aio to " << ai->off << "~" << ai->len
-	       << " wrote " << event[i].res << dendl;
+	       << " wrote " << paio[i]->rval << dendl;
 	  assert(0 == "unexpected aio error");
 	}
 	dout(10) << "write_finish_thread_entry aio " << ai->off
@@ -1637,10 +1798,17 @@ void FileJournal::submit_entry(uint64_t seq, bufferlist& e, uint32_t orig_len,
   {
     Mutex::Locker l1(writeq_lock);  // ** lock **
     Mutex::Locker l2(completions_lock);  // ** lock **
+    utime_t now = ceph_clock_now(g_ceph_context);
+    if (last_submit_stamp != utime_t() && !group_commit_missed) {
+      double gap = (double)(now - last_submit_stamp) * 1000000.0;
+      submit_interval_us = submit_interval_us * .875 + gap * .125;
+    }
+    last_submit_stamp = now;
+    group_commit_missed = false;
     completions.push_back(
       completion_item(
-	seq, oncommit, ceph_clock_now(g_ceph_context), osd_op));
-    if (writeq.empty())
+	seq, oncommit, now, osd_op));
+    if (writeq.empty() || group_commit_waiting)
       writeq_cond.Signal();
     writeq.push_back(write_item(seq, e, orig_len, osd_op));
   }
@@ -24,10 +24,7 @@ using std::deque;
 #include "common/Mutex.h"
 #include "common/Thread.h"
 #include "common/Throttle.h"
-
-#ifdef HAVE_LIBAIO
-# include <libaio.h>
-#endif
+#include "os/fs/FS.h"
 
 /**
  * Implements journaling on top of block device or file.
@@ -67,6 +64,12 @@ public:
   Mutex writeq_lock;
   Cond writeq_cond;
   deque<write_item> writeq;
+
+  /// group commit: smoothed gap between submitted entries (protected by writeq_lock)
+  utime_t last_submit_stamp;
+  double submit_interval_us;
+  bool group_commit_waiting;   ///< writer is coalescing; wake it on every submit
+  bool group_commit_missed;    ///< last wait got nothing; next gap includes it
   bool writeq_empty();
   write_item &peek_write();
   void pop_write();
@@ -229,30 +232,31 @@ private:
   off64_t read_pos;       //
   bool discard;	  //for block journal whether support discard
 
+  /// persistent memory mode: entries are copied into a shared mapping
+  /// of the journal and made durable with cache line flushes
+  bool dax;
+  char *dax_base;
+  bool dax_map_sync;      ///< MAP_SYNC mapping; flushing the cpu cache is enough
+
 #ifdef HAVE_LIBAIO
   /// state associated with an in-flight aio request
   /// Protected by aio_lock
   struct aio_info {
-    struct iocb iocb;
+    FS::aio_t aio;
     bufferlist bl;
-    struct iovec *iov;
     bool done;
     uint64_t off, len;    ///< these are for debug only
     uint64_t seq;         ///< seq number to complete on aio completion, if non-zero
 
-    aio_info(bufferlist& b, uint64_t o, uint64_t s)
-      : iov(NULL), done(false), off(o), len(b.length()), seq(s) {
+    aio_info(int fd, bufferlist& b, uint64_t o, uint64_t s)
+      : aio(NULL, fd), done(false), off(o), len(b.length()), seq(s) {
       bl.claim(b);
-      memset((void*)&iocb, 0, sizeof(iocb));
-    }
-    ~aio_info() {
-      delete[] iov;
     }
   };
   Mutex aio_lock;
   Cond aio_cond;
   Cond write_finish_cond;
-  io_context_t aio_ctx;
+  FS::aio_queue_t *aio_ctx;
   list<aio_info> aio_queue;
   int aio_num, aio_bytes;
   /// End protected by aio_lock
@@ -306,6 +310,7 @@ private:
   void start_writer();
   void stop_writer();
   void write_thread_entry();
+  void group_commit_wait();
 
   void queue_completions_thru(uint64_t seq);
 
@@ -322,6 +327,9 @@ private:
 
   void align_bl(off64_t pos, bufferlist& bl);
   int write_bl(off64_t& pos, bufferlist& bl);
+  int _dax_map();
+  void _dax_unmap();
+  int dax_write(off64_t pos, bufferlist& bl);
 
   /// read len from journal starting at in_pos and wrapping up to len
   void wrap_read_bl(
@@ -364,6 +372,9 @@ private:
     journaled_seq(0),
     plug_journal_completions(false),
     writeq_lock("FileJournal::writeq_lock", false, true, false, g_ceph_context),
+    submit_interval_us(0),
+    group_commit_waiting(false),
+    group_commit_missed(false),
     completions_lock(
       "FileJournal::completions_lock", false, true, false, g_ceph_context),
     fn(f),
@@ -373,9 +384,10 @@ private:
     must_write_header(false),
     write_pos(0), read_pos(0),
     discard(false),
+    dax(g_conf->journal_dax), dax_base(NULL), dax_map_sync(false),
 #ifdef HAVE_LIBAIO
     aio_lock("FileJournal::aio_lock"),
-    aio_ctx(0),
+    aio_ctx(NULL),
     aio_num(0), aio_bytes(0),
 #endif
     last_committed_seq(0), 
@@ -405,6 +417,12 @@ private:
   ~FileJournal() {
     assert(fd == -1);
     delete[] zero_buf;
+#ifdef HAVE_LIBAIO
+    if (aio_ctx) {
+      aio_ctx->shutdown();
+      delete aio_ctx;
+    }
+#endif
   }
 
   int check();
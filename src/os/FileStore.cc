@@ -300,6 +300,8 @@ int FileStore::lfn_open(coll_t cid,
           << ") in index: " << cpp_strerror(-r) << dendl;
       goto fail;
     }
+    if ((*index)->has_background_work())
+      queue_index_work(cid);
     r = chain_fsetxattr(fd, XATTR_SPILL_OUT_NAME,
                         XATTR_NO_SPILL_OUT, sizeof(XATTR_NO_SPILL_OUT), true);
     if (r < 0) {
@@ -405,6 +407,8 @@ int FileStore::lfn_link(coll_t c, coll_t newcid, const ghobject_t& o, const ghob
       assert(!m_filestore_fail_eio || r != -EIO);
       return r;
     }
+    if (index_new->has_background_work())
+      queue_index_work(newcid);
   } else {
     RWLock::WLocker l1((index_old.index)->access_lock);
 
@@ -438,6 +442,8 @@ int FileStore::lfn_link(coll_t c, coll_t newcid, const ghobject_t& o, const ghob
       assert(!m_filestore_fail_eio || r != -EIO);
       return r;
     }
+    if (index_new->has_background_work())
+      queue_index_work(newcid);
   }    
   return 0;
 }
@@ -527,6 +533,9 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, osflagbit
   sync_entry_timeo_lock("sync_entry_timeo_lock"),
   timer(g_ceph_context, sync_entry_timeo_lock),
   stop(false), sync_thread(this),
+  index_work_lock("FileStore::index_work_lock"),
+  index_work_stop(false),
+  index_work_thread(this),
   fdcache(g_ceph_context),
   wbthrottle(g_ceph_context),
   next_osr_id(0),
@@ -618,9 +627,17 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, osflagbit
   plb.add_time_avg(l_os_commit_len, "commitcycle_interval", "Average interval between commits");
   plb.add_time_avg(l_os_commit_lat, "commitcycle_latency", "Average latency of commit");
   plb.add_u64_counter(l_os_j_full, "journal_full", "Journal writes while full");
+  plb.add_time_avg(l_os_j_group_wait, "journal_group_commit_wait", "Time journal writes were held open to coalesce entries");
   plb.add_time_avg(l_os_queue_lat, "queue_transaction_latency_avg", "Store operation queue latency");
+  plb.add_u64_counter(l_os_readahead_bytes, "readahead_bytes", "Data prefetched for sequential readers");
+  plb.add_u64_counter(l_os_readahead_hit_bytes, "readahead_hit_bytes", "Data read from a prefetched range");
+  plb.add_u64_counter(l_os_readahead_waste_bytes, "readahead_waste_bytes", "Prefetched data skipped by the reader");
+  plb.add_u64_counter(l_os_lfn_cache_hit, "lfn_cache_hit", "Long name lookups served from cache");
+  plb.add_u64_counter(l_os_lfn_cache_miss, "lfn_cache_miss", "Long name lookups that went to the filesystem");
+  plb.add_u64_counter(l_os_lfn_cache_saved, "lfn_cache_syscalls_saved", "Estimated stat and getxattr calls avoided by the lfn cache");
 
   logger = plb.create_perf_counters();
+  index_manager.set_logger(logger);
 
   g_ceph_context->get_perfcounters_collection()->add(logger);
   g_ceph_context->_conf->add_observer(this);
@@ -1650,6 +1667,8 @@ int FileStore::mount()
   journal_start();
 
   op_tp.start();
+  index_work_stop = false;
+  index_work_thread.create();
   for (vector<Finisher*>::iterator it = ondisk_finishers.begin(); it != ondisk_finishers.end(); ++it) {
     (*it)->start();
   }
@@ -1738,6 +1757,11 @@ int FileStore::umount()
   sync_cond.Signal();
   lock.Unlock();
   sync_thread.join();
+  index_work_lock.Lock();
+  index_work_stop = true;
+  index_work_cond.Signal();
+  index_work_lock.Unlock();
+  index_work_thread.join();
   wbthrottle.stop();
   op_tp.stop();
 
@@ -2937,6 +2961,67 @@ int FileStore::stat(
   }
 }
 
+/*
+ * Track the access pattern of reads through this fd and, once the
+ * reader looks sequential, ask the kernel to start fetching what comes
+ * next.  Random readers never trigger anything beyond the bookkeeping.
+ */
+void FileStore::_readahead(FDRef& fd, uint64_t offset, uint64_t len)
+{
+#ifdef HAVE_POSIX_FADVISE
+  if (!g_conf->filestore_readahead_max_bytes || !len)
+    return;
+
+  Mutex::Locker l(fd->ra_lock);
+  if (!fd->ra_init) {
+    fd->readahead.set_trigger_requests(
+      g_conf->filestore_readahead_trigger_requests);
+    fd->readahead.set_min_readahead_size(
+      g_conf->filestore_readahead_min_bytes);
+    fd->readahead.set_max_readahead_size(
+      g_conf->filestore_readahead_max_bytes);
+    fd->ra_init = true;
+  }
+
+  // charge this read against the window we prefetched earlier
+  uint64_t end = offset + len;
+  uint64_t hit = 0, waste = 0;
+  if (fd->ra_pos < fd->ra_end && end > fd->ra_pos) {
+    if (offset > fd->ra_pos)
+      waste += MIN(offset, fd->ra_end) - fd->ra_pos;
+    uint64_t s = MAX(offset, fd->ra_pos);
+    uint64_t e = MIN(end, fd->ra_end);
+    if (e > s)
+      hit += e - s;
+    fd->ra_pos = e;
+  }
+
+  Readahead::extent_t ex = fd->readahead.update(offset, len,
+						Readahead::NO_LIMIT);
+  if (ex.second) {
+    struct stat st;
+    int r = ::fstat(**fd, &st);
+    if (r == 0 && ex.first < (uint64_t)st.st_size) {
+      uint64_t ra_len = MIN(ex.second, st.st_size - ex.first);
+      dout(20) << __func__ << " fd " << **fd << " prefetch " << ex.first
+	       << "~" << ra_len << dendl;
+      posix_fadvise(**fd, ex.first, ra_len, POSIX_FADV_WILLNEED);
+      if (ex.first != fd->ra_end) {
+	// a new stream; whatever is left of the old window was for nothing
+	waste += fd->ra_end - fd->ra_pos;
+	fd->ra_pos = ex.first;
+      }
+      fd->ra_end = ex.first + ra_len;
+      logger->inc(l_os_readahead_bytes, ra_len);
+    }
+  }
+  if (hit)
+    logger->inc(l_os_readahead_hit_bytes, hit);
+  if (waste)
+    logger->inc(l_os_readahead_waste_bytes, waste);
+#endif
+}
+
 int FileStore::read(
   coll_t cid,
   const ghobject_t& oid,
@@ -2986,6 +3071,10 @@ int FileStore::read(
   bptr.set_length(got);   // properly size the buffer
   bl.push_back(bptr);   // put it in the target bufferlist
 
+  if (!(op_flags & (CEPH_OSD_OP_FLAG_FADVISE_RANDOM |
+		    CEPH_OSD_OP_FLAG_FADVISE_DONTNEED)))
+    _readahead(fd, offset, got);
+
 #ifdef HAVE_POSIX_FADVISE
   if (op_flags & CEPH_OSD_OP_FLAG_FADVISE_DONTNEED)
     posix_fadvise(**fd, offset, len, POSIX_FADV_DONTNEED);
@@ -3617,6 +3706,44 @@ private:
   int m_commit_timeo;
 };
 
+void FileStore::queue_index_work(coll_t cid)
+{
+  Mutex::Locker l(index_work_lock);
+  if (index_work_queue.insert(cid).second)
+    index_work_cond.Signal();
+}
+
+void FileStore::index_work_entry()
+{
+  index_work_lock.Lock();
+  while (!index_work_stop) {
+    if (index_work_queue.empty()) {
+      index_work_cond.Wait(index_work_lock);
+      continue;
+    }
+    coll_t cid = *index_work_queue.begin();
+    index_work_queue.erase(index_work_queue.begin());
+    index_work_lock.Unlock();
+
+    Index index;
+    int r = get_index(cid, &index);
+    if (r == 0) {
+      dout(15) << __func__ << " " << cid << dendl;
+      r = index->do_background_work();
+      if (r < 0)
+	derr << __func__ << " " << cid << " error " << cpp_strerror(r)
+	     << dendl;
+      assert(!m_filestore_fail_eio || r != -EIO);
+    }
+
+    index_work_lock.Lock();
+    if (r == 0 && index.index && index->has_background_work())
+      index_work_queue.insert(cid);
+  }
+  index_work_queue.clear();
+  index_work_lock.Unlock();
+}
+
 void FileStore::sync_entry()
 {
   lock.Lock();
@@ -181,6 +181,22 @@ private:
     }
   } sync_thread;
 
+  // -- deferred index work (background directory splits) --
+  Mutex index_work_lock;
+  Cond index_work_cond;
+  bool index_work_stop;
+  set<coll_t> index_work_queue;
+  void queue_index_work(coll_t cid);
+  void index_work_entry();
+  struct IndexWorkThread : public Thread {
+    FileStore *fs;
+    IndexWorkThread(FileStore *f) : fs(f) {}
+    void *entry() {
+      fs->index_work_entry();
+      return 0;
+    }
+  } index_work_thread;
+
   // -- op workqueue --
   struct Op {
     utime_t start;
@@ -549,6 +565,7 @@ public:
     bufferlist& bl,
     uint32_t op_flags = 0,
     bool allow_eio = false);
+  void _readahead(FDRef& fd, uint64_t offset, uint64_t len);
   int _do_fiemap(int fd, uint64_t offset, size_t len,
                  map<uint64_t, uint64_t> *m);
   int _do_seek_hole_data(int fd, uint64_t offset, size_t len,
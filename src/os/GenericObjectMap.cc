@@ -807,6 +807,11 @@ int GenericObjectMap::scan(Header header,
                            set<string> *out_keys,
                            map<string, bufferlist> *out_values)
 {
+  if (!header->parent && out_values && !out_keys) {
+    // nothing to merge with a parent; look the keys up in one batch
+    return db->get(user_prefix(header, prefix), in_keys, out_values);
+  }
+
   ObjectMap::ObjectMapIterator db_iter = _get_iterator(header, prefix);
   for (set<string>::const_iterator key_iter = in_keys.begin();
        key_iter != in_keys.end();
@@ -14,16 +14,53 @@
 
 #include "include/types.h"
 #include "include/buffer.h"
+#include "include/compat.h"
 #include "osd/osd_types.h"
+#include <dirent.h>
 #include <errno.h>
+#include <stddef.h>
+#include <sys/stat.h>
 
 #include "HashIndex.h"
 
 #include "common/debug.h"
+#include "common/errno.h"
+#include "chain_xattr.h"
 #define dout_subsys ceph_subsys_filestore
 
 const string HashIndex::SUBDIR_ATTR = "contents";
 const string HashIndex::IN_PROGRESS_OP_TAG = "in_progress_op";
+const string HashIndex::BG_SPLIT_TAG = "bg_split_op";
+
+/// directory entries not starting with '.', with their inode numbers
+static int list_inodes(const string &dir, map<string, ino_t> *out)
+{
+  DIR *d = ::opendir(dir.c_str());
+  if (!d)
+    return -errno;
+  char buf[offsetof(struct dirent, d_name) + PATH_MAX + 1];
+  struct dirent *de;
+  while (!::readdir_r(d, reinterpret_cast<struct dirent*>(buf), &de) && de) {
+    if (de->d_name[0] == '.')
+      continue;
+    (*out)[de->d_name] = de->d_ino;
+  }
+  ::closedir(d);
+  return 0;
+}
+
+/// fsync a directory by its full path
+static int fsync_path(const string &dir)
+{
+  int fd = ::open(dir.c_str(), O_RDONLY);
+  if (fd < 0)
+    return -errno;
+  int r = ::fsync(fd);
+  if (r < 0)
+    r = -errno;
+  VOID_TEMP_FAILURE_RETRY(::close(fd));
+  return r;
+}
 
 /// hex digit to integer value
 int hex_to_int(char c)
@@ -89,8 +126,12 @@ bool cmp_hexdigit_string_bitwise(const string& l, const string& r)
 }
 
 int HashIndex::cleanup() {
+  lfn_cache_clear();
+  int r = cleanup_background_split();
+  if (r < 0)
+    return r;
   bufferlist bl;
-  int r = get_attr_path(vector<string>(), IN_PROGRESS_OP_TAG, bl);
+  r = get_attr_path(vector<string>(), IN_PROGRESS_OP_TAG, bl);
   if (r < 0) {
     // No in progress operations!
     return 0;
@@ -324,6 +365,13 @@ int HashIndex::_created(const vector<string> &path,
     return r;
 
   if (must_split(info)) {
+    if (!must_split_inline(path, info)) {
+      Mutex::Locker l(bg_lock);
+      if (bg_pending.insert(path).second)
+	dout(10) << __func__ << " queued background split of " << path
+		 << " objs " << info.objs << dendl;
+      return 0;
+    }
     int r = initiate_split(path, info);
     if (r < 0)
       return r;
@@ -399,6 +447,14 @@ int HashIndex::_collection_list_partial(const ghobject_t &start,
 }
 
 int HashIndex::prep_delete() {
+  {
+    Mutex::Locker l(bg_lock);
+    bg_abort = true;
+    bg_pending.clear();
+  }
+  int r = cleanup_background_split();
+  if (r < 0)
+    return r;
   return recursive_remove(vector<string>());
 }
 
@@ -786,6 +842,401 @@ int HashIndex::complete_split(const vector<string> &path, subdir_info_s info) {
   return end_split_or_merge(path);
 }
 
+bool HashIndex::must_split_inline(const vector<string> &path,
+				  const subdir_info_s &info) {
+  // the root can't be swapped out with a rename, and the shadow
+  // layout only knows how to replace a plain leaf
+  if (!background_split || path.empty() || info.subdirs)
+    return true;
+  // don't let a leaf grow without bound while the background catches up
+  return info.objs > 2 * (uint64_t)abs(merge_threshold) * 16 * split_multiplier;
+}
+
+bool HashIndex::has_background_work() {
+  Mutex::Locker l(bg_lock);
+  return !bg_abort && !bg_pending.empty();
+}
+
+int HashIndex::do_background_work() {
+  vector<string> path;
+  {
+    Mutex::Locker l(bg_lock);
+    if (bg_abort || bg_pending.empty())
+      return 0;
+    path = *bg_pending.begin();
+    bg_pending.erase(bg_pending.begin());
+  }
+  return do_background_split(path);
+}
+
+void HashIndex::get_background_split_paths(const vector<string> &path,
+					   string *shadow, string *old) {
+  // leading '.' hides these from list_objects and list_subdirs
+  vector<string> parent(path.begin(), path.end() - 1);
+  string dir = get_full_path_subdir(parent) + "/";
+  string name = mangle_path_component(path.back());
+  *shadow = dir + ".split_" + name;
+  *old = dir + ".old_" + name;
+}
+
+int HashIndex::do_background_split(const vector<string> &path) {
+  bg_split_t split;
+  int r = bg_split_start(path, &split);
+  if (r == 0)
+    r = bg_split_link(&split);
+  if (r == 0) {
+    try {
+      r = bg_split_swap(&split);
+    } catch (RetryException) {
+      // an injected crash; recover the way cleanup() would on restart
+      complete_inject_failure();
+      RWLock::WLocker l(access_lock);
+      return cleanup_background_split();
+    }
+  }
+  if (r == 0)
+    r = bg_split_finish(&split);
+  return r < 0 ? r : 0;
+}
+
+int HashIndex::bg_split_start(const vector<string> &path, bg_split_t *split) {
+  split->path = path;
+  split->leaf = get_full_path_subdir(path);
+  get_background_split_paths(path, &split->shadow, &split->old);
+  dout(10) << __func__ << " " << split->leaf << dendl;
+
+  // record the split, so that cleanup() can find the shadow if we crash
+  RWLock::RLocker l(access_lock);
+  if (bg_aborted())
+    return 1;
+  subdir_info_s info;
+  int r = get_info(path, &info);
+  if (r == -ENOENT)
+    return 1;  // merged away meanwhile
+  if (r < 0)
+    return r;
+  if (info.subdirs || !must_split(info))
+    return 1;  // split inline meanwhile
+  bufferlist bl;
+  InProgressOp op_tag(InProgressOp::BG_SPLIT, path);
+  op_tag.encode(bl);
+  r = add_attr_path(vector<string>(), BG_SPLIT_TAG, bl);
+  if (r < 0)
+    return r;
+  if (::mkdir(split->shadow.c_str(), 0777) < 0 && errno != EEXIST)
+    return -errno;
+  return list_objects(path, 0, 0, &split->objects);
+}
+
+int HashIndex::bg_split_link(bg_split_t *split) {
+  const int batch = MAX(g_conf->filestore_split_background_batch, 1);
+  const double delay = g_conf->filestore_split_background_delay;
+  const unsigned level = split->path.size();
+
+  // whatever changes between batches is fixed up by bg_split_swap()
+  map<string, ghobject_t>::iterator i = split->objects.begin();
+  while (i != split->objects.end()) {
+    {
+      // prep_delete() removes the shadow under the write lock
+      RWLock::RLocker l(access_lock);
+      if (bg_aborted())
+	return 1;
+      for (int n = 0; n < batch && i != split->objects.end(); ++n, ++i) {
+	vector<string> comps;
+	get_path_components(i->second, &comps);
+	string child = split->shadow + "/" + mangle_path_component(comps[level]);
+	if (split->children.insert(comps[level]).second &&
+	    ::mkdir(child.c_str(), 0777) < 0 && errno != EEXIST)
+	  return -errno;
+	string from = split->leaf + "/" + i->first;
+	string to = child + "/" + i->first;
+	if (::link(from.c_str(), to.c_str()) < 0 &&
+	    errno != ENOENT && errno != EEXIST)
+	  return -errno;
+      }
+    }
+    if (delay > 0 && i != split->objects.end())
+      usleep(delay * 1000000);
+  }
+  return 0;
+}
+
+int HashIndex::bg_split_swap(bg_split_t *split) {
+  const vector<string> &path = split->path;
+  const string &leaf = split->leaf;
+  const string &shadow = split->shadow;
+  const string &old = split->old;
+  set<string> &children = split->children;
+  const unsigned level = path.size();
+
+  RWLock::WLocker l(access_lock);
+  if (bg_aborted())
+    return 1;
+  subdir_info_s info;
+  int r = get_info(path, &info);
+  if (r < 0 || info.subdirs) {
+    // merged or split inline meanwhile; just drop the shadow
+    dout(10) << __func__ << " " << leaf << " changed under us, r = "
+	     << r << dendl;
+    r = cleanup_background_split();
+    return r < 0 ? r : 1;
+  }
+
+  map<string, ghobject_t> cur;
+  map<string, ino_t> cur_ino;
+  r = list_objects(path, 0, 0, &cur);
+  if (r < 0)
+    goto out;
+  r = list_inodes(leaf, &cur_ino);
+  if (r < 0)
+    goto out;
+  {
+    map<string, map<string, ino_t> > placed;
+    for (set<string>::iterator c = children.begin();
+	 c != children.end();
+	 ++c) {
+      r = list_inodes(shadow + "/" + mangle_path_component(*c), &placed[*c]);
+      if (r < 0)
+	goto out;
+    }
+
+    // relink anything created, replaced or renamed since the snapshot
+    map<string, uint64_t> counts;
+    for (map<string, ghobject_t>::iterator i = cur.begin();
+	 i != cur.end();
+	 ++i) {
+      vector<string> comps;
+      get_path_components(i->second, &comps);
+      const string &c = comps[level];
+      counts[c]++;
+      string child = shadow + "/" + mangle_path_component(c);
+      string to = child + "/" + i->first;
+      map<string, ino_t> &p = placed[c];
+      map<string, ino_t>::iterator j = p.find(i->first);
+      if (j != p.end()) {
+	bool same = (j->second == cur_ino[i->first]);
+	p.erase(j);
+	if (same)
+	  continue;
+	if (::unlink(to.c_str()) < 0 && errno != ENOENT) {
+	  r = -errno;
+	  goto out;
+	}
+      }
+      if (children.insert(c).second &&
+	  ::mkdir(child.c_str(), 0777) < 0 && errno != EEXIST) {
+	r = -errno;
+	goto out;
+      }
+      string from = leaf + "/" + i->first;
+      if (::link(from.c_str(), to.c_str()) < 0) {
+	r = -errno;
+	goto out;
+      }
+    }
+
+    // and drop anything removed since
+    for (map<string, map<string, ino_t> >::iterator c = placed.begin();
+	 c != placed.end();
+	 ++c) {
+      string child = shadow + "/" + mangle_path_component(c->first);
+      for (map<string, ino_t>::iterator j = c->second.begin();
+	   j != c->second.end();
+	   ++j) {
+	string to = child + "/" + j->first;
+	if (::unlink(to.c_str()) < 0 && errno != ENOENT) {
+	  r = -errno;
+	  goto out;
+	}
+      }
+    }
+
+    // set the subdir info and make it all durable before the swap
+    subdir_info_s shadow_info;
+    shadow_info.hash_level = level;
+    for (set<string>::iterator c = children.begin();
+	 c != children.end();
+	 ++c) {
+      string child = shadow + "/" + mangle_path_component(*c);
+      if (!counts.count(*c)) {
+	if (::rmdir(child.c_str()) < 0) {
+	  r = -errno;
+	  goto out;
+	}
+	continue;
+      }
+      subdir_info_s child_info;
+      child_info.objs = counts[*c];
+      child_info.hash_level = level + 1;
+      bufferlist bl;
+      child_info.encode(bl);
+      r = chain_setxattr(child.c_str(), mangle_attr_name(SUBDIR_ATTR).c_str(),
+			 bl.c_str(), bl.length());
+      if (r < 0)
+	goto out;
+      r = fsync_path(child);
+      if (r < 0)
+	goto out;
+      shadow_info.subdirs++;
+    }
+    bufferlist bl;
+    shadow_info.encode(bl);
+    r = chain_setxattr(shadow.c_str(), mangle_attr_name(SUBDIR_ATTR).c_str(),
+		       bl.c_str(), bl.length());
+    if (r < 0)
+      goto out;
+    vector<string> parent(path.begin(), path.end() - 1);
+    r = fsync_path(shadow);
+    if (r < 0)
+      goto out;
+    r = fsync_dir(parent);
+    if (r < 0)
+      goto out;
+
+    // cleanup() puts the old leaf back if we die between these
+    init_inject_failure();
+    maybe_inject_failure();
+    if (::rename(leaf.c_str(), old.c_str()) < 0) {
+      r = -errno;
+      goto out;
+    }
+    maybe_inject_failure();
+    if (::rename(shadow.c_str(), leaf.c_str()) < 0) {
+      r = -errno;
+      goto out;
+    }
+    complete_inject_failure();
+    lfn_cache_clear();
+    r = fsync_dir(parent);
+    if (r < 0)
+      goto out;
+    dout(10) << __func__ << " " << leaf << " split into "
+	     << shadow_info.subdirs << " subdirs" << dendl;
+  }
+out:
+  if (r < 0) {
+    complete_inject_failure();
+    derr << __func__ << " " << leaf << " failed: " << cpp_strerror(r)
+	 << dendl;
+    cleanup_background_split();
+  }
+  return r;
+}
+
+int HashIndex::bg_split_finish(bg_split_t *split) {
+  // the retired leaf is outside the index; drop it at our leisure
+  int r = remove_tree(split->old, true);
+  if (r != 0)
+    return r;
+  RWLock::RLocker l(access_lock);
+  if (bg_aborted())
+    return 1;
+  return remove_attr_path(vector<string>(), BG_SPLIT_TAG);
+}
+
+int HashIndex::remove_tree(const string &dir, bool background) {
+  const int batch = MAX(g_conf->filestore_split_background_batch, 1);
+  const double delay = g_conf->filestore_split_background_delay;
+
+  vector<string> entries;
+  DIR *d = ::opendir(dir.c_str());
+  if (!d)
+    return errno == ENOENT ? 0 : -errno;
+  char buf[offsetof(struct dirent, d_name) + PATH_MAX + 1];
+  struct dirent *de;
+  while (!::readdir_r(d, reinterpret_cast<struct dirent*>(buf), &de) && de) {
+    if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+      continue;
+    entries.push_back(dir + "/" + de->d_name);
+  }
+  ::closedir(d);
+
+  // in the background, in batches under access_lock like
+  // bg_split_link() so that prep_delete() can stop us
+  vector<string> subdirs;
+  vector<string>::iterator i = entries.begin();
+  while (i != entries.end()) {
+    if (background) {
+      access_lock.get_read();
+      if (bg_aborted()) {
+	access_lock.put_read();
+	return 1;
+      }
+    }
+    int r = 0;
+    for (int n = 0; i != entries.end() && (!background || n < batch);
+	 ++n, ++i) {
+      if (::unlink(i->c_str()) < 0) {
+	if (errno == EISDIR || errno == EPERM) {
+	  subdirs.push_back(*i);
+	} else if (errno != ENOENT) {
+	  r = -errno;
+	  break;
+	}
+      }
+    }
+    if (background)
+      access_lock.put_read();
+    if (r < 0)
+      return r;
+    if (background && delay > 0 && i != entries.end())
+      usleep(delay * 1000000);
+  }
+  for (vector<string>::iterator j = subdirs.begin(); j != subdirs.end(); ++j) {
+    int r = remove_tree(*j, background);
+    if (r != 0)
+      return r;
+  }
+
+  if (background) {
+    access_lock.get_read();
+    if (bg_aborted()) {
+      access_lock.put_read();
+      return 1;
+    }
+  }
+  int r = 0;
+  if (::rmdir(dir.c_str()) < 0 && errno != ENOENT)
+    r = -errno;
+  if (background)
+    access_lock.put_read();
+  return r;
+}
+
+int HashIndex::cleanup_background_split() {
+  bufferlist bl;
+  int r = get_attr_path(vector<string>(), BG_SPLIT_TAG, bl);
+  if (r < 0)
+    return 0;  // nothing in progress
+  bufferlist::iterator i = bl.begin();
+  InProgressOp op_tag(i);
+  assert(op_tag.is_bg_split());
+  string leaf = get_full_path_subdir(op_tag.path);
+  string shadow, old;
+  get_background_split_paths(op_tag.path, &shadow, &old);
+  dout(10) << __func__ << " " << leaf << dendl;
+
+  struct stat st;
+  if (::stat(leaf.c_str(), &st) < 0 && errno == ENOENT &&
+      ::stat(old.c_str(), &st) == 0) {
+    // interrupted between the two renames
+    if (::rename(old.c_str(), leaf.c_str()) < 0)
+      return -errno;
+  }
+  lfn_cache_clear();
+  r = remove_tree(shadow, false);
+  if (r < 0)
+    return r;
+  r = remove_tree(old, false);
+  if (r < 0)
+    return r;
+  vector<string> parent(op_tag.path.begin(), op_tag.path.end() - 1);
+  r = fsync_dir(parent);
+  if (r < 0 && r != -ENOENT)
+    return r;
+  return remove_attr_path(vector<string>(), BG_SPLIT_TAG);
+}
+
 void HashIndex::get_path_components(const ghobject_t &oid,
 				    vector<string> *path) {
   char buf[MAX_HASH_LEVEL + 1];
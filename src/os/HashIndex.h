@@ -17,6 +17,7 @@
 
 #include "include/buffer.h"
 #include "include/encoding.h"
+#include "common/Mutex.h"
 #include "LFNIndex.h"
 
 extern string reverse_hexdigit_bits_string(string l);
@@ -53,6 +54,8 @@ private:
   static const string SUBDIR_ATTR;
   /// Attribute name for storing in progress op tag
   static const string IN_PROGRESS_OP_TAG;
+  /// Attribute name for storing the in progress background split
+  static const string BG_SPLIT_TAG;
   /// Size (bits) in object hash
   static const int PATH_HASH_LEN = 32;
   /// Max length of hashed path
@@ -67,6 +70,25 @@ private:
   int merge_threshold;
   int split_multiplier;
 
+  /**
+   * Background splitting
+   *
+   * With background_split set, a leaf that crosses the split threshold
+   * is only queued in bg_pending.  do_background_work() later links
+   * its objects into a hidden shadow directory in batches, holding
+   * access_lock for reading only while it works on a batch, then
+   * takes the lock for writing just long enough to catch up with
+   * changes made meanwhile and swap the shadow in with two renames.
+   * Each batch rechecks bg_abort under the lock, so prep_delete()
+   * never races with it.  Leaves that grow to twice the threshold
+   * before that happens, the root and leaves with subdirs still
+   * split inline.
+   */
+  bool background_split;
+  Mutex bg_lock;                    ///< protects bg_pending, bg_abort
+  set<vector<string> > bg_pending;  ///< leaves waiting to be split
+  bool bg_abort;                    ///< collection is being removed
+
   /// Encodes current subdir state for determining when to split/merge.
   struct subdir_info_s {
     uint64_t objs;       ///< Objects in subdir.
@@ -100,6 +122,7 @@ private:
     static const int SPLIT = 0;
     static const int MERGE = 1;
     static const int COL_SPLIT = 2;
+    static const int BG_SPLIT = 3;
     int op;
     vector<string> path;
 
@@ -113,6 +136,7 @@ private:
     bool is_split() const { return op == SPLIT; }
     bool is_col_split() const { return op == COL_SPLIT; }
     bool is_merge() const { return op == MERGE; }
+    bool is_bg_split() const { return op == BG_SPLIT; }
 
     void encode(bufferlist &bl) const {
       __u8 v = 1;
@@ -139,10 +163,14 @@ public:
     int merge_at,          ///< [in] Merge threshhold.
     int split_multiple,	   ///< [in] Split threshhold.
     uint32_t index_version,///< [in] Index version
-    double retry_probability=0) ///< [in] retry probability
+    double retry_probability=0, ///< [in] retry probability
+    bool background_split=false) ///< [in] defer splits @see do_background_work
     : LFNIndex(collection, base_path, index_version, retry_probability),
       merge_threshold(merge_at),
-      split_multiplier(split_multiple) {}
+      split_multiplier(split_multiple),
+      background_split(background_split),
+      bg_lock("HashIndex::bg_lock"),
+      bg_abort(false) {}
 
   /// @see CollectionIndex
   uint32_t collection_version() { return index_version; }
@@ -153,6 +181,12 @@ public:
   /// @see CollectionIndex
   int prep_delete();
 
+  /// @see CollectionIndex
+  bool has_background_work();
+
+  /// @see CollectionIndex
+  int do_background_work();
+
   /// @see CollectionIndex
   int _split(
     uint32_t match,
@@ -197,6 +231,41 @@ protected:
     vector<ghobject_t> *ls,
     ghobject_t *next
     );
+
+  /// Split path via a shadow directory @see background_split
+  int do_background_split(
+    const vector<string> &path ///< [in] Leaf to split
+    ); /// @return Error Code, 0 on success
+
+  /// State of one background split @see do_background_split
+  struct bg_split_t {
+    vector<string> path;             ///< leaf being split
+    string leaf, shadow, old;        ///< @see get_background_split_paths
+    map<string, ghobject_t> objects; ///< leaf contents at the start
+    set<string> children;            ///< subdirs made in the shadow
+  };
+  /**
+   * The steps of do_background_split
+   *
+   * Each returns 0 to go on to the next, 1 if the split was abandoned
+   * (bg_abort set, or the leaf changed shape meanwhile) or an error.
+   */
+  /// snapshot the leaf and record the split for cleanup()
+  int bg_split_start(const vector<string> &path, bg_split_t *split);
+  /// hard link the snapshot into the shadow
+  int bg_split_link(bg_split_t *split);
+  /// catch up with changes since the snapshot and swap the shadow in
+  int bg_split_swap(bg_split_t *split);
+  /// remove the retired leaf and the split record
+  int bg_split_finish(bg_split_t *split);
+
+  /**
+   * Remove a shadow or retired leaf and everything below it
+   *
+   * With background set, works in batches under access_lock and
+   * returns 1 once bg_abort is set; otherwise the caller holds the lock.
+   */
+  int remove_tree(const string &dir, bool background);
 private:
   /// Recursively remove path and its subdirs
   int recursive_remove(
@@ -269,6 +338,27 @@ private:
     subdir_info_s info	       ///< [in] Info attached to path
     ); /// @return Error Code, 0 on success
 
+  /// True if a split of info can't wait for the background
+  bool must_split_inline(
+    const vector<string> &path, ///< [in] Subdir to split
+    const subdir_info_s &info   ///< [in] Info attached to path
+    );
+
+  /// Roll back or finish an interrupted background split
+  int cleanup_background_split(); ///< @return Error Code, 0 on success
+
+  /// Full paths of the shadow and retired copies of path
+  void get_background_split_paths(
+    const vector<string> &path, ///< [in] Leaf being split
+    string *shadow,             ///< [out] New layout being built
+    string *old                 ///< [out] Old leaf after the swap
+    );
+
+  bool bg_aborted() {
+    Mutex::Locker l(bg_lock);
+    return bg_abort;
+  }
+
   /// Determine path components from hoid hash
   void get_path_components(
     const ghobject_t &oid, ///< [in] Object for which to get path components
@@ -99,8 +99,12 @@ int IndexManager::build_index(coll_t c, const char *path, CollectionIndex **inde
     case CollectionIndex::HASH_INDEX_TAG_2: // fall through
     case CollectionIndex::HOBJECT_WITH_POOL: {
       // Must be a HashIndex
-      *index = new HashIndex(c, path, g_conf->filestore_merge_threshold,
-				   g_conf->filestore_split_multiple, version);
+      HashIndex *h = new HashIndex(c, path, g_conf->filestore_merge_threshold,
+				   g_conf->filestore_split_multiple, version,
+				   0,
+				   g_conf->filestore_split_background);
+      h->set_lfn_cache(g_conf->filestore_lfn_cache_size, logger);
+      *index = h;
       return 0;
     }
     default: assert(0);
@@ -108,10 +112,13 @@ int IndexManager::build_index(coll_t c, const char *path, CollectionIndex **inde
 
   } else {
     // No need to check
-    *index = new HashIndex(c, path, g_conf->filestore_merge_threshold,
+    HashIndex *h = new HashIndex(c, path, g_conf->filestore_merge_threshold,
 				 g_conf->filestore_split_multiple,
 				 CollectionIndex::HOBJECT_WITH_POOL,
-				 g_conf->filestore_index_retry_probability);
+				 g_conf->filestore_index_retry_probability,
+				 g_conf->filestore_split_background);
+    h->set_lfn_cache(g_conf->filestore_lfn_cache_size, logger);
+    *index = h;
     return 0;
   }
 }
@@ -51,6 +51,7 @@ struct Index {
 class IndexManager {
   Mutex lock; ///< Lock for Index Manager
   bool upgrade;
+  PerfCounters *logger; ///< for the indexes' lookup caches
   ceph::unordered_map<coll_t, CollectionIndex* > col_indices;
 
   /**
@@ -68,10 +69,17 @@ class IndexManager {
 public:
   /// Constructor
   IndexManager(bool upgrade) : lock("IndexManager lock"),
-			       upgrade(upgrade) {}
+			       upgrade(upgrade),
+			       logger(NULL) {}
 
   ~IndexManager();
 
+  /// Set the counters new indexes report cache hits to
+  void set_logger(PerfCounters *l) {
+    Mutex::Locker locker(lock);
+    logger = l;
+  }
+
   /**
    * Reserve and return index for c
    *
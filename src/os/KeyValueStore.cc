@@ -371,13 +371,17 @@ void KeyValueStore::BufferTransaction::set_buffer_keys(
      StripObjectMap::StripObjectHeaderRef strip_header,
      const string &prefix, map<string, bufferlist> &values)
 {
-  store->backend->set_keys(strip_header->header, prefix, values, t);
-
   uniq_id uid = make_pair(strip_header->cid, strip_header->oid);
   map<pair<string, string>, bufferlist> &uid_buffers = buffers[uid];
+  PendingKeys &p = pending[uid];
+  p.header = strip_header;
   for (map<string, bufferlist>::iterator iter = values.begin();
        iter != values.end(); ++iter) {
-    uid_buffers[make_pair(prefix, iter->first)].swap(iter->second);
+    pair<string, string> key = make_pair(prefix, iter->first);
+    bufferlist &pbl = p.keys[key];
+    coalesced_bytes += pbl.length();
+    pbl = iter->second;
+    uid_buffers[key].swap(iter->second);
   }
 }
 
@@ -386,6 +390,13 @@ int KeyValueStore::BufferTransaction::remove_buffer_keys(
      const set<string> &keys)
 {
   uniq_id uid = make_pair(strip_header->cid, strip_header->oid);
+  PendingKeysMap::iterator pit = pending.find(uid);
+  if (pit != pending.end()) {
+    for (set<string>::const_iterator iter = keys.begin(); iter != keys.end();
+	 ++iter)
+      pit->second.keys.erase(make_pair(prefix, *iter));
+  }
+
   map< uniq_id, map<pair<string, string>, bufferlist> >::iterator obj_it = buffers.find(uid);
   set<string> buffered_keys;
   if ( obj_it != buffers.end() ) {
@@ -409,6 +420,18 @@ void KeyValueStore::BufferTransaction::clear_buffer_keys(
      StripObjectMap::StripObjectHeaderRef strip_header, const string &prefix)
 {
   uniq_id uid = make_pair(strip_header->cid, strip_header->oid);
+  PendingKeysMap::iterator pit = pending.find(uid);
+  if (pit != pending.end()) {
+    map<pair<string, string>, bufferlist> &keys = pit->second.keys;
+    for (map<pair<string, string>, bufferlist>::iterator iter = keys.begin();
+	 iter != keys.end(); ) {
+      if (iter->first.first == prefix)
+	keys.erase(iter++);
+      else
+	++iter;
+    }
+  }
+
   map< uniq_id, map<pair<string, string>, bufferlist> >::iterator obj_it = buffers.find(uid);
   if ( obj_it != buffers.end() ) {
     for (map<pair<string, string>, bufferlist>::iterator iter = obj_it->second.begin();
@@ -423,6 +446,7 @@ int KeyValueStore::BufferTransaction::clear_buffer(
      StripObjectMap::StripObjectHeaderRef strip_header)
 {
   strip_header->deleted = true;
+  pending.erase(make_pair(strip_header->cid, strip_header->oid));
 
   InvalidateCacheContext *c = new InvalidateCacheContext(store, strip_header->cid, strip_header->oid);
   finishes.push_back(c);
@@ -433,8 +457,12 @@ void KeyValueStore::BufferTransaction::clone_buffer(
     StripObjectMap::StripObjectHeaderRef old_header,
     const coll_t &cid, const ghobject_t &oid)
 {
+  // The clone shares whatever the source holds at this point
+  flush_pending_keys(make_pair(old_header->cid, old_header->oid));
+
   // Remove target ahead to avoid dead lock
   strip_headers.erase(make_pair(cid, oid));
+  pending.erase(make_pair(cid, oid));
 
   StripObjectMap::StripObjectHeaderRef new_target_header;
 
@@ -452,6 +480,9 @@ void KeyValueStore::BufferTransaction::rename_buffer(
 {
   // FIXME: Lacking of lock for origin header, it will cause other operation
   // can get the origin header while submitting transactions
+  flush_pending_keys(make_pair(old_header->cid, old_header->oid));
+  pending.erase(make_pair(cid, oid));
+
   StripObjectMap::StripObjectHeaderRef new_header;
   store->backend->rename_wrap(old_header, cid, oid, t, &new_header);
 
@@ -460,9 +491,42 @@ void KeyValueStore::BufferTransaction::rename_buffer(
   strip_headers[make_pair(cid, oid)] = new_header;
 }
 
+uint64_t KeyValueStore::BufferTransaction::flush_pending_keys(
+    const uniq_id &uid)
+{
+  PendingKeysMap::iterator p = pending.find(uid);
+  if (p == pending.end())
+    return 0;
+
+  uint64_t bytes = 0;
+  map<string, bufferlist> to_set;
+  string prefix;
+  for (map<pair<string, string>, bufferlist>::iterator i =
+	 p->second.keys.begin();
+       i != p->second.keys.end(); ++i) {
+    if (i->first.first != prefix) {
+      if (!to_set.empty()) {
+	store->backend->set_keys(p->second.header->header, prefix, to_set, t);
+	to_set.clear();
+      }
+      prefix = i->first.first;
+    }
+    bytes += i->second.length();
+    to_set[i->first.second].swap(i->second);
+  }
+  if (!to_set.empty())
+    store->backend->set_keys(p->second.header->header, prefix, to_set, t);
+  pending.erase(p);
+  return bytes;
+}
+
 int KeyValueStore::BufferTransaction::submit_transaction()
 {
   int r = 0;
+  uint64_t bytes = 0;
+
+  while (!pending.empty())
+    bytes += flush_pending_keys(pending.begin()->first);
 
   for (StripHeaderMap::iterator header_iter = strip_headers.begin();
        header_iter != strip_headers.end(); ++header_iter) {
@@ -472,6 +536,7 @@ int KeyValueStore::BufferTransaction::submit_transaction()
       continue;
 
     if (header->updated) {
+      bytes += header->bits.size() + 2 * sizeof(uint64_t);
       r = store->backend->save_strip_header(header, t);
 
       if (r < 0) {
@@ -481,6 +546,9 @@ int KeyValueStore::BufferTransaction::submit_transaction()
     }
   }
 
+  store->perf_logger->inc(l_os_kv_write_bytes, bytes);
+  store->perf_logger->inc(l_os_kv_coalesced_bytes, coalesced_bytes);
+
   r = store->backend->submit_transaction_sync(t);
   for (list<Context*>::iterator it = finishes.begin(); it != finishes.end(); ++it) {
     (*it)->complete(r);
@@ -544,6 +612,8 @@ KeyValueStore::KeyValueStore(const std::string &base,
   perf_logger(NULL),
   m_keyvaluestore_queue_max_ops(g_conf->keyvaluestore_queue_max_ops),
   m_keyvaluestore_queue_max_bytes(g_conf->keyvaluestore_queue_max_bytes),
+  m_keyvaluestore_op_batch_max_ops(g_conf->keyvaluestore_op_batch_max_ops),
+  m_keyvaluestore_op_batch_max_bytes(g_conf->keyvaluestore_op_batch_max_bytes),
   m_keyvaluestore_strip_size(g_conf->keyvaluestore_default_strip_size),
   m_keyvaluestore_max_expected_write_size(g_conf->keyvaluestore_max_expected_write_size),
   do_update(do_update),
@@ -566,6 +636,9 @@ KeyValueStore::KeyValueStore(const std::string &base,
   plb.add_time_avg(l_os_commit_lat, "commit_latency", "Commit latency");
   plb.add_time_avg(l_os_apply_lat, "apply_latency", "Apply latency");
   plb.add_time_avg(l_os_queue_lat, "queue_transaction_latency_avg", "Store operation queue latency");
+  plb.add_u64_avg(l_os_kv_batch_ops, "kv_batch_ops", "Operations applied per kv transaction");
+  plb.add_u64_counter(l_os_kv_write_bytes, "kv_write_bytes", "Data and metadata written to the kv backend");
+  plb.add_u64_counter(l_os_kv_coalesced_bytes, "kv_coalesced_bytes", "Key updates overwritten before reaching the kv backend");
 
   perf_logger = plb.create_perf_counters();
 
@@ -1097,6 +1170,7 @@ KeyValueStore::Op *KeyValueStore::build_op(list<Transaction*>& tls,
   o->ops = ops;
   o->bytes = bytes;
   o->osd_op = osd_op;
+  o->applied = false;
   return o;
 }
 
@@ -1156,17 +1230,39 @@ void KeyValueStore::_do_op(OpSequencer *osr, ThreadPool::TPHandle &handle)
   // one PG, so this lock will ensure no other concurrent write operation
   osr->apply_lock.Lock();
   Op *o = osr->peek_queue();
-  dout(5) << "_do_op " << o << " seq " << o->op << " " << *osr << "/" << osr->parent << " start" << dendl;
-  int r = _do_transactions(o->tls, o->op, &handle);
-  dout(10) << "_do_op " << o << " seq " << o->op << " r = " << r
-           << ", finisher " << o->onreadable << " " << o->onreadable_sync << dendl;
-
-  if (o->ondisk) {
-    if (r < 0) {
-      delete o->ondisk;
-      o->ondisk = 0;
-    } else {
-      ondisk_finisher.queue(o->ondisk, r);
+  if (o->applied) {
+    dout(10) << "_do_op " << o << " seq " << o->op << " " << *osr
+	     << " already applied" << dendl;
+    return;
+  }
+
+  // Ops queued behind this one on the same sequencer go into the same kv
+  // transaction, so objects they share are written back only once.  Each
+  // still completes through its own _finish_op, in order.
+  list<Op*> batch;
+  osr->peek_batch(m_keyvaluestore_op_batch_max_ops,
+		  m_keyvaluestore_op_batch_max_bytes, &batch);
+  list<Transaction*> tls;
+  for (list<Op*>::iterator p = batch.begin(); p != batch.end(); ++p)
+    tls.insert(tls.end(), (*p)->tls.begin(), (*p)->tls.end());
+  dout(5) << "_do_op " << o << " seq " << o->op << " " << *osr << "/" << osr->parent
+	  << " start, batch of " << batch.size() << dendl;
+  int r = _do_transactions(tls, o->op, &handle);
+  perf_logger->inc(l_os_kv_batch_ops, batch.size());
+
+  for (list<Op*>::iterator p = batch.begin(); p != batch.end(); ++p) {
+    o = *p;
+    o->applied = true;
+    dout(10) << "_do_op " << o << " seq " << o->op << " r = " << r
+	     << ", finisher " << o->onreadable << " " << o->onreadable_sync << dendl;
+
+    if (o->ondisk) {
+      if (r < 0) {
+	delete o->ondisk;
+	o->ondisk = 0;
+      } else {
+	ondisk_finisher.queue(o->ondisk, r);
+      }
     }
   }
 }
@@ -2887,6 +2983,8 @@ const char** KeyValueStore::get_tracked_conf_keys() const
   static const char* KEYS[] = {
     "keyvaluestore_queue_max_ops",
     "keyvaluestore_queue_max_bytes",
+    "keyvaluestore_op_batch_max_ops",
+    "keyvaluestore_op_batch_max_bytes",
     "keyvaluestore_default_strip_size",
     "keyvaluestore_dump_file",
     NULL
@@ -2906,6 +3004,11 @@ void KeyValueStore::handle_conf_change(const struct md_config_t *conf,
     throttle_ops.reset_max(conf->keyvaluestore_queue_max_ops);
     throttle_bytes.reset_max(conf->keyvaluestore_queue_max_bytes);
   }
+  if (changed.count("keyvaluestore_op_batch_max_ops") ||
+      changed.count("keyvaluestore_op_batch_max_bytes")) {
+    m_keyvaluestore_op_batch_max_ops = conf->keyvaluestore_op_batch_max_ops;
+    m_keyvaluestore_op_batch_max_bytes = conf->keyvaluestore_op_batch_max_bytes;
+  }
   if (changed.count("keyvaluestore_default_strip_size")) {
     m_keyvaluestore_strip_size = conf->keyvaluestore_default_strip_size;
     default_strip_size = m_keyvaluestore_strip_size;
@@ -256,6 +256,18 @@ class KeyValueStore : public ObjectStore,
     map< uniq_id, map<pair<string, string>, bufferlist>,
 	 CollGhobjectPairBitwiseComparator> buffers;  // pair(prefix, key),to buffer updated data in one transaction
 
+    // Key updates not yet added to "t".  Rewrites of the same strip or
+    // attr within the batch overwrite each other here, so only the last
+    // version of each key reaches the backend at submit time.
+    struct PendingKeys {
+      StripObjectMap::StripObjectHeaderRef header;
+      map<pair<string, string>, bufferlist> keys;
+    };
+    typedef map<uniq_id, PendingKeys,
+		CollGhobjectPairBitwiseComparator> PendingKeysMap;
+    PendingKeysMap pending;
+    uint64_t coalesced_bytes;  // bytes overwritten before reaching "t"
+
     list<Context*> finishes;
 
     KeyValueStore *store;
@@ -285,9 +297,11 @@ class KeyValueStore : public ObjectStore,
                       const coll_t &cid, const ghobject_t &oid);
     void rename_buffer(StripObjectMap::StripObjectHeaderRef old_header,
                        const coll_t &cid, const ghobject_t &oid);
+    uint64_t flush_pending_keys(const uniq_id &uid);
     int submit_transaction();
 
-    BufferTransaction(KeyValueStore *store): store(store) {
+    BufferTransaction(KeyValueStore *store)
+      : coalesced_bytes(0), store(store) {
       t = store->backend->get_transaction();
     }
 
@@ -311,6 +325,7 @@ class KeyValueStore : public ObjectStore,
     Context *ondisk, *onreadable, *onreadable_sync;
     uint64_t ops, bytes;
     TrackedOpRef osd_op;
+    bool applied;  // applied as part of an earlier op's batch
   };
   class OpSequencer : public Sequencer_impl {
     Mutex qlock; // to protect q, for benefit of flush (peek/dequeue also protected by lock)
@@ -376,6 +391,22 @@ class KeyValueStore : public ObjectStore,
       return q.front();
     }
 
+    /// collect the unapplied ops at the front of the queue
+    void peek_batch(unsigned max_ops, uint64_t max_bytes, list<Op*> *ls) {
+      assert(apply_lock.is_locked());
+      Mutex::Locker l(qlock);
+      uint64_t bytes = 0;
+      for (list<Op*>::iterator p = q.begin();
+	   p != q.end() && !(*p)->applied;
+	   ++p) {
+	if (!ls->empty() &&
+	    (ls->size() >= max_ops || bytes + (*p)->bytes > max_bytes))
+	  break;
+	bytes += (*p)->bytes;
+	ls->push_back(*p);
+      }
+    }
+
     Op *dequeue(list<Context*> *to_queue) {
       assert(to_queue);
       assert(apply_lock.is_locked());
@@ -677,6 +708,8 @@ class KeyValueStore : public ObjectStore,
   std::string m_osd_rollback_to_cluster_snap;
   int m_keyvaluestore_queue_max_ops;
   int m_keyvaluestore_queue_max_bytes;
+  int m_keyvaluestore_op_batch_max_ops;
+  uint64_t m_keyvaluestore_op_batch_max_bytes;
   int m_keyvaluestore_strip_size;
   uint64_t m_keyvaluestore_max_expected_write_size;
   int do_update;
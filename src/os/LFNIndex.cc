@@ -27,10 +27,12 @@
 #include "include/object.h"
 #include "common/config.h"
 #include "common/debug.h"
+#include "common/perf_counters.h"
 #include "include/buffer.h"
 #include "common/ceph_crypto.h"
 #include "include/compat.h"
 #include "chain_xattr.h"
+#include "ObjectStore.h"
 
 #include "LFNIndex.h"
 using ceph::crypto::SHA1;
@@ -102,6 +104,7 @@ int LFNIndex::unlink(const ghobject_t &oid)
   WRAP_RETRY(
   vector<string> path;
   string short_name;
+  lfn_cache_erase(oid);
   r = _lookup(oid, &path, &short_name, NULL);
   if (r < 0) {
     goto out;
@@ -117,6 +120,13 @@ int LFNIndex::lookup(const ghobject_t &oid,
 		     IndexedPath *out_path,
 		     int *exist)
 {
+  LFNCacheEntry cached;
+  if (lfn_cache_lookup(oid, &cached)) {
+    *exist = 1;
+    *out_path = IndexedPath(
+      new Path(get_full_path(cached.path, cached.short_name), this));
+    return 0;
+  }
   WRAP_RETRY(
   vector<string> path;
   string short_name;
@@ -137,12 +147,84 @@ int LFNIndex::lookup(const ghobject_t &oid,
     }
   } else {
     *exist = 1;
+    lfn_cache_add(oid, path, short_name);
   }
   *out_path = IndexedPath(new Path(full_path, this));
   r = 0;
   );
 }
 
+bool LFNIndex::lfn_cache_lookup(const ghobject_t &oid, LFNCacheEntry *out)
+{
+  Mutex::Locker l(lfn_cache_lock);
+  if (!lfn_cache_max)
+    return false;
+  ceph::unordered_map<ghobject_t, lfn_lru_t::iterator>::iterator p =
+    lfn_cache.find(oid);
+  if (p == lfn_cache.end())
+    return false;
+  lfn_lru.splice(lfn_lru.begin(), lfn_lru, p->second);
+  *out = p->second->second;
+  if (logger) {
+    logger->inc(l_os_lfn_cache_hit);
+    logger->inc(l_os_lfn_cache_saved, out->cost);
+  }
+  return true;
+}
+
+void LFNIndex::lfn_cache_add(const ghobject_t &oid, const vector<string> &path,
+			     const string &short_name)
+{
+  // short names resolve with a single stat; not worth caching
+  if (!lfn_is_hashed_filename(short_name))
+    return;
+  LFNCacheEntry e;
+  e.path = path;
+  e.short_name = short_name;
+  // a miss stats each directory on the way down plus the next level,
+  // reads the lfn attr of each chain entry up to ours, then stats it
+  e.cost = path.size() + 2 + 1;
+  for (int i = 0; i < 16 && lfn_get_short_name(oid, i) != short_name; ++i)
+    ++e.cost;
+
+  Mutex::Locker l(lfn_cache_lock);
+  if (!lfn_cache_max)
+    return;
+  if (logger)
+    logger->inc(l_os_lfn_cache_miss);
+  ceph::unordered_map<ghobject_t, lfn_lru_t::iterator>::iterator p =
+    lfn_cache.find(oid);
+  if (p != lfn_cache.end()) {
+    lfn_lru.splice(lfn_lru.begin(), lfn_lru, p->second);
+    p->second->second = e;
+    return;
+  }
+  lfn_lru.push_front(make_pair(oid, e));
+  lfn_cache[oid] = lfn_lru.begin();
+  while (lfn_lru.size() > lfn_cache_max) {
+    lfn_cache.erase(lfn_lru.back().first);
+    lfn_lru.pop_back();
+  }
+}
+
+void LFNIndex::lfn_cache_erase(const ghobject_t &oid)
+{
+  Mutex::Locker l(lfn_cache_lock);
+  ceph::unordered_map<ghobject_t, lfn_lru_t::iterator>::iterator p =
+    lfn_cache.find(oid);
+  if (p == lfn_cache.end())
+    return;
+  lfn_lru.erase(p->second);
+  lfn_cache.erase(p);
+}
+
+void LFNIndex::lfn_cache_clear()
+{
+  Mutex::Locker l(lfn_cache_lock);
+  lfn_lru.clear();
+  lfn_cache.clear();
+}
+
 int LFNIndex::pre_hash_collection(uint32_t pg_num, uint64_t expected_num_objs)
 {
   return _pre_hash_collection(pg_num, expected_num_objs);
@@ -202,6 +284,8 @@ int LFNIndex::remove_objects(const vector<string> &dir,
 			     const map<string, ghobject_t> &to_remove,
 			     map<string, ghobject_t> *remaining)
 {
+  // chain entries get renamed into the holes
+  lfn_cache_clear();
   set<string> clean_chains;
   for (map<string, ghobject_t>::const_iterator to_clean = to_remove.begin();
        to_clean != to_remove.end();
@@ -267,6 +351,7 @@ int LFNIndex::move_objects(const vector<string> &from,
 {
   map<string, ghobject_t> to_move;
   int r;
+  lfn_cache_clear();
   r = list_objects(from, 0, NULL, &to_move);
   if (r < 0)
     return r;
@@ -334,6 +419,8 @@ int LFNIndex::move_subdir(
   sub_path.push_back(dir);
   string from_path(from.get_full_path_subdir(sub_path));
   string to_path(dest.get_full_path_subdir(sub_path));
+  from.lfn_cache_clear();
+  dest.lfn_cache_clear();
   int r = ::rename(from_path.c_str(), to_path.c_str());
   if (r < 0)
     return -errno;
@@ -834,6 +921,7 @@ int LFNIndex::lfn_created(const vector<string> &path,
 {
   if (!lfn_is_hashed_filename(mangled_name))
     return 0;
+  lfn_cache_erase(oid);
   string full_path = get_full_path(path, mangled_name);
   string full_name = lfn_generate_object_name(oid);
   maybe_inject_failure();
@@ -848,6 +936,12 @@ int LFNIndex::lfn_created(const vector<string> &path,
 	     << " moving old name to alt attr "
 	     << string(buf, r)
 	     << ", new name is " << full_name << dendl;
+    // the old name now resolves through the alt attr only
+    ghobject_t old_oid;
+    if (lfn_parse_object_name(string(buf, r), &old_oid))
+      lfn_cache_erase(old_oid);
+    else
+      lfn_cache_clear();
     r = chain_setxattr(full_path.c_str(), get_alt_lfn_attr().c_str(),
 		       buf, r);
     if (r < 0)
@@ -871,6 +965,7 @@ int LFNIndex::lfn_unlink(const vector<string> &path,
       return -errno;
     return 0;
   }
+  lfn_cache_erase(oid);
   string subdir_path = get_full_path_subdir(path);
   
   
@@ -909,6 +1004,8 @@ int LFNIndex::lfn_unlink(const vector<string> &path,
   } else {
     string& rename_to = full_path;
     string rename_from = get_full_path(path, lfn_get_short_name(oid, i - 1));
+    // the tail of the chain changes name
+    lfn_cache_clear();
     maybe_inject_failure();
     int r = ::rename(rename_from.c_str(), rename_to.c_str());
     maybe_inject_failure();
@@ -17,6 +17,7 @@
 #define OS_LFNINDEX_H
 
 #include <string>
+#include <list>
 #include <map>
 #include <set>
 #include <vector>
@@ -25,10 +26,14 @@
 
 #include "osd/osd_types.h"
 #include "include/object.h"
+#include "include/unordered_map.h"
 #include "common/ceph_crypto.h"
+#include "common/Mutex.h"
 
 #include "CollectionIndex.h"
 
+class PerfCounters;
+
 /** 
  * LFNIndex also encapsulates logic for manipulating
  * subdirectories of of a collection as well as the long filename
@@ -124,6 +129,34 @@ private:
   string lfn_attribute, lfn_alt_attribute;
   coll_t collection;
 
+  /**
+   * Cache of resolved long name lookups
+   *
+   * Resolving a hashed (long) name walks the hash directories and
+   * reads the lfn xattr of each candidate in the collision chain.
+   * Positive results of lookup() are kept here, bounded by
+   * lfn_cache_max entries in LRU order.  An entry is dropped when
+   * its object is created or unlinked, and the whole cache is
+   * dropped whenever objects or directories move around (split,
+   * merge, removal).
+   */
+  struct LFNCacheEntry {
+    vector<string> path;
+    string short_name;
+    int cost;          ///< estimated syscalls a miss takes
+  };
+  typedef list<pair<ghobject_t, LFNCacheEntry> > lfn_lru_t;
+  Mutex lfn_cache_lock;
+  size_t lfn_cache_max;
+  lfn_lru_t lfn_lru;
+  ceph::unordered_map<ghobject_t, lfn_lru_t::iterator> lfn_cache;
+  PerfCounters *logger;
+
+  bool lfn_cache_lookup(const ghobject_t &oid, LFNCacheEntry *out);
+  void lfn_cache_add(const ghobject_t &oid, const vector<string> &path,
+		     const string &short_name);
+  void lfn_cache_erase(const ghobject_t &oid);
+
 public:
   /// Constructor
   LFNIndex(
@@ -138,7 +171,10 @@ public:
       error_injection_on(_error_injection_probability != 0),
       error_injection_probability(_error_injection_probability),
       last_failure(0), current_failure(0),
-      collection(collection) {
+      collection(collection),
+      lfn_cache_lock("LFNIndex::lfn_cache_lock"),
+      lfn_cache_max(0),
+      logger(NULL) {
     if (index_version == HASH_INDEX_TAG) {
       lfn_attribute = LFN_ATTR;
     } else {
@@ -151,6 +187,13 @@ public:
 
   coll_t coll() const { return collection; }
 
+  /// Enable the long name lookup cache, reporting to logger if set
+  void set_lfn_cache(size_t max, PerfCounters *l) {
+    Mutex::Locker locker(lfn_cache_lock);
+    lfn_cache_max = max;
+    logger = l;
+  }
+
   /// Virtual destructor
   virtual ~LFNIndex() {}
 
@@ -259,6 +302,9 @@ protected:
 
   /* Non-virtual utility methods */
 
+  /// Drop all cached lookups; call whenever objects change directory
+  void lfn_cache_clear();
+
   /// Sync a subdirectory
   int fsync_dir(
     const vector<string> &path ///< [in] Path to sync
@@ -404,6 +450,27 @@ protected:
     const string &attr_name	///< [in] attr to remove
     ); ///< @return Error code, 0 on success
 
+  /// Get full path the subdir
+  string get_full_path_subdir(
+    const vector<string> &rel ///< [in] The subdir.
+    ); ///< @return Full path to rel.
+
+  /// Get full path to object
+  string get_full_path(
+    const vector<string> &rel, ///< [in] Path to object.
+    const string &name	       ///< [in] Filename of object.
+    ); ///< @return Fullpath to object at name in rel.
+
+  /// Get mangled path component
+  string mangle_path_component(
+    const string &component ///< [in] Component to mangle
+    ); /// @return Mangled component
+
+  /// Mangle attribute name
+  string mangle_attr_name(
+    const string &attr ///< [in] Attribute to mangle.
+    ); ///< @return Mangled attribute name.
+
 private:
   /* lfn translation functions */
 
@@ -522,22 +589,6 @@ private:
   /// Gets the base path
   const string &get_base_path(); ///< @return Index base_path
 
-  /// Get full path the subdir
-  string get_full_path_subdir(
-    const vector<string> &rel ///< [in] The subdir.
-    ); ///< @return Full path to rel.
-
-  /// Get full path to object
-  string get_full_path(
-    const vector<string> &rel, ///< [in] Path to object.
-    const string &name	       ///< [in] Filename of object.
-    ); ///< @return Fullpath to object at name in rel.
-
-  /// Get mangled path component
-  string mangle_path_component(
-    const string &component ///< [in] Component to mangle
-    ); /// @return Mangled component
-
   /// Demangle component
   string demangle_path_component(
     const string &component ///< [in] Subdir name to demangle
@@ -551,11 +602,6 @@ private:
     string *shortname	 ///< [out] Filename of object at in.
     ); ///< @return Error Code, 0 on success.
 
-  /// Mangle attribute name
-  string mangle_attr_name(
-    const string &attr ///< [in] Attribute to mangle.
-    ); ///< @return Mangled attribute name.
-
   /// Builds hashed filename
   void build_filename(
     const char *old_filename, ///< [in] Filename to convert.
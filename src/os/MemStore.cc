@@ -33,6 +33,9 @@
 #undef dout_prefix
 #define dout_prefix *_dout << "memstore(" << path << ") "
 
+/// MemStores created in this process, to give each its own perf counters
+static std::atomic<unsigned> memstore_instances(0);
+
 // for comparing collections for lock ordering
 bool operator>(const MemStore::CollectionRef& l,
 	       const MemStore::CollectionRef& r)
@@ -41,6 +44,35 @@ bool operator>(const MemStore::CollectionRef& l,
 }
 
 
+MemStore::MemStore(CephContext *cct, const string& path)
+  : ObjectStore(path),
+    cct(cct),
+    coll_lock("MemStore::coll_lock"),
+    apply_lock("MemStore::apply_lock"),
+    next_finisher(0),
+    logger(NULL),
+    used_bytes(0),
+    sharded(false)
+{
+  unsigned id = memstore_instances++;
+  logger_name = id ? "memstore-" + stringify(id) : "memstore";
+
+  int n = MAX(cct->_conf->memstore_finisher_threads, 1);
+  for (int i = 0; i < n; ++i) {
+    ostringstream oss;
+    oss << "memstore-" << i;
+    finishers.push_back(new Finisher(cct, oss.str()));
+  }
+}
+
+MemStore::~MemStore()
+{
+  for (vector<Finisher*>::iterator p = finishers.begin();
+       p != finishers.end();
+       ++p)
+    delete *p;
+}
+
 int MemStore::peek_journal_fsid(uuid_d *fsid)
 {
   *fsid = uuid_d();
@@ -52,13 +84,35 @@ int MemStore::mount()
   int r = _load();
   if (r < 0)
     return r;
-  finisher.start();
+  for (vector<Finisher*>::iterator p = finishers.begin();
+       p != finishers.end();
+       ++p)
+    (*p)->start();
+
+  PerfCountersBuilder plb(cct, logger_name, l_memstore_first,
+			  l_memstore_last);
+  plb.add_u64(l_memstore_arena_slab_bytes, "arena_slab_bytes",
+	      "Memory mapped for page slabs");
+  plb.add_u64(l_memstore_arena_used_bytes, "arena_used_bytes",
+	      "Slab memory holding pages");
+  plb.add_u64(l_memstore_arena_huge_slabs, "arena_huge_slabs",
+	      "Page slabs backed by huge pages");
+  logger = plb.create_perf_counters();
+  cct->get_perfcounters_collection()->add(logger);
   return 0;
 }
 
 int MemStore::umount()
 {
-  finisher.stop();
+  for (vector<Finisher*>::iterator p = finishers.begin();
+       p != finishers.end();
+       ++p)
+    (*p)->stop();
+  if (logger) {
+    cct->get_perfcounters_collection()->remove(logger);
+    delete logger;
+    logger = NULL;
+  }
   return _save();
 }
 
@@ -244,6 +298,17 @@ int MemStore::statfs(struct statfs *st)
   dout(10) << __func__ << ": used_bytes: " << used_bytes << "/" << g_conf->memstore_device_bytes << dendl;
   st->f_bfree = st->f_bavail = MAX((long(st->f_blocks) - long(used_bytes / st->f_bsize)), 0);
 
+  // statfs is polled regularly, so refresh the arena gauges here
+  if (logger) {
+    PageArena::Stats as = PageArena::get_all_stats();
+    dout(10) << __func__ << ": arena used " << as.used_bytes << "/"
+	     << as.slab_bytes << " in " << as.slabs << " slabs ("
+	     << as.huge_slabs << " huge)" << dendl;
+    logger->set(l_memstore_arena_slab_bytes, as.slab_bytes);
+    logger->set(l_memstore_arena_used_bytes, as.used_bytes);
+    logger->set(l_memstore_arena_huge_slabs, as.huge_slabs);
+  }
+
   return 0;
 }
 
@@ -587,16 +652,20 @@ int MemStore::queue_transactions(Sequencer *osr,
   // while allowing operations on different sequencers to happen in parallel
   struct OpSequencer : public Sequencer_impl {
     std::mutex mutex;
+    unsigned finisher;  ///< index of the finisher for our completions
+    OpSequencer(unsigned finisher) : finisher(finisher) {}
     void flush() override {}
     bool flush_commit(Context*) override { return true; }
   };
 
   std::unique_lock<std::mutex> lock;
+  Finisher *finisher = finishers[0];
   if (osr) {
     auto seq = reinterpret_cast<OpSequencer**>(&osr->p);
     if (*seq == nullptr)
-      *seq = new OpSequencer;
+      *seq = new OpSequencer(next_finisher++ % finishers.size());
     lock = std::unique_lock<std::mutex>((*seq)->mutex);
+    finisher = finishers[(*seq)->finisher];
   }
 
   for (list<Transaction*>::iterator p = tls.begin(); p != tls.end(); ++p) {
@@ -613,9 +682,9 @@ int MemStore::queue_transactions(Sequencer *osr,
   if (on_apply_sync)
     on_apply_sync->complete(0);
   if (on_apply)
-    finisher.queue(on_apply);
+    finisher->queue(on_apply);
   if (on_commit)
-    finisher.queue(on_commit);
+    finisher->queue(on_commit);
   return 0;
 }
 
@@ -1023,12 +1092,10 @@ int MemStore::_remove(coll_t cid, const ghobject_t& oid)
     return -ENOENT;
   RWLock::WLocker l(c->lock);
 
-  auto i = c->object_hash.find(oid);
-  if (i == c->object_hash.end())
+  ObjectRef o = c->_erase(oid);
+  if (!o)
     return -ENOENT;
-  c->object_hash.erase(i);
-  c->object_map.erase(oid);
-  used_bytes -= i->second->get_size();
+  used_bytes -= o->get_size();
 
   return 0;
 }
@@ -1278,13 +1345,12 @@ int MemStore::_collection_add(coll_t cid, coll_t ocid, const ghobject_t& oid)
   RWLock::WLocker l1(MIN(&(*c), &(*oc))->lock);
   RWLock::WLocker l2(MAX(&(*c), &(*oc))->lock);
 
-  if (c->object_hash.count(oid))
+  if (c->_lookup(oid))
     return -EEXIST;
-  if (oc->object_hash.count(oid) == 0)
+  ObjectRef o = oc->_lookup(oid);
+  if (!o)
     return -ENOENT;
-  ObjectRef o = oc->object_hash[oid];
-  c->object_map[oid] = o;
-  c->object_hash[oid] = o;
+  c->_insert(oid, o);
   return 0;
 }
 
@@ -1312,17 +1378,14 @@ int MemStore::_collection_move_rename(coll_t oldcid, const ghobject_t& oldoid,
   }
 
   int r = -EEXIST;
-  if (c->object_hash.count(oid))
+  if (c->_lookup(oid))
     goto out;
   r = -ENOENT;
-  if (oc->object_hash.count(oldoid) == 0)
-    goto out;
   {
-    ObjectRef o = oc->object_hash[oldoid];
-    c->object_map[oid] = o;
-    c->object_hash[oid] = o;
-    oc->object_map.erase(oldoid);
-    oc->object_hash.erase(oldoid);
+    ObjectRef o = oc->_erase(oldoid);
+    if (!o)
+      goto out;
+    c->_insert(oid, o);
   }
   r = 0;
  out:
@@ -1350,10 +1413,8 @@ int MemStore::_split_collection(coll_t cid, uint32_t bits, uint32_t match,
   while (p != sc->object_map.end()) {
     if (p->first.match(bits, match)) {
       dout(20) << " moving " << p->first << dendl;
-      dc->object_map.insert(make_pair(p->first, p->second));
-      dc->object_hash.insert(make_pair(p->first, p->second));
-      sc->object_hash.erase(p->first);
-      sc->object_map.erase(p++);
+      ghobject_t oid = (p++)->first;
+      dc->_insert(oid, sc->_erase(oid));
     } else {
       ++p;
     }
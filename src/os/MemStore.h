@@ -16,6 +16,7 @@
 #ifndef CEPH_MEMSTORE_H
 #define CEPH_MEMSTORE_H
 
+#include <atomic>
 #include <mutex>
 #include <boost/intrusive_ptr.hpp>
 
@@ -23,12 +24,21 @@
 #include "include/memory.h"
 #include "include/Spinlock.h"
 #include "common/Finisher.h"
+#include "common/perf_counters.h"
 #include "common/RefCountedObj.h"
 #include "common/RWLock.h"
 #include "ObjectStore.h"
 #include "PageSet.h"
 #include "include/assert.h"
 
+enum {
+  l_memstore_first = 84500,
+  l_memstore_arena_slab_bytes,
+  l_memstore_arena_used_bytes,
+  l_memstore_arena_huge_slabs,
+  l_memstore_last,
+};
+
 class MemStore : public ObjectStore {
 private:
   CephContext *const cct;
@@ -130,7 +140,8 @@ public:
     static thread_local PageSet::page_vector tls_pages;
 #endif
 
-    PageSetObject(size_t page_size) : data(page_size), data_len(0) {}
+    PageSetObject(size_t page_size, PageArena *arena)
+      : data(page_size, arena), data_len(0) {}
 
     size_t get_size() const override { return data_len; }
 
@@ -159,18 +170,40 @@ public:
   struct Collection : public RefCountedObject {
     CephContext *cct;
     bool use_page_set;
-    ceph::unordered_map<ghobject_t, ObjectRef> object_hash;  ///< for lookup
     map<ghobject_t, ObjectRef,ghobject_t::BitwiseComparator> object_map;        ///< for iteration
     map<string,bufferptr> xattr;
-    RWLock lock;   ///< for object_{map,hash}
+    RWLock lock;   ///< for object_map, and membership of the hash shards
+
+    /**
+     * object lookup table, split into shards with their own locks
+     *
+     * Point lookups from concurrent sequencers only take the shard
+     * lock, not the collection lock.  Adding or removing an object
+     * takes the collection lock for write and then the shard lock, so
+     * holding either one is enough to read a shard.
+     */
+    struct HashShard {
+      Spinlock lock;
+      ceph::unordered_map<ghobject_t, ObjectRef> objects;
+    };
+    static const unsigned NUM_HASH_SHARDS = 32;
+    HashShard hash_shards[NUM_HASH_SHARDS];
+
+    HashShard &get_shard(const ghobject_t &oid) {
+      return hash_shards[std::hash<ghobject_t>()(oid) % NUM_HASH_SHARDS];
+    }
 
     typedef boost::intrusive_ptr<Collection> Ref;
     friend void intrusive_ptr_add_ref(Collection *c) { c->get(); }
     friend void intrusive_ptr_release(Collection *c) { c->put(); }
 
     ObjectRef create_object() const {
-      if (use_page_set)
-        return new PageSetObject(cct->_conf->memstore_page_size);
+      if (use_page_set) {
+        size_t page_size = cct->_conf->memstore_page_size;
+        return new PageSetObject(page_size,
+                                 cct->_conf->memstore_page_arena ?
+                                 PageSet::get_arena(page_size) : nullptr);
+      }
       return new BufferlistObject();
     }
 
@@ -180,19 +213,54 @@ public:
     // level.
 
     ObjectRef get_object(ghobject_t oid) {
-      RWLock::RLocker l(lock);
-      auto o = object_hash.find(oid);
-      if (o == object_hash.end())
+      HashShard &s = get_shard(oid);
+      Spinlock::Locker l(s.lock);
+      auto o = s.objects.find(oid);
+      if (o == s.objects.end())
 	return ObjectRef();
       return o->second;
     }
 
     ObjectRef get_or_create_object(ghobject_t oid) {
+      ObjectRef o = get_object(oid);
+      if (o)
+	return o;
       RWLock::WLocker l(lock);
-      auto result = object_hash.emplace(oid, ObjectRef());
-      if (result.second)
-        object_map[oid] = result.first->second = create_object();
-      return result.first->second;
+      o = _lookup(oid);
+      if (!o) {
+	o = create_object();
+	_insert(oid, o);
+      }
+      return o;
+    }
+
+    // the following require lock held; _insert and _erase for write
+    ObjectRef _lookup(const ghobject_t &oid) {
+      HashShard &s = get_shard(oid);
+      auto o = s.objects.find(oid);
+      if (o == s.objects.end())
+	return ObjectRef();
+      return o->second;
+    }
+    void _insert(const ghobject_t &oid, ObjectRef o) {
+      object_map[oid] = o;
+      HashShard &s = get_shard(oid);
+      Spinlock::Locker l(s.lock);
+      s.objects[oid] = o;
+    }
+    ObjectRef _erase(const ghobject_t &oid) {
+      HashShard &s = get_shard(oid);
+      ObjectRef o;
+      {
+	Spinlock::Locker l(s.lock);
+	auto p = s.objects.find(oid);
+	if (p == s.objects.end())
+	  return o;
+	o.swap(p->second);
+	s.objects.erase(p);
+      }
+      object_map.erase(oid);
+      return o;
     }
 
     void encode(bufferlist& bl) const {
@@ -220,8 +288,7 @@ public:
 	::decode(k, p);
 	auto o = create_object();
 	o->decode(p);
-	object_map.insert(make_pair(k, o));
-	object_hash.insert(make_pair(k, o));
+	_insert(k, o);
       }
       DECODE_FINISH(p);
     }
@@ -296,9 +363,13 @@ private:
 
   CollectionRef get_collection(coll_t cid);
 
-  Finisher finisher;
+  /// completions for a sequencer always go to the same finisher
+  vector<Finisher*> finishers;
+  std::atomic<unsigned> next_finisher;
+  PerfCounters *logger;
+  string logger_name;   ///< "memstore", numbered if there are several
 
-  uint64_t used_bytes;
+  std::atomic<uint64_t> used_bytes;  ///< updated by concurrent sequencers
 
   void _do_transaction(Transaction& t);
 
@@ -338,15 +409,8 @@ private:
   void dump_all();
 
 public:
-  MemStore(CephContext *cct, const string& path)
-    : ObjectStore(path),
-      cct(cct),
-      coll_lock("MemStore::coll_lock"),
-      apply_lock("MemStore::apply_lock"),
-      finisher(cct),
-      used_bytes(0),
-      sharded(false) {}
-  ~MemStore() { }
+  MemStore(CephContext *cct, const string& path);
+  ~MemStore();
 
   int peek_journal_fsid(uuid_d *fsid);
 
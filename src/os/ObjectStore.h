@@ -57,6 +57,7 @@ enum {
   l_os_j_wr,
   l_os_j_wr_bytes,
   l_os_j_full,
+  l_os_j_group_wait,
   l_os_committing,
   l_os_commit,
   l_os_commit_len,
@@ -69,6 +70,15 @@ enum {
   l_os_bytes,
   l_os_apply_lat,
   l_os_queue_lat,
+  l_os_readahead_bytes,
+  l_os_readahead_hit_bytes,
+  l_os_readahead_waste_bytes,
+  l_os_kv_batch_ops,
+  l_os_kv_write_bytes,
+  l_os_kv_coalesced_bytes,
+  l_os_lfn_cache_hit,
+  l_os_lfn_cache_miss,
+  l_os_lfn_cache_saved,
   l_os_last,
 };
 
@@ -389,6 +399,7 @@ public:
     // Transaction hint type
     enum {
       COLL_HINT_EXPECTED_NUM_OBJECTS = 1,
+      COLL_HINT_COMPRESSION = 2,  // string algorithm; empty for default
     };
 
     struct Op {
@@ -646,7 +657,9 @@ public:
       if (other.data.largest_data_len > data.largest_data_len) {
 	data.largest_data_len = other.data.largest_data_len;
 	data.largest_data_off = other.data.largest_data_off;
-	data.largest_data_off_in_tbl = tbl.length() + other.data.largest_data_off_in_tbl;
+	data.largest_data_off_in_tbl =
+	  (use_tbl ? tbl.length() : data_bl.length()) +
+	  other.data.largest_data_off_in_tbl;
       }
       data.fadvise_flags |= other.data.fadvise_flags;
       tbl.append(other.tbl);
@@ -671,21 +684,34 @@ public:
         om[object_index_p->second] = _get_object_id(object_index_p->first);
       }      
 
-      //the other.op_bl SHOULD NOT be changes during append operation,
-      //we use additional bufferlist to avoid this problem
-      bufferptr other_op_bl_ptr(other.op_bl.length());
-      other.op_bl.copy(0, other.op_bl.length(), other_op_bl_ptr.c_str());
-      bufferlist other_op_bl;
-      other_op_bl.append(other_op_bl_ptr);
-
-      //update other_op_bl with cm & om
-      //When the other is appended to current transaction, all coll_index and
-      //object_index in other.op_buffer should be updated by new index of the
-      //combined transaction
-      _update_op_bl(other_op_bl, cm, om);
-
-      //append op_bl
-      op_bl.append(other_op_bl);
+      //if every index of other maps to itself (e.g. we were empty, or
+      //both sides touched the same colls and objects in the same order)
+      //the ops can be shared as-is
+      bool identity = true;
+      for (unsigned i = 0; identity && i < cm.size(); ++i)
+        identity = (cm[i] == i);
+      for (unsigned i = 0; identity && i < om.size(); ++i)
+        identity = (om[i] == i);
+
+      if (identity) {
+        op_bl.append(other.op_bl);
+      } else {
+        //the other.op_bl SHOULD NOT be changes during append operation,
+        //we use additional bufferlist to avoid this problem
+        bufferptr other_op_bl_ptr(other.op_bl.length());
+        other.op_bl.copy(0, other.op_bl.length(), other_op_bl_ptr.c_str());
+        bufferlist other_op_bl;
+        other_op_bl.append(other_op_bl_ptr);
+
+        //update other_op_bl with cm & om
+        //When the other is appended to current transaction, all coll_index and
+        //object_index in other.op_buffer should be updated by new index of the
+        //combined transaction
+        _update_op_bl(other_op_bl, cm, om);
+
+        //append op_bl
+        op_bl.append(other_op_bl);
+      }
       //append data_bl
       data_bl.append(other.data_bl);
     }
@@ -730,8 +756,7 @@ public:
             sizeof(uint32_t) +  // largest_data_len
             sizeof(uint32_t) +  // largest_data_off
             sizeof(uint32_t) +  // largest_data_off_in_tbl
-	    sizeof(uint32_t) +   //fadvise_flags
-            sizeof(__u32);      // tbl length
+            sizeof(__u32);      // tbl length (fadvise_flags come after tbl)
         } else {
           return data.largest_data_off_in_tbl +
             sizeof(__u8) +      // encode struct_v
@@ -777,7 +802,9 @@ public:
       Transaction *t;
 
       uint64_t ops;
-      char* op_buffer_p;
+      std::list<bufferptr>::const_iterator op_buffer_p;
+      unsigned op_buffer_off;
+      Op op_tmp;   ///< an op that straddles two segments of op_bl
 
       bufferlist::iterator data_bl_p;
 
@@ -793,7 +820,8 @@ public:
           objects(t->object_index.size()) {
 
         ops = t->data.ops;
-        op_buffer_p = t->op_bl.get_contiguous(0, t->data.ops * sizeof(Op));
+        op_buffer_p = t->op_bl.buffers().begin();
+        op_buffer_off = 0;
 
         map<coll_t, __le32>::iterator coll_index_p;
         for (coll_index_p = t->coll_index.begin();
@@ -820,8 +848,35 @@ public:
       Op* decode_op() {
         assert(ops > 0);
 
-        Op* op = reinterpret_cast<Op*>(op_buffer_p);
-        op_buffer_p += sizeof(Op);
+        // walk op_bl in place rather than flattening it; a decoded
+        // op_bl may be split across message segments, in which case
+        // only the op on the boundary is copied out
+        while (op_buffer_off == op_buffer_p->length()) {
+          ++op_buffer_p;
+          op_buffer_off = 0;
+        }
+        Op* op;
+        if (op_buffer_p->length() - op_buffer_off >= sizeof(Op)) {
+          op = reinterpret_cast<Op*>(
+            const_cast<char*>(op_buffer_p->c_str()) + op_buffer_off);
+          op_buffer_off += sizeof(Op);
+        } else {
+          char *dst = reinterpret_cast<char*>(&op_tmp);
+          unsigned left = sizeof(Op);
+          while (left > 0) {
+            if (op_buffer_off == op_buffer_p->length()) {
+              ++op_buffer_p;
+              op_buffer_off = 0;
+              continue;
+            }
+            unsigned n = MIN(left, op_buffer_p->length() - op_buffer_off);
+            memcpy(dst, op_buffer_p->c_str() + op_buffer_off, n);
+            dst += n;
+            op_buffer_off += n;
+            left -= n;
+          }
+          op = &op_tmp;
+        }
         ops--;
 
         return op;
@@ -885,12 +940,13 @@ private:
       if (op_ptr.length() == 0 || op_ptr.offset() >= op_ptr.length()) {
         op_ptr = bufferptr(sizeof(Op) * OPS_PER_PTR);
       }
-      bufferptr ptr(op_ptr, 0, sizeof(Op));
-      op_bl.append(ptr);
+      // consecutive ops from the same chunk extend the tail bufferptr,
+      // so op_bl stays one segment per OPS_PER_PTR ops
+      char* p = op_ptr.c_str();
+      op_bl.append(op_ptr, 0, sizeof(Op));
 
       op_ptr.set_offset(op_ptr.offset() + sizeof(Op));
 
-      char* p = ptr.c_str();
       memset(p, 0, sizeof(Op));
       return reinterpret_cast<Op*>(p);
     }
@@ -975,7 +1031,6 @@ public:
         ::encode(oid, tbl);
         ::encode(off, tbl);
         ::encode(len, tbl);
-        ::encode(write_data, tbl);
       } else {
         Op* _op = _get_next_op();
         _op->op = OP_WRITE;
@@ -983,15 +1038,22 @@ public:
         _op->oid = _get_object_id(oid);
         _op->off = off;
         _op->len = len;
-        ::encode(write_data, data_bl);
       }
       assert(len == write_data.length());
       data.fadvise_flags = data.fadvise_flags | flags;
       if (write_data.length() > data.largest_data_len) {
 	data.largest_data_len = write_data.length();
 	data.largest_data_off = off;
-	data.largest_data_off_in_tbl = tbl.length() + sizeof(__u32);  // we are about to
+	if (use_tbl)
+	  data.largest_data_off_in_tbl = tbl.length();
+	else
+	  data.largest_data_off_in_tbl = sizeof(__u32) + data_bl.length(); // data_bl length prefix
+	data.largest_data_off_in_tbl += sizeof(__u32);  // we are about to encode write_data's length
       }
+      if (use_tbl)
+        ::encode(write_data, tbl);
+      else
+        ::encode(write_data, data_bl);
       data.ops++;
     }
     /**
@@ -0,0 +1,249 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2015 Red Hat
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.	See file COPYING.
+ *
+ */
+
+#ifndef CEPH_PAGEARENA_H
+#define CEPH_PAGEARENA_H
+
+#include <sys/mman.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "include/Spinlock.h"
+
+/**
+ * Slab allocator for fixed-size pages
+ *
+ * Each chunk is a data block plus a small header (the PageSet Page
+ * struct).  Chunks are carved out of large anonymous mmap slabs: data
+ * blocks are packed at the front of the slab so they stay page_size
+ * aligned, and headers are packed at the back.  Slabs are backed by
+ * 2MB huge pages when the kernel has some reserved (MAP_HUGETLB), and
+ * are otherwise hinted for transparent huge pages.
+ *
+ * Freed chunks go to a small per-thread cache first and spill to a
+ * shared free list, so steady state alloc/free does not touch malloc
+ * and usually takes no lock.  Slabs are never returned to the kernel.
+ */
+class PageArena {
+ public:
+  struct Chunk {
+    char *data;
+    void *hdr;
+  };
+
+  struct Stats {
+    uint64_t slabs;
+    uint64_t huge_slabs;
+    uint64_t slab_bytes;  ///< mapped
+    uint64_t used_bytes;  ///< handed out, data + header
+    Stats() : slabs(0), huge_slabs(0), slab_bytes(0), used_bytes(0) {}
+    void add(const Stats &o) {
+      slabs += o.slabs;
+      huge_slabs += o.huge_slabs;
+      slab_bytes += o.slab_bytes;
+      used_bytes += o.used_bytes;
+    }
+  };
+
+ private:
+  static const size_t HUGE_PAGE_SIZE = 2 << 20;
+  static const size_t MIN_CHUNKS_PER_SLAB = 64;
+  static const size_t THREAD_CACHE_MAX = 64;
+
+  const size_t data_size;
+  const size_t hdr_size;
+  const size_t slab_size;
+  const size_t chunks_per_slab;
+
+  Spinlock lock;                 ///< protects free_list
+  std::vector<Chunk> free_list;
+
+  std::atomic<uint64_t> nr_used;
+  std::atomic<uint64_t> nr_slabs;
+  std::atomic<uint64_t> nr_huge_slabs;
+
+  static size_t round_up(size_t v, size_t to) {
+    return (v + to - 1) / to * to;
+  }
+
+  // a few arenas per thread is plenty; the rest use the shared list
+  struct ThreadCache {
+    static const int SLOTS = 4;
+    PageArena *arena[SLOTS];
+    std::vector<Chunk> chunks[SLOTS];
+    ThreadCache() {
+      for (int i = 0; i < SLOTS; ++i)
+	arena[i] = nullptr;
+    }
+    ~ThreadCache() {
+      for (int i = 0; i < SLOTS; ++i)
+	if (arena[i])
+	  arena[i]->spill(chunks[i], chunks[i].size());
+    }
+    std::vector<Chunk> *get(PageArena *a) {
+      for (int i = 0; i < SLOTS; ++i) {
+	if (arena[i] == a)
+	  return &chunks[i];
+	if (!arena[i]) {
+	  arena[i] = a;
+	  return &chunks[i];
+	}
+      }
+      return nullptr;
+    }
+  };
+  static std::vector<Chunk> *thread_cache(PageArena *a) {
+    static thread_local ThreadCache tc;
+    return tc.get(a);
+  }
+
+  struct Registry {
+    std::mutex lock;
+    std::map<std::pair<size_t,size_t>, PageArena*> arenas;
+  };
+  static Registry &registry() {
+    // arenas live for the life of the process
+    static Registry *r = new Registry;
+    return *r;
+  }
+
+  // move the last n chunks of a thread cache to the shared list
+  void spill(std::vector<Chunk> &cache, size_t n) {
+    std::lock_guard<Spinlock> l(lock);
+    free_list.insert(free_list.end(), cache.end() - n, cache.end());
+    cache.resize(cache.size() - n);
+  }
+
+  void add_slab() {
+    void *p = MAP_FAILED;
+    bool huge = false;
+#ifdef MAP_HUGETLB
+    p = ::mmap(NULL, slab_size, PROT_READ | PROT_WRITE,
+	       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    huge = (p != MAP_FAILED);
+#endif
+    if (p == MAP_FAILED) {
+      p = ::mmap(NULL, slab_size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p == MAP_FAILED)
+	throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+      ::madvise(p, slab_size, MADV_HUGEPAGE);
+#endif
+    }
+    ++nr_slabs;
+    if (huge)
+      ++nr_huge_slabs;
+
+    char *data = static_cast<char*>(p);
+    char *hdr = data + chunks_per_slab * data_size;
+    std::lock_guard<Spinlock> l(lock);
+    free_list.reserve(free_list.size() + chunks_per_slab);
+    // push in reverse so chunks are handed out in address order
+    for (size_t i = chunks_per_slab; i > 0; --i) {
+      Chunk c = { data + (i - 1) * data_size, hdr + (i - 1) * hdr_size };
+      free_list.push_back(c);
+    }
+  }
+
+ public:
+  PageArena(size_t data_size, size_t hdr_size)
+    : data_size(round_up(data_size, sizeof(void*))),
+      hdr_size(round_up(hdr_size, sizeof(void*))),
+      slab_size(round_up(MIN_CHUNKS_PER_SLAB * (this->data_size +
+						this->hdr_size),
+			 HUGE_PAGE_SIZE)),
+      chunks_per_slab(slab_size / (this->data_size + this->hdr_size)),
+      nr_used(0), nr_slabs(0), nr_huge_slabs(0) {}
+
+  // disable copy
+  PageArena(const PageArena&) = delete;
+  const PageArena& operator=(const PageArena&) = delete;
+
+  /// shared arena for the given chunk geometry
+  static PageArena *get(size_t data_size, size_t hdr_size) {
+    Registry &r = registry();
+    std::lock_guard<std::mutex> l(r.lock);
+    PageArena *&a = r.arenas[std::make_pair(data_size, hdr_size)];
+    if (!a)
+      a = new PageArena(data_size, hdr_size);
+    return a;
+  }
+
+  /// sum of stats over all arenas
+  static Stats get_all_stats() {
+    Registry &r = registry();
+    std::lock_guard<std::mutex> l(r.lock);
+    Stats s;
+    for (auto p = r.arenas.begin(); p != r.arenas.end(); ++p)
+      s.add(p->second->get_stats());
+    return s;
+  }
+
+  Chunk alloc() {
+    ++nr_used;
+    std::vector<Chunk> *cache = thread_cache(this);
+    if (cache && !cache->empty()) {
+      Chunk c = cache->back();
+      cache->pop_back();
+      return c;
+    }
+    while (true) {
+      {
+	std::lock_guard<Spinlock> l(lock);
+	if (!free_list.empty()) {
+	  Chunk c = free_list.back();
+	  free_list.pop_back();
+	  // refill the thread cache while we hold the lock
+	  if (cache) {
+	    size_t n = std::min(free_list.size(), THREAD_CACHE_MAX / 2);
+	    cache->insert(cache->end(), free_list.end() - n, free_list.end());
+	    free_list.resize(free_list.size() - n);
+	  }
+	  return c;
+	}
+      }
+      add_slab();
+    }
+  }
+
+  void free(const Chunk &c) {
+    --nr_used;
+    std::vector<Chunk> *cache = thread_cache(this);
+    if (cache) {
+      cache->push_back(c);
+      if (cache->size() >= THREAD_CACHE_MAX)
+	spill(*cache, THREAD_CACHE_MAX / 2);
+      return;
+    }
+    std::lock_guard<Spinlock> l(lock);
+    free_list.push_back(c);
+  }
+
+  Stats get_stats() const {
+    Stats s;
+    s.slabs = nr_slabs;
+    s.huge_slabs = nr_huge_slabs;
+    s.slab_bytes = s.slabs * slab_size;
+    s.used_bytes = nr_used * (data_size + hdr_size);
+    return s;
+  }
+};
+
+#endif // CEPH_PAGEARENA_H
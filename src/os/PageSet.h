@@ -25,12 +25,14 @@
 
 #include "include/encoding.h"
 #include "include/Spinlock.h"
+#include "PageArena.h"
 
 
 struct Page {
   char *const data;
   boost::intrusive::avl_set_member_hook<> hook;
   uint64_t offset;
+  PageArena *const arena;  ///< NULL if allocated with new[]
 
   // avoid RefCountedObject because it has a virtual destructor
   std::atomic<uint16_t> nrefs;
@@ -62,11 +64,16 @@ struct Page {
     ::decode(offset, p);
   }
 
-  static Ref create(size_t page_size, uint64_t offset = 0) {
+  static Ref create(size_t page_size, uint64_t offset = 0,
+		    PageArena *arena = nullptr) {
+    if (arena) {
+      PageArena::Chunk c = arena->alloc();
+      return new (c.hdr) Page(c.data, offset, arena);
+    }
     // allocate the Page and its data in a single buffer
     auto buffer = new char[page_size + sizeof(Page)];
     // place the Page structure at the end of the buffer
-    return new (buffer + page_size) Page(buffer, offset);
+    return new (buffer + page_size) Page(buffer, offset, nullptr);
   }
 
   // copy disabled
@@ -74,10 +81,17 @@ struct Page {
   const Page& operator=(const Page&) = delete;
 
  private: // private constructor, use create() instead
-  Page(char *data, uint64_t offset) : data(data), offset(offset), nrefs(1) {}
+  Page(char *data, uint64_t offset, PageArena *arena)
+    : data(data), offset(offset), arena(arena), nrefs(1) {}
 
   static void operator delete(void *p) {
-    delete[] reinterpret_cast<Page*>(p)->data;
+    Page *page = reinterpret_cast<Page*>(p);
+    if (page->arena) {
+      PageArena::Chunk c = { page->data, p };
+      page->arena->free(c);
+    } else {
+      delete[] page->data;
+    }
   }
 };
 
@@ -99,6 +113,7 @@ class PageSet {
 
   page_set pages;
   uint64_t page_size;
+  PageArena *arena;
 
   typedef Spinlock lock_type;
   lock_type mutex;
@@ -126,9 +141,11 @@ class PageSet {
   }
 
  public:
-  PageSet(size_t page_size) : page_size(page_size) {}
+  PageSet(size_t page_size, PageArena *arena = nullptr)
+    : page_size(page_size), arena(arena) {}
   PageSet(PageSet &&rhs)
-    : pages(std::move(rhs.pages)), page_size(rhs.page_size) {}
+    : pages(std::move(rhs.pages)), page_size(rhs.page_size),
+      arena(rhs.arena) {}
   ~PageSet() {
     free_pages(pages.begin(), pages.end());
   }
@@ -141,6 +158,11 @@ class PageSet {
   size_t size() const { return pages.size(); }
   size_t get_page_size() const { return page_size; }
 
+  /// shared slab arena for pages of the given size
+  static PageArena *get_arena(size_t page_size) {
+    return PageArena::get(page_size, sizeof(Page));
+  }
+
   // allocate all pages that intersect the range [offset,length)
   void alloc_range(uint64_t offset, uint64_t length, page_vector &range) {
     // loop in reverse so we can provide hints to avl_set::insert_check()
@@ -158,7 +180,7 @@ class PageSet {
       typename page_set::insert_commit_data commit;
       auto insert = pages.insert_check(cur, page_offset, page_cmp(), commit);
       if (insert.second) {
-        auto page = Page::create(page_size, page_offset);
+        auto page = Page::create(page_size, page_offset, arena);
         cur = pages.insert_commit(*page, commit);
 
         // assume that the caller will write to the range [offset,length),
@@ -217,7 +239,7 @@ class PageSet {
     ::decode(count, p);
     auto cur = pages.end();
     for (unsigned i = 0; i < count; i++) {
-      auto page = Page::create(page_size);
+      auto page = Page::create(page_size, 0, arena);
       page->decode(p, page_size);
       cur = pages.insert_before(cur, *page);
     }
@@ -718,6 +718,10 @@ void ObjectStore::Transaction::dump(ceph::Formatter *f)
           ::decode(num_objs, hiter);
           f->dump_unsigned("pg_num", pg_num);
           f->dump_unsigned("expected_num_objects", num_objs);
+        } else if (type == Transaction::COLL_HINT_COMPRESSION) {
+          string alg;
+          ::decode(alg, hiter);
+          f->dump_string("compression", alg);
         }
       }
       break;
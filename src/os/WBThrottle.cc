@@ -3,11 +3,16 @@
 
 #include "acconfig.h"
 
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/stat.h>
+
 #include "os/WBThrottle.h"
 #include "common/perf_counters.h"
 
 WBThrottle::WBThrottle(CephContext *cct) :
   cur_ios(0), cur_size(0),
+  drain_bytes_sec(0), drain_ios_sec(0),
   cct(cct),
   logger(NULL),
   stopping(true),
@@ -28,10 +33,20 @@ WBThrottle::WBThrottle(CephContext *cct) :
   b.add_u64(l_wbthrottle_ios_wb, "ios_wb", "Written operations");
   b.add_u64(l_wbthrottle_inodes_dirtied, "inodes_dirtied", "Entries waiting for write");
   b.add_u64(l_wbthrottle_inodes_wb, "inodes_wb", "Written entries");
+  b.add_time_avg(l_wbthrottle_flush_lat, "flush_latency", "Latency of a writeback batch");
+  b.add_u64(l_wbthrottle_drain_bytes_sec, "drain_bytes_sec", "Measured writeback rate");
+  b.add_u64(l_wbthrottle_bytes_start, "bytes_start_flusher", "Current dirty data flusher start limit");
+  b.add_u64(l_wbthrottle_bytes_hard, "bytes_hard_limit", "Current dirty data hard limit");
   logger = b.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
-  for (unsigned i = l_wbthrottle_first + 1; i != l_wbthrottle_last; ++i)
-    logger->set(i, 0);
+  for (unsigned i = l_wbthrottle_first + 1; i != l_wbthrottle_last; ++i) {
+    if (i != l_wbthrottle_flush_lat)
+      logger->set(i, 0);
+  }
+  {
+    Mutex::Locker l(lock);
+    set_adaptive_limits();
+  }
 
   cct->_conf->add_observer(this);
 }
@@ -78,6 +93,8 @@ const char** WBThrottle::get_tracked_conf_keys() const
     "filestore_wbthrottle_xfs_ios_hard_limit",
     "filestore_wbthrottle_xfs_inodes_start_flusher",
     "filestore_wbthrottle_xfs_inodes_hard_limit",
+    "filestore_wbthrottle_adaptive",
+    "filestore_wbthrottle_adaptive_target",
     NULL
   };
   return KEYS;
@@ -87,26 +104,26 @@ void WBThrottle::set_from_conf()
 {
   assert(lock.is_locked());
   if (fs == BTRFS) {
-    size_limits.first =
+    conf_size_limits.first =
       cct->_conf->filestore_wbthrottle_btrfs_bytes_start_flusher;
-    size_limits.second =
+    conf_size_limits.second =
       cct->_conf->filestore_wbthrottle_btrfs_bytes_hard_limit;
-    io_limits.first =
+    conf_io_limits.first =
       cct->_conf->filestore_wbthrottle_btrfs_ios_start_flusher;
-    io_limits.second =
+    conf_io_limits.second =
       cct->_conf->filestore_wbthrottle_btrfs_ios_hard_limit;
     fd_limits.first =
       cct->_conf->filestore_wbthrottle_btrfs_inodes_start_flusher;
     fd_limits.second =
       cct->_conf->filestore_wbthrottle_btrfs_inodes_hard_limit;
   } else if (fs == XFS) {
-    size_limits.first =
+    conf_size_limits.first =
       cct->_conf->filestore_wbthrottle_xfs_bytes_start_flusher;
-    size_limits.second =
+    conf_size_limits.second =
       cct->_conf->filestore_wbthrottle_xfs_bytes_hard_limit;
-    io_limits.first =
+    conf_io_limits.first =
       cct->_conf->filestore_wbthrottle_xfs_ios_start_flusher;
-    io_limits.second =
+    conf_io_limits.second =
       cct->_conf->filestore_wbthrottle_xfs_ios_hard_limit;
     fd_limits.first =
       cct->_conf->filestore_wbthrottle_xfs_inodes_start_flusher;
@@ -115,9 +132,61 @@ void WBThrottle::set_from_conf()
   } else {
     assert(0 == "invalid value for fs");
   }
+  set_adaptive_limits();
   cond.Signal();
 }
 
+// hard limit worth want, clamped to [conf.first, conf.second], with the
+// start limit scaled along
+static void adapt_limits(pair<uint64_t, uint64_t> *out,
+			 const pair<uint64_t, uint64_t> &conf,
+			 double want)
+{
+  uint64_t hard = std::min(std::max((uint64_t)want, conf.first), conf.second);
+  out->second = hard;
+  out->first = conf.second ?
+    std::max<uint64_t>(1, (double)hard * conf.first / conf.second) :
+    conf.first;
+}
+
+void WBThrottle::set_adaptive_limits()
+{
+  assert(lock.is_locked());
+  size_limits = conf_size_limits;
+  io_limits = conf_io_limits;
+  if (cct->_conf->filestore_wbthrottle_adaptive && drain_bytes_sec > 0) {
+    double target = cct->_conf->filestore_wbthrottle_adaptive_target;
+    adapt_limits(&size_limits, conf_size_limits, drain_bytes_sec * target);
+    adapt_limits(&io_limits, conf_io_limits, drain_ios_sec * target);
+  }
+  if (logger) {
+    logger->set(l_wbthrottle_bytes_start, size_limits.first);
+    logger->set(l_wbthrottle_bytes_hard, size_limits.second);
+  }
+}
+
+void WBThrottle::update_drain_rate(uint64_t bytes, uint64_t ios, double secs)
+{
+  assert(lock.is_locked());
+  if (secs <= 0)
+    return;
+  const double alpha = .25;
+  double b = bytes / secs, i = ios / secs;
+  if (drain_bytes_sec <= 0) {
+    drain_bytes_sec = b;
+    drain_ios_sec = i;
+  } else {
+    drain_bytes_sec = (1 - alpha) * drain_bytes_sec + alpha * b;
+    drain_ios_sec = (1 - alpha) * drain_ios_sec + alpha * i;
+  }
+  logger->set(l_wbthrottle_drain_bytes_sec, drain_bytes_sec);
+  if (cct->_conf->filestore_wbthrottle_adaptive) {
+    set_adaptive_limits();
+    // a lower limit may mean more to flush, a higher one less to wait for
+    cond.Signal();
+  }
+}
+
 void WBThrottle::handle_conf_change(const md_config_t *conf,
 				    const std::set<std::string> &changed)
 {
@@ -130,8 +199,7 @@ void WBThrottle::handle_conf_change(const md_config_t *conf,
   }
 }
 
-bool WBThrottle::get_next_should_flush(
-  boost::tuple<ghobject_t, FDRef, PendingWB> *next)
+bool WBThrottle::get_next_should_flush(vector<wb_t> *next)
 {
   assert(lock.is_locked());
   assert(next);
@@ -140,46 +208,93 @@ bool WBThrottle::get_next_should_flush(
   if (stopping)
     return false;
   assert(!pending_wbs.empty());
-  ghobject_t obj(pop_object());
-  
-  ceph::unordered_map<ghobject_t, pair<PendingWB, FDRef> >::iterator i =
-    pending_wbs.find(obj);
-  *next = boost::make_tuple(obj, i->second.second, i->second.first);
-  pending_wbs.erase(i);
+  unsigned max = std::max(cct->_conf->filestore_wbthrottle_flush_batch, 1);
+  while (next->size() < max && !lru.empty() && beyond_limit()) {
+    ghobject_t obj(pop_object());
+    ceph::unordered_map<ghobject_t, pair<PendingWB, FDRef> >::iterator i =
+      pending_wbs.find(obj);
+    const PendingWB &wb = i->second.first;
+    cur_ios -= wb.ios;
+    logger->dec(l_wbthrottle_ios_dirtied, wb.ios);
+    logger->inc(l_wbthrottle_ios_wb, wb.ios);
+    cur_size -= wb.size;
+    logger->dec(l_wbthrottle_bytes_dirtied, wb.size);
+    logger->inc(l_wbthrottle_bytes_wb, wb.size);
+    logger->dec(l_wbthrottle_inodes_dirtied);
+    logger->inc(l_wbthrottle_inodes_wb);
+    next->push_back(boost::make_tuple(obj, i->second.second, wb));
+    clearing.insert(obj);
+    pending_wbs.erase(i);
+  }
   return true;
 }
 
-
-void *WBThrottle::entry()
+void WBThrottle::flush_batch(vector<wb_t> &batch)
 {
-  Mutex::Locker l(lock);
-  boost::tuple<ghobject_t, FDRef, PendingWB> wb;
-  while (get_next_should_flush(&wb)) {
-    clearing = wb.get<0>();
-    cur_ios -= wb.get<2>().ios;
-    logger->dec(l_wbthrottle_ios_dirtied, wb.get<2>().ios);
-    logger->inc(l_wbthrottle_ios_wb, wb.get<2>().ios);
-    cur_size -= wb.get<2>().size;
-    logger->dec(l_wbthrottle_bytes_dirtied, wb.get<2>().size);
-    logger->inc(l_wbthrottle_bytes_wb, wb.get<2>().size);
-    logger->dec(l_wbthrottle_inodes_dirtied);
-    logger->inc(l_wbthrottle_inodes_wb);
-    lock.Unlock();
-#ifdef HAVE_FDATASYNC
-    ::fdatasync(**wb.get<1>());
+  // inode order roughly follows allocation order, so the device sees
+  // the batch as one mostly sequential sweep
+  vector<pair<ino_t, int> > order;
+  order.reserve(batch.size());
+  for (unsigned i = 0; i < batch.size(); ++i) {
+    struct stat st;
+    if (::fstat(**batch[i].get<1>(), &st) < 0)
+      st.st_ino = 0;
+    order.push_back(make_pair(st.st_ino, **batch[i].get<1>()));
+  }
+  std::sort(order.begin(), order.end());
+
+#ifdef HAVE_SYNC_FILE_RANGE
+  // only the dirty page count matters here, durability comes from the
+  // sync thread; start writeback on everything before waiting on any
+  for (unsigned i = 0; i < order.size(); ++i)
+    ::sync_file_range(order[i].second, 0, 0, SYNC_FILE_RANGE_WRITE);
+  for (unsigned i = 0; i < order.size(); ++i)
+    ::sync_file_range(order[i].second, 0, 0,
+		      SYNC_FILE_RANGE_WAIT_BEFORE |
+		      SYNC_FILE_RANGE_WRITE |
+		      SYNC_FILE_RANGE_WAIT_AFTER);
 #else
-    ::fsync(**wb.get<1>());
+  for (unsigned i = 0; i < order.size(); ++i) {
+# ifdef HAVE_FDATASYNC
+    ::fdatasync(order[i].second);
+# else
+    ::fsync(order[i].second);
+# endif
+  }
 #endif
+
 #ifdef HAVE_POSIX_FADVISE
-    if (g_conf->filestore_fadvise && wb.get<2>().nocache) {
-      int fa_r = posix_fadvise(**wb.get<1>(), 0, 0, POSIX_FADV_DONTNEED);
+  if (g_conf->filestore_fadvise) {
+    for (unsigned i = 0; i < batch.size(); ++i) {
+      if (!batch[i].get<2>().nocache)
+	continue;
+      int fa_r = posix_fadvise(**batch[i].get<1>(), 0, 0, POSIX_FADV_DONTNEED);
       assert(fa_r == 0);
     }
+  }
 #endif
+}
+
+void *WBThrottle::entry()
+{
+  Mutex::Locker l(lock);
+  vector<wb_t> batch;
+  while (get_next_should_flush(&batch)) {
+    uint64_t bytes = 0, ios = 0;
+    for (unsigned i = 0; i < batch.size(); ++i) {
+      bytes += batch[i].get<2>().size;
+      ios += batch[i].get<2>().ios;
+    }
+    lock.Unlock();
+    utime_t start = ceph_clock_now(cct);
+    flush_batch(batch);
+    utime_t lat = ceph_clock_now(cct) - start;
     lock.Lock();
-    clearing = ghobject_t();
+    logger->tinc(l_wbthrottle_flush_lat, lat);
+    update_drain_rate(bytes, ios, (double)lat);
+    clearing.clear();
     cond.Signal();
-    wb = boost::tuple<ghobject_t, FDRef, PendingWB>();
+    batch.clear();
   }
   return 0;
 }
@@ -241,7 +356,7 @@ void WBThrottle::clear()
 void WBThrottle::clear_object(const ghobject_t &hoid)
 {
   Mutex::Locker l(lock);
-  while (clearing == hoid)
+  while (clearing.count(hoid))
     cond.Wait(lock);
   ceph::unordered_map<ghobject_t, pair<PendingWB, FDRef> >::iterator i =
     pending_wbs.find(hoid);
@@ -262,7 +377,7 @@ void WBThrottle::clear_object(const ghobject_t &hoid)
 void WBThrottle::throttle()
 {
   Mutex::Locker l(lock);
-  while (!stopping && beyond_limit()) {
+  while (!stopping && need_flush()) {
     cond.Wait(lock);
   }
 }
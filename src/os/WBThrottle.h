@@ -16,6 +16,7 @@
 #define WBTHROTTLE_H
 
 #include "include/unordered_map.h"
+#include "include/unordered_set.h"
 #include <boost/tuple/tuple.hpp>
 #include "include/memory.h"
 #include "include/buffer.h"
@@ -35,6 +36,10 @@ enum {
   l_wbthrottle_ios_wb,
   l_wbthrottle_inodes_dirtied,
   l_wbthrottle_inodes_wb,
+  l_wbthrottle_flush_lat,
+  l_wbthrottle_drain_bytes_sec,
+  l_wbthrottle_bytes_start,
+  l_wbthrottle_bytes_hard,
   l_wbthrottle_last
 };
 
@@ -44,7 +49,10 @@ enum {
  * Tracks, throttles, and flushes outstanding IO
  */
 class WBThrottle : Thread, public md_config_obs_t {
-  ghobject_t clearing;
+  friend class WBThrottleTest;
+
+  /// objects in the batch being written back
+  ceph::unordered_set<ghobject_t> clearing;
   /* *_limits.first is the start_flusher limit and
    * *_limits.second is the hard limit
    */
@@ -61,6 +69,24 @@ class WBThrottle : Thread, public md_config_obs_t {
   uint64_t cur_ios;  /// Currently unflushed IOs
   uint64_t cur_size; /// Currently unflushed bytes
 
+  /**
+   * Adaptive limits
+   *
+   * With filestore_wbthrottle_adaptive we keep a moving average of the
+   * rate at which the device drains dirty bytes and ios, and size the
+   * hard limits to filestore_wbthrottle_adaptive_target seconds of
+   * writeback.  The hard limits stay between the configured start
+   * and hard limits, and the start limits keep their configured
+   * ratio to the hard limits.  A slow disk thus never
+   * accumulates more dirty data than it can write back in that time,
+   * which bounds the stall when the sync thread forces it all out.
+   */
+  pair<uint64_t, uint64_t> conf_size_limits, conf_io_limits;
+  double drain_bytes_sec;  ///< moving average, 0 until measured
+  double drain_ios_sec;
+  void update_drain_rate(uint64_t bytes, uint64_t ios, double secs);
+  void set_adaptive_limits();
+
   /**
    * PendingWB tracks the ios pending on an object.
    */
@@ -115,10 +141,15 @@ class WBThrottle : Thread, public md_config_obs_t {
 
   ceph::unordered_map<ghobject_t, pair<PendingWB, FDRef> > pending_wbs;
 
-  /// get next flush to perform
+  typedef boost::tuple<ghobject_t, FDRef, PendingWB> wb_t;
+
+  /// get next batch of flushes to perform
   bool get_next_should_flush(
-    boost::tuple<ghobject_t, FDRef, PendingWB> *next ///< [out] next to flush
+    vector<wb_t> *next ///< [out] objects to flush, oldest first
     ); ///< @return false if we are shutting down
+
+  /// write back a batch, in inode order
+  void flush_batch(vector<wb_t> &batch);
 public:
   enum FS {
     BTRFS,
@@ -137,6 +168,14 @@ private:
     else
       return true;
   }
+  bool need_flush() const {
+    if (cur_ios < io_limits.second &&
+	pending_wbs.size() < fd_limits.second &&
+	cur_size < size_limits.second)
+      return false;
+    else
+      return true;
+  }
 
 public:
   WBThrottle(CephContext *cct);
@@ -30,6 +30,10 @@
 #include "XFS.h"
 #endif
 
+#if defined(HAVE_LIBAIO) && defined(HAVE_LINUX_IO_URING_H)
+#include "io_uring.h"
+#endif
+
 #if defined(DARWIN) || defined(__FreeBSD__)
 #include <sys/mount.h>
 #else
@@ -184,3 +188,35 @@ int FS::zero(int fd, uint64_t offset, uint64_t length)
  out:
   return r;
 }
+
+// ---------------
+
+#if defined(HAVE_LIBAIO)
+int FS::create_aio_queue(const std::string& engine,
+			 unsigned max_iodepth,
+			 aio_queue_t **pq)
+{
+  aio_queue_t *q = NULL;
+  int r;
+#if defined(HAVE_LINUX_IO_URING_H)
+  if (engine == "io_uring") {
+    q = new io_uring_queue_t(max_iodepth);
+    r = q->init();
+    if (r == 0) {
+      *pq = q;
+      return 0;
+    }
+    // probably an old kernel; fall back to libaio
+    delete q;
+  }
+#endif
+  q = new libaio_queue_t(max_iodepth);
+  r = q->init();
+  if (r < 0) {
+    delete q;
+    return r;
+  }
+  *pq = q;
+  return 0;
+}
+#endif
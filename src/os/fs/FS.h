@@ -57,28 +57,82 @@ public:
     void *priv;
     int fd;
     vector<iovec> iov;
+    uint64_t offset, length;
+    long rval;         ///< result, once completed
 
-    aio_t(void *p, int f) : priv(p), fd(f) {
+    aio_t(void *p, int f)
+      : priv(p), fd(f), offset(0), length(0), rval(-1000) {
       memset(&iocb, 0, sizeof(iocb));
     }
 
-    void pwritev(uint64_t offset) {
+    void pwritev(uint64_t _offset) {
+      offset = _offset;
+      length = 0;
+      for (vector<iovec>::iterator p = iov.begin(); p != iov.end(); ++p)
+	length += p->iov_len;
       io_prep_pwritev(&iocb, fd, &iov[0], iov.size(), offset);
     }
   };
 
+  /// an aio submission and completion engine
   struct aio_queue_t {
+    virtual ~aio_queue_t() {}
+
+    virtual const char *get_name() = 0;
+    virtual int init() = 0;
+    virtual void shutdown() = 0;
+
+    /**
+     * submit a batch of aios
+     *
+     * As soon as an aio is submitted it may complete, so the caller
+     * must not touch it (or anything its completion may free) after
+     * calling this.
+     *
+     * On failure nothing from the failing submission was queued: no
+     * completion will be reported for those aios.  A batch bigger than
+     * the queue goes in several submissions, and aios from earlier
+     * ones were already accepted and still complete as usual.
+     *
+     * @param aios array of aios to submit
+     * @param n number of aios
+     * @param retries [out] incremented each time we had to back off
+     * @returns 0 on success, negative error code on failure
+     */
+    virtual int submit_batch(aio_t **aios, int n, int *retries) = 0;
+    int submit(aio_t &aio, int *retries) {
+      aio_t *p = &aio;
+      return submit_batch(&p, 1, retries);
+    }
+
+    /**
+     * reap completed aios
+     *
+     * @param timeout_ms how long to wait for a completion; -1 for forever
+     * @param paio [out] completed aios, with rval filled in
+     * @param max size of paio
+     * @returns number of completed aios, 0 on timeout, or negative error
+     */
+    virtual int get_next_completed(int timeout_ms, aio_t **paio, int max) = 0;
+  };
+
+  /// the libaio engine
+  struct libaio_queue_t : public aio_queue_t {
     int max_iodepth;
     io_context_t ctx;
 
-    aio_queue_t(unsigned max_iodepth)
+    libaio_queue_t(unsigned max_iodepth)
       : max_iodepth(max_iodepth),
 	ctx(0) {
     }
-    ~aio_queue_t() {
+    ~libaio_queue_t() {
       assert(ctx == 0);
     }
 
+    const char *get_name() {
+      return "libaio";
+    }
+
     int init() {
       assert(ctx == 0);
       return io_setup(max_iodepth, &ctx);
@@ -91,11 +145,13 @@ public:
       }
     }
 
-    int submit(aio_t &aio, int *retries) {
+    int submit_batch(aio_t **aios, int n, int *retries) {
+      // aio_t starts with its iocb, so the array doubles as an iocb array
+      iocb **piocb = reinterpret_cast<iocb**>(aios);
       int attempts = 10;
-      iocb *piocb = &aio.iocb;
-      while (true) {
-	int r = io_submit(ctx, 1, &piocb);
+      int done = 0;
+      while (done < n) {
+	int r = io_submit(ctx, n - done, piocb + done);
 	if (r < 0) {
 	  if (r == -EAGAIN && attempts-- > 0) {
 	    usleep(500);
@@ -104,8 +160,8 @@ public:
 	  }
 	  return r;
 	}
-	assert(r == 1);
-	break;
+	assert(r > 0);
+	done += r;
       }
       return 0;
     }
@@ -116,16 +172,29 @@ public:
 	timeout_ms / 1000,
 	(timeout_ms % 1000) * 1000 * 1000
       };
-      int r = io_getevents(ctx, 1, 1, event, &t);
+      int r = io_getevents(ctx, 1, max, event, timeout_ms < 0 ? NULL : &t);
       if (r <= 0) {
 	return r;
       }
       for (int i=0; i<r; ++i) {
 	paio[i] = (aio_t *)event[i].obj;
+	paio[i]->rval = event[i].res;
       }
       return r;
     }
   };
+
+  /**
+   * create and initialize an aio engine
+   *
+   * @param engine "libaio" or "io_uring"; we fall back to libaio if
+   *               the requested engine is unavailable
+   * @param max_iodepth queue depth
+   * @param pq [out] the engine
+   */
+  static int create_aio_queue(const std::string& engine,
+			      unsigned max_iodepth,
+			      aio_queue_t **pq);
 #endif
 };
 
@@ -0,0 +1,269 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2015 Red Hat
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "io_uring.h"
+
+#if defined(HAVE_LIBAIO) && defined(HAVE_LINUX_IO_URING_H)
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "include/compat.h"
+
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+  int r = ::syscall(__NR_io_uring_setup, entries, p);
+  if (r < 0)
+    return -errno;
+  return r;
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit,
+			      unsigned min_complete, unsigned flags)
+{
+  int r = ::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+		    NULL, 0);
+  if (r < 0)
+    return -errno;
+  return r;
+}
+
+// the rings are shared with the kernel; order our accesses to the
+// head and tail indices against the entries they cover
+static inline unsigned load_acquire(const unsigned *p)
+{
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_release(unsigned *p, unsigned v)
+{
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+int io_uring_queue_t::init()
+{
+  assert(ring_fd < 0);
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  int r = sys_io_uring_setup(max_iodepth, &p);
+  if (r < 0)
+    return r;
+  ring_fd = r;
+
+  sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  sq_ring = ::mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  if (sq_ring == MAP_FAILED) {
+    r = -errno;
+    sq_ring = NULL;
+    goto fail;
+  }
+  sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  sqes = (struct io_uring_sqe *)::mmap(NULL, sqes_size,
+				       PROT_READ | PROT_WRITE,
+				       MAP_SHARED | MAP_POPULATE, ring_fd,
+				       IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    r = -errno;
+    sqes = NULL;
+    goto fail;
+  }
+  cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  cq_ring = ::mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+  if (cq_ring == MAP_FAILED) {
+    r = -errno;
+    cq_ring = NULL;
+    goto fail;
+  }
+
+  sq_head = (unsigned *)((char *)sq_ring + p.sq_off.head);
+  sq_tail = (unsigned *)((char *)sq_ring + p.sq_off.tail);
+  sq_mask = (unsigned *)((char *)sq_ring + p.sq_off.ring_mask);
+  sq_array = (unsigned *)((char *)sq_ring + p.sq_off.array);
+  sq_entries = p.sq_entries;
+  cq_head = (unsigned *)((char *)cq_ring + p.cq_off.head);
+  cq_tail = (unsigned *)((char *)cq_ring + p.cq_off.tail);
+  cq_mask = (unsigned *)((char *)cq_ring + p.cq_off.ring_mask);
+  cq_entries = p.cq_entries;
+  inflight = 0;
+  cqes = (struct io_uring_cqe *)((char *)cq_ring + p.cq_off.cqes);
+  return 0;
+
+ fail:
+  shutdown();
+  return r;
+}
+
+void io_uring_queue_t::shutdown()
+{
+  if (cq_ring) {
+    ::munmap(cq_ring, cq_ring_size);
+    cq_ring = NULL;
+  }
+  if (sqes) {
+    ::munmap(sqes, sqes_size);
+    sqes = NULL;
+  }
+  if (sq_ring) {
+    ::munmap(sq_ring, sq_ring_size);
+    sq_ring = NULL;
+  }
+  if (ring_fd >= 0) {
+    VOID_TEMP_FAILURE_RETRY(::close(ring_fd));
+    ring_fd = -1;
+  }
+}
+
+int io_uring_queue_t::submit_batch(FS::aio_t **aios, int n, int *retries)
+{
+  Mutex::Locker l(sq_lock);
+  int queued = 0;
+  int attempts = 10;
+  while (true) {
+    // wait for the reapers if every completion slot is spoken for
+    while (queued < n && inflight >= cq_entries) {
+      (*retries)++;
+      sq_cond.Wait(sq_lock);
+    }
+
+    // fill as many free submission slots as we can
+    unsigned head = load_acquire(sq_head);
+    unsigned tail = *sq_tail;
+    while (queued < n && tail - head < sq_entries && inflight < cq_entries) {
+      FS::aio_t *aio = aios[queued];
+      unsigned idx = tail & *sq_mask;
+      struct io_uring_sqe *sqe = &sqes[idx];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_WRITEV;
+      sqe->fd = aio->fd;
+      sqe->off = aio->offset;
+      sqe->addr = (unsigned long)&aio->iov[0];
+      sqe->len = aio->iov.size();
+      sqe->user_data = (unsigned long)aio;
+      sq_array[idx] = idx;
+      ++tail;
+      ++queued;
+      ++inflight;
+    }
+    store_release(sq_tail, tail);
+
+    unsigned pending = tail - head;
+    if (pending == 0)
+      break;
+    int r = sys_io_uring_enter(ring_fd, pending, 0, 0);
+    if (r < 0) {
+      if ((r == -EAGAIN || r == -EBUSY || r == -EINTR) && attempts-- > 0) {
+	usleep(500);
+	(*retries)++;
+	continue;
+      }
+      // take back whatever the kernel did not consume, so that it does
+      // not pick those up on someone else's enter and complete aios
+      // our caller thinks failed.  the kernel only reads the sq ring
+      // inside io_uring_enter, so head is stable here.
+      head = load_acquire(sq_head);
+      unsigned unconsumed = tail - head;
+      store_release(sq_tail, head);
+      assert(inflight >= unconsumed);
+      inflight -= unconsumed;
+      sq_cond.Signal();
+      return r;
+    }
+    if (queued == n && load_acquire(sq_head) == tail)
+      break;
+  }
+  return 0;
+}
+
+void io_uring_queue_t::put_inflight(unsigned n)
+{
+  Mutex::Locker l(sq_lock);
+  assert(inflight >= n);
+  inflight -= n;
+  sq_cond.Signal();
+}
+
+int io_uring_queue_t::get_next_completed(int timeout_ms, FS::aio_t **paio,
+					 int max)
+{
+  Mutex::Locker l(cq_lock);
+  unsigned head = *cq_head;
+  if (head == load_acquire(cq_tail)) {
+    int r;
+    if (timeout_ms < 0) {
+      r = sys_io_uring_enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS);
+    } else {
+      // the ring fd polls readable when there are completions
+      struct pollfd pfd;
+      pfd.fd = ring_fd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      r = ::poll(&pfd, 1, timeout_ms);
+      if (r < 0)
+	r = -errno;
+    }
+    if (r == -EINTR)
+      return 0;
+    if (r < 0)
+      return r;
+  }
+
+  unsigned tail = load_acquire(cq_tail);
+  int n = 0;
+  while (head != tail && n < max) {
+    struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+    FS::aio_t *aio = (FS::aio_t *)(unsigned long)cqe->user_data;
+    aio->rval = cqe->res;
+    paio[n++] = aio;
+    ++head;
+  }
+  store_release(cq_head, head);
+  if (n)
+    put_inflight(n);
+  return n;
+}
+
+#else // __NR_io_uring_setup
+
+int io_uring_queue_t::init()
+{
+  return -ENOSYS;
+}
+
+void io_uring_queue_t::shutdown()
+{
+}
+
+int io_uring_queue_t::submit_batch(FS::aio_t **aios, int n, int *retries)
+{
+  return -ENOSYS;
+}
+
+int io_uring_queue_t::get_next_completed(int timeout_ms, FS::aio_t **paio,
+					 int max)
+{
+  return -ENOSYS;
+}
+
+#endif // __NR_io_uring_setup
+
+#endif
@@ -0,0 +1,99 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2015 Red Hat
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OS_FS_IO_URING_H
+#define CEPH_OS_FS_IO_URING_H
+
+#include "acconfig.h"
+
+#if defined(HAVE_LIBAIO) && defined(HAVE_LINUX_IO_URING_H)
+
+#include "FS.h"
+#include "common/Cond.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/**
+ * io_uring aio engine
+ *
+ * We talk to the kernel directly via the io_uring_setup(2) and
+ * io_uring_enter(2) syscalls and the shared submission and completion
+ * rings, so no library is needed.  A whole batch of aios is queued in
+ * the submission ring and handed to the kernel with a single syscall,
+ * and completions are reaped straight from the completion ring
+ * without any syscall at all when they are already there.
+ *
+ * We never have more aios in flight than the completion ring holds:
+ * kernels without IORING_FEAT_NODROP drop completions that don't fit,
+ * and those that have it make io_uring_enter fail with EBUSY instead.
+ * Submitters wait for the reapers to make room.
+ */
+struct io_uring_queue_t : public FS::aio_queue_t {
+  unsigned max_iodepth;
+  int ring_fd;
+
+  Mutex sq_lock;  ///< serialize submitters
+  Cond sq_cond;   ///< signaled when inflight drops
+  unsigned inflight;  ///< submitted but not reaped yet
+  void *sq_ring;
+  size_t sq_ring_size;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned sq_entries;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+
+  Mutex cq_lock;  ///< serialize reapers
+  void *cq_ring;
+  size_t cq_ring_size;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  unsigned cq_entries;
+  struct io_uring_cqe *cqes;
+
+  io_uring_queue_t(unsigned max_iodepth)
+    : max_iodepth(max_iodepth),
+      ring_fd(-1),
+      sq_lock("io_uring_queue_t::sq_lock"),
+      inflight(0),
+      sq_ring(NULL), sq_ring_size(0),
+      sq_head(NULL), sq_tail(NULL), sq_mask(NULL), sq_array(NULL),
+      sq_entries(0),
+      sqes(NULL), sqes_size(0),
+      cq_lock("io_uring_queue_t::cq_lock"),
+      cq_ring(NULL), cq_ring_size(0),
+      cq_head(NULL), cq_tail(NULL), cq_mask(NULL),
+      cq_entries(0),
+      cqes(NULL) {
+  }
+  ~io_uring_queue_t() {
+    assert(ring_fd < 0);
+  }
+
+  const char *get_name() {
+    return "io_uring";
+  }
+
+  int init();
+  void shutdown();
+  int submit_batch(FS::aio_t **aios, int n, int *retries);
+  int get_next_completed(int timeout_ms, FS::aio_t **paio, int max);
+
+private:
+  /// n aios were reaped; wake up submitters
+  void put_inflight(unsigned n);
+};
+
+#endif
+
+#endif
@@ -0,0 +1,205 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2015 Red Hat
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#if defined(__linux__)
+#include <linux/fs.h>
+#endif
+
+#include "BlockDevice.h"
+#include "include/compat.h"
+#include "common/debug.h"
+#include "common/errno.h"
+
+#define dout_subsys ceph_subsys_newstore
+#undef dout_prefix
+#define dout_prefix *_dout << "bdev(" << path << ") "
+
+int BlockDevice::create_file(const std::string& path, uint64_t size)
+{
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    int r = -errno;
+    if (r == -EEXIST)
+      return 0;
+    return r;
+  }
+  int r = ::ftruncate(fd, size);
+  if (r < 0)
+    r = -errno;
+  VOID_TEMP_FAILURE_RETRY(::close(fd));
+  return r;
+}
+
+int BlockDevice::open(const std::string& p)
+{
+  path = p;
+  dout(1) << __func__ << dendl;
+
+  fd_buffered = ::open(path.c_str(), O_RDWR);
+  if (fd_buffered < 0) {
+    int r = -errno;
+    derr << __func__ << " open got: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  fd_direct = ::open(path.c_str(), O_RDWR | O_DIRECT | O_DSYNC);
+  if (fd_direct < 0) {
+    int r = -errno;
+    derr << __func__ << " open O_DIRECT got: " << cpp_strerror(r) << dendl;
+    close();
+    return r;
+  }
+
+  struct stat st;
+  int r = ::fstat(fd_buffered, &st);
+  if (r < 0) {
+    r = -errno;
+    derr << __func__ << " fstat got " << cpp_strerror(r) << dendl;
+    close();
+    return r;
+  }
+  block_size = st.st_blksize;
+  if (S_ISBLK(st.st_mode)) {
+#if defined(__linux__)
+    uint64_t s;
+    r = ::ioctl(fd_buffered, BLKGETSIZE64, &s);
+    if (r < 0) {
+      r = -errno;
+      derr << __func__ << " BLKGETSIZE64 got " << cpp_strerror(r) << dendl;
+      close();
+      return r;
+    }
+    size = s;
+#else
+    derr << __func__ << " raw block devices not supported on this platform"
+	 << dendl;
+    close();
+    return -EOPNOTSUPP;
+#endif
+  } else {
+    size = st.st_size;
+  }
+
+  dout(1) << __func__ << " size " << size << " block_size " << block_size
+	  << dendl;
+  return 0;
+}
+
+void BlockDevice::close()
+{
+  if (fd_direct >= 0) {
+    VOID_TEMP_FAILURE_RETRY(::close(fd_direct));
+    fd_direct = -1;
+  }
+  if (fd_buffered >= 0) {
+    VOID_TEMP_FAILURE_RETRY(::close(fd_buffered));
+    fd_buffered = -1;
+  }
+}
+
+int BlockDevice::dup_direct_fd()
+{
+  int fd = ::dup(fd_direct);
+  if (fd < 0)
+    return -errno;
+  return fd;
+}
+
+int BlockDevice::dup_buffered_fd()
+{
+  int fd = ::dup(fd_buffered);
+  if (fd < 0)
+    return -errno;
+  return fd;
+}
+
+int BlockDevice::read(uint64_t offset, uint64_t length, bufferlist *pbl)
+{
+  dout(30) << __func__ << " " << offset << "~" << length << dendl;
+  assert(offset + length <= size);
+  bufferptr p = buffer::create_page_aligned(length);
+  uint64_t done = 0;
+  while (done < length) {
+    ssize_t r = ::pread(fd_buffered, p.c_str() + done, length - done,
+			offset + done);
+    if (r < 0) {
+      if (errno == EINTR)
+	continue;
+      r = -errno;
+      derr << __func__ << " " << offset << "~" << length << " got "
+	   << cpp_strerror(r) << dendl;
+      return r;
+    }
+    if (r == 0) {
+      // past end of a sparse file; the rest is zeros
+      memset(p.c_str() + done, 0, length - done);
+      break;
+    }
+    done += r;
+  }
+  pbl->append(p);
+  return length;
+}
+
+int BlockDevice::write(uint64_t offset, bufferlist& bl)
+{
+  uint64_t length = bl.length();
+  dout(30) << __func__ << " " << offset << "~" << length << dendl;
+  assert(offset + length <= size);
+  std::vector<iovec> iov;
+  bl.prepare_iov(&iov);
+  unsigned idx = 0;
+  while (idx < iov.size()) {
+    int cnt = MIN(iov.size() - idx, (size_t)IOV_MAX);
+    ssize_t r = ::pwritev(fd_buffered, &iov[idx], cnt, offset);
+    if (r < 0) {
+      if (errno == EINTR)
+	continue;
+      r = -errno;
+      derr << __func__ << " " << offset << "~" << length << " got "
+	   << cpp_strerror(r) << dendl;
+      return r;
+    }
+    offset += r;
+    // advance over whatever we wrote
+    while (r > 0 && idx < iov.size()) {
+      if ((size_t)r >= iov[idx].iov_len) {
+	r -= iov[idx].iov_len;
+	++idx;
+      } else {
+	iov[idx].iov_base = (char*)iov[idx].iov_base + r;
+	iov[idx].iov_len -= r;
+	r = 0;
+      }
+    }
+  }
+  return 0;
+}
+
+int BlockDevice::flush()
+{
+  dout(20) << __func__ << dendl;
+  int r = ::fdatasync(fd_buffered);
+  if (r < 0) {
+    r = -errno;
+    derr << __func__ << " fdatasync got: " << cpp_strerror(r) << dendl;
+  }
+  return r;
+}
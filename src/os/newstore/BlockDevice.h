@@ -0,0 +1,74 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2015 Red Hat
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OS_NEWSTORE_BLOCKDEVICE_H
+#define CEPH_OS_NEWSTORE_BLOCKDEVICE_H
+
+#include <string>
+
+#include "include/buffer.h"
+
+/**
+ * A raw block device (or a plain file standing in for one).
+ *
+ * We keep two descriptors open: a buffered one for small or unaligned
+ * io and reads, and an O_DIRECT one that callers can dup() for aio.
+ * All io is positional, so the descriptors can be shared between
+ * threads.
+ */
+class BlockDevice {
+  std::string path;
+  int fd_buffered;  ///< buffered io
+  int fd_direct;    ///< O_DIRECT io
+  uint64_t size;
+  uint64_t block_size;
+
+public:
+  BlockDevice()
+    : fd_buffered(-1),
+      fd_direct(-1),
+      size(0),
+      block_size(0) {
+  }
+  ~BlockDevice() {
+    close();
+  }
+
+  /// create a regular file of the given size if path does not exist
+  static int create_file(const std::string& path, uint64_t size);
+
+  int open(const std::string& path);
+  void close();
+
+  const std::string& get_path() const {
+    return path;
+  }
+  uint64_t get_size() const {
+    return size;
+  }
+  uint64_t get_block_size() const {
+    return block_size;
+  }
+
+  /// return a new descriptor for O_DIRECT io; caller must close it
+  int dup_direct_fd();
+  /// return a new descriptor for buffered io; caller must close it
+  int dup_buffered_fd();
+
+  int read(uint64_t offset, uint64_t length, bufferlist *pbl);
+  int write(uint64_t offset, bufferlist& bl);
+  int flush();
+};
+
+#endif
@@ -0,0 +1,290 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2015 Red Hat
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "FreelistManager.h"
+#include "common/debug.h"
+
+#define dout_subsys ceph_subsys_newstore
+#undef dout_prefix
+#define dout_prefix *_dout << "freelist "
+
+static void make_offset_key(uint64_t offset, std::string *key)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)offset);
+  *key = buf;
+}
+
+static int parse_offset_key(const std::string& key, uint64_t *offset)
+{
+  unsigned long long o;
+  if (sscanf(key.c_str(), "%llx", &o) < 1)
+    return -EINVAL;
+  *offset = o;
+  return 0;
+}
+
+int FreelistManager::init(KeyValueDB *kvdb, std::string p)
+{
+  dout(1) << __func__ << " prefix " << p << dendl;
+  Mutex::Locker l(lock);
+  prefix = p;
+  kv_free.clear();
+  free.clear();
+  total_free = 0;
+  last_alloc = 0;
+
+  KeyValueDB::Iterator it = kvdb->get_iterator(prefix);
+  it->lower_bound(std::string());
+  while (it->valid()) {
+    uint64_t offset, length;
+    if (parse_offset_key(it->key(), &offset) < 0) {
+      derr << __func__ << " unrecognized key " << it->key() << dendl;
+      return -EIO;
+    }
+    bufferlist bl = it->value();
+    bufferlist::iterator bp = bl.begin();
+    try {
+      ::decode(length, bp);
+    } catch (buffer::error& e) {
+      derr << __func__ << " failed to decode extent at " << offset << dendl;
+      return -EIO;
+    }
+    kv_free[offset] = length;
+    free[offset] = length;
+    total_free += length;
+    it->next();
+  }
+  dout(10) << __func__ << " loaded " << kv_free.size() << " extents, "
+	   << total_free << " bytes free" << dendl;
+  _dump();
+  return 0;
+}
+
+void FreelistManager::shutdown()
+{
+  dout(1) << __func__ << dendl;
+  Mutex::Locker l(lock);
+  kv_free.clear();
+  free.clear();
+  total_free = 0;
+}
+
+void FreelistManager::_dump()
+{
+  dout(30) << __func__ << " " << free.size() << " free extents" << dendl;
+  for (std::map<uint64_t,uint64_t>::iterator p = free.begin();
+       p != free.end();
+       ++p) {
+    dout(30) << __func__ << "  0x" << std::hex << p->first << "~" << p->second
+	     << std::dec << dendl;
+  }
+}
+
+void FreelistManager::_kv_insert(uint64_t offset, uint64_t length,
+				 KeyValueDB::Transaction t)
+{
+  std::string key;
+  std::map<uint64_t,uint64_t>::iterator p = kv_free.lower_bound(offset);
+  if (p != kv_free.end()) {
+    assert(p->first >= offset + length);
+    if (p->first == offset + length) {
+      // merge with next
+      length += p->second;
+      make_offset_key(p->first, &key);
+      t->rmkey(prefix, key);
+      kv_free.erase(p++);
+    }
+  }
+  if (p != kv_free.begin()) {
+    --p;
+    assert(p->first + p->second <= offset);
+    if (p->first + p->second == offset) {
+      // merge with previous
+      offset = p->first;
+      length += p->second;
+      kv_free.erase(p);
+    }
+  }
+  kv_free[offset] = length;
+  make_offset_key(offset, &key);
+  bufferlist bl;
+  ::encode(length, bl);
+  t->set(prefix, key, bl);
+}
+
+void FreelistManager::_kv_remove(uint64_t offset, uint64_t length,
+				 KeyValueDB::Transaction t)
+{
+  std::map<uint64_t,uint64_t>::iterator p = kv_free.upper_bound(offset);
+  assert(p != kv_free.begin());
+  --p;
+  assert(p->first <= offset);
+  assert(p->first + p->second >= offset + length);
+
+  uint64_t start = p->first;
+  uint64_t end = p->first + p->second;
+  std::string key;
+  make_offset_key(start, &key);
+  t->rmkey(prefix, key);
+  kv_free.erase(p);
+
+  if (start < offset) {
+    kv_free[start] = offset - start;
+    bufferlist bl;
+    ::encode(offset - start, bl);
+    t->set(prefix, key, bl);
+  }
+  if (offset + length < end) {
+    kv_free[offset + length] = end - (offset + length);
+    make_offset_key(offset + length, &key);
+    bufferlist bl;
+    ::encode(end - (offset + length), bl);
+    t->set(prefix, key, bl);
+  }
+}
+
+void FreelistManager::_insert_free(uint64_t offset, uint64_t length)
+{
+  total_free += length;
+  std::map<uint64_t,uint64_t>::iterator p = free.lower_bound(offset);
+  if (p != free.end()) {
+    assert(p->first >= offset + length);
+    if (p->first == offset + length) {
+      length += p->second;
+      free.erase(p++);
+    }
+  }
+  if (p != free.begin()) {
+    --p;
+    assert(p->first + p->second <= offset);
+    if (p->first + p->second == offset) {
+      offset = p->first;
+      length += p->second;
+      free.erase(p);
+    }
+  }
+  free[offset] = length;
+}
+
+int FreelistManager::create(uint64_t offset, uint64_t length,
+			    KeyValueDB::Transaction t)
+{
+  dout(10) << __func__ << " 0x" << std::hex << offset << "~" << length
+	   << std::dec << dendl;
+  Mutex::Locker l(lock);
+  _kv_insert(offset, length, t);
+  _insert_free(offset, length);
+  return 0;
+}
+
+int FreelistManager::allocate(uint64_t want, uint64_t min_alloc_size,
+			      uint64_t max_extent_size,
+			      std::vector<extent_t> *extents)
+{
+  assert(min_alloc_size > 0);
+  want = ROUND_UP_TO(want, min_alloc_size);
+  if (max_extent_size) {
+    max_extent_size -= max_extent_size % min_alloc_size;
+    assert(max_extent_size > 0);
+  }
+
+  Mutex::Locker l(lock);
+  dout(10) << __func__ << " want " << want << " (" << total_free
+	   << " free)" << dendl;
+  if (want > total_free) {
+    dout(10) << __func__ << " want " << want << " > free " << total_free
+	     << dendl;
+    return -ENOSPC;
+  }
+
+  size_t orig_num = extents->size();
+  uint64_t left = want;
+  bool wrapped = false;
+  std::map<uint64_t,uint64_t>::iterator p = free.lower_bound(last_alloc);
+  while (left > 0) {
+    if (p == free.end()) {
+      if (wrapped)
+	break;
+      wrapped = true;
+      p = free.begin();
+      continue;
+    }
+    uint64_t offset = p->first;
+    uint64_t length = MIN(p->second, left);
+    if (max_extent_size && length > max_extent_size)
+      length = max_extent_size;
+    length -= length % min_alloc_size;
+    if (length == 0) {
+      ++p;
+      continue;
+    }
+
+    // carve from the front of this free extent
+    uint64_t rest = p->second - length;
+    free.erase(p++);
+    if (rest) {
+      p = free.insert(std::make_pair(offset + length, rest)).first;
+    }
+    total_free -= length;
+    extents->push_back(extent_t(offset, length));
+    left -= length;
+    last_alloc = offset + length;
+    dout(20) << __func__ << "  got 0x" << std::hex << offset << "~" << length
+	     << std::dec << dendl;
+  }
+
+  if (left > 0) {
+    dout(10) << __func__ << " fragmented; only found " << (want - left)
+	     << " of " << want << " bytes" << dendl;
+    while (extents->size() > orig_num) {
+      extent_t& e = extents->back();
+      _insert_free(e.offset, e.length);
+      extents->pop_back();
+    }
+    return -ENOSPC;
+  }
+  return 0;
+}
+
+void FreelistManager::apply(const std::vector<extent_t>& allocated,
+			    const std::vector<extent_t>& released,
+			    KeyValueDB::Transaction t)
+{
+  Mutex::Locker l(lock);
+  // allocations first: an extent may be allocated and released again
+  // by the same transaction
+  for (std::vector<extent_t>::const_iterator p = allocated.begin();
+       p != allocated.end();
+       ++p) {
+    dout(20) << __func__ << " allocated 0x" << std::hex << p->offset << "~"
+	     << p->length << std::dec << dendl;
+    _kv_remove(p->offset, p->length, t);
+  }
+  for (std::vector<extent_t>::const_iterator p = released.begin();
+       p != released.end();
+       ++p) {
+    dout(20) << __func__ << " released 0x" << std::hex << p->offset << "~"
+	     << p->length << std::dec << dendl;
+    _kv_insert(p->offset, p->length, t);
+  }
+}
+
+void FreelistManager::release_committed(uint64_t offset, uint64_t length)
+{
+  dout(20) << __func__ << " 0x" << std::hex << offset << "~" << length
+	   << std::dec << dendl;
+  Mutex::Locker l(lock);
+  _insert_free(offset, length);
+}
@@ -0,0 +1,105 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2015 Red Hat
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OS_NEWSTORE_FREELISTMANAGER_H
+#define CEPH_OS_NEWSTORE_FREELISTMANAGER_H
+
+#include <string>
+#include <map>
+#include <vector>
+#include <ostream>
+
+#include "common/Mutex.h"
+#include "kv/KeyValueDB.h"
+#include "newstore_types.h"
+
+/**
+ * Track free space on the raw block device.
+ *
+ * The free list is persisted in the KeyValueDB as one key per free
+ * extent (device offset -> length).  We keep two in-memory copies:
+ *
+ *  - kv_free mirrors what the kv store will contain once all
+ *    transactions queued so far commit, and is what we diff against
+ *    when generating kv updates.  Because each update is a diff
+ *    against the previous ones, they are generated by apply() in the
+ *    order the kv transactions are submitted, not when the
+ *    transactions are prepared.
+ *  - free is what is safe to hand out right now.  allocate() takes
+ *    extents out of it immediately.  Extents released by a transaction
+ *    are only added back once that transaction has committed, so that
+ *    we never overwrite data that a crash could still expose.
+ */
+class FreelistManager {
+  std::string prefix;
+  Mutex lock;
+  uint64_t total_free;                   ///< bytes in free
+  std::map<uint64_t, uint64_t> kv_free;  ///< mirrors kv; offset -> length
+  std::map<uint64_t, uint64_t> free;     ///< allocatable; offset -> length
+  uint64_t last_alloc;                   ///< next-fit cursor
+
+  void _dump();
+  void _kv_insert(uint64_t offset, uint64_t length,
+		  KeyValueDB::Transaction t);
+  void _kv_remove(uint64_t offset, uint64_t length,
+		  KeyValueDB::Transaction t);
+  void _insert_free(uint64_t offset, uint64_t length);
+
+public:
+  FreelistManager()
+    : lock("FreelistManager::lock"),
+      total_free(0),
+      last_alloc(0) {
+  }
+
+  /// load the free list from kv
+  int init(KeyValueDB *kvdb, std::string prefix);
+  void shutdown();
+
+  /// mark [offset, offset+length) free on a freshly created device
+  int create(uint64_t offset, uint64_t length, KeyValueDB::Transaction t);
+
+  /**
+   * allocate want bytes, in units of min_alloc_size
+   *
+   * The result may be split into several extents.  They are removed
+   * from the in-memory free list only; the kv update is generated by
+   * apply().
+   *
+   * @returns 0 on success, -ENOSPC if there is not enough free space
+   */
+  int allocate(uint64_t want, uint64_t min_alloc_size,
+	       uint64_t max_extent_size,
+	       std::vector<extent_t> *extents);
+
+  /**
+   * queue the kv updates for a transaction's allocations and releases
+   *
+   * Must be called in the order the kv transactions are submitted.
+   * Released extents stay unusable until release_committed().
+   */
+  void apply(const std::vector<extent_t>& allocated,
+	     const std::vector<extent_t>& released,
+	     KeyValueDB::Transaction t);
+
+  /// make a previously released extent available for allocation
+  void release_committed(uint64_t offset, uint64_t length);
+
+  uint64_t get_total_free() {
+    Mutex::Locker l(lock);
+    return total_free;
+  }
+};
+
+#endif
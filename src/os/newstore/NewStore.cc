@@ -24,6 +24,8 @@
 #include "include/stringify.h"
 #include "common/errno.h"
 #include "common/safe_io.h"
+#include "common/perf_counters.h"
+#include "include/ceph_hash.h"
 
 #define dout_subsys ceph_subsys_newstore
 
@@ -50,6 +52,7 @@ const string PREFIX_OBJ = "O";  // object name -> onode
 const string PREFIX_OVERLAY = "V"; // u64 + offset -> value
 const string PREFIX_OMAP = "M"; // u64 + keyname -> value
 const string PREFIX_WAL = "L";  // write ahead log
+const string PREFIX_ALLOC = "B"; // u64 offset -> u64 length (freelist)
 
 
 /*
@@ -342,21 +345,92 @@ NewStore::Onode::Onode(const ghobject_t& o, const string& k)
   : nref(0),
     oid(o),
     key(k),
+    cache(NULL),
+    cache_bytes(0),
     dirty(false),
     exists(true),
     flush_lock("NewStore::Onode::flush_lock") {
 }
 
-// OnodeHashLRU
+uint32_t NewStore::Onode::approx_bytes() const
+{
+  uint64_t b = sizeof(*this) + oid.hobj.oid.name.length() + key.length();
+  for (map<string,bufferptr>::const_iterator p = onode.attrs.begin();
+       p != onode.attrs.end();
+       ++p)
+    b += 64 + p->first.length() + p->second.length();
+  b += onode.data_map.size() * (64 + sizeof(fragment_t));
+  b += onode.block_map.size() * (64 + sizeof(extent_t));
+  for (map<uint64_t,extent_t>::const_iterator p = onode.block_map.begin();
+       p != onode.block_map.end();
+       ++p)
+    b += p->second.csum.size() * sizeof(uint32_t);
+  b += onode.overlay_map.size() * (64 + sizeof(overlay_t));
+  b += onode.shared_overlays.size() * 48;
+  return b;
+}
+
+// OnodeLRUShard
 
 #undef dout_prefix
 #define dout_prefix *_dout << "newstore.lru(" << this << ") "
 
+int NewStore::OnodeLRUShard::trim()
+{
+  Mutex::Locker l(lock);
+  dout(20) << __func__ << " bytes " << bytes << " max " << max_bytes
+	   << " onodes " << lru.size() << dendl;
+  int trimmed = 0;
+  onode_lru_list_t::iterator p = lru.end();
+  while (bytes > max_bytes && p != lru.begin()) {
+    --p;
+    Onode *o = &*p;
+    OnodeHashLRU *c = o->cache;
+    assert(c);
+    // we are taking the locks out of order; skip anything busy
+    if (!c->lock.TryLock()) {
+      dout(30) << __func__ << "  " << o->oid << " collection busy" << dendl;
+      continue;
+    }
+    int refs = o->nref.read();
+    if (refs > 1) {
+      dout(30) << __func__ << "  " << o->oid << " has " << refs << " refs"
+	       << dendl;
+      c->lock.Unlock();
+      continue;
+    }
+    dout(30) << __func__ << "  trim " << o->oid << dendl;
+    o->get();  // paranoia
+    bytes -= o->cache_bytes;
+    p = lru.erase(p);
+    o->cache = NULL;
+    c->onode_map.erase(o->oid);
+    c->lock.Unlock();
+    o->put();
+    ++trimmed;
+  }
+  return trimmed;
+}
+
+// OnodeHashLRU
+
 void NewStore::OnodeHashLRU::_touch(OnodeRef o)
 {
-  lru_list_t::iterator p = lru.iterator_to(*o);
-  lru.erase(p);
-  lru.push_front(*o);
+  assert(lock.is_locked());
+  Mutex::Locker l(shard->lock);
+  onode_lru_list_t::iterator p = shard->lru.iterator_to(*o);
+  shard->lru.erase(p);
+  shard->lru.push_front(*o);
+}
+
+void NewStore::OnodeHashLRU::_unlink(Onode *o)
+{
+  assert(lock.is_locked());
+  assert(shard->lock.is_locked());
+  onode_lru_list_t::iterator p = shard->lru.iterator_to(*o);
+  shard->lru.erase(p);
+  shard->bytes -= o->cache_bytes;
+  o->cache = NULL;
 }
 
 void NewStore::OnodeHashLRU::add(const ghobject_t& oid, OnodeRef o)
@@ -364,8 +438,31 @@ void NewStore::OnodeHashLRU::add(const ghobject_t& oid, OnodeRef o)
   Mutex::Locker l(lock);
   dout(30) << __func__ << " " << oid << " " << o << dendl;
   assert(onode_map.count(oid) == 0);
+  assert(o->cache == NULL);
   onode_map[oid] = o;
-  lru.push_back(*o);
+  o->cache = this;
+  // nobody else can be modifying the onode yet; later changes are
+  // charged by recharge() when a txc writes it out
+  o->cache_bytes = o->approx_bytes();
+  Mutex::Locker sl(shard->lock);
+  shard->lru.push_front(*o);
+  shard->bytes += o->cache_bytes;
+}
+
+void NewStore::OnodeHashLRU::recharge(Onode *o)
+{
+  uint32_t b = o->approx_bytes();
+  Mutex::Locker l(lock);
+  if (o->cache != this) {
+    dout(30) << __func__ << " " << o->oid << " no longer cached" << dendl;
+    return;
+  }
+  dout(30) << __func__ << " " << o->oid << " " << o->cache_bytes << " -> "
+	   << b << dendl;
+  Mutex::Locker sl(shard->lock);
+  shard->bytes -= o->cache_bytes;
+  o->cache_bytes = b;
+  shard->bytes += b;
 }
 
 NewStore::OnodeRef NewStore::OnodeHashLRU::lookup(const ghobject_t& oid)
@@ -386,7 +483,11 @@ void NewStore::OnodeHashLRU::clear()
 {
   Mutex::Locker l(lock);
   dout(10) << __func__ << dendl;
-  lru.clear();
+  Mutex::Locker sl(shard->lock);
+  for (ceph::unordered_map<ghobject_t,OnodeRef>::iterator p = onode_map.begin();
+       p != onode_map.end();
+       ++p)
+    _unlink(p->second.get());
   onode_map.clear();
 }
 
@@ -399,8 +500,10 @@ void NewStore::OnodeHashLRU::remove(const ghobject_t& oid)
     return;
   }
   dout(30) << __func__ << " " << oid << " hit " << p->second << dendl;
-  lru_list_t::iterator pi = lru.iterator_to(*p->second);
-  lru.erase(pi);
+  {
+    Mutex::Locker sl(shard->lock);
+    _unlink(p->second.get());
+  }
   onode_map.erase(p);
 }
 
@@ -415,8 +518,8 @@ void NewStore::OnodeHashLRU::rename(const ghobject_t& old_oid,
 
   assert(po != onode_map.end());
   if (pn != onode_map.end()) {
-    lru_list_t::iterator p = lru.iterator_to(*pn->second);
-    lru.erase(p);
+    Mutex::Locker sl(shard->lock);
+    _unlink(pn->second.get());
     onode_map.erase(pn);
   }
   onode_map.insert(make_pair(new_oid, po->second));
@@ -431,63 +534,22 @@ bool NewStore::OnodeHashLRU::get_next(
   Mutex::Locker l(lock);
   dout(20) << __func__ << " after " << after << dendl;
 
+  ceph::unordered_map<ghobject_t,OnodeRef>::iterator p;
   if (after == ghobject_t()) {
-    if (lru.empty()) {
-      return false;
-    }
-    ceph::unordered_map<ghobject_t,OnodeRef>::iterator p = onode_map.begin();
-    assert(p != onode_map.end());
-    next->first = p->first;
-    next->second = p->second;
-    return true;
+    p = onode_map.begin();
+  } else {
+    p = onode_map.find(after);
+    assert(p != onode_map.end()); // for now
+    ++p;
   }
-
-  ceph::unordered_map<ghobject_t,OnodeRef>::iterator p = onode_map.find(after);
-  assert(p != onode_map.end()); // for now
-  lru_list_t::iterator pi = lru.iterator_to(*p->second);
-  ++pi;
-  if (pi == lru.end()) {
+  if (p == onode_map.end()) {
     return false;
   }
-  next->first = pi->oid;
-  next->second = onode_map[pi->oid];
+  next->first = p->first;
+  next->second = p->second;
   return true;
 }
 
-int NewStore::OnodeHashLRU::trim(int max)
-{
-  Mutex::Locker l(lock);
-  dout(20) << __func__ << " max " << max
-	   << " size " << onode_map.size() << dendl;
-  int trimmed = 0;
-  int num = onode_map.size() - max;
-  lru_list_t::iterator p = lru.end();
-  if (num)
-    --p;
-  while (num > 0) {
-    Onode *o = &*p;
-    int refs = o->nref.read();
-    if (refs > 1) {
-      dout(20) << __func__ << "  " << o->oid << " has " << refs
-	       << " refs; stopping with " << num << " left to trim" << dendl;
-      break;
-    }
-    dout(30) << __func__ << "  trim " << o->oid << dendl;
-    if (p != lru.begin()) {
-      lru.erase(p--);
-    } else {
-      lru.erase(p);
-      assert(num == 1);
-    }
-    o->get();  // paranoia
-    onode_map.erase(o->oid);
-    o->put();
-    --num;
-    ++trimmed;
-  }
-  return trimmed;
-}
-
 // =======================================================
 
 // Collection
@@ -499,7 +561,7 @@ NewStore::Collection::Collection(NewStore *ns, coll_t c)
   : store(ns),
     cid(c),
     lock("NewStore::Collection::lock"),
-    onode_map()
+    onode_map(ns->_get_onode_lru_shard(c))
 {
 }
 
@@ -519,8 +581,11 @@ NewStore::OnodeRef NewStore::Collection::get_onode(
   }
 
   OnodeRef o = onode_map.lookup(oid);
-  if (o)
+  if (o) {
+    store->logger->inc(l_newstore_onode_hits);
     return o;
+  }
+  store->logger->inc(l_newstore_onode_misses);
 
   string key;
   get_object_key(oid, &key);
@@ -548,6 +613,7 @@ NewStore::OnodeRef NewStore::Collection::get_onode(
   }
   o.reset(on);
   onode_map.add(oid, o);
+  store->_trim_onode_cache(onode_map.shard);
   return o;
 }
 
@@ -568,6 +634,10 @@ NewStore::NewStore(CephContext *cct, const string& path)
     fsid_fd(-1),
     frag_fd(-1),
     fset_fd(-1),
+    bdev(NULL),
+    freelist(NULL),
+    block_size(0),
+    csum_type(extent_t::CSUM_NONE),
     mounted(false),
     coll_lock("NewStore::coll_lock"),
     fid_lock("NewStore::fid_lock"),
@@ -602,7 +672,7 @@ NewStore::NewStore(CephContext *cct, const string& path)
 	     &fsync_tp),
     aio_thread(this),
     aio_stop(false),
-    aio_queue(cct->_conf->newstore_aio_max_queue_depth),
+    aio_queue(NULL),
     kv_sync_thread(this),
     kv_lock("NewStore::kv_lock"),
     kv_stop(false),
@@ -610,25 +680,73 @@ NewStore::NewStore(CephContext *cct, const string& path)
     reap_lock("NewStore::reap_lock")
 {
   _init_logger();
+
+  int num_shards = cct->_conf->newstore_onode_cache_shards;
+  if (num_shards <= 0)
+    num_shards = cct->_conf->osd_op_num_shards;
+  if (num_shards <= 0)
+    num_shards = 1;
+  uint64_t max_bytes = cct->_conf->newstore_onode_cache_bytes / num_shards;
+  for (int i = 0; i < num_shards; ++i)
+    onode_lru_shards.push_back(new OnodeLRUShard(max_bytes));
 }
 
 NewStore::~NewStore()
 {
   _shutdown_logger();
+  coll_map.clear();
+  for (vector<OnodeLRUShard*>::iterator p = onode_lru_shards.begin();
+       p != onode_lru_shards.end();
+       ++p) {
+    assert((*p)->lru.empty());
+    delete *p;
+  }
   assert(!mounted);
   assert(db == NULL);
   assert(fsid_fd < 0);
   assert(frag_fd < 0);
+  assert(bdev == NULL);
+  assert(freelist == NULL);
 }
 
 void NewStore::_init_logger()
 {
-  // XXX
+  PerfCountersBuilder b(cct, "newstore",
+			l_newstore_first, l_newstore_last);
+  b.add_u64_counter(l_newstore_onode_hits, "onode_hits",
+		    "Onode lookups satisfied from cache");
+  b.add_u64_counter(l_newstore_onode_misses, "onode_misses",
+		    "Onode lookups that went to the kv store");
+  b.add_u64_counter(l_newstore_onode_trims, "onode_trims",
+		    "Onodes evicted from cache");
+  logger = b.create_perf_counters();
+  cct->get_perfcounters_collection()->add(logger);
 }
 
 void NewStore::_shutdown_logger()
 {
-  // XXX
+  cct->get_perfcounters_collection()->remove(logger);
+  delete logger;
+  logger = NULL;
+}
+
+NewStore::OnodeLRUShard *NewStore::_get_onode_lru_shard(coll_t cid)
+{
+  // match the OSD's pg -> op shard mapping
+  spg_t pgid;
+  unsigned h;
+  if (cid.is_pg(&pgid))
+    h = pgid.ps();
+  else
+    h = ceph_str_hash_linux(cid.to_str().c_str(), cid.to_str().length());
+  return onode_lru_shards[h % onode_lru_shards.size()];
+}
+
+void NewStore::_trim_onode_cache(OnodeLRUShard *shard)
+{
+  int n = shard->trim();
+  if (n)
+    logger->inc(l_newstore_onode_trims, n);
 }
 
 int NewStore::peek_journal_fsid(uuid_d *fsid)
@@ -844,13 +962,160 @@ void NewStore::_close_db()
   db = NULL;
 }
 
+int NewStore::_create_block()
+{
+  const string& bpath = g_conf->newstore_block_path;
+  dout(1) << __func__ << " " << bpath << dendl;
+  int r = BlockDevice::create_file(bpath, g_conf->newstore_block_create_size);
+  if (r < 0) {
+    derr << __func__ << " failed to create " << bpath << ": "
+	 << cpp_strerror(r) << dendl;
+    return r;
+  }
+  r = ::symlinkat(bpath.c_str(), path_fd, "block");
+  if (r < 0 && errno == EEXIST) {
+    ::unlinkat(path_fd, "block", 0);
+    r = ::symlinkat(bpath.c_str(), path_fd, "block");
+  }
+  if (r < 0) {
+    r = -errno;
+    derr << __func__ << " failed to link " << path << "/block to " << bpath
+	 << ": " << cpp_strerror(r) << dendl;
+    return r;
+  }
+
+  BlockDevice b;
+  r = b.open(bpath);
+  if (r < 0)
+    return r;
+  uint64_t bs = MAX((uint64_t)g_conf->newstore_block_size,
+		    b.get_block_size());
+  uint64_t size = b.get_size() - b.get_size() % bs;
+  b.close();
+  if (size <= bs) {
+    derr << __func__ << " " << bpath << " is too small" << dendl;
+    return -EINVAL;
+  }
+
+  KeyValueDB::Transaction t = db->get_transaction();
+  bufferlist bl;
+  ::encode(bs, bl);
+  t->set(PREFIX_SUPER, "block_size", bl);
+  db->submit_transaction_sync(t);
+
+  r = _open_block();
+  if (r < 0)
+    return r;
+
+  // the first block is reserved for a label
+  t = db->get_transaction();
+  freelist->create(bs, size - bs, t);
+  db->submit_transaction_sync(t);
+  _close_block();
+  return 0;
+}
+
+int NewStore::_open_block()
+{
+  assert(bdev == NULL);
+  bufferlist bl;
+  db->get(PREFIX_SUPER, "block_size", &bl);
+  if (bl.length() == 0) {
+    dout(10) << __func__ << " no block device, using fragment files" << dendl;
+    return 0;
+  }
+  try {
+    ::decode(block_size, bl);
+  } catch (buffer::error& e) {
+    derr << __func__ << " unable to decode block_size" << dendl;
+    return -EIO;
+  }
+  int ct = extent_t::get_csum_type_by_name(g_conf->newstore_csum_type);
+  if (ct < 0) {
+    derr << __func__ << " unrecognized newstore_csum_type '"
+	 << g_conf->newstore_csum_type << "'" << dendl;
+    return -EINVAL;
+  }
+  csum_type = ct;
+
+  char fn[PATH_MAX];
+  snprintf(fn, sizeof(fn), "%s/block", path.c_str());
+  bdev = new BlockDevice;
+  int r = bdev->open(fn);
+  if (r < 0) {
+    delete bdev;
+    bdev = NULL;
+    return r;
+  }
+  freelist = new FreelistManager;
+  r = freelist->init(db, PREFIX_ALLOC);
+  if (r < 0) {
+    _close_block();
+    return r;
+  }
+  compressors[extent_t::COMP_SNAPPY] = Compressor::create("snappy");
+  dout(1) << __func__ << " " << fn << " block_size " << block_size
+	  << " csum " << extent_t::get_csum_type_name(csum_type)
+	  << ", " << freelist->get_total_free() << " bytes free" << dendl;
+  return 0;
+}
+
+void NewStore::_close_block()
+{
+  for (map<int,Compressor*>::iterator p = compressors.begin();
+       p != compressors.end();
+       ++p) {
+    delete p->second;
+  }
+  compressors.clear();
+  if (freelist) {
+    freelist->shutdown();
+    delete freelist;
+    freelist = NULL;
+  }
+  if (bdev) {
+    bdev->close();
+    delete bdev;
+    bdev = NULL;
+  }
+}
+
+int NewStore::_get_comp_type(CollectionRef& c)
+{
+  const string& name = c->cnode.compression.length() ?
+    c->cnode.compression : g_conf->newstore_compression;
+  int t = extent_t::get_comp_type_by_name(name);
+  if (t < 0) {
+    dout(10) << __func__ << " unrecognized compression '" << name << "'"
+	     << dendl;
+    return extent_t::COMP_NONE;
+  }
+  return t;
+}
+
+Compressor *NewStore::_get_compressor(int comp_type)
+{
+  map<int,Compressor*>::iterator p = compressors.find(comp_type);
+  if (p == compressors.end())
+    return NULL;
+  return p->second;
+}
+
 int NewStore::_aio_start()
 {
   if (g_conf->newstore_aio) {
     dout(10) << __func__ << dendl;
-    int r = aio_queue.init();
-    if (r < 0)
+    int r = FS::create_aio_queue(g_conf->newstore_aio_engine,
+				 g_conf->newstore_aio_max_queue_depth,
+				 &aio_queue);
+    if (r < 0) {
+      derr << __func__ << " failed to set up aio: " << cpp_strerror(r)
+	   << dendl;
       return r;
+    }
+    if (g_conf->newstore_aio_engine != aio_queue->get_name())
+      derr << __func__ << " " << g_conf->newstore_aio_engine
+	   << " unavailable, using " << aio_queue->get_name() << dendl;
     aio_thread.create();
   }
   return 0;
@@ -863,7 +1128,9 @@ void NewStore::_aio_stop()
     aio_stop = true;
     aio_thread.join();
     aio_stop = false;
-    aio_queue.shutdown();
+    aio_queue->shutdown();
+    delete aio_queue;
+    aio_queue = NULL;
   }
 }
 
@@ -889,6 +1156,12 @@ int NewStore::_open_collections()
   return 0;
 }
 
+void NewStore::_close_collections()
+{
+  RWLock::WLocker l(coll_lock);
+  coll_map.clear();
+}
+
 int NewStore::mkfs()
 {
   dout(1) << __func__ << " path " << path << dendl;
@@ -937,12 +1210,19 @@ int NewStore::mkfs()
   if (r < 0)
     goto out_close_frag;
 
+  if (g_conf->newstore_block_path.length()) {
+    r = _create_block();
+    if (r < 0)
+      goto out_close_db;
+  }
+
   // FIXME: superblock
 
   dout(10) << __func__ << " success" << dendl;
   r = 0;
-  _close_db();
 
+ out_close_db:
+  _close_db();
  out_close_frag:
   _close_frag();
  out_close_fsid:
@@ -981,6 +1261,10 @@ int NewStore::mount()
   if (r < 0)
     goto out_frag;
 
+  r = _open_block();
+  if (r < 0)
+    goto out_db;
+
   r = _recover_next_fid();
   if (r < 0)
     goto out_db;
@@ -1012,6 +1296,7 @@ int NewStore::mount()
  out_aio:
   _aio_stop();
  out_db:
+  _close_block();
   _close_db();
  out_frag:
   _close_frag();
@@ -1047,8 +1332,10 @@ int NewStore::umount()
   dout(20) << __func__ << " closing" << dendl;
 
   mounted = false;
+  _close_collections();
   if (fset_fd >= 0)
     VOID_TEMP_FAILURE_RETRY(::close(fset_fd));
+  _close_block();
   _close_db();
   _close_frag();
   _close_fsid();
@@ -1081,6 +1368,12 @@ int NewStore::statfs(struct statfs *buf)
     assert(!g_conf->newstore_fail_eio || r != -EIO);
     return r;
   }
+  if (bdev) {
+    buf->f_bsize = block_size;
+    buf->f_blocks = bdev->get_size() / block_size;
+    buf->f_bfree = freelist->get_total_free() / block_size;
+    buf->f_bavail = buf->f_bfree;
+  }
   return 0;
 }
 
@@ -1237,6 +1530,13 @@ int NewStore::_do_read(
 
   o->flush();
 
+  if (bdev) {
+    r = _do_read_block(NULL, o, offset, length, bl);
+    if (r >= 0)
+      r = bl.length();
+    goto out;
+  }
+
   r = 0;
 
   // loop over overlays and data fragments.  overlays take precedence.
@@ -1353,6 +1653,233 @@ int NewStore::_do_read(
   return r;
 }
 
+int NewStore::_do_read_block(
+    TransContext *txc,
+    OnodeRef o,
+    uint64_t offset,
+    size_t length,
+    bufferlist& bl)
+{
+  map<uint64_t,extent_t>::iterator bp, bend;
+  map<uint64_t,overlay_t>::iterator op, oend;
+  int r;
+
+  // loop over overlays and block extents.  overlays take precedence.
+  bend = o->onode.block_map.end();
+  bp = o->onode.block_map.lower_bound(offset);
+  if (bp != o->onode.block_map.begin()) {
+    --bp;
+  }
+  oend = o->onode.overlay_map.end();
+  op = o->onode.overlay_map.lower_bound(offset);
+  if (op != o->onode.overlay_map.begin()) {
+    --op;
+  }
+  while (length > 0) {
+    if (op != oend && op->first + op->second.length <= offset) {
+      dout(20) << __func__ << " skip overlay " << op->first << " " << op->second
+	       << dendl;
+      ++op;
+      continue;
+    }
+    if (bp != bend && bp->first + bp->second.logical_length() <= offset) {
+      dout(30) << __func__ << " skip extent " << bp->first << " " << bp->second
+	       << dendl;
+      ++bp;
+      continue;
+    }
+
+    // overlay?
+    if (op != oend && op->first <= offset) {
+      uint64_t x_off = offset - op->first + op->second.value_offset;
+      uint64_t x_len = MIN(op->first + op->second.length - offset, length);
+      dout(20) << __func__ << "  overlay " << op->first << " " << op->second
+	       << " use " << x_off << "~" << x_len << dendl;
+      bufferlist v;
+      string key;
+      get_overlay_key(o->onode.nid, op->second.key, &key);
+      db->get(PREFIX_OVERLAY, key, &v);
+      bufferlist frag;
+      frag.substr_of(v, x_off, x_len);
+      bl.claim_append(frag);
+      ++op;
+      length -= x_len;
+      offset += x_len;
+      continue;
+    }
+
+    uint64_t x_len = length;
+    if (op != oend &&
+	op->first > offset &&
+	op->first - offset < x_len) {
+      x_len = op->first - offset;
+    }
+
+    // extent?
+    if (bp != bend && bp->first <= offset) {
+      uint64_t x_off = offset - bp->first;
+      x_len = MIN(x_len, bp->second.logical_length() - x_off);
+      dout(30) << __func__ << " data " << bp->first << " " << bp->second
+	       << " use " << x_off << "~" << x_len << dendl;
+      bufferlist t;
+      r = _block_read_extent(txc, bp->second, x_off, x_len, &t);
+      if (r < 0)
+	return r;
+      bl.claim_append(t);
+      offset += x_len;
+      length -= x_len;
+      if (x_off + x_len == bp->second.logical_length()) {
+	++bp;
+      }
+      continue;
+    }
+
+    // zero, up to the next extent
+    if (bp != bend &&
+	bp->first > offset &&
+	bp->first - offset < x_len) {
+      x_len = bp->first - offset;
+    }
+    dout(30) << __func__ << " zero " << offset << "~" << x_len << dendl;
+    bufferptr z(x_len);
+    z.zero();
+    bl.push_back(z);
+    offset += x_len;
+    length -= x_len;
+  }
+  return 0;
+}
+
+int NewStore::_do_read_block_range(
+    TransContext *txc,
+    OnodeRef o,
+    uint64_t offset,
+    uint64_t length,
+    bufferlist *bl)
+{
+  // read a range for read/modify/write, zero-filling anything past eof
+  uint64_t valid = 0;
+  if (offset < o->onode.size)
+    valid = MIN(length, o->onode.size - offset);
+  if (valid) {
+    o->flush();
+    int r = _do_read_block(txc, o, offset, valid, *bl);
+    if (r < 0)
+      return r;
+  }
+  if (valid < length)
+    bl->append_zero(length - valid);
+  return 0;
+}
+
+int NewStore::_block_verify_csum(const extent_t& e, uint64_t x_off,
+				 const bufferlist& bl)
+{
+  uint32_t bad_off;
+  int r = e.verify_csum(x_off, bl, &bad_off);
+  if (r < 0) {
+    derr << __func__ << " bad " << extent_t::get_csum_type_name(e.csum_type)
+	 << " checksum on " << e << " at device offset "
+	 << (e.offset + bad_off) << "~" << e.get_csum_block_size() << dendl;
+  }
+  return r;
+}
+
+int NewStore::_block_read_compressed(TransContext *txc, const extent_t& e,
+				     uint64_t x_off, uint64_t x_len,
+				     bufferlist *out)
+{
+  // we always write a compressed blob in full, so an unsubmitted write
+  // from this transaction will be keyed by the extent offset
+  bufferlist pbl;
+  map<uint64_t,bufferlist>::iterator p;
+  if (txc &&
+      (p = txc->block_writes.find(e.offset)) != txc->block_writes.end()) {
+    pbl = p->second;
+  } else {
+    int r = bdev->read(e.offset, e.length, &pbl);
+    if (r < 0)
+      return r;
+    r = _block_verify_csum(e, 0, pbl);
+    if (r < 0)
+      return r;
+  }
+
+  Compressor *compressor = _get_compressor(e.comp_type);
+  if (!compressor) {
+    derr << __func__ << " no compressor for " << e << dendl;
+    return -EIO;
+  }
+  bufferlist cbl, raw;
+  cbl.substr_of(pbl, 0, e.comp_length);
+  int r = compressor->decompress(cbl, raw);
+  if (r < 0 || raw.length() != e.raw_length) {
+    derr << __func__ << " failed to decompress " << e << dendl;
+    return -EIO;
+  }
+  if (x_off == 0 && x_len == raw.length()) {
+    out->claim_append(raw);
+  } else {
+    bufferlist t;
+    t.substr_of(raw, x_off, x_len);
+    out->claim_append(t);
+  }
+  return 0;
+}
+
+int NewStore::_block_read_extent(TransContext *txc, const extent_t& e,
+				 uint64_t x_off, uint64_t x_len,
+				 bufferlist *out)
+{
+  if (e.is_compressed())
+    return _block_read_compressed(txc, e, x_off, x_len, out);
+
+  uint64_t dev_off = e.offset + x_off;
+
+  // data we wrote earlier in this transaction may not have been
+  // submitted yet
+  if (txc && !txc->block_writes.empty()) {
+    map<uint64_t,bufferlist>::iterator p =
+      txc->block_writes.upper_bound(dev_off);
+    if (p != txc->block_writes.begin()) {
+      --p;
+      if (p->first + p->second.length() >= dev_off + x_len) {
+	bufferlist t;
+	t.substr_of(p->second, dev_off - p->first, x_len);
+	out->claim_append(t);
+	return 0;
+      }
+    }
+  }
+
+  if (!e.has_csum()) {
+    int r = bdev->read(dev_off, x_len, out);
+    if (r < 0)
+      return r;
+    return 0;
+  }
+
+  // read whole csum blocks and verify them
+  uint32_t cbs = e.get_csum_block_size();
+  uint64_t c_off = x_off - x_off % cbs;
+  uint64_t c_len = ROUND_UP_TO(x_off + x_len, cbs) - c_off;
+  bufferlist t;
+  int r = bdev->read(e.offset + c_off, c_len, &t);
+  if (r < 0)
+    return r;
+  r = _block_verify_csum(e, c_off, t);
+  if (r < 0)
+    return r;
+  if (c_off == x_off && c_len == x_len) {
+    out->claim_append(t);
+  } else {
+    bufferlist u;
+    u.substr_of(t, x_off - c_off, x_len);
+    out->claim_append(u);
+  }
+  return 0;
+}
+
 int NewStore::fiemap(
   coll_t cid,
   const ghobject_t& oid,
@@ -1387,10 +1914,22 @@ int NewStore::fiemap(
   map<uint64_t,fragment_t>::iterator fp, fend;
   map<uint64_t,overlay_t>::iterator op, oend;
 
+  // present block extents as fragments so we can share the walk below
+  map<uint64_t,fragment_t> block_frags;
+  map<uint64_t,fragment_t> *data_map = &o->onode.data_map;
+  if (bdev) {
+    for (map<uint64_t,extent_t>::iterator p = o->onode.block_map.begin();
+	 p != o->onode.block_map.end();
+	 ++p) {
+      block_frags[p->first] = fragment_t(0, p->second.logical_length());
+    }
+    data_map = &block_frags;
+  }
+
   // loop over overlays and data fragments.  overlays take precedence.
-  fend = o->onode.data_map.end();
-  fp = o->onode.data_map.lower_bound(offset);
-  if (fp != o->onode.data_map.begin()) {
+  fend = data_map->end();
+  fp = data_map->lower_bound(offset);
+  if (fp != data_map->begin()) {
     --fp;
   }
   oend = o->onode.overlay_map.end();
@@ -1439,6 +1978,11 @@ int NewStore::fiemap(
 	++fp;
       continue;
     }
+    if (fp != fend &&
+	fp->first > offset &&
+	fp->first - offset < x_len) {
+      x_len = fp->first - offset;
+    }
     // we are seeing a hole, time to add an entry to fiemap.
     m[start] = offset - start;
     dout(20) << __func__ << " get fiemap entry, off =  " << start << " len=" << m[start] << dendl;
@@ -1891,13 +2435,25 @@ int NewStore::omap_get_values(
   if (!o->onode.omap_head)
     goto out;
   o->flush();
-  for (set<string>::const_iterator p = keys.begin(); p != keys.end(); ++p) {
-    string key;
-    get_omap_key(o->onode.omap_head, *p, &key);
-    bufferlist val;
-    if (db->get(PREFIX_OMAP, key, &val) >= 0) {
-      dout(30) << __func__ << "  got " << key << " -> " << *p << dendl;
-      out->insert(make_pair(*p, val));
+  {
+    // one batched lookup for all keys
+    set<string> db_keys;
+    for (set<string>::const_iterator p = keys.begin(); p != keys.end(); ++p) {
+      string key;
+      get_omap_key(o->onode.omap_head, *p, &key);
+      db_keys.insert(db_keys.end(), key);
+    }
+    map<string, bufferlist> db_out;
+    r = db->get(PREFIX_OMAP, db_keys, &db_out);
+    if (r < 0)
+      goto out;
+    for (map<string, bufferlist>::iterator p = db_out.begin();
+	 p != db_out.end(); ++p) {
+      string user_key;
+      decode_omap_key(p->first, &user_key);
+      dout(30) << __func__ << "  got " << p->first << " -> " << user_key
+	       << dendl;
+      (*out)[user_key].swap(p->second);
     }
   }
  out:
@@ -1926,15 +2482,24 @@ int NewStore::omap_check_keys(
   if (!o->onode.omap_head)
     goto out;
   o->flush();
-  for (set<string>::const_iterator p = keys.begin(); p != keys.end(); ++p) {
-    string key;
-    get_omap_key(o->onode.omap_head, *p, &key);
-    bufferlist val;
-    if (db->get(PREFIX_OMAP, key, &val) >= 0) {
-      dout(30) << __func__ << "  have " << key << " -> " << *p << dendl;
-      out->insert(*p);
-    } else {
-      dout(30) << __func__ << "  miss " << key << " -> " << *p << dendl;
+  {
+    set<string> db_keys;
+    for (set<string>::const_iterator p = keys.begin(); p != keys.end(); ++p) {
+      string key;
+      get_omap_key(o->onode.omap_head, *p, &key);
+      db_keys.insert(db_keys.end(), key);
+    }
+    map<string, bufferlist> db_out;
+    r = db->get(PREFIX_OMAP, db_keys, &db_out);
+    if (r < 0)
+      goto out;
+    for (map<string, bufferlist>::iterator p = db_out.begin();
+	 p != db_out.end(); ++p) {
+      string user_key;
+      decode_omap_key(p->first, &user_key);
+      dout(30) << __func__ << "  have " << p->first << " -> " << user_key
+	       << dendl;
+      out->insert(out->end(), user_key);
     }
   }
  out:
@@ -2180,16 +2745,21 @@ void NewStore::_txc_state_proc(TransContext *txc)
     case TransContext::STATE_IO_DONE:
       assert(txc->osr->qlock.is_locked());  // see _txc_finish_io
       txc->state = TransContext::STATE_KV_QUEUED;
-      if (!g_conf->newstore_sync_transaction) {
+      {
 	Mutex::Locker l(kv_lock);
-	if (g_conf->newstore_sync_submit_transaction) {
-	  db->submit_transaction(txc->t);
+	// txcs from different sequencers get here in any order; generate
+	// the freelist updates in the order they go to kv.
+	_txc_update_freelist(txc);
+	if (!g_conf->newstore_sync_transaction) {
+	  if (g_conf->newstore_sync_submit_transaction) {
+	    db->submit_transaction(txc->t);
+	  }
+	  kv_queue.push_back(txc);
+	  kv_cond.SignalOne();
+	  return;
 	}
-	kv_queue.push_back(txc);
-	kv_cond.SignalOne();
-	return;
+	db->submit_transaction_sync(txc->t);
       }
-      db->submit_transaction_sync(txc->t);
       break;
 
     case TransContext::STATE_KV_QUEUED:
@@ -2302,6 +2872,13 @@ int NewStore::_txc_finalize(OpSequencer *osr, TransContext *txc)
     ::encode((*p)->onode, bl);
     txc->t->set(PREFIX_OBJ, (*p)->key, bl);
 
+    // the onode may have grown (or shrunk) since it was charged.  it
+    // can't be trimmed while we hold a ref, and only moves out of its
+    // cache under that cache's lock, which recharge() rechecks.
+    OnodeHashLRU *c = (*p)->cache;
+    if (c)
+      c->recharge(p->get());
+
     Mutex::Locker l((*p)->flush_lock);
     (*p)->flush_txns.insert(txc);
   }
@@ -2370,6 +2947,14 @@ void NewStore::_txc_finish_kv(TransContext *txc)
     txc->oncommits.pop_front();
   }
 
+  // blocks freed by this txc are now safe to reuse
+  for (vector<extent_t>::iterator p = txc->released.begin();
+       p != txc->released.end();
+       ++p) {
+    freelist->release_committed(p->offset, p->length);
+  }
+  txc->released.clear();
+
   throttle_ops.put(txc->ops);
   throttle_bytes.put(txc->bytes);
 }
@@ -2423,7 +3008,7 @@ void NewStore::_osr_reap_done(OpSequencer *osr)
     }
 
     if (txc->first_collection) {
-      txc->first_collection->onode_map.trim(g_conf->newstore_onode_map_size);
+      _trim_onode_cache(txc->first_collection->onode_map.shard);
     }
 
     osr->q.pop_front();
@@ -2439,7 +3024,7 @@ void NewStore::_aio_thread()
     dout(40) << __func__ << " polling" << dendl;
     int max = 16;
     FS::aio_t *aio[max];
-    int r = aio_queue.get_next_completed(g_conf->newstore_aio_poll_ms,
+    int r = aio_queue->get_next_completed(g_conf->newstore_aio_poll_ms,
 					 aio, max);
     if (r < 0) {
       derr << __func__ << " got " << cpp_strerror(r) << dendl;
@@ -2448,6 +3033,11 @@ void NewStore::_aio_thread()
       dout(30) << __func__ << " got " << r << " completed aios" << dendl;
       for (int i = 0; i < r; ++i) {
 	TransContext *txc = static_cast<TransContext*>(aio[i]->priv);
+	if (aio[i]->rval != (long)aio[i]->length) {
+	  derr << __func__ << " aio " << aio[i] << " to " << aio[i]->offset
+	       << "~" << aio[i]->length << " got " << aio[i]->rval << dendl;
+	  assert(0 == "unexpected aio error");
+	}
 	int left = txc->num_aio.dec();
 	dout(10) << __func__ << " finished aio " << aio[i] << " txc " << txc
 		 << " state " << txc->get_state_name() << ", "
@@ -2810,33 +3400,29 @@ void NewStore::_txc_aio_submit(TransContext *txc)
   txc->submitted_aios.splice(e, txc->pending_aios);
   list<FS::aio_t>::iterator p = txc->submitted_aios.begin();
   assert(p != e);
-  bool done = false;
-  while (!done) {
+  FS::aio_t *aios[num];
+  int n = 0;
+  for (; p != e; ++p, ++n) {
     FS::aio_t& aio = *p;
-    dout(20) << __func__ << " aio " << &aio << " fd " << aio.fd << dendl;
+    dout(20) << __func__ << " aio " << &aio << " fd " << aio.fd
+	     << " " << aio.offset << "~" << aio.length << dendl;
     for (vector<iovec>::iterator q = aio.iov.begin(); q != aio.iov.end(); ++q)
       dout(30) << __func__ << "  iov " << (void*)q->iov_base
 	       << " len " << q->iov_len << dendl;
-    dout(30) << " fd " << aio.fd << " offset " << lseek64(aio.fd, 0, SEEK_CUR)
-	     << dendl;
+    aios[n] = &aio;
+  }
+  assert(n == num);
 
-    // be careful: as soon as we submit aio we race with completion.
-    // since we are holding a ref take care not to dereference txc at
-    // all after that point.
-    list<FS::aio_t>::iterator cur = p;
-    ++p;
-    done = (p == e);
-
-    // do not dereference txc (or it's contents) after we submit (if
-    // done == true and we don't loop)
-    int retries = 0;
-    int r = aio_queue.submit(*cur, &retries);
-    if (retries)
-      derr << __func__ << " retries " << retries << dendl;
-    if (r) {
-      derr << " aio submit got " << cpp_strerror(r) << dendl;
-      assert(r == 0);
-    }
+  // be careful: as soon as we submit aio we race with completion.
+  // since we are holding a ref take care not to dereference txc (or
+  // its contents) at all after that point.
+  int retries = 0;
+  int r = aio_queue->submit_batch(aios, num, &retries);
+  if (retries)
+    derr << __func__ << " retries " << retries << dendl;
+  if (r) {
+    derr << " aio submit got " << cpp_strerror(r) << dendl;
+    assert(r == 0);
   }
 }
 
@@ -2995,6 +3581,11 @@ int NewStore::_txc_add_transaction(TransContext *txc, Transaction *t)
           dout(10) << __func__ << " collection hint objects is a no-op, "
 		   << " pg_num " << pg_num << " num_objects " << num_objs
 		   << dendl;
+        } else if (type == Transaction::COLL_HINT_COMPRESSION) {
+	  string alg;
+	  ::decode(alg, hiter);
+	  if (c)
+	    r = _collection_hint_compression(txc, c, alg);
         } else {
           // Ignore the hint
           dout(10) << __func__ << " unknown collection hint " << type << dendl;
@@ -3381,6 +3972,7 @@ void NewStore::_do_read_all_overlays(wal_transaction_t& wt)
 }
 
 int NewStore::_do_write(TransContext *txc,
+			CollectionRef& c,
 			OnodeRef o,
 			uint64_t offset, uint64_t length,
 			bufferlist& bl,
@@ -3427,6 +4019,11 @@ int NewStore::_do_write(TransContext *txc,
     goto out;
   }
 
+  if (bdev) {
+    r = _do_block_write(txc, c, o, offset, length, bl);
+    goto out;
+  }
+
   flags = O_RDWR;
   if (g_conf->newstore_o_direct &&
       (offset & ~CEPH_PAGE_MASK) == 0 &&
@@ -3625,6 +4222,320 @@ int NewStore::_clean_fid_tail(TransContext *txc, const fragment_t& f)
 }
 
 
+void NewStore::_txc_update_freelist(TransContext *txc)
+{
+  assert(kv_lock.is_locked());
+  if (txc->allocated.empty() && txc->released.empty())
+    return;
+  freelist->apply(txc->allocated, txc->released, txc->t);
+  txc->allocated.clear();
+}
+
+void NewStore::_txc_release_extent(TransContext *txc,
+				   uint64_t offset, uint64_t length)
+{
+  dout(20) << __func__ << " " << offset << "~" << length << dendl;
+  txc->released.push_back(extent_t(offset, length));
+}
+
+int NewStore::_block_write_extent(TransContext *txc, const extent_t& e,
+				  bufferlist& bl)
+{
+  assert(bl.length() == e.length);
+#ifdef HAVE_LIBAIO
+  if (g_conf->newstore_aio && g_conf->newstore_o_direct) {
+    if (!bl.is_page_aligned()) {
+      dout(20) << __func__ << " rebuilding buffer to be page-aligned" << dendl;
+      bl.rebuild_page_aligned();
+    }
+    int fd = bdev->dup_direct_fd();
+    if (fd < 0)
+      return fd;
+    txc->pending_aios.push_back(FS::aio_t(txc, fd));
+    FS::aio_t& aio = txc->pending_aios.back();
+    bl.prepare_iov(&aio.iov);
+    txc->aio_bl.append(bl);
+    txc->block_writes[e.offset] = bl;
+    aio.pwritev(e.offset);
+    dout(20) << __func__ << " prepared aio " << &aio << " " << e << dendl;
+    return 0;
+  }
+#endif
+  int r = bdev->write(e.offset, bl);
+  if (r < 0)
+    return r;
+  if (!txc->bdev_sync_queued) {
+    int fd = bdev->dup_buffered_fd();
+    if (fd < 0)
+      return fd;
+    txc->sync_fd(fd);
+    txc->bdev_sync_queued = true;
+  }
+  dout(20) << __func__ << " wrote " << e << dendl;
+  return 0;
+}
+
+int NewStore::_do_block_unmap(TransContext *txc,
+			      CollectionRef& c,
+			      OnodeRef o,
+			      uint64_t offset, uint64_t length)
+{
+  dout(20) << __func__ << " " << o->oid << " " << offset << "~" << length
+	   << dendl;
+  assert(offset % block_size == 0);
+  assert(length % block_size == 0);
+  map<uint64_t,extent_t>& bm = o->onode.block_map;
+  uint64_t end = offset + length;
+  map<uint64_t,extent_t>::iterator p = bm.lower_bound(offset);
+  if (p != bm.begin()) {
+    --p;
+    if (p->first + p->second.logical_length() <= offset)
+      ++p;
+  }
+  while (p != bm.end() && p->first < end) {
+    uint64_t lstart = p->first;
+    extent_t e = p->second;
+    uint64_t lend = lstart + e.logical_length();
+    uint64_t cut_start = MAX(lstart, offset);
+    uint64_t cut_end = MIN(lend, end);
+
+    if (e.is_compressed()) {
+      // a compressed blob cannot be split; rewrite whatever survives
+      bufferlist head, tail;
+      if (lstart < cut_start || cut_end < lend) {
+	o->flush();
+	bufferlist raw;
+	int r = _block_read_extent(txc, e, 0, e.raw_length, &raw);
+	if (r < 0)
+	  return r;
+	if (lstart < cut_start)
+	  head.substr_of(raw, 0, cut_start - lstart);
+	if (cut_end < lend)
+	  tail.substr_of(raw, cut_end - lstart, lend - cut_end);
+      }
+      bm.erase(p);
+      _txc_release_extent(txc, e.offset, e.length);
+      if (head.length()) {
+	int r = _do_block_allocate(txc, c, o, lstart, head);
+	if (r < 0)
+	  return r;
+      }
+      if (tail.length()) {
+	int r = _do_block_allocate(txc, c, o, cut_end, tail);
+	if (r < 0)
+	  return r;
+      }
+      p = bm.lower_bound(cut_end);
+      continue;
+    }
+
+    bm.erase(p++);
+    if (lstart < cut_start) {
+      e.split(0, cut_start - lstart, &bm[lstart]);
+    }
+    if (cut_end < lend) {
+      e.split(cut_end - lstart, lend - cut_end, &bm[cut_end]);
+    }
+    _txc_release_extent(txc, e.offset + (cut_start - lstart),
+			cut_end - cut_start);
+  }
+  return 0;
+}
+
+int NewStore::_do_block_allocate_raw(TransContext *txc,
+				     OnodeRef o,
+				     uint64_t offset,
+				     bufferlist& data)
+{
+  vector<extent_t> extents;
+  int r = freelist->allocate(data.length(), block_size,
+			     g_conf->newstore_block_max_extent_size,
+			     &extents);
+  if (r < 0) {
+    derr << __func__ << " failed to allocate " << data.length() << " bytes: "
+	 << cpp_strerror(r) << dendl;
+    return r;
+  }
+  txc->allocated.insert(txc->allocated.end(), extents.begin(), extents.end());
+
+  uint64_t pos = 0;
+  for (vector<extent_t>::iterator p = extents.begin();
+       p != extents.end();
+       ++p) {
+    bufferlist t;
+    t.substr_of(data, pos, p->length);
+    p->calc_csum(csum_type, block_size, t);
+    o->onode.block_map[offset + pos] = *p;
+    r = _block_write_extent(txc, *p, t);
+    if (r < 0)
+      return r;
+    pos += p->length;
+  }
+  return 0;
+}
+
+int NewStore::_do_block_allocate(TransContext *txc,
+				 CollectionRef& c,
+				 OnodeRef o,
+				 uint64_t offset,
+				 bufferlist& data)
+{
+  assert(offset % block_size == 0);
+  assert(data.length() % block_size == 0);
+
+  int comp_type = _get_comp_type(c);
+  Compressor *compressor = _get_compressor(comp_type);
+  uint64_t min_blob = g_conf->newstore_compression_min_blob_size;
+  uint64_t max_blob = ROUND_UP_TO(
+    MAX((uint64_t)g_conf->newstore_compression_max_blob_size, block_size),
+    block_size);
+  if (!compressor || data.length() < min_blob)
+    return _do_block_allocate_raw(txc, o, offset, data);
+
+  // compress each blob independently so that reads only need to
+  // decompress the blobs they touch
+  uint64_t pos = 0;
+  while (pos < data.length()) {
+    uint64_t blen = MIN(max_blob, data.length() - pos);
+    bufferlist raw;
+    raw.substr_of(data, pos, blen);
+    bufferlist comp;
+    int r = compressor->compress(raw, comp);
+    uint64_t plen = ROUND_UP_TO(comp.length(), block_size);
+    vector<extent_t> extents;
+    if (r == 0 &&
+	blen >= min_blob &&
+	plen <= blen * g_conf->newstore_compression_required_ratio &&
+	freelist->allocate(plen, plen, 0, &extents) == 0) {
+      assert(extents.size() == 1);
+      txc->allocated.push_back(extents.front());
+      extent_t& e = extents.front();
+      e.comp_type = comp_type;
+      e.raw_length = blen;
+      e.comp_length = comp.length();
+      comp.append_zero(plen - comp.length());
+      e.calc_csum(csum_type, block_size, comp);
+      dout(20) << __func__ << " " << (offset + pos) << "~" << blen
+	       << " -> " << e << dendl;
+      o->onode.block_map[offset + pos] = e;
+      r = _block_write_extent(txc, e, comp);
+    } else {
+      dout(20) << __func__ << " " << (offset + pos) << "~" << blen
+	       << " stored raw (compressed to " << comp.length() << ")"
+	       << dendl;
+      r = _do_block_allocate_raw(txc, o, offset + pos, raw);
+    }
+    if (r < 0)
+      return r;
+    pos += blen;
+  }
+  return 0;
+}
+
+int NewStore::_do_block_write(TransContext *txc,
+			      CollectionRef& c,
+			      OnodeRef o,
+			      uint64_t offset, uint64_t length,
+			      bufferlist& bl)
+{
+  uint64_t start = offset - offset % block_size;
+  uint64_t end = ROUND_UP_TO(offset + length, block_size);
+  dout(20) << __func__ << " " << o->oid << " " << offset << "~" << length
+	   << " -> blocks " << start << "~" << (end - start) << dendl;
+
+  // fill out partial head and tail blocks with the current content.
+  // note that we never overwrite in place: every write gets freshly
+  // allocated blocks and the old ones are released on commit.
+  bufferlist data;
+  int r;
+  if (start < offset) {
+    r = _do_read_block_range(txc, o, start, offset - start, &data);
+    if (r < 0)
+      return r;
+  }
+  data.append(bl);
+  if (offset + length < end) {
+    bufferlist tail;
+    r = _do_read_block_range(txc, o, offset + length,
+			     end - (offset + length), &tail);
+    if (r < 0)
+      return r;
+    data.claim_append(tail);
+  }
+  assert(data.length() == end - start);
+
+  if (_do_overlay_trim(txc, o, start, end - start) > 0)
+    txc->write_onode(o);
+  r = _do_block_unmap(txc, c, o, start, end - start);
+  if (r < 0)
+    return r;
+  r = _do_block_allocate(txc, c, o, start, data);
+  if (r < 0)
+    return r;
+
+  if (offset + length > o->onode.size) {
+    dout(20) << __func__ << " extending size to " << offset + length << dendl;
+    o->onode.size = offset + length;
+  }
+  txc->write_onode(o);
+  return 0;
+}
+
+int NewStore::_do_block_zero(TransContext *txc,
+			     CollectionRef& c,
+			     OnodeRef o,
+			     uint64_t offset, uint64_t length)
+{
+  dout(20) << __func__ << " " << o->oid << " " << offset << "~" << length
+	   << dendl;
+  uint64_t end = offset + length;
+  uint64_t astart = ROUND_UP_TO(offset, block_size);
+  uint64_t aend = end - end % block_size;
+  int r;
+
+  // partial head block
+  if (offset < astart) {
+    uint64_t hend = MIN(astart, end);
+    map<uint64_t,extent_t>::iterator p =
+      o->onode.block_map.upper_bound(offset);
+    if (p != o->onode.block_map.begin()) {
+      --p;
+      if (p->first + p->second.logical_length() > offset) {
+	bufferlist z;
+	z.append_zero(hend - offset);
+	r = _do_block_write(txc, c, o, offset, hend - offset, z);
+	if (r < 0)
+	  return r;
+      }
+    }
+  }
+
+  // whole blocks are simply unmapped
+  if (astart < aend) {
+    r = _do_block_unmap(txc, c, o, astart, aend - astart);
+    if (r < 0)
+      return r;
+  }
+
+  // partial tail block
+  if (aend < end && aend >= astart) {
+    map<uint64_t,extent_t>::iterator p =
+      o->onode.block_map.upper_bound(aend);
+    if (p != o->onode.block_map.begin()) {
+      --p;
+      if (p->first + p->second.logical_length() > aend) {
+	bufferlist z;
+	z.append_zero(end - aend);
+	r = _do_block_write(txc, c, o, aend, end - aend, z);
+	if (r < 0)
+	  return r;
+      }
+    }
+  }
+  txc->write_onode(o);
+  return 0;
+}
+
 int NewStore::_write(TransContext *txc,
 		     CollectionRef& c,
 		     const ghobject_t& oid,
@@ -3638,7 +4549,7 @@ int NewStore::_write(TransContext *txc,
   RWLock::WLocker l(c->lock);
   OnodeRef o = c->get_onode(oid, true);
   _assign_nid(txc, o);
-  int r = _do_write(txc, o, offset, length, bl, fadvise_flags);
+  int r = _do_write(txc, c, o, offset, length, bl, fadvise_flags);
   txc->write_onode(o);
 
   dout(10) << __func__ << " " << c->cid << " " << oid
@@ -3665,6 +4576,17 @@ int NewStore::_zero(TransContext *txc,
   if (_do_overlay_trim(txc, o, offset, length) > 0)
     txc->write_onode(o);
 
+  if (bdev) {
+    r = _do_block_zero(txc, c, o, offset, length);
+    if (r < 0)
+      goto out;
+    if (offset + length > o->onode.size) {
+      o->onode.size = offset + length;
+      txc->write_onode(o);
+    }
+    goto out;
+  }
+
   if (o->onode.data_map.empty()) {
     // we're already a big hole
     if (offset + length > o->onode.size) {
@@ -3717,8 +4639,18 @@ int NewStore::_zero(TransContext *txc,
   return r;
 }
 
-int NewStore::_do_truncate(TransContext *txc, OnodeRef o, uint64_t offset)
+int NewStore::_do_truncate(TransContext *txc, CollectionRef& c, OnodeRef o,
+			   uint64_t offset)
 {
+  // release blocks past the new eof, and zero the tail of the last
+  // block so that extending later exposes zeros
+  if (bdev && offset < o->onode.size) {
+    uint64_t end = ROUND_UP_TO(o->onode.size, block_size);
+    int r = _do_block_zero(txc, c, o, offset, end - offset);
+    if (r < 0)
+      return r;
+  }
+
   // trim down fragments
   map<uint64_t,fragment_t>::iterator fp = o->onode.data_map.end();
   if (fp != o->onode.data_map.begin())
@@ -3829,7 +4761,7 @@ int NewStore::_truncate(TransContext *txc,
     r = -ENOENT;
     goto out;
   }
-  r = _do_truncate(txc, o, offset);
+  r = _do_truncate(txc, c, o, offset);
 
  out:
   dout(10) << __func__ << " " << c->cid << " " << oid
@@ -3854,6 +4786,13 @@ int NewStore::_do_remove(TransContext *txc,
     }
   }
   o->onode.data_map.clear();
+  for (map<uint64_t,extent_t>::iterator p = o->onode.block_map.begin();
+       p != o->onode.block_map.end();
+       ++p) {
+    dout(20) << __func__ << " will release " << p->second << dendl;
+    _txc_release_extent(txc, p->second.offset, p->second.length);
+  }
+  o->onode.block_map.clear();
   o->onode.size = 0;
   if (o->onode.omap_head) {
     _do_omap_clear(txc, o->onode.omap_head);
@@ -3990,20 +4929,11 @@ int NewStore::_rmattrs(TransContext *txc,
 
 void NewStore::_do_omap_clear(TransContext *txc, uint64_t id)
 {
-  KeyValueDB::Iterator it = db->get_iterator(PREFIX_OMAP);
   string prefix, tail;
   get_omap_header(id, &prefix);
   get_omap_tail(id, &tail);
-  it->lower_bound(prefix);
-  while (it->valid()) {
-    if (it->key() >= tail) {
-      dout(30) << __func__ << "  stop at " << tail << dendl;
-      break;
-    }
-    txc->t->rmkey(PREFIX_OMAP, it->key());
-    dout(30) << __func__ << "  rm " << it->key() << dendl;
-    it->next();
-  }
+  dout(30) << __func__ << "  rm " << prefix << " to " << tail << dendl;
+  txc->t->rm_range_keys(PREFIX_OMAP, prefix, tail);
 }
 
 int NewStore::_omap_clear(TransContext *txc,
@@ -4238,8 +5168,16 @@ int NewStore::_clone(TransContext *txc,
     op->fid = newo->onode.data_map.rbegin()->second.fid;
     newo->onode.data_map.erase(newo->onode.data_map.rbegin()->first);
   }
+  if (!newo->onode.block_map.empty()) {
+    map<uint64_t,extent_t>::reverse_iterator last =
+      newo->onode.block_map.rbegin();
+    r = _do_block_unmap(txc, c, newo, 0,
+			last->first + last->second.logical_length());
+    if (r < 0)
+      goto out;
+  }
 
-  r = _do_write(txc, newo, 0, oldo->onode.size, bl, 0);
+  r = _do_write(txc, c, newo, 0, oldo->onode.size, bl, 0);
 
   newo->onode.attrs = oldo->onode.attrs;
 
@@ -4310,7 +5248,7 @@ int NewStore::_clone_range(TransContext *txc,
   if (r < 0)
     goto out;
 
-  r = _do_write(txc, newo, dstoff, bl.length(), bl, 0);
+  r = _do_write(txc, c, newo, dstoff, bl.length(), bl, 0);
 
   txc->write_onode(newo);
 
@@ -4399,6 +5337,33 @@ int NewStore::_create_collection(
   return r;
 }
 
+int NewStore::_collection_hint_compression(TransContext *txc,
+					   CollectionRef& c,
+					   const string& alg)
+{
+  dout(15) << __func__ << " " << c->cid << " '" << alg << "'" << dendl;
+  int r = 0;
+  bufferlist bl;
+
+  // hints are advisory; ignore anything we do not understand
+  if (alg.length() && extent_t::get_comp_type_by_name(alg) < 0) {
+    dout(1) << __func__ << " " << c->cid << " ignoring unrecognized "
+	    << "compression '" << alg << "'" << dendl;
+    goto out;
+  }
+  {
+    RWLock::WLocker l(c->lock);
+    c->cnode.compression = alg;
+    ::encode(c->cnode, bl);
+  }
+  txc->t->set(PREFIX_COLL, stringify(c->cid), bl);
+
+ out:
+  dout(10) << __func__ << " " << c->cid << " '" << alg << "' = " << r
+	   << dendl;
+  return r;
+}
+
 int NewStore::_remove_collection(TransContext *txc, coll_t cid,
 				 CollectionRef *c)
 {
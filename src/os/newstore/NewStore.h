@@ -30,15 +30,29 @@
 #include "kv/KeyValueDB.h"
 
 #include "newstore_types.h"
+#include "BlockDevice.h"
+#include "FreelistManager.h"
+#include "compressor/Compressor.h"
 
 #include "boost/intrusive/list.hpp"
 
+class PerfCounters;
+
+enum {
+  l_newstore_first = 732430,
+  l_newstore_onode_hits,
+  l_newstore_onode_misses,
+  l_newstore_onode_trims,
+  l_newstore_last
+};
+
 class NewStore : public ObjectStore {
   // -----------------------------------------------------
   // types
 public:
 
   class TransContext;
+  struct OnodeHashLRU;
 
   /// an in-memory object
   struct Onode {
@@ -47,6 +61,8 @@ public:
     ghobject_t oid;
     string key;     ///< key under PREFIX_OBJ where we are stored
     boost::intrusive::list_member_hook<> lru_item;
+    OnodeHashLRU *cache;  ///< collection index we are cached in, if any
+    uint32_t cache_bytes; ///< memory charged to our lru shard
 
     onode_t onode;  ///< metadata stored as value in kv store
     bool dirty;     // ???
@@ -70,31 +86,65 @@ public:
       if (nref.dec() == 0)
 	delete this;
     }
+
+    /// rough in-memory footprint, for the cache budget
+    uint32_t approx_bytes() const;
   };
   typedef boost::intrusive_ptr<Onode> OnodeRef;
 
-  struct OnodeHashLRU {
-    typedef boost::intrusive::list<
+  typedef boost::intrusive::list<
+    Onode,
+    boost::intrusive::member_hook<
       Onode,
-      boost::intrusive::member_hook<
-        Onode,
-	boost::intrusive::list_member_hook<>,
-	&Onode::lru_item> > lru_list_t;
+      boost::intrusive::list_member_hook<>,
+      &Onode::lru_item> > onode_lru_list_t;
+
+  /**
+   * One shard of the store-wide onode lru.  Collections map onto
+   * shards the same way the OSD maps PGs onto op shards, so each op
+   * thread mostly touches a single shard, and the memory budget is
+   * shared by every collection in the shard rather than fixed per
+   * collection.
+   *
+   * Lock order is OnodeHashLRU::lock, then OnodeLRUShard::lock; trim
+   * goes the other way and so only try-locks the collection.
+   */
+  struct OnodeLRUShard {
+    Mutex lock;
+    onode_lru_list_t lru;
+    uint64_t bytes;      ///< charged to onodes in lru
+    uint64_t max_bytes;
+
+    OnodeLRUShard(uint64_t max)
+      : lock("NewStore::OnodeLRUShard::lock"),
+	bytes(0),
+	max_bytes(max) {}
 
+    int trim();
+  };
+
+  /// per-collection index of cached onodes; recency lives in the shard
+  struct OnodeHashLRU {
     Mutex lock;
     ceph::unordered_map<ghobject_t,OnodeRef> onode_map;  ///< forward lookups
-    lru_list_t lru;                                      ///< lru
+    OnodeLRUShard *shard;
 
-    OnodeHashLRU() : lock("NewStore::OnodeHashLRU::lock") {}
+    OnodeHashLRU(OnodeLRUShard *s)
+      : lock("NewStore::OnodeHashLRU::lock"),
+	shard(s) {}
+    ~OnodeHashLRU() {
+      clear();
+    }
 
     void add(const ghobject_t& oid, OnodeRef o);
     void _touch(OnodeRef o);
+    void _unlink(Onode *o);
+    void recharge(Onode *o);
     OnodeRef lookup(const ghobject_t& o);
     void remove(const ghobject_t& o);
     void rename(const ghobject_t& old_oid, const ghobject_t& new_oid);
     void clear();
     bool get_next(const ghobject_t& after, pair<ghobject_t,OnodeRef> *next);
-    int trim(int max=-1);
   };
 
   struct Collection {
@@ -205,6 +255,11 @@ public:
     bufferlist aio_bl;  // just a pile of refs
     atomic_t num_aio;
 
+    vector<extent_t> allocated; ///< block extents allocated, not yet in kv
+    vector<extent_t> released;  ///< block extents to free on commit
+    map<uint64_t,bufferlist> block_writes;  ///< unsubmitted block aio data
+    bool bdev_sync_queued;      ///< block device fsync already queued
+
     Mutex lock;
     Cond cond;
 
@@ -221,6 +276,7 @@ public:
 	wal_txn(NULL),
 	num_fsyncs_completed(0),
 	num_aio(0),
+	bdev_sync_queued(false),
 	lock("NewStore::TransContext::lock") {
       //cout << "txc new " << this << std::endl;
     }
@@ -465,6 +521,11 @@ private:
   int fsid_fd;  ///< open handle (locked) to $path/fsid
   int frag_fd;  ///< open handle to $path/fragments
   int fset_fd;  ///< open handle to $path/fragments/$cur_fid.fset
+  BlockDevice *bdev;           ///< raw block device (if any) for data
+  FreelistManager *freelist;   ///< free space on bdev
+  uint64_t block_size;         ///< allocation unit on bdev
+  int csum_type;               ///< extent_t::CSUM_* for new block writes
+  map<int,Compressor*> compressors;  ///< extent_t::COMP_* -> compressor
   bool mounted;
 
   RWLock coll_lock;    ///< rwlock to protect coll_map
@@ -492,7 +553,7 @@ private:
 
   AioCompletionThread aio_thread;
   bool aio_stop;
-  FS::aio_queue_t aio_queue;
+  FS::aio_queue_t *aio_queue;
 
   KVSyncThread kv_sync_thread;
   Mutex kv_lock;
@@ -501,7 +562,9 @@ private:
   deque<TransContext*> kv_queue, kv_committing;
   deque<TransContext*> wal_cleanup_queue, wal_cleaning;
 
-  Logger *logger;
+  PerfCounters *logger;
+
+  vector<OnodeLRUShard*> onode_lru_shards;
 
   Mutex reap_lock;
   Cond reap_cond;
@@ -526,9 +589,15 @@ private:
   void _close_frag();
   int _open_db(bool create);
   void _close_db();
+  int _create_block();
+  int _open_block();
+  void _close_block();
   int _open_collections();
   void _close_collections();
 
+  OnodeLRUShard *_get_onode_lru_shard(coll_t cid);
+  void _trim_onode_cache(OnodeLRUShard *shard);
+
   CollectionRef _get_collection(coll_t cid);
   void _queue_reap_collection(CollectionRef& c);
   void _reap_collections();
@@ -544,6 +613,21 @@ private:
   int _clean_fid_tail_fd(const fragment_t& f, int fd);
   int _clean_fid_tail(TransContext *txc, const fragment_t& f);
 
+  int _get_comp_type(CollectionRef& c);
+  Compressor *_get_compressor(int comp_type);
+
+  int _block_verify_csum(const extent_t& e, uint64_t x_off,
+			 const bufferlist& bl);
+  int _block_read_compressed(TransContext *txc, const extent_t& e,
+			     uint64_t x_off, uint64_t x_len, bufferlist *out);
+  int _block_read_extent(TransContext *txc, const extent_t& e,
+			 uint64_t x_off, uint64_t x_len, bufferlist *out);
+  int _block_write_extent(TransContext *txc, const extent_t& e,
+			  bufferlist& bl);
+  void _txc_update_freelist(TransContext *txc);
+  void _txc_release_extent(TransContext *txc, uint64_t offset,
+			   uint64_t length);
+
   TransContext *_txc_create(OpSequencer *osr);
   int _txc_add_transaction(TransContext *txc, Transaction *t);
   int _txc_finalize(OpSequencer *osr, TransContext *txc);
@@ -639,6 +723,18 @@ public:
     size_t len,
     bufferlist& bl,
     uint32_t op_flags = 0);
+  int _do_read_block(
+    TransContext *txc,
+    OnodeRef o,
+    uint64_t offset,
+    size_t len,
+    bufferlist& bl);
+  int _do_read_block_range(
+    TransContext *txc,
+    OnodeRef o,
+    uint64_t offset,
+    uint64_t len,
+    bufferlist *bl);
 
   int fiemap(coll_t cid, const ghobject_t& oid, uint64_t offset, size_t len, bufferlist& bl);
   int getattr(coll_t cid, const ghobject_t& oid, const char *name, bufferptr& value);
@@ -741,10 +837,33 @@ private:
 			     OnodeRef o);
   void _do_read_all_overlays(wal_transaction_t& wt);
   int _do_write(TransContext *txc,
+		CollectionRef& c,
 		OnodeRef o,
 		uint64_t offset, uint64_t length,
 		bufferlist& bl,
 		uint32_t fadvise_flags);
+  int _do_block_allocate_raw(TransContext *txc,
+			     OnodeRef o,
+			     uint64_t offset,
+			     bufferlist& data);
+  int _do_block_allocate(TransContext *txc,
+			 CollectionRef& c,
+			 OnodeRef o,
+			 uint64_t offset,
+			 bufferlist& data);
+  int _do_block_write(TransContext *txc,
+		      CollectionRef& c,
+		      OnodeRef o,
+		      uint64_t offset, uint64_t length,
+		      bufferlist& bl);
+  int _do_block_zero(TransContext *txc,
+		     CollectionRef& c,
+		     OnodeRef o,
+		     uint64_t offset, uint64_t length);
+  int _do_block_unmap(TransContext *txc,
+		      CollectionRef& c,
+		      OnodeRef o,
+		      uint64_t offset, uint64_t length);
   int _touch(TransContext *txc,
 	     CollectionRef& c,
 	     const ghobject_t& oid);
@@ -753,6 +872,7 @@ private:
 	    const ghobject_t& oid,
 	    uint64_t offset, size_t len);
   int _do_truncate(TransContext *txc,
+		   CollectionRef& c,
 		   OnodeRef o,
 		   uint64_t offset);
   int _truncate(TransContext *txc,
@@ -821,6 +941,8 @@ private:
   int _create_collection(TransContext *txc, coll_t cid, unsigned bits,
 			 CollectionRef *c);
   int _remove_collection(TransContext *txc, coll_t cid, CollectionRef *c);
+  int _collection_hint_compression(TransContext *txc, CollectionRef& c,
+				   const string& alg);
   int _split_collection(TransContext *txc,
 			CollectionRef& c,
 			CollectionRef& d,
@@ -19,21 +19,25 @@
 
 void cnode_t::encode(bufferlist& bl) const
 {
-  ENCODE_START(1, 1, bl);
+  ENCODE_START(2, 1, bl);
   ::encode(bits, bl);
+  ::encode(compression, bl);
   ENCODE_FINISH(bl);
 }
 
 void cnode_t::decode(bufferlist::iterator& p)
 {
-  DECODE_START(1, p);
+  DECODE_START(2, p);
   ::decode(bits, p);
+  if (struct_v >= 2)
+    ::decode(compression, p);
   DECODE_FINISH(p);
 }
 
 void cnode_t::dump(Formatter *f) const
 {
   f->dump_unsigned("bits", bits);
+  f->dump_string("compression", compression);
 }
 
 void cnode_t::generate_test_instances(list<cnode_t*>& o)
@@ -41,6 +45,8 @@ void cnode_t::generate_test_instances(list<cnode_t*>& o)
   o.push_back(new cnode_t());
   o.push_back(new cnode_t(0));
   o.push_back(new cnode_t(123));
+  o.push_back(new cnode_t(123));
+  o.back()->compression = "snappy";
 }
 
 // fit_t
@@ -98,6 +104,147 @@ ostream& operator<<(ostream& out, const fragment_t& f)
   return out;
 }
 
+// extent_t
+
+void extent_t::encode(bufferlist& bl) const
+{
+  ENCODE_START(3, 1, bl);
+  ::encode(offset, bl);
+  ::encode(length, bl);
+  ::encode(csum_type, bl);
+  ::encode(csum, bl);
+  ::encode(comp_type, bl);
+  if (comp_type != COMP_NONE) {
+    ::encode(raw_length, bl);
+    ::encode(comp_length, bl);
+  }
+  ENCODE_FINISH(bl);
+}
+
+void extent_t::decode(bufferlist::iterator& p)
+{
+  DECODE_START(3, p);
+  ::decode(offset, p);
+  ::decode(length, p);
+  if (struct_v >= 2) {
+    ::decode(csum_type, p);
+    ::decode(csum, p);
+  } else {
+    csum_type = CSUM_NONE;
+    csum.clear();
+  }
+  comp_type = COMP_NONE;
+  raw_length = comp_length = 0;
+  if (struct_v >= 3) {
+    ::decode(comp_type, p);
+    if (comp_type != COMP_NONE) {
+      ::decode(raw_length, p);
+      ::decode(comp_length, p);
+    }
+  }
+  DECODE_FINISH(p);
+}
+
+void extent_t::dump(Formatter *f) const
+{
+  f->dump_unsigned("offset", offset);
+  f->dump_unsigned("length", length);
+  f->dump_string("csum_type", get_csum_type_name(csum_type));
+  f->open_array_section("csum");
+  for (vector<uint32_t>::const_iterator p = csum.begin(); p != csum.end(); ++p)
+    f->dump_unsigned("csum", *p);
+  f->close_section();
+  f->dump_string("comp_type", get_comp_type_name(comp_type));
+  if (is_compressed()) {
+    f->dump_unsigned("raw_length", raw_length);
+    f->dump_unsigned("comp_length", comp_length);
+  }
+}
+
+void extent_t::generate_test_instances(list<extent_t*>& o)
+{
+  o.push_back(new extent_t());
+  o.push_back(new extent_t(4096, 65536));
+  o.push_back(new extent_t(8192, 8192));
+  o.back()->csum_type = CSUM_CRC32C;
+  o.back()->csum.push_back(0x12345678);
+  o.back()->csum.push_back(0x9abcdef0);
+  o.push_back(new extent_t(16384, 4096));
+  o.back()->comp_type = COMP_SNAPPY;
+  o.back()->raw_length = 65536;
+  o.back()->comp_length = 3000;
+}
+
+void extent_t::calc_csum(int type, uint32_t csum_block_size,
+			 const bufferlist& bl)
+{
+  assert(bl.length() == length);
+  csum_type = type;
+  csum.clear();
+  if (type == CSUM_NONE)
+    return;
+  assert(csum_block_size > 0);
+  assert(length % csum_block_size == 0);
+  csum.reserve(length / csum_block_size);
+  for (uint32_t pos = 0; pos < length; pos += csum_block_size) {
+    bufferlist t;
+    t.substr_of(bl, pos, csum_block_size);
+    csum.push_back(t.crc32c(-1));
+  }
+}
+
+int extent_t::verify_csum(uint32_t x_off, const bufferlist& bl,
+			  uint32_t *bad_off) const
+{
+  if (!has_csum())
+    return 0;
+  uint32_t cbs = get_csum_block_size();
+  assert(x_off % cbs == 0);
+  assert(bl.length() % cbs == 0);
+  assert(x_off + bl.length() <= length);
+  unsigned i = x_off / cbs;
+  for (uint32_t pos = 0; pos < bl.length(); pos += cbs, ++i) {
+    bufferlist t;
+    t.substr_of(bl, pos, cbs);
+    if (t.crc32c(-1) != csum[i]) {
+      if (bad_off)
+	*bad_off = x_off + pos;
+      return -EIO;
+    }
+  }
+  return 0;
+}
+
+void extent_t::split(uint32_t x_off, uint32_t x_len, extent_t *out) const
+{
+  assert(!is_compressed());
+  assert(x_off + x_len <= length);
+  out->offset = offset + x_off;
+  out->length = x_len;
+  out->csum_type = csum_type;
+  out->csum.clear();
+  if (has_csum()) {
+    uint32_t cbs = get_csum_block_size();
+    assert(x_off % cbs == 0);
+    assert(x_len % cbs == 0);
+    out->csum.assign(csum.begin() + x_off / cbs,
+		     csum.begin() + (x_off + x_len) / cbs);
+  }
+}
+
+ostream& operator<<(ostream& out, const extent_t& e)
+{
+  out << "extent(" << e.offset << "~" << e.length;
+  if (e.has_csum())
+    out << " " << extent_t::get_csum_type_name(e.csum_type) << "/"
+	<< e.get_csum_block_size();
+  if (e.is_compressed())
+    out << " " << extent_t::get_comp_type_name(e.comp_type) << " "
+	<< e.comp_length << "/" << e.raw_length;
+  out << ")";
+  return out;
+}
+
 // overlay_t
 
 void overlay_t::encode(bufferlist& bl) const
@@ -142,7 +289,7 @@ ostream& operator<<(ostream& out, const overlay_t& o)
 
 void onode_t::encode(bufferlist& bl) const
 {
-  ENCODE_START(1, 1, bl);
+  ENCODE_START(2, 1, bl);
   ::encode(nid, bl);
   ::encode(size, bl);
   ::encode(attrs, bl);
@@ -153,12 +300,13 @@ void onode_t::encode(bufferlist& bl) const
   ::encode(omap_head, bl);
   ::encode(expected_object_size, bl);
   ::encode(expected_write_size, bl);
+  ::encode(block_map, bl);
   ENCODE_FINISH(bl);
 }
 
 void onode_t::decode(bufferlist::iterator& p)
 {
-  DECODE_START(1, p);
+  DECODE_START(2, p);
   ::decode(nid, p);
   ::decode(size, p);
   ::decode(attrs, p);
@@ -169,6 +317,9 @@ void onode_t::decode(bufferlist::iterator& p)
   ::decode(omap_head, p);
   ::decode(expected_object_size, p);
   ::decode(expected_write_size, p);
+  if (struct_v >= 2) {
+    ::decode(block_map, p);
+  }
   DECODE_FINISH(p);
 }
 
@@ -193,6 +344,15 @@ void onode_t::dump(Formatter *f) const
     f->close_section();
   }
   f->close_section();
+  f->open_object_section("block_map");
+  for (map<uint64_t, extent_t>::const_iterator p = block_map.begin();
+       p != block_map.end(); ++p) {
+    f->open_object_section("extent");
+    f->dump_unsigned("logical_offset", p->first);
+    p->second.dump(f);
+    f->close_section();
+  }
+  f->close_section();
   f->open_object_section("overlays");
   for (map<uint64_t, overlay_t>::const_iterator p = overlay_map.begin();
        p != overlay_map.end(); ++p) {
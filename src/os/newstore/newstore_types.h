@@ -25,6 +25,7 @@ namespace ceph {
 /// collection metadata
 struct cnode_t {
   uint32_t bits;   ///< how many bits of coll pgid are significant
+  string compression;  ///< compression algorithm; empty for default
 
   cnode_t(int b=0) : bits(b) {}
 
@@ -90,6 +91,107 @@ WRITE_CLASS_ENCODER(fragment_t)
 
 ostream& operator<<(ostream& out, const fragment_t& o);
 
+/// extent: a contiguous byte range on the raw block device
+struct extent_t {
+  enum {
+    CSUM_NONE = 0,
+    CSUM_CRC32C = 1,
+  };
+  static const char *get_csum_type_name(int t) {
+    switch (t) {
+    case CSUM_NONE: return "none";
+    case CSUM_CRC32C: return "crc32c";
+    default: return "???";
+    }
+  }
+  static int get_csum_type_by_name(const string& s) {
+    if (s == "none")
+      return CSUM_NONE;
+    if (s == "crc32c")
+      return CSUM_CRC32C;
+    return -EINVAL;
+  }
+
+  enum {
+    COMP_NONE = 0,
+    COMP_SNAPPY = 1,
+  };
+  static const char *get_comp_type_name(int t) {
+    switch (t) {
+    case COMP_NONE: return "none";
+    case COMP_SNAPPY: return "snappy";
+    default: return "???";
+    }
+  }
+  static int get_comp_type_by_name(const string& s) {
+    if (s == "none")
+      return COMP_NONE;
+    if (s == "snappy")
+      return COMP_SNAPPY;
+    return -EINVAL;
+  }
+
+  uint64_t offset;   ///< offset on the block device
+  uint32_t length;   ///< length of extent
+  uint8_t csum_type; ///< CSUM_*
+  vector<uint32_t> csum;  ///< one checksum per csum block
+  uint8_t comp_type;     ///< COMP_*
+  uint32_t raw_length;   ///< logical length, if compressed
+  uint32_t comp_length;  ///< compressed bytes at the start of the extent
+
+  extent_t()
+    : offset(0), length(0), csum_type(CSUM_NONE),
+      comp_type(COMP_NONE), raw_length(0), comp_length(0) {}
+  extent_t(uint64_t o, uint32_t l)
+    : offset(o), length(l), csum_type(CSUM_NONE),
+      comp_type(COMP_NONE), raw_length(0), comp_length(0) {}
+
+  uint64_t end() const {
+    return offset + length;
+  }
+
+  bool is_compressed() const {
+    return comp_type != COMP_NONE;
+  }
+  /// bytes of object data this extent maps
+  uint32_t logical_length() const {
+    return is_compressed() ? raw_length : length;
+  }
+
+  bool has_csum() const {
+    return csum_type != CSUM_NONE && !csum.empty();
+  }
+  /// bytes covered by each entry in csum
+  uint32_t get_csum_block_size() const {
+    assert(!csum.empty());
+    return length / csum.size();
+  }
+
+  /// compute checksums for our content in units of csum_block_size
+  void calc_csum(int type, uint32_t csum_block_size, const bufferlist& bl);
+  /**
+   * verify content against our checksums
+   *
+   * @param x_off offset of bl within the extent; must be csum block aligned
+   * @param bl data; length must be csum block aligned
+   * @param bad_off [out] extent offset of the first bad csum block
+   * @returns 0 on success, -EIO on mismatch
+   */
+  int verify_csum(uint32_t x_off, const bufferlist& bl,
+		  uint32_t *bad_off) const;
+  /// trim to the [x_off, x_off+x_len) subrange, keeping matching csums.
+  /// compressed extents cannot be split.
+  void split(uint32_t x_off, uint32_t x_len, extent_t *out) const;
+
+  void encode(bufferlist& bl) const;
+  void decode(bufferlist::iterator& p);
+  void dump(Formatter *f) const;
+  static void generate_test_instances(list<extent_t*>& o);
+};
+WRITE_CLASS_ENCODER(extent_t)
+
+ostream& operator<<(ostream& out, const extent_t& e);
+
 struct overlay_t {
   uint64_t key;          ///< key (offset of start of original k/v pair)
   uint32_t value_offset; ///< offset in associated value for this extent
@@ -115,6 +217,7 @@ struct onode_t {
   uint64_t size;                       ///< object size
   map<string, bufferptr> attrs;        ///< attrs
   map<uint64_t, fragment_t> data_map;  ///< data (offset to fragment mapping)
+  map<uint64_t, extent_t> block_map;   ///< data (offset to block extent mapping)
   map<uint64_t,overlay_t> overlay_map; ///< overlay data (stored in db)
   set<uint64_t> shared_overlays;       ///< overlay keys that are shared
   uint32_t last_overlay_key;           ///< key for next overlay
@@ -22,6 +22,7 @@
 #include "messages/MOSDPGPush.h"
 #include "messages/MOSDPGPushReply.h"
 #include "ReplicatedPG.h"
+#include "common/errno.h"
 
 class ReplicatedPG;
 
@@ -944,7 +945,8 @@ void ECBackend::handle_sub_read(
       // are read in sections, so the digest check here won't be done here.
       // Do NOT check osd_read_eio_on_bad_digest here.  We need to report
       // the state of our chunk in case other chunks could substitute.
-      if ((bl.length() == hinfo->get_total_chunk_size()) &&
+      if (hinfo->has_chunk_hash() &&
+	  (bl.length() == hinfo->get_total_chunk_size()) &&
 	  (j->get<0>() == 0)) {
 	dout(20) << __func__ << ": Checking hash of " << i->first << dendl;
 	bufferhash h(-1);
@@ -958,6 +960,16 @@ void ECBackend::handle_sub_read(
 	  goto error;
 	}
       }
+      uint64_t bad_off;
+      if (hinfo->has_stripe_hashes() &&
+	  !hinfo->check_stripe_hashes(shard, j->get<0>(), bl, &bad_off)) {
+	get_parent()->clog_error() << __func__ << ": Bad hash for " << i->first
+				   << " chunk at 0x" << hex << bad_off << dec << "\n";
+	dout(5) << __func__ << ": Bad hash for " << i->first
+		<< " chunk at 0x" << hex << bad_off << dec << dendl;
+	r = -EIO;
+	goto error;
+      }
     }
     continue;
 error:
@@ -1266,6 +1278,7 @@ void ECBackend::check_recovery_sources(const OSDMapRef osdmap)
 void ECBackend::on_change()
 {
   dout(10) << __func__ << dendl;
+  waiting_state.clear();
   writing.clear();
   tid_to_op_map.clear();
   for (map<ceph_tid_t, ReadOp>::iterator i = tid_to_read_map.begin();
@@ -1336,6 +1349,11 @@ struct MustPrependHashInfo : public ObjectModDesc::Visitor {
       state = FOUND_APPEND;
     }
   }
+  void rollback_extents(version_t, uint64_t, interval_set<uint64_t> &) {
+    if (state == EMPTY) {
+      state = FOUND_APPEND;
+    }
+  }
   void rmobject(version_t) {
     if (state == EMPTY) {
       state = FOUND_CREATE_STASH;
@@ -1382,6 +1400,13 @@ void ECBackend::submit_transaction(
   
   op->t = static_cast<ECTransaction*>(_t);
 
+  dout(10) << __func__ << ": op " << *op << " queued" << dendl;
+  waiting_state.push_back(op);
+  check_waiting();
+}
+
+void ECBackend::plan_write(Op *op)
+{
   set<hobject_t, hobject_t::BitwiseComparator> need_hinfos;
   op->t->get_append_objects(&need_hinfos);
   for (set<hobject_t, hobject_t::BitwiseComparator>::iterator i = need_hinfos.begin();
@@ -1422,10 +1447,186 @@ void ECBackend::submit_transaction(
     }
   }
 
-  dout(10) << __func__ << ": op " << *op << " starting" << dendl;
-  start_write(op);
-  writing.push_back(op);
-  dout(10) << "onreadable_sync: " << op->on_local_applied_sync << dendl;
+  op->t->get_rmw_stripes(op->unstable_hash_infos, sinfo, &(op->rmw_pending));
+  op->planned = true;
+}
+
+bool ECBackend::rmw_blocked(Op *op)
+{
+  // the stripes must be read back after earlier writes to them applied
+  for (list<Op*>::iterator i = writing.begin(); i != writing.end(); ++i) {
+    if ((*i)->pending_apply.empty())
+      continue;
+    for (map<hobject_t, set<uint64_t>, hobject_t::BitwiseComparator>::iterator j =
+	   op->rmw_pending.begin();
+	 j != op->rmw_pending.end();
+	 ++j) {
+      if ((*i)->unstable_hash_infos.count(j->first))
+	return true;
+    }
+  }
+  return false;
+}
+
+struct OnRMWReadComplete :
+  public GenContext<pair<RecoveryMessages*, ECBackend::read_result_t& > &> {
+  ECBackend *ec;
+  ceph_tid_t tid;
+  hobject_t hoid;
+  OnRMWReadComplete(ECBackend *ec, ceph_tid_t tid, const hobject_t &hoid)
+    : ec(ec), tid(tid), hoid(hoid) {}
+  void finish(pair<RecoveryMessages *, ECBackend::read_result_t &> &in) {
+    ec->handle_rmw_read(tid, hoid, in.second);
+  }
+};
+
+void ECBackend::start_rmw_read(Op *op)
+{
+  set<int> want_to_read;
+  get_want_to_read_shards(&want_to_read);
+
+  // the first round reads the minimum set of shards, a retry reads
+  // every shard we have so a single bad one cannot block the write
+  bool redundant = op->rmw_attempts > 0;
+  map<hobject_t, read_request_t, hobject_t::BitwiseComparator> for_read_op;
+  for (map<hobject_t, set<uint64_t>, hobject_t::BitwiseComparator>::iterator i =
+	 op->rmw_pending.begin();
+       i != op->rmw_pending.end();
+       ++i) {
+    // one read per run of adjacent stripes
+    list<boost::tuple<uint64_t, uint64_t, uint32_t> > offsets;
+    for (set<uint64_t>::iterator j = i->second.begin();
+	 j != i->second.end();
+	 ++j) {
+      if (!offsets.empty() &&
+	  offsets.back().get<0>() + offsets.back().get<1>() == *j) {
+	offsets.back().get<1>() += sinfo.get_stripe_width();
+      } else {
+	offsets.push_back(boost::make_tuple(*j, sinfo.get_stripe_width(), 0));
+      }
+    }
+    set<pg_shard_t> shards;
+    int r = get_min_avail_to_read_shards(
+      i->first,
+      want_to_read,
+      false,
+      redundant,
+      &shards);
+    if (r < 0) {
+      for (map<hobject_t, read_request_t, hobject_t::BitwiseComparator>::iterator j =
+	     for_read_op.begin();
+	   j != for_read_op.end();
+	   ++j)
+	delete j->second.cb;
+      fail_rmw_read(op, i->first, r);
+      return;
+    }
+    for_read_op.insert(
+      make_pair(
+	i->first,
+	read_request_t(
+	  i->first,
+	  offsets,
+	  shards,
+	  false,
+	  new OnRMWReadComplete(this, op->tid, i->first))));
+  }
+  dout(10) << __func__ << ": op " << *op << " reading " << op->rmw_pending
+	   << (redundant ? " from all shards" : "") << dendl;
+  op->rmw_reading = for_read_op.size();
+  ++op->rmw_attempts;
+  start_read_op(
+    cct->_conf->osd_client_op_priority,
+    for_read_op,
+    op->client_op,
+    redundant, false);
+}
+
+void ECBackend::fail_rmw_read(Op *op, const hobject_t &hoid, int r)
+{
+  // The log entries and in-memory object state for op are already
+  // committed to, so the write cannot be failed back to the client.
+  // Leave it (and everything queued behind it) blocked until the
+  // next interval change requeues it against a new acting set.
+  derr << __func__ << ": unable to read " << hoid << " for " << *op
+       << ": " << cpp_strerror(r) << dendl;
+  get_parent()->clog_error() << "unable to read " << hoid
+			     << " to overwrite it: " << cpp_strerror(r)
+			     << ", blocking writes until the next interval\n";
+  op->rmw_failed = true;
+}
+
+void ECBackend::handle_rmw_read(
+  ceph_tid_t tid,
+  const hobject_t &hoid,
+  read_result_t &res)
+{
+  map<ceph_tid_t, Op>::iterator i = tid_to_op_map.find(tid);
+  assert(i != tid_to_op_map.end());
+  Op *op = &(i->second);
+  assert(op->rmw_reading > 0);
+  --op->rmw_reading;
+
+  int r = res.r;
+  ECTransaction::stripes_t stripes;
+  for (list<boost::tuple<uint64_t, uint64_t, map<pg_shard_t, bufferlist> > >::iterator j =
+	 res.returned.begin();
+       r == 0 && j != res.returned.end();
+       ++j) {
+    map<int, bufferlist> to_decode;
+    for (map<pg_shard_t, bufferlist>::iterator k = j->get<2>().begin();
+	 k != j->get<2>().end();
+	 ++k) {
+      to_decode[k->first.shard].claim(k->second);
+    }
+    bufferlist bl;
+    r = ECUtil::decode(sinfo, ec_impl, to_decode, &bl);
+    if (r == 0 && bl.length() != j->get<1>())
+      r = -EIO;
+    if (r < 0)
+      break;
+    for (uint64_t off = 0; off < bl.length(); off += sinfo.get_stripe_width()) {
+      stripes[j->get<0>() + off].substr_of(
+	bl, off, sinfo.get_stripe_width());
+    }
+  }
+  if (r == 0) {
+    op->rmw_stripes[hoid].swap(stripes);
+    op->rmw_pending.erase(hoid);
+  } else {
+    dout(5) << __func__ << ": reading " << hoid << " for " << *op
+	    << " failed with " << r << dendl;
+  }
+
+  if (op->rmw_reading)
+    return;
+  if (op->rmw_pending.empty()) {
+    check_waiting();
+  } else if (op->rmw_attempts < 2) {
+    start_rmw_read(op);
+  } else {
+    fail_rmw_read(op, op->rmw_pending.begin()->first, r < 0 ? r : -EIO);
+  }
+}
+
+void ECBackend::check_waiting()
+{
+  while (!waiting_state.empty()) {
+    Op *op = waiting_state.front();
+    if (!op->planned)
+      plan_write(op);
+    if (op->rmw_reading || op->rmw_failed)
+      return;
+    if (!op->rmw_pending.empty()) {
+      if (!rmw_blocked(op))
+	start_rmw_read(op);
+      return;
+    }
+    waiting_state.pop_front();
+    dout(10) << __func__ << ": op " << *op << " starting" << dendl;
+    start_write(op);
+    writing.push_back(op);
+  }
 }
 
 int ECBackend::get_min_avail_to_read_shards(
@@ -1713,7 +1914,10 @@ ECUtil::HashInfoRef ECBackend::get_hash_info(
       coll,
       ghobject_t(hoid, ghobject_t::NO_GEN, get_parent()->whoami_shard().shard),
       &st);
-    ECUtil::HashInfo hinfo(ec_impl->get_chunk_count());
+    ECUtil::HashInfo hinfo(
+      ec_impl->get_chunk_count(),
+      get_parent()->get_pool().allows_ec_overwrites() ?
+        sinfo.get_chunk_size() : 0);
     // XXX: What does it mean if there is no object on disk?
     if (r >= 0) {
       dout(10) << __func__ << ": found on disk, size " << st.st_size << dendl;
@@ -1764,6 +1968,7 @@ void ECBackend::check_op(Op *op)
        ++i) {
     dout(20) << __func__ << " tid " << i->first <<": " << i->second << dendl;
   }
+  check_waiting();
 }
 
 void ECBackend::start_write(Op *op) {
@@ -1780,6 +1985,7 @@ void ECBackend::start_write(Op *op) {
 
   op->t->generate_transactions(
     op->unstable_hash_infos,
+    op->rmw_stripes,
     ec_impl,
     get_parent()->get_info().pgid.pgid,
     sinfo,
@@ -2048,6 +2254,51 @@ void ECBackend::rollback_append(
       old_size));
 }
 
+void ECBackend::rollback_extents(
+  const hobject_t &hoid,
+  version_t gen,
+  uint64_t old_size,
+  const interval_set<uint64_t> &extents,
+  ObjectStore::Transaction *t)
+{
+  generate_rollback_extents(
+    sinfo, coll, hoid, get_parent()->whoami_shard().shard,
+    gen, old_size, extents, t);
+}
+
+void ECBackend::generate_rollback_extents(
+  const ECUtil::stripe_info_t &sinfo,
+  const coll_t &coll,
+  const hobject_t &hoid,
+  shard_id_t shard,
+  version_t gen,
+  uint64_t old_size,
+  const interval_set<uint64_t> &extents,
+  ObjectStore::Transaction *t)
+{
+  // the same chunk ranges ECTransaction saved before overwriting them
+  interval_set<uint64_t> saved;
+  sinfo.extents_to_chunk_ranges(old_size, extents, &saved);
+  ghobject_t head(hoid, ghobject_t::NO_GEN, shard);
+  ghobject_t stash(hoid, gen, shard);
+  t->truncate(
+    coll,
+    head,
+    sinfo.logical_to_next_chunk_offset(old_size));
+  for (interval_set<uint64_t>::iterator i = saved.begin();
+       i != saved.end();
+       ++i) {
+    t->clone_range(
+      coll,
+      stash,
+      head,
+      i.get_start(),
+      i.get_len(),
+      i.get_start());
+  }
+  t->remove(coll, stash);
+}
+
 void ECBackend::be_deep_scrub(
   const hobject_t &poid,
   uint32_t seed,
@@ -2062,6 +2313,8 @@ void ECBackend::be_deep_scrub(
 
   uint32_t fadvise_flags = CEPH_OSD_OP_FLAG_FADVISE_SEQUENTIAL | CEPH_OSD_OP_FLAG_FADVISE_DONTNEED;
 
+  ECUtil::HashInfoRef hinfo = get_hash_info(poid, false);
+  uint64_t bad_off = 0;
   while (true) {
     bufferlist bl;
     handle.reset_tp_timeout();
@@ -2078,6 +2331,14 @@ void ECBackend::be_deep_scrub(
       r = -EIO;
       break;
     }
+    if (hinfo && hinfo->has_stripe_hashes() &&
+	!hinfo->check_stripe_hashes(
+	  get_parent()->whoami_shard().shard, pos, bl, &bad_off)) {
+      dout(0) << "_scan_list  " << poid << " got incorrect hash for chunk at "
+	      << bad_off << dendl;
+      o.read_error = true;
+      return;
+    }
     pos += r;
     h << bl;
     if ((unsigned)r < stride)
@@ -2091,14 +2352,14 @@ void ECBackend::be_deep_scrub(
     return;
   }
 
-  ECUtil::HashInfoRef hinfo = get_hash_info(poid, false);
   if (!hinfo) {
     dout(0) << "_scan_list  " << poid << " could not retrieve hash info" << dendl;
     o.read_error = true;
     o.digest_present = false;
     return;
   } else {
-    if (hinfo->get_chunk_hash(get_parent()->whoami_shard().shard) != h.digest()) {
+    if (hinfo->has_chunk_hash() &&
+	hinfo->get_chunk_hash(get_parent()->whoami_shard().shard) != h.digest()) {
       dout(0) << "_scan_list  " << poid << " got incorrect hash on read" << dendl;
       o.read_error = true;
       return;
@@ -2115,9 +2376,18 @@ void ECBackend::be_deep_scrub(
      * our locally stored hash of shard 0 on the assumption that if
      * we match our chunk hash and our recollection of the hash for
      * chunk 0 matches that of our peers, there is likely no corruption.
+     * Objects overwritten in place were checked stripe by stripe above
+     * and send the digest of the stripe hashes of chunk 0 instead.
      */
-    o.digest = hinfo->get_chunk_hash(0);
-    o.digest_present = true;
+    if (hinfo->has_chunk_hash()) {
+      o.digest = hinfo->get_chunk_hash(0);
+      o.digest_present = true;
+    } else if (hinfo->has_stripe_hashes()) {
+      o.digest = hinfo->get_stripe_hashes_digest(0);
+      o.digest_present = true;
+    } else {
+      o.digest_present = false;
+    }
   }
 
   o.omap_digest = seed;
@@ -344,6 +344,11 @@ public:
    * As with client reads, there is a possibility of out-of-order
    * completions. Thus, callbacks and completion are called in order
    * on the writing list.
+   *
+   * Ops partially overwriting stripes first read those stripes back
+   * (read-modify-write).  Ops wait in order on waiting_state until the
+   * ones ahead of them were sent and, if they need stripes, until
+   * earlier writes to those objects were applied and the read returned.
    */
   struct Op {
     hobject_t hoid;
@@ -368,6 +373,15 @@ public:
     set<pg_shard_t> pending_apply;
 
     map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator> unstable_hash_infos;
+
+    bool planned;       ///< hash infos and stripes to read are known
+    unsigned rmw_reading;  ///< object reads still outstanding
+    unsigned rmw_attempts; ///< read rounds issued for rmw_pending
+    bool rmw_failed;       ///< stripes unreadable, wait for on_change
+    map<hobject_t, set<uint64_t>, hobject_t::BitwiseComparator> rmw_pending;
+    ECTransaction::stripe_map_t rmw_stripes;
+
+    Op() : planned(false), rmw_reading(0), rmw_attempts(0), rmw_failed(false) {}
     ~Op() {
       delete t;
       delete on_local_applied_sync;
@@ -397,6 +411,7 @@ public:
     RecoveryMessages *m);
 
   map<ceph_tid_t, Op> tid_to_op_map; /// lists below point into here
+  list<Op*> waiting_state;
   list<Op*> writing;
 
   CephContext *cct;
@@ -459,7 +474,17 @@ public:
   ECUtil::HashInfoRef get_hash_info(const hobject_t &hoid, bool checks = true);
 
   friend struct ReadCB;
+  friend struct OnRMWReadComplete;
   void check_op(Op *op);
+  void plan_write(Op *op);
+  bool rmw_blocked(Op *op);
+  void start_rmw_read(Op *op);
+  void fail_rmw_read(Op *op, const hobject_t &hoid, int r);
+  void handle_rmw_read(
+    ceph_tid_t tid,
+    const hobject_t &hoid,
+    read_result_t &res);
+  void check_waiting();
   void start_write(Op *op);
 public:
   ECBackend(
@@ -493,6 +518,23 @@ public:
     uint64_t old_size,
     ObjectStore::Transaction *t);
 
+  void rollback_extents(
+    const hobject_t &hoid,
+    version_t gen,
+    uint64_t old_size,
+    const interval_set<uint64_t> &extents,
+    ObjectStore::Transaction *t);
+  /// copy the chunk ranges of extents saved in stash gen back to head
+  static void generate_rollback_extents(
+    const ECUtil::stripe_info_t &sinfo,
+    const coll_t &coll,
+    const hobject_t &hoid,
+    shard_id_t shard,
+    version_t gen,
+    uint64_t old_size,
+    const interval_set<uint64_t> &extents,
+    ObjectStore::Transaction *t);
+
   bool scrub_supported() { return true; }
   bool auto_repair_supported() const { return true; }
 
@@ -28,6 +28,9 @@ struct AppendObjectsGenerator: public boost::static_visitor<void> {
   void operator()(const ECTransaction::AppendOp &op) {
     out->insert(op.oid);
   }
+  void operator()(const ECTransaction::OverwriteOp &op) {
+    out->insert(op.oid);
+  }
   void operator()(const ECTransaction::TouchOp &op) {
     out->insert(op.oid);
   }
@@ -57,6 +60,112 @@ void ECTransaction::get_append_objects(
   reverse_visit(gen);
 }
 
+struct RMWStripePlanner : public boost::static_visitor<void> {
+  struct ObjState {
+    uint64_t size;         ///< projected size, stripe aligned
+    bool on_disk;          ///< other stripes below size can be read back
+    set<uint64_t> written; ///< stripes written by this transaction
+    bool stripe_hashes;    ///< HashInfo has per stripe hashes
+    ObjState() : size(0), on_disk(false), stripe_hashes(false) {}
+  };
+  map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator> &hash_infos;
+  const ECUtil::stripe_info_t &sinfo;
+  map<hobject_t, set<uint64_t>, hobject_t::BitwiseComparator> *out;
+  map<hobject_t, ObjState, hobject_t::BitwiseComparator> objs;
+  RMWStripePlanner(
+    map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator> &hash_infos,
+    const ECUtil::stripe_info_t &sinfo,
+    map<hobject_t, set<uint64_t>, hobject_t::BitwiseComparator> *out)
+    : hash_infos(hash_infos), sinfo(sinfo), out(out) {}
+
+  ObjState &get(const hobject_t &oid) {
+    map<hobject_t, ObjState, hobject_t::BitwiseComparator>::iterator i =
+      objs.find(oid);
+    if (i == objs.end()) {
+      assert(hash_infos.count(oid));
+      ObjState s;
+      s.size = sinfo.aligned_chunk_offset_to_logical_offset(
+	hash_infos[oid]->get_total_chunk_size());
+      s.on_disk = true;
+      s.stripe_hashes = hash_infos[oid]->has_stripe_hashes();
+      i = objs.insert(make_pair(oid, s)).first;
+    }
+    return i->second;
+  }
+  void write(ObjState &s, uint64_t off, uint64_t len) {
+    uint64_t end = sinfo.logical_to_next_stripe_offset(off + len);
+    for (uint64_t i = sinfo.logical_to_prev_stripe_offset(off);
+	 i < end;
+	 i += sinfo.get_stripe_width())
+      s.written.insert(i);
+    s.size = std::max(s.size, end);
+  }
+  void need(const hobject_t &oid, ObjState &s, uint64_t stripe) {
+    if (stripe >= s.size || s.written.count(stripe))
+      return;
+    // clone and rename targets are only ever rewritten whole
+    assert(s.on_disk);
+    (*out)[oid].insert(stripe);
+  }
+
+  void operator()(const ECTransaction::AppendOp &op) {
+    write(get(op.oid), op.off, op.bl.length());
+  }
+  void operator()(const ECTransaction::OverwriteOp &op) {
+    ObjState &s = get(op.oid);
+    uint64_t end = op.off + op.bl.length();
+    if (op.off % sinfo.get_stripe_width())
+      need(op.oid, s, sinfo.logical_to_prev_stripe_offset(op.off));
+    if (end % sinfo.get_stripe_width())
+      need(op.oid, s, sinfo.logical_to_prev_stripe_offset(end));
+    uint64_t old_size = s.size;
+    write(s, op.off, op.bl.length());
+    if (!s.stripe_hashes) {
+      // the first overwrite hashes every stripe, see TransGenerator
+      for (uint64_t i = 0; i < old_size; i += sinfo.get_stripe_width())
+	need(op.oid, s, i);
+      s.stripe_hashes = true;
+    }
+  }
+  void reset(ObjState &s) {
+    bool stripe_hashes = s.stripe_hashes;
+    s = ObjState();
+    s.stripe_hashes = stripe_hashes;
+  }
+  void operator()(const ECTransaction::CloneOp &op) {
+    ObjState &source = get(op.source);
+    ObjState &target = get(op.target);
+    target = source;
+    target.on_disk = false;
+  }
+  void operator()(const ECTransaction::RenameOp &op) {
+    ObjState &source = get(op.source);
+    ObjState &destination = get(op.destination);
+    destination = source;
+    destination.on_disk = false;
+    reset(source);
+  }
+  void operator()(const ECTransaction::StashOp &op) {
+    reset(get(op.oid));
+  }
+  void operator()(const ECTransaction::RemoveOp &op) {
+    reset(get(op.oid));
+  }
+  void operator()(const ECTransaction::TouchOp &op) {}
+  void operator()(const ECTransaction::SetAttrsOp &op) {}
+  void operator()(const ECTransaction::RmAttrOp &op) {}
+  void operator()(const ECTransaction::AllocHintOp &op) {}
+  void operator()(const ECTransaction::NoOp &op) {}
+};
+void ECTransaction::get_rmw_stripes(
+  map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator> &hash_infos,
+  const ECUtil::stripe_info_t &sinfo,
+  map<hobject_t, set<uint64_t>, hobject_t::BitwiseComparator> *out) const
+{
+  RMWStripePlanner planner(hash_infos, sinfo, out);
+  visit(planner);
+}
+
 struct TransGenerator : public boost::static_visitor<void> {
   map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator> &hash_infos;
 
@@ -68,8 +177,18 @@ struct TransGenerator : public boost::static_visitor<void> {
   set<hobject_t, hobject_t::BitwiseComparator> *temp_added;
   set<hobject_t, hobject_t::BitwiseComparator> *temp_removed;
   stringstream *out;
+
+  /// stripe contents as of the op being generated, for overwrites
+  bool cache_stripes;
+  ECTransaction::stripe_map_t stripes;
+  /// hash info before the transaction, and chunk ranges saved since
+  map<hobject_t, ECUtil::HashInfo, hobject_t::BitwiseComparator> orig_hinfo;
+  map<hobject_t, pair<version_t, interval_set<uint64_t> >,
+      hobject_t::BitwiseComparator> saved;
+
   TransGenerator(
     map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator> &hash_infos,
+    const ECTransaction::stripe_map_t &stripes,
     ErasureCodeInterfaceRef &ecimpl,
     pg_t pgid,
     const ECUtil::stripe_info_t &sinfo,
@@ -82,10 +201,78 @@ struct TransGenerator : public boost::static_visitor<void> {
       sinfo(sinfo),
       trans(trans),
       temp_added(temp_added), temp_removed(temp_removed),
-      out(out) {
+      out(out),
+      cache_stripes(false),
+      stripes(stripes) {
     for (unsigned i = 0; i < ecimpl->get_chunk_count(); ++i) {
       want.insert(i);
     }
+    for (map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator>::iterator i =
+	   hash_infos.begin();
+	 i != hash_infos.end();
+	 ++i) {
+      orig_hinfo[i->first] = *(i->second);
+    }
+  }
+
+  /**
+   * Put back the data overwritten earlier in this transaction
+   *
+   * Before the object is stashed, so that the stash holds the object
+   * as of the start of the transaction.
+   */
+  void restore_saved(const hobject_t &oid) {
+    if (!saved.count(oid))
+      return;
+    version_t gen = saved[oid].first;
+    interval_set<uint64_t> &ranges = saved[oid].second;
+    bufferlist hbuf;
+    ::encode(orig_hinfo[oid], hbuf);
+    for (map<shard_id_t, ObjectStore::Transaction>::iterator i = trans->begin();
+	 i != trans->end();
+	 ++i) {
+      coll_t cid(get_coll(i->first));
+      ghobject_t head(oid, ghobject_t::NO_GEN, i->first);
+      ghobject_t stash(oid, gen, i->first);
+      i->second.truncate(cid, head, orig_hinfo[oid].get_total_chunk_size());
+      for (interval_set<uint64_t>::iterator j = ranges.begin();
+	   j != ranges.end();
+	   ++j) {
+	i->second.clone_range(
+	  cid, stash, head, j.get_start(), j.get_len(), j.get_start());
+      }
+      i->second.remove(cid, stash);
+      i->second.setattr(cid, head, ECUtil::get_hinfo_key(), hbuf);
+    }
+    saved.erase(oid);
+  }
+
+  void reset_hinfo(const hobject_t &oid) {
+    assert(hash_infos.count(oid));
+    *(hash_infos[oid]) = ECUtil::HashInfo(
+      ecimpl->get_chunk_count(),
+      hash_infos[oid]->get_stripe_chunk_size());
+    stripes.erase(oid);
+  }
+  void cache(const hobject_t &oid, uint64_t off, bufferlist &bl) {
+    if (!cache_stripes)
+      return;
+    ECTransaction::stripes_t &s = stripes[oid];
+    for (uint64_t i = 0; i < bl.length(); i += sinfo.get_stripe_width()) {
+      s[off + i].substr_of(bl, i, sinfo.get_stripe_width());
+    }
+  }
+  bufferlist get_stripe(const hobject_t &oid, uint64_t off) {
+    ECTransaction::stripes_t &s = stripes[oid];
+    ECTransaction::stripes_t::iterator i = s.find(off);
+    if (i != s.end())
+      return i->second;
+    // past the end, or get_rmw_stripes would have asked for it
+    assert(off >= sinfo.aligned_chunk_offset_to_logical_offset(
+	     hash_infos[oid]->get_total_chunk_size()));
+    bufferlist bl;
+    bl.append_zero(sinfo.get_stripe_width());
+    return bl;
   }
 
   coll_t get_coll_ct(shard_id_t shard, const hobject_t &hoid) {
@@ -147,6 +334,7 @@ struct TransGenerator : public boost::static_visitor<void> {
     assert(bl.length() - op.bl.length() < sinfo.get_stripe_width());
     int r = ECUtil::encode(
       sinfo, ecimpl, bl, want, &buffers);
+    cache(op.oid, offset, bl);
 
     hinfo->append(
       sinfo.aligned_logical_offset_to_chunk_offset(op.off),
@@ -177,10 +365,136 @@ struct TransGenerator : public boost::static_visitor<void> {
 	hbuf);
     }
   }
+  void operator()(const ECTransaction::OverwriteOp &op) {
+    assert(hash_infos.count(op.oid));
+    ECUtil::HashInfoRef hinfo = hash_infos[op.oid];
+    uint64_t end = op.off + op.bl.length();
+    uint64_t stripe_start = sinfo.logical_to_prev_stripe_offset(op.off);
+    uint64_t stripe_end = sinfo.logical_to_next_stripe_offset(end);
+
+    // splice the new data into the stripes it partially covers
+    bufferlist bl;
+    if (stripe_start < op.off) {
+      bufferlist head;
+      head.substr_of(
+	get_stripe(op.oid, stripe_start), 0, op.off - stripe_start);
+      bl.claim_append(head);
+    }
+    bl.append(op.bl);
+    if (end < stripe_end) {
+      uint64_t tail_start = stripe_end - sinfo.get_stripe_width();
+      bufferlist tail;
+      tail.substr_of(
+	get_stripe(op.oid, tail_start), end - tail_start, stripe_end - end);
+      bl.claim_append(tail);
+    }
+    assert(bl.length() == stripe_end - stripe_start);
+
+    map<int, bufferlist> buffers;
+    int r = ECUtil::encode(
+      sinfo, ecimpl, bl, want, &buffers);
+    assert(r == 0);
+    cache(op.oid, stripe_start, bl);
+
+    // chunk ranges which existed before the transaction and have not
+    // been saved yet
+    interval_set<uint64_t> to_save;
+    bool first_save = false;
+    if (op.stash_version != ghobject_t::NO_GEN) {
+      first_save = !saved.count(op.oid);
+      if (first_save)
+	saved[op.oid].first = op.stash_version;
+      assert(saved[op.oid].first == op.stash_version);
+      interval_set<uint64_t> extent;
+      extent.insert(op.off, op.bl.length());
+      sinfo.extents_to_chunk_ranges(
+	sinfo.aligned_chunk_offset_to_logical_offset(
+	  orig_hinfo[op.oid].get_total_chunk_size()),
+	extent,
+	&to_save);
+      interval_set<uint64_t> &done = saved[op.oid].second;
+      interval_set<uint64_t> already;
+      already.intersection_of(to_save, done);
+      to_save.subtract(already);
+      done.union_of(to_save);
+    }
+
+    uint64_t chunk_off = sinfo.aligned_logical_offset_to_chunk_offset(
+      stripe_start);
+    if (hinfo->has_stripe_hashes()) {
+      hinfo->overwrite(chunk_off, buffers);
+    } else {
+      // First overwrite of an object written before it kept stripe
+      // hashes: hash every stripe, so reads and deep scrub can still
+      // detect corruption once the cumulative hashes are gone.
+      uint64_t size = std::max(
+	sinfo.aligned_chunk_offset_to_logical_offset(
+	  hinfo->get_total_chunk_size()),
+	stripe_end);
+      bufferlist whole;
+      for (uint64_t off = 0; off < stripe_start;
+	   off += sinfo.get_stripe_width())
+	whole.append(get_stripe(op.oid, off));
+      whole.append(bl);
+      for (uint64_t off = stripe_end; off < size;
+	   off += sinfo.get_stripe_width())
+	whole.append(get_stripe(op.oid, off));
+      map<int, bufferlist> shards;
+      r = ECUtil::encode(
+	sinfo, ecimpl, whole, want, &shards);
+      assert(r == 0);
+      hinfo->set_stripe_hashes(sinfo.get_chunk_size(), shards);
+    }
+    bufferlist hbuf;
+    ::encode(
+      *hinfo,
+      hbuf);
+
+    for (map<shard_id_t, ObjectStore::Transaction>::iterator i = trans->begin();
+	 i != trans->end();
+	 ++i) {
+      coll_t cid(get_coll_ct(i->first, op.oid));
+      ghobject_t head(op.oid, ghobject_t::NO_GEN, i->first);
+      if (first_save) {
+	i->second.touch(
+	  cid,
+	  ghobject_t(op.oid, op.stash_version, i->first));
+      }
+      for (interval_set<uint64_t>::iterator j = to_save.begin();
+	   j != to_save.end();
+	   ++j) {
+	i->second.clone_range(
+	  cid,
+	  head,
+	  ghobject_t(op.oid, op.stash_version, i->first),
+	  j.get_start(),
+	  j.get_len(),
+	  j.get_start());
+      }
+      assert(buffers.count(i->first));
+      bufferlist &enc_bl = buffers[i->first];
+      i->second.write(
+	cid,
+	head,
+	chunk_off,
+	enc_bl.length(),
+	enc_bl,
+	op.fadvise_flags);
+      i->second.setattr(
+	cid,
+	head,
+	ECUtil::get_hinfo_key(),
+	hbuf);
+    }
+  }
   void operator()(const ECTransaction::CloneOp &op) {
     assert(hash_infos.count(op.source));
     assert(hash_infos.count(op.target));
     *(hash_infos[op.target]) = *(hash_infos[op.source]);
+    if (stripes.count(op.source))
+      stripes[op.target] = stripes[op.source];
+    else
+      stripes.erase(op.target);
     for (map<shard_id_t, ObjectStore::Transaction>::iterator i = trans->begin();
 	 i != trans->end();
 	 ++i) {
@@ -193,8 +507,13 @@ struct TransGenerator : public boost::static_visitor<void> {
   void operator()(const ECTransaction::RenameOp &op) {
     assert(hash_infos.count(op.source));
     assert(hash_infos.count(op.destination));
+    assert(!saved.count(op.source));
     *(hash_infos[op.destination]) = *(hash_infos[op.source]);
-    hash_infos[op.source]->clear();
+    if (stripes.count(op.source))
+      stripes[op.destination].swap(stripes[op.source]);
+    else
+      stripes.erase(op.destination);
+    reset_hinfo(op.source);
     for (map<shard_id_t, ObjectStore::Transaction>::iterator i = trans->begin();
 	 i != trans->end();
 	 ++i) {
@@ -206,8 +525,8 @@ struct TransGenerator : public boost::static_visitor<void> {
     }
   }
   void operator()(const ECTransaction::StashOp &op) {
-    assert(hash_infos.count(op.oid));
-    hash_infos[op.oid]->clear();
+    restore_saved(op.oid);
+    reset_hinfo(op.oid);
     for (map<shard_id_t, ObjectStore::Transaction>::iterator i = trans->begin();
 	 i != trans->end();
 	 ++i) {
@@ -220,8 +539,8 @@ struct TransGenerator : public boost::static_visitor<void> {
     }
   }
   void operator()(const ECTransaction::RemoveOp &op) {
-    assert(hash_infos.count(op.oid));
-    hash_infos[op.oid]->clear();
+    restore_saved(op.oid);
+    reset_hinfo(op.oid);
     for (map<shard_id_t, ObjectStore::Transaction>::iterator i = trans->begin();
 	 i != trans->end();
 	 ++i) {
@@ -274,6 +593,7 @@ struct TransGenerator : public boost::static_visitor<void> {
 
 void ECTransaction::generate_transactions(
   map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator> &hash_infos,
+  const stripe_map_t &stripes,
   ErasureCodeInterfaceRef &ecimpl,
   pg_t pgid,
   const ECUtil::stripe_info_t &sinfo,
@@ -284,6 +604,7 @@ void ECTransaction::generate_transactions(
 {
   TransGenerator gen(
     hash_infos,
+    stripes,
     ecimpl,
     pgid,
     sinfo,
@@ -291,5 +612,11 @@ void ECTransaction::generate_transactions(
     temp_added,
     temp_removed,
     out);
+  for (list<Op>::const_iterator i = ops.begin(); i != ops.end(); ++i) {
+    if (boost::get<OverwriteOp>(&*i)) {
+      gen.cache_stripes = true;
+      break;
+    }
+  }
   visit(gen);
 }
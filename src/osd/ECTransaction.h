@@ -32,6 +32,17 @@ public:
     AppendOp(const hobject_t &oid, uint64_t off, bufferlist &bl, uint32_t flags)
       : oid(oid), off(off), bl(bl), fadvise_flags(flags) {}
   };
+  struct OverwriteOp {
+    hobject_t oid;
+    uint64_t off;
+    bufferlist bl;
+    uint32_t fadvise_flags;
+    version_t stash_version;
+    OverwriteOp(const hobject_t &oid, uint64_t off, bufferlist &bl,
+		uint32_t flags, version_t stash_version)
+      : oid(oid), off(off), bl(bl), fadvise_flags(flags),
+	stash_version(stash_version) {}
+  };
   struct CloneOp {
     hobject_t source;
     hobject_t target;
@@ -88,6 +99,7 @@ public:
   struct NoOp {};
   typedef boost::variant<
     AppendOp,
+    OverwriteOp,
     CloneOp,
     RenameOp,
     StashOp,
@@ -121,6 +133,21 @@ public:
     assert(len == bl.length());
     ops.push_back(AppendOp(hoid, off, bl, fadvise_flags));
   }
+  void overwrite(
+    const hobject_t &hoid,
+    uint64_t off,
+    uint64_t len,
+    bufferlist &bl,
+    uint32_t fadvise_flags,
+    version_t stash_version) {
+    if (len == 0) {
+      touch(hoid);
+      return;
+    }
+    written += len;
+    assert(len == bl.length());
+    ops.push_back(OverwriteOp(hoid, off, bl, fadvise_flags, stash_version));
+  }
   void stash(
     const hobject_t &hoid,
     version_t former_version) {
@@ -195,8 +222,28 @@ public:
   }
   void get_append_objects(
      set<hobject_t, hobject_t::BitwiseComparator> *out) const;
+
+  /// logical stripe offset -> stripe_width bytes of data
+  typedef map<uint64_t, bufferlist> stripes_t;
+  typedef map<hobject_t, stripes_t, hobject_t::BitwiseComparator> stripe_map_t;
+
+  /**
+   * Stripes partially overwritten by OverwriteOps which must be read
+   * back before the transaction can be generated
+   *
+   * Stripes written earlier in the same transaction and stripes past
+   * the end of the object are not included.  hash_infos must describe
+   * the objects as of the start of the transaction.
+   */
+  void get_rmw_stripes(
+    map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator> &hash_infos,
+    const ECUtil::stripe_info_t &sinfo,
+    map<hobject_t, set<uint64_t>, hobject_t::BitwiseComparator> *out) const;
+
+  /// stripes holds the stripes named by get_rmw_stripes
   void generate_transactions(
     map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator> &hash_infos,
+    const stripe_map_t &stripes,
     ErasureCodeInterfaceRef &ecimpl,
     pg_t pgid,
     const ECUtil::stripe_info_t &sinfo,
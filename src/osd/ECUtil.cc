@@ -4,6 +4,26 @@
 #include "include/encoding.h"
 #include "ECUtil.h"
 
+void ECUtil::stripe_info_t::extents_to_chunk_ranges(
+  uint64_t size,
+  const interval_set<uint64_t> &extents,
+  interval_set<uint64_t> *out) const
+{
+  uint64_t end = logical_to_next_chunk_offset(size);
+  for (interval_set<uint64_t>::const_iterator i = extents.begin();
+       i != extents.end();
+       ++i) {
+    uint64_t from = logical_to_prev_chunk_offset(i.get_start());
+    uint64_t to = std::min(
+      logical_to_next_chunk_offset(i.get_start() + i.get_len()), end);
+    if (from >= to)
+      continue;
+    interval_set<uint64_t> r;
+    r.insert(from, to - from);
+    out->union_of(r);
+  }
+}
+
 int ECUtil::decode(
   const stripe_info_t &sinfo,
   ErasureCodeInterfaceRef &ec_impl,
@@ -137,19 +157,92 @@ int ECUtil::encode(
   return 0;
 }
 
+void ECUtil::HashInfo::append_stripe_hashes(
+  uint64_t chunk_off, map<int, bufferlist> &chunks)
+{
+  assert(chunk_off % stripe_chunk_size == 0);
+  assert(chunks.size() == stripe_hashes.size());
+  uint64_t first = chunk_off / stripe_chunk_size;
+  for (map<int, bufferlist>::iterator i = chunks.begin();
+       i != chunks.end();
+       ++i) {
+    assert((unsigned)i->first < stripe_hashes.size());
+    assert(i->second.length() % stripe_chunk_size == 0);
+    vector<uint32_t> &hashes = stripe_hashes[i->first];
+    assert(first <= hashes.size());
+    uint64_t n = i->second.length() / stripe_chunk_size;
+    if (hashes.size() < first + n)
+      hashes.resize(first + n);
+    for (uint64_t j = 0; j < n; ++j) {
+      bufferlist chunk;
+      chunk.substr_of(i->second, j * stripe_chunk_size, stripe_chunk_size);
+      hashes[first + j] = chunk.crc32c(-1);
+    }
+  }
+}
+
+void ECUtil::HashInfo::set_stripe_hashes(
+  uint64_t chunk_size, map<int, bufferlist> &shards)
+{
+  assert(chunk_size);
+  *this = HashInfo(shards.size(), chunk_size);
+  append(0, shards);
+}
+
+bool ECUtil::HashInfo::check_stripe_hashes(
+  int shard, uint64_t chunk_off, const bufferlist &bl, uint64_t *bad_off) const
+{
+  assert(has_stripe_hashes());
+  assert((unsigned)shard < stripe_hashes.size());
+  const vector<uint32_t> &hashes = stripe_hashes[shard];
+  uint64_t first = chunk_off / stripe_chunk_size;
+  uint64_t skip = chunk_off % stripe_chunk_size;
+  // only whole chunks can be checked
+  if (skip)
+    ++first;
+  for (uint64_t off = skip ? stripe_chunk_size - skip : 0, i = first;
+       off + stripe_chunk_size <= bl.length() && i < hashes.size();
+       off += stripe_chunk_size, ++i) {
+    bufferlist chunk;
+    chunk.substr_of(bl, off, stripe_chunk_size);
+    if (chunk.crc32c(-1) != hashes[i]) {
+      *bad_off = i * stripe_chunk_size;
+      return false;
+    }
+  }
+  return true;
+}
+
+uint32_t ECUtil::HashInfo::get_stripe_hashes_digest(int shard) const
+{
+  assert((unsigned)shard < stripe_hashes.size());
+  bufferlist bl;
+  ::encode(stripe_hashes[shard], bl);
+  return bl.crc32c(-1);
+}
+
 void ECUtil::HashInfo::encode(bufferlist &bl) const
 {
-  ENCODE_START(1, 1, bl);
+  ENCODE_START(2, 1, bl);
   ::encode(total_chunk_size, bl);
   ::encode(cumulative_shard_hashes, bl);
+  ::encode(stripe_chunk_size, bl);
+  ::encode(stripe_hashes, bl);
   ENCODE_FINISH(bl);
 }
 
 void ECUtil::HashInfo::decode(bufferlist::iterator &bl)
 {
-  DECODE_START(1, bl);
+  DECODE_START(2, bl);
   ::decode(total_chunk_size, bl);
   ::decode(cumulative_shard_hashes, bl);
+  if (struct_v >= 2) {
+    ::decode(stripe_chunk_size, bl);
+    ::decode(stripe_hashes, bl);
+  } else {
+    stripe_chunk_size = 0;
+    stripe_hashes.clear();
+  }
   DECODE_FINISH(bl);
 }
 
@@ -164,6 +257,18 @@ void ECUtil::HashInfo::dump(Formatter *f) const
     f->close_section();
   }
   f->close_section();
+  f->dump_unsigned("stripe_chunk_size", stripe_chunk_size);
+  f->open_array_section("stripe_hashes");
+  for (unsigned i = 0; i != stripe_hashes.size(); ++i) {
+    f->open_object_section("shard");
+    f->dump_unsigned("shard", i);
+    f->open_array_section("hashes");
+    for (unsigned j = 0; j != stripe_hashes[i].size(); ++j)
+      f->dump_unsigned("hash", stripe_hashes[i][j]);
+    f->close_section();
+    f->close_section();
+  }
+  f->close_section();
 }
 
 void ECUtil::HashInfo::generate_test_instances(list<HashInfo*>& o)
@@ -180,6 +285,18 @@ void ECUtil::HashInfo::generate_test_instances(list<HashInfo*>& o)
     o.back()->append(20, buffers);
   }
   o.push_back(new HashInfo(4));
+  o.push_back(new HashInfo(3, 20));
+  {
+    bufferlist bl;
+    bl.append_zero(20);
+    map<int, bufferlist> buffers;
+    buffers[0] = bl;
+    buffers[1] = bl;
+    buffers[2] = bl;
+    o.back()->append(0, buffers);
+    o.back()->append(20, buffers);
+    o.back()->overwrite(0, buffers);
+  }
 }
 
 const string HINFO_KEY = "hinfo_key";
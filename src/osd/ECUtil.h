@@ -23,6 +23,7 @@
 #include "include/buffer.h"
 #include "include/assert.h"
 #include "include/encoding.h"
+#include "include/interval_set.h"
 #include "common/Formatter.h"
 
 namespace ECUtil {
@@ -83,6 +84,11 @@ public:
       (in.first - off) + in.second);
     return make_pair(off, len);
   }
+  /// chunk ranges holding the stripes of extents, clipped to logical size
+  void extents_to_chunk_ranges(
+    uint64_t size,
+    const interval_set<uint64_t> &extents,
+    interval_set<uint64_t> *out) const;
 };
 
 int decode(
@@ -107,39 +113,86 @@ int encode(
 class HashInfo {
   uint64_t total_chunk_size;
   vector<uint32_t> cumulative_shard_hashes;
+  /// chunk size covered by each entry of stripe_hashes, 0 if not kept
+  uint64_t stripe_chunk_size;
+  /// per shard, crc32c(-1) of each chunk, kept where data is overwritten
+  vector<vector<uint32_t> > stripe_hashes;
+
+  void append_stripe_hashes(
+    uint64_t chunk_off, map<int, bufferlist> &chunks);
 public:
-  HashInfo() : total_chunk_size(0) {}
-  HashInfo(unsigned num_chunks)
+  HashInfo() : total_chunk_size(0), stripe_chunk_size(0) {}
+  HashInfo(unsigned num_chunks, uint64_t stripe_chunk_size = 0)
   : total_chunk_size(0),
-    cumulative_shard_hashes(num_chunks, -1) {}
+    cumulative_shard_hashes(num_chunks, -1),
+    stripe_chunk_size(stripe_chunk_size),
+    stripe_hashes(stripe_chunk_size ? num_chunks : 0) {}
   void append(uint64_t old_size, map<int, bufferlist> &to_append) {
-    assert(to_append.size() == cumulative_shard_hashes.size());
     assert(old_size == total_chunk_size);
     uint64_t size_to_append = to_append.begin()->second.length();
-    for (map<int, bufferlist>::iterator i = to_append.begin();
-	 i != to_append.end();
-	 ++i) {
-      assert(size_to_append == i->second.length());
-      assert((unsigned)i->first < cumulative_shard_hashes.size());
-      uint32_t new_hash = i->second.crc32c(cumulative_shard_hashes[i->first]);
-      cumulative_shard_hashes[i->first] = new_hash;
+    if (has_chunk_hash()) {
+      assert(to_append.size() == cumulative_shard_hashes.size());
+      for (map<int, bufferlist>::iterator i = to_append.begin();
+	   i != to_append.end();
+	   ++i) {
+	assert(size_to_append == i->second.length());
+	assert((unsigned)i->first < cumulative_shard_hashes.size());
+	uint32_t new_hash = i->second.crc32c(cumulative_shard_hashes[i->first]);
+	cumulative_shard_hashes[i->first] = new_hash;
+      }
     }
+    if (has_stripe_hashes())
+      append_stripe_hashes(old_size, to_append);
     total_chunk_size += size_to_append;
   }
-  void clear() {
-    total_chunk_size = 0;
-    cumulative_shard_hashes = vector<uint32_t>(
-      cumulative_shard_hashes.size(),
-      -1);
+  /**
+   * Data was overwritten in place at chunk_off
+   *
+   * The cumulative hashes can no longer be maintained, only the
+   * hashes of the stripes written.
+   */
+  void overwrite(uint64_t chunk_off, map<int, bufferlist> &to_write) {
+    assert(has_stripe_hashes());
+    assert(chunk_off <= total_chunk_size);
+    append_stripe_hashes(chunk_off, to_write);
+    total_chunk_size = std::max(
+      total_chunk_size, chunk_off + to_write.begin()->second.length());
+    cumulative_shard_hashes.clear();
   }
+  /**
+   * Rebuild all hashes from the complete contents of every shard
+   *
+   * Used the first time an object without stripe hashes is overwritten.
+   */
+  void set_stripe_hashes(uint64_t chunk_size, map<int, bufferlist> &shards);
   void encode(bufferlist &bl) const;
   void decode(bufferlist::iterator &bl);
   void dump(Formatter *f) const;
   static void generate_test_instances(list<HashInfo*>& o);
+  bool has_chunk_hash() const {
+    return !cumulative_shard_hashes.empty();
+  }
   uint32_t get_chunk_hash(int shard) const {
     assert((unsigned)shard < cumulative_shard_hashes.size());
     return cumulative_shard_hashes[shard];
   }
+  bool has_stripe_hashes() const {
+    return stripe_chunk_size != 0;
+  }
+  uint64_t get_stripe_chunk_size() const {
+    return stripe_chunk_size;
+  }
+  /**
+   * Check the chunks of shard read from chunk_off against their hashes
+   *
+   * @param [out] bad_off offset of the first chunk that does not match
+   * @return false if a chunk does not match
+   */
+  bool check_stripe_hashes(
+    int shard, uint64_t chunk_off, const bufferlist &bl,
+    uint64_t *bad_off) const;
+  /// digest of the stripe hashes of shard, for comparison between shards
+  uint32_t get_stripe_hashes_digest(int shard) const;
   uint64_t get_total_chunk_size() const {
     return total_chunk_size;
   }
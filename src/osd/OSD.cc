@@ -166,6 +166,87 @@ void PGQueueable::RunVis::operator()(PGScrub &op) {
   return pg->scrub(op.epoch_queued, handle);
 }
 
+PGQueueable::op_class_t PGQueueable::get_op_class() const
+{
+  if (boost::get<PGScrub>(&qvariant))
+    return OP_CLASS_SCRUB;
+  if (boost::get<PGSnapTrim>(&qvariant))
+    return OP_CLASS_SNAPTRIM;
+  const OpRequestRef *op = boost::get<OpRequestRef>(&qvariant);
+  assert(op);
+  switch ((*op)->get_req()->get_type()) {
+  case MSG_OSD_PG_PUSH:
+  case MSG_OSD_PG_PULL:
+  case MSG_OSD_PG_PUSH_REPLY:
+    return OP_CLASS_RECOVERY;
+  }
+  if (owner.name.is_osd())
+    return OP_CLASS_SUBOP;
+  return OP_CLASS_CLIENT;
+}
+
+namespace {
+  typedef mClockQueue< pair<PGRef, PGQueueable>, entity_inst_t> mClockOpQueue;
+
+  struct OpClassify {
+    unsigned operator()(const entity_inst_t &owner,
+			const pair<PGRef, PGQueueable> &item) const {
+      return item.second.get_op_class();
+    }
+  };
+
+  struct OpClassInfo {
+    CephContext *cct;
+    OpClassInfo(CephContext *cct) : cct(cct) {}
+    mClockOpQueue::ClientInfo operator()(unsigned op_class,
+					 const entity_inst_t &owner) const {
+      const md_config_t *conf = cct->_conf;
+      switch (op_class) {
+      case PGQueueable::OP_CLASS_SUBOP:
+	return mClockOpQueue::ClientInfo(
+	  conf->osd_op_queue_mclock_osd_subop_res,
+	  conf->osd_op_queue_mclock_osd_subop_wgt,
+	  conf->osd_op_queue_mclock_osd_subop_lim);
+      case PGQueueable::OP_CLASS_RECOVERY:
+	return mClockOpQueue::ClientInfo(
+	  conf->osd_op_queue_mclock_recov_res,
+	  conf->osd_op_queue_mclock_recov_wgt,
+	  conf->osd_op_queue_mclock_recov_lim);
+      case PGQueueable::OP_CLASS_SCRUB:
+	return mClockOpQueue::ClientInfo(
+	  conf->osd_op_queue_mclock_scrub_res,
+	  conf->osd_op_queue_mclock_scrub_wgt,
+	  conf->osd_op_queue_mclock_scrub_lim);
+      case PGQueueable::OP_CLASS_SNAPTRIM:
+	return mClockOpQueue::ClientInfo(
+	  conf->osd_op_queue_mclock_snap_res,
+	  conf->osd_op_queue_mclock_snap_wgt,
+	  conf->osd_op_queue_mclock_snap_lim);
+      default:
+	return mClockOpQueue::ClientInfo(
+	  conf->osd_op_queue_mclock_client_op_res,
+	  conf->osd_op_queue_mclock_client_op_wgt,
+	  conf->osd_op_queue_mclock_client_op_lim);
+      }
+    }
+  };
+}
+
+OSD::ShardedOpWQ::OpQueueType *OSD::ShardedOpWQ::create_op_queue(
+  CephContext *cct)
+{
+  const md_config_t *conf = cct->_conf;
+  if (conf->osd_op_queue == "mclock")
+    return new mClockOpQueue(OpClassify(), OpClassInfo(cct),
+			     conf->osd_op_queue_mclock_cost_unit);
+  if (conf->osd_op_queue != "prio")
+    lgeneric_derr(cct) << "unknown osd_op_queue '" << conf->osd_op_queue
+	       << "', using prio" << dendl;
+  return new PrioritizedQueue< pair<PGRef, PGQueueable>, entity_inst_t>(
+    conf->osd_op_pq_max_tokens_per_priority,
+    conf->osd_op_pq_min_cost);
+}
+
 //Initial features in new superblock.
 //Features here are also automatically upgraded
 CompatSet OSD::get_osd_initial_compat_set() {
@@ -1569,6 +1650,8 @@ OSD::OSD(CephContext *cct_, ObjectStore *store_,
   recovery_tp(cct, "OSD::recovery_tp", cct->_conf->osd_recovery_threads, "osd_recovery_threads"),
   disk_tp(cct, "OSD::disk_tp", cct->_conf->osd_disk_threads, "osd_disk_threads"),
   command_tp(cct, "OSD::command_tp", 1),
+  pg_mapping_enabled(cct->_conf->osd_map_mapping_table),
+  pg_mapping_builder(cct, cct->_conf->osd_map_mapping_threads),
   paused_recovery(false),
   session_waiting_lock("OSD::session_waiting_lock"),
   heartbeat_lock("OSD::heartbeat_lock"),
@@ -1966,6 +2049,8 @@ int OSD::init()
   recovery_tp.start();
   disk_tp.start();
   command_tp.start();
+  if (pg_mapping_enabled)
+    pg_mapping_builder.start();
 
   set_disk_tp_priority();
 
@@ -2427,6 +2512,11 @@ int OSD::shutdown()
   command_tp.stop();
   dout(10) << "command tp stopped" << dendl;
 
+  if (pg_mapping_enabled) {
+    pg_mapping_builder.stop();
+    dout(10) << "pg mapping builder stopped" << dendl;
+  }
+
   disk_tp.drain();
   disk_tp.stop();
   dout(10) << "disk tp paused (new)" << dendl;
@@ -3129,6 +3219,9 @@ void OSD::build_past_intervals_parallel()
       if (new_interval) {
 	dout(10) << __func__ << " epoch " << cur_epoch << " pg " << pg->info.pgid
 		 << " " << debug.str() << dendl;
+	if (cct->_conf->osd_summarize_past_intervals)
+	  pg_interval_t::summarize_interval(&pg->past_intervals,
+					    p.same_interval_since);
 	p.old_up = up;
 	p.old_acting = acting;
 	p.primary = primary;
@@ -6275,6 +6368,15 @@ void OSD::osdmap_subscribe(version_t epoch, bool force_request)
   }
 }
 
+void OSD::queue_pg_mapping(OSDMapRef map, list<OSDMapRef> *pinned_maps)
+{
+  // built off osd_lock; lookups run CRUSH until the table is in place
+  if (pg_mapping_enabled)
+    pg_mapping_builder.queue(map, pinned_maps->empty() ? osdmap :
+			     pinned_maps->back());
+  pinned_maps->push_back(map);
+}
+
 void OSD::handle_osd_map(MOSDMap *m)
 {
   assert(osd_lock.is_locked());
@@ -6364,7 +6466,7 @@ void OSD::handle_osd_map(MOSDMap *m)
       ghobject_t fulloid = get_osdmap_pobject_name(e);
       t.write(coll_t::meta(), fulloid, 0, bl.length(), bl);
       pin_map_bl(e, bl);
-      pinned_maps.push_back(add_map(o));
+      queue_pg_mapping(add_map(o), &pinned_maps);
 
       got_full_map(e);
       continue;
@@ -6421,7 +6523,7 @@ void OSD::handle_osd_map(MOSDMap *m)
       ghobject_t fulloid = get_osdmap_pobject_name(e);
       t.write(coll_t::meta(), fulloid, 0, fbl.length(), fbl);
       pin_map_bl(e, fbl);
-      pinned_maps.push_back(add_map(o));
+      queue_pg_mapping(add_map(o), &pinned_maps);
       continue;
     }
 
@@ -8270,19 +8372,19 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb )
   ShardData* sdata = shard_list[shard_index];
   assert(NULL != sdata);
   sdata->sdata_op_ordering_lock.Lock();
-  if (sdata->pqueue.empty()) {
+  if (sdata->pqueue->empty()) {
     sdata->sdata_op_ordering_lock.Unlock();
     osd->cct->get_heartbeat_map()->reset_timeout(hb, 4, 0);
     sdata->sdata_lock.Lock();
     sdata->sdata_cond.WaitInterval(osd->cct, sdata->sdata_lock, utime_t(2, 0));
     sdata->sdata_lock.Unlock();
     sdata->sdata_op_ordering_lock.Lock();
-    if(sdata->pqueue.empty()) {
+    if(sdata->pqueue->empty()) {
       sdata->sdata_op_ordering_lock.Unlock();
       return;
     }
   }
-  pair<PGRef, PGQueueable> item = sdata->pqueue.dequeue();
+  pair<PGRef, PGQueueable> item = sdata->pqueue->dequeue();
   sdata->pg_for_processing[&*(item.first)].push_back(item.second);
   sdata->sdata_op_ordering_lock.Unlock();
   ThreadPool::TPHandle tp_handle(osd->cct, hb, timeout_interval, 
@@ -8353,10 +8455,10 @@ void OSD::ShardedOpWQ::_enqueue(pair<PGRef, PGQueueable> item) {
   sdata->sdata_op_ordering_lock.Lock();
  
   if (priority >= CEPH_MSG_PRIO_LOW)
-    sdata->pqueue.enqueue_strict(
+    sdata->pqueue->enqueue_strict(
       item.second.get_owner(), priority, item);
   else
-    sdata->pqueue.enqueue(
+    sdata->pqueue->enqueue(
       item.second.get_owner(),
       priority, cost, item);
   sdata->sdata_op_ordering_lock.Unlock();
@@ -8382,11 +8484,11 @@ void OSD::ShardedOpWQ::_enqueue_front(pair<PGRef, PGQueueable> item) {
   unsigned priority = item.second.get_priority();
   unsigned cost = item.second.get_cost();
   if (priority >= CEPH_MSG_PRIO_LOW)
-    sdata->pqueue.enqueue_strict_front(
+    sdata->pqueue->enqueue_strict_front(
       item.second.get_owner(),
       priority, item);
   else
-    sdata->pqueue.enqueue_front(
+    sdata->pqueue->enqueue_front(
       item.second.get_owner(),
       priority, cost, item);
 
@@ -8550,6 +8652,21 @@ const char** OSD::get_tracked_conf_keys() const
     "osd_pg_epoch_persisted_max_stale",
     "osd_disk_thread_ioprio_class",
     "osd_disk_thread_ioprio_priority",
+    "osd_op_queue_mclock_client_op_res",
+    "osd_op_queue_mclock_client_op_wgt",
+    "osd_op_queue_mclock_client_op_lim",
+    "osd_op_queue_mclock_osd_subop_res",
+    "osd_op_queue_mclock_osd_subop_wgt",
+    "osd_op_queue_mclock_osd_subop_lim",
+    "osd_op_queue_mclock_recov_res",
+    "osd_op_queue_mclock_recov_wgt",
+    "osd_op_queue_mclock_recov_lim",
+    "osd_op_queue_mclock_scrub_res",
+    "osd_op_queue_mclock_scrub_wgt",
+    "osd_op_queue_mclock_scrub_lim",
+    "osd_op_queue_mclock_snap_res",
+    "osd_op_queue_mclock_snap_wgt",
+    "osd_op_queue_mclock_snap_lim",
     // clog & admin clog
     "clog_to_monitors",
     "clog_to_syslog",
@@ -8593,6 +8710,13 @@ void OSD::handle_conf_change(const struct md_config_t *conf,
     service.map_bl_cache.set_size(cct->_conf->osd_map_cache_size);
     service.map_bl_inc_cache.set_size(cct->_conf->osd_map_cache_size);
   }
+  for (set<string>::const_iterator i = changed.begin(); i != changed.end(); ++i) {
+    if (i->find("osd_op_queue_mclock_") == 0) {
+      // queued clients switch now, the others when they next queue an op
+      op_shardedwq.update_queue_params();
+      break;
+    }
+  }
   if (changed.count("clog_to_monitors") ||
       changed.count("clog_to_syslog") ||
       changed.count("clog_to_syslog_level") ||
@@ -53,6 +53,7 @@ using namespace std;
 #include "common/simple_cache.hpp"
 #include "common/sharedptr_registry.hpp"
 #include "common/PrioritizedQueue.h"
+#include "common/mClockQueue.h"
 #include "messages/MOSDOp.h"
 #include "include/Spinlock.h"
 
@@ -340,6 +341,16 @@ struct PGSnapTrim {
 };
 
 class PGQueueable {
+public:
+  /// scheduling classes for the mclock op queue
+  enum op_class_t {
+    OP_CLASS_CLIENT,
+    OP_CLASS_SUBOP,     ///< replication from a peer
+    OP_CLASS_RECOVERY,  ///< push and pull
+    OP_CLASS_SCRUB,
+    OP_CLASS_SNAPTRIM,
+  };
+private:
   typedef boost::variant<
     OpRequestRef,
     PGSnapTrim,
@@ -389,6 +400,7 @@ public:
   int get_cost() const { return cost; }
   utime_t get_start_time() const { return start_time; }
   entity_inst_t get_owner() const { return owner; }
+  op_class_t get_op_class() const;
 };
 
 class OSDService {
@@ -1262,6 +1274,11 @@ private:
   ThreadPool disk_tp;
   ThreadPool command_tp;
 
+  /// precompute pg mappings of new maps in the background
+  bool pg_mapping_enabled;
+  PGMappingBuilder pg_mapping_builder;
+  void queue_pg_mapping(OSDMapRef map, list<OSDMapRef> *pinned_maps);
+
   bool paused_recovery;
 
   void set_disk_tp_priority();
@@ -1619,18 +1636,24 @@ private:
   friend class PGQueueable;
   class ShardedOpWQ: public ShardedThreadPool::ShardedWQ < pair <PGRef, PGQueueable> > {
 
+    typedef OpQueue< pair<PGRef, PGQueueable>, entity_inst_t> OpQueueType;
+    static OpQueueType *create_op_queue(CephContext *cct);
+
     struct ShardData {
       Mutex sdata_lock;
       Cond sdata_cond;
       Mutex sdata_op_ordering_lock;
       map<PG*, list<PGQueueable> > pg_for_processing;
-      PrioritizedQueue< pair<PGRef, PGQueueable>, entity_inst_t> pqueue;
+      OpQueueType *pqueue;
       ShardData(
 	string lock_name, string ordering_lock,
-	uint64_t max_tok_per_prio, uint64_t min_cost, CephContext *cct)
+	OpQueueType *q, CephContext *cct)
 	: sdata_lock(lock_name.c_str(), false, true, false, cct),
 	  sdata_op_ordering_lock(ordering_lock.c_str(), false, true, false, cct),
-	  pqueue(max_tok_per_prio, min_cost) {}
+	  pqueue(q) {}
+      ~ShardData() {
+	delete pqueue;
+      }
     };
     
     vector<ShardData*> shard_list;
@@ -1649,9 +1672,7 @@ private:
 	  order_lock, sizeof(order_lock), "%s.%d",
 	  "OSD:ShardedOpWQ:order:", i);
 	ShardData* one_shard = new ShardData(
-	  lock_name, order_lock,
-	  osd->cct->_conf->osd_op_pq_max_tokens_per_priority, 
-	  osd->cct->_conf->osd_op_pq_min_cost, osd->cct);
+	  lock_name, order_lock, create_op_queue(osd->cct), osd->cct);
 	shard_list.push_back(one_shard);
       }
     }
@@ -1685,7 +1706,7 @@ private:
 	assert (NULL != sdata);
 	sdata->sdata_op_ordering_lock.Lock();
 	f->open_object_section(lock_name);
-	sdata->pqueue.dump(f);
+	sdata->pqueue->dump(f);
 	f->close_section();
 	sdata->sdata_op_ordering_lock.Unlock();
       }
@@ -1706,7 +1727,7 @@ private:
       sdata = shard_list[shard_index];
       assert(sdata != NULL);
       sdata->sdata_op_ordering_lock.Lock();
-      sdata->pqueue.remove_by_filter(Pred(pg));
+      sdata->pqueue->remove_by_filter(Pred(pg));
       sdata->pg_for_processing.erase(pg);
       sdata->sdata_op_ordering_lock.Unlock();
     }
@@ -1720,7 +1741,7 @@ private:
       assert(dequeued);
       list<pair<PGRef, PGQueueable> > _dequeued;
       sdata->sdata_op_ordering_lock.Lock();
-      sdata->pqueue.remove_by_filter(Pred(pg), &_dequeued);
+      sdata->pqueue->remove_by_filter(Pred(pg), &_dequeued);
       for (list<pair<PGRef, PGQueueable> >::iterator i = _dequeued.begin();
 	   i != _dequeued.end(); ++i) {
 	boost::optional<OpRequestRef> mop = i->second.maybe_get_op();
@@ -1742,12 +1763,21 @@ private:
       sdata->sdata_op_ordering_lock.Unlock();
     }
  
+    void update_queue_params() {
+      for (uint32_t i = 0; i < num_shards; i++) {
+	ShardData* sdata = shard_list[i];
+	assert(NULL != sdata);
+	Mutex::Locker l(sdata->sdata_op_ordering_lock);
+	sdata->pqueue->update_params();
+      }
+    }
+
     bool is_shard_empty(uint32_t thread_index) {
       uint32_t shard_index = thread_index % num_shards; 
       ShardData* sdata = shard_list[shard_index];
       assert(NULL != sdata);
       Mutex::Locker l(sdata->sdata_op_ordering_lock);
-      return sdata->pqueue.empty();
+      return sdata->pqueue->empty();
     }
   } op_shardedwq;
 
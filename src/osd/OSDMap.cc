@@ -25,6 +25,9 @@
 #include "include/stringify.h"
 
 #include "common/code_environment.h"
+#include "common/WorkQueue.h"
+#include "common/Finisher.h"
+#include "include/atomic.h"
 
 #include "crush/CrushTreeDumper.h"
 
@@ -1670,6 +1673,8 @@ void OSDMap::pg_to_raw_up(pg_t pg, vector<int> *up, int *primary) const
       up->clear();
     return;
   }
+  if (_pg_mapping_lookup(*pool, pg, up, primary, NULL, NULL))
+    return;
   vector<int> raw;
   ps_t pps;
   _pg_to_osds(*pool, pg, &raw, primary, &pps);
@@ -1692,6 +1697,8 @@ void OSDMap::_pg_to_up_acting_osds(const pg_t& pg, vector<int> *up, int *up_prim
       *acting_primary = -1;
     return;
   }
+  if (_pg_mapping_lookup(*pool, pg, up, up_primary, acting, acting_primary))
+    return;
   vector<int> raw;
   vector<int> _up;
   vector<int> _acting;
@@ -1718,6 +1725,416 @@ void OSDMap::_pg_to_up_acting_osds(const pg_t& pg, vector<int> *up, int *up_prim
     *acting_primary = _acting_primary;
 }
 
+// ----------------------------------
+// precomputed pg mappings
+
+/// a list of mapping jobs, consumed by any number of threads
+struct PGMappingBuilder::Work {
+  unsigned njobs;
+  atomic_t next, done;
+  Mutex lock;
+  Cond cond;
+  bufferlist crush_bl;  ///< for threads that map with their own CrushWrapper
+  Work() : njobs(0), next(0), done(0), lock("PGMappingBuilder::Work::lock") {}
+  virtual ~Work() {}
+  virtual void do_job(unsigned j, const CrushWrapper *c) = 0;
+
+  void run(const CrushWrapper *c) {
+    while (true) {
+      unsigned j = next.inc() - 1;
+      if (j >= njobs)
+	break;
+      do_job(j, c);
+      if (done.inc() == njobs) {
+	Mutex::Locker l(lock);
+	cond.Signal();
+      }
+    }
+  }
+  void run_private() {
+    if (next.read() >= njobs)
+      return;  // the others got there first
+    // CrushWrapper serializes do_rule() on a lock, so each thread
+    // maps with a private copy
+    CrushWrapper *c = NULL;
+    if (crush_bl.length()) {
+      c = new CrushWrapper;
+      bufferlist::iterator p = crush_bl.begin();
+      c->decode(p);
+    }
+    run(c);
+    delete c;
+  }
+  void wait() {
+    Mutex::Locker l(lock);
+    while (done.read() < njobs)
+      cond.Wait(lock);
+  }
+};
+
+struct PGMappingBuilder::WQ : public ThreadPool::PointerWQ<ceph::shared_ptr<Work> > {
+  WQ(ThreadPool *tp)
+    : ThreadPool::PointerWQ<ceph::shared_ptr<Work> >(
+	"PGMappingBuilder::WQ", 0, 0, tp) {}
+  void process(ceph::shared_ptr<Work> *w) {
+    (*w)->run_private();
+    delete w;
+  }
+};
+
+struct PGMappingBuilder::C_Build : public Context {
+  PGMappingBuilder *builder;
+  OSDMapRef map, prev;
+  C_Build(PGMappingBuilder *b, OSDMapRef map, OSDMapRef prev)
+    : builder(b), map(map), prev(prev) {}
+  void finish(int r) {
+    map->build_pg_mapping(builder->cct, prev.get(), builder);
+  }
+};
+
+PGMappingBuilder::PGMappingBuilder(CephContext *cct, int threads)
+  : cct(cct),
+    tp(new ThreadPool(cct, "PGMappingBuilder::tp", MAX(threads, 1))),
+    wq(new WQ(tp)),
+    finisher(new Finisher(cct, "PGMappingBuilder"))
+{
+}
+
+PGMappingBuilder::~PGMappingBuilder()
+{
+  delete finisher;
+  delete wq;
+  delete tp;
+}
+
+void PGMappingBuilder::start()
+{
+  tp->start();
+  finisher->start();
+}
+
+void PGMappingBuilder::stop()
+{
+  finisher->wait_for_empty();
+  finisher->stop();
+  wq->drain();
+  tp->stop();
+}
+
+void PGMappingBuilder::queue(OSDMapRef map, OSDMapRef prev)
+{
+  finisher->queue(new C_Build(this, map, prev));
+}
+
+void PGMappingBuilder::wait()
+{
+  finisher->wait_for_empty();
+}
+
+void PGMappingBuilder::run(ceph::shared_ptr<Work> w)
+{
+  // helpers that find nothing left to do return at once; we only
+  // wait for the jobs to be done, not for every helper to run
+  unsigned helpers = MIN((unsigned)tp->get_num_threads(), w->njobs - 1);
+  for (unsigned i = 0; i < helpers; ++i)
+    wq->queue(new ceph::shared_ptr<Work>(w));
+}
+
+namespace {
+  const unsigned PGS_PER_MAPPING_JOB = 1024;
+
+  void run_mapping_work(PGMappingBuilder *builder,
+			ceph::shared_ptr<PGMappingBuilder::Work> w,
+			const CrushWrapper *crush)
+  {
+    if (builder)
+      builder->run(w);
+    w->run(crush);
+    w->wait();
+  }
+
+  /// osds whose weight, or exists, up and primary affinity differ
+  template <typename T>
+  void diff_osds(const vector<T>& a, const vector<T>& b, T dflt,
+		 set<int> *out)
+  {
+    unsigned n = MAX(a.size(), b.size());
+    for (unsigned i = 0; i < n; ++i) {
+      T x = i < a.size() ? a[i] : dflt;
+      T y = i < b.size() ? b[i] : dflt;
+      if (x != y)
+	out->insert(i);
+    }
+  }
+
+  bool intersects(const set<int>& a, const set<int>& b)
+  {
+    for (set<int>::const_iterator i = a.begin(); i != a.end(); ++i)
+      if (b.count(*i))
+	return true;
+    return false;
+  }
+}
+
+void OSDMap::_build_pg_mapping_raw(const CrushWrapper& c,
+				   const pg_pool_t& pool, int64_t poolid,
+				   PGMapping::Raw *raw,
+				   unsigned begin, unsigned end) const
+{
+  vector<int> osds;
+  for (unsigned ps = begin; ps < end; ++ps) {
+    int32_t *row = &raw->rows[ps * raw->stride()];
+    osds.clear();
+    if (raw->ruleno >= 0)
+      c.do_rule(raw->ruleno, pool.raw_pg_to_pps(pg_t(ps, poolid)), osds,
+		raw->size, osd_weight);
+    row[0] = osds.size();
+    for (unsigned i = 0; i < osds.size(); ++i)
+      row[1 + i] = osds[i];
+  }
+}
+
+void OSDMap::_build_pg_mapping_rows(const pg_pool_t& pool, int64_t poolid,
+				    PGMapping::Pool *p,
+				    unsigned begin, unsigned end) const
+{
+  const PGMapping::Raw& raw = *p->raw;
+  vector<int> osds, up, acting;
+  for (unsigned ps = begin; ps < end; ++ps) {
+    const int32_t *r = &raw.rows[ps * raw.stride()];
+    osds.assign(r + 1, r + 1 + r[0]);
+    _remove_nonexistent_osds(pool, osds);
+
+    // same steps as _pg_to_up_acting_osds
+    pg_t pg(ps, poolid);
+    int up_primary, acting_primary;
+    _raw_to_up_osds(pool, osds, &up, &up_primary);
+    _apply_primary_affinity(pool.raw_pg_to_pps(pg), pool, &up, &up_primary);
+    _get_temp_osds(pool, pg, &acting, &acting_primary);
+    if (acting.empty()) {
+      acting = up;
+      if (acting_primary == -1)
+	acting_primary = up_primary;
+    }
+
+    int32_t *row = &(*p->rows)[ps * p->stride()];
+    row[0] = up_primary;
+    row[1] = acting_primary;
+    row[2] = up.size();
+    row[3] = acting.size();
+    std::copy(up.begin(), up.end(), row + 4);
+    std::copy(acting.begin(), acting.end(), row + 4 + p->width);
+  }
+}
+
+void OSDMap::build_pg_mapping(CephContext *cct, const OSDMap *prev,
+			      PGMappingBuilder *builder) const
+{
+  utime_t start = ceph_clock_now(cct);
+  ceph::shared_ptr<const PGMapping> old;
+  if (prev)
+    old = prev->pg_mapping.get();
+  if (!old)
+    old = pg_mapping.get();
+
+  ceph::shared_ptr<PGMapping> m(new PGMapping);
+  m->epoch = epoch;
+  m->osd_weight = osd_weight;
+  m->osd_state.resize(osd_state.size());
+  for (unsigned i = 0; i < osd_state.size(); ++i)
+    m->osd_state[i] = osd_state[i] & (CEPH_OSD_EXISTS | CEPH_OSD_UP);
+  if (osd_primary_affinity)
+    m->osd_primary_affinity = *osd_primary_affinity;
+  crush->encode(m->crush_bl);
+
+  // what could have moved raw CRUSH output since the old table?
+  bool crush_changed = !old || !old->crush_bl.contents_equal(m->crush_bl);
+  set<int> reweighted;
+  // and what else the up/acting rows depend on?
+  set<int> moved;
+  if (old) {
+    diff_osds<__u32>(old->osd_weight, osd_weight, 0, &reweighted);
+    diff_osds<uint8_t>(old->osd_state, m->osd_state, 0, &moved);
+    diff_osds<__u32>(old->osd_primary_affinity, m->osd_primary_affinity,
+		     CEPH_OSD_DEFAULT_PRIMARY_AFFINITY, &moved);
+  }
+  map<int,set<int> > rule_devices;
+
+  for (map<pg_t,vector<int32_t> >::const_iterator p = pg_temp->begin();
+       p != pg_temp->end();
+       ++p)
+    if (pools.count(p->first.pool()))
+      m->pools[p->first.pool()].pg_temp.insert(*p);
+  for (map<pg_t,int32_t>::const_iterator p = primary_temp->begin();
+       p != primary_temp->end();
+       ++p)
+    if (pools.count(p->first.pool()))
+      m->pools[p->first.pool()].primary_temp.insert(*p);
+
+  // each job covers PGS_PER_MAPPING_JOB pgs of one pool
+  struct Work : public PGMappingBuilder::Work {
+    struct Job {
+      int64_t pool;
+      unsigned begin;
+      PGMapping::Raw *raw;  ///< or NULL to fill in up/acting
+    };
+    const OSDMap *osdmap;
+    PGMapping *m;
+    vector<Job> jobs;
+    Work(const OSDMap *o, PGMapping *m) : osdmap(o), m(m) {}
+    void add(int64_t pool, unsigned pg_num, PGMapping::Raw *raw) {
+      for (unsigned ps = 0; ps < pg_num; ps += PGS_PER_MAPPING_JOB) {
+	Job j = { pool, ps, raw };
+	jobs.push_back(j);
+      }
+      njobs = jobs.size();
+    }
+    void do_job(unsigned j, const CrushWrapper *c) {
+      const Job& job = jobs[j];
+      const pg_pool_t& pool = osdmap->pools.find(job.pool)->second;
+      unsigned end = MIN(job.begin + PGS_PER_MAPPING_JOB, pool.get_pg_num());
+      if (job.raw)
+	osdmap->_build_pg_mapping_raw(*c, pool, job.pool, job.raw,
+				      job.begin, end);
+      else
+	osdmap->_build_pg_mapping_rows(pool, job.pool,
+				       &m->pools.find(job.pool)->second,
+				       job.begin, end);
+    }
+  };
+  ceph::shared_ptr<Work> raw_work(new Work(this, m.get()));
+  ceph::shared_ptr<Work> rows_work(new Work(this, m.get()));
+  raw_work->crush_bl = m->crush_bl;
+
+  unsigned num_pgs = 0;
+  for (map<int64_t,pg_pool_t>::const_iterator i = pools.begin();
+       i != pools.end();
+       ++i) {
+    const pg_pool_t& pool = i->second;
+    PGMapping::Raw *raw = new PGMapping::Raw;
+    raw->size = pool.get_size();
+    raw->type = pool.get_type();
+    raw->ruleno = crush->find_rule(pool.get_crush_ruleset(), raw->type,
+				   raw->size);
+    raw->pg_num = pool.get_pg_num();
+    raw->pgp_num = pool.get_pgp_num();
+    raw->hashpspool = pool.has_flag(pg_pool_t::FLAG_HASHPSPOOL);
+    num_pgs += raw->pg_num;
+
+    PGMapping::Pool& p = m->pools[i->first];
+    const PGMapping::Pool *op = NULL;
+    if (old) {
+      map<int64_t,PGMapping::Pool>::const_iterator q =
+	old->pools.find(i->first);
+      if (q != old->pools.end())
+	op = &q->second;
+    }
+    // only devices under the rule's take steps can be mapped to
+    const set<int> *devices = NULL;
+    if (raw->ruleno >= 0 && (!reweighted.empty() || !moved.empty())) {
+      map<int,set<int> >::iterator r = rule_devices.find(raw->ruleno);
+      if (r == rule_devices.end()) {
+	map<int,float> w;
+	crush->get_rule_weight_osd_map(raw->ruleno, &w);
+	r = rule_devices.insert(make_pair(raw->ruleno, set<int>())).first;
+	for (map<int,float>::iterator d = w.begin(); d != w.end(); ++d)
+	  r->second.insert(d->first);
+      }
+      devices = &r->second;
+    }
+
+    const PGMapping::Raw *o = op && !crush_changed ? op->raw.get() : NULL;
+    bool reuse = o &&
+      o->ruleno == raw->ruleno && o->size == raw->size &&
+      o->type == raw->type && o->pg_num == raw->pg_num &&
+      o->pgp_num == raw->pgp_num && o->hashpspool == raw->hashpspool;
+    if (reuse && devices)
+      reuse = !intersects(reweighted, *devices);
+    if (reuse) {
+      delete raw;
+      p.raw = op->raw;
+    } else {
+      raw->rows.resize(raw->pg_num * raw->stride());
+      p.raw.reset(raw);
+      raw_work->add(i->first, raw->pg_num, raw);
+      m->num_raw_built += raw->pg_num;
+    }
+
+    p.width = pool.get_size();
+    for (map<pg_t,vector<int32_t> >::iterator t = p.pg_temp.begin();
+	 t != p.pg_temp.end();
+	 ++t)
+      p.width = MAX(p.width, t->second.size());
+
+    // the rows follow from the raw output, the temps and the state and
+    // primary affinity of the osds either of them name
+    bool reuse_rows = reuse && op->width == p.width &&
+      op->pg_temp == p.pg_temp && op->primary_temp == p.primary_temp;
+    if (reuse_rows && !moved.empty()) {
+      if (devices)
+	reuse_rows = !intersects(moved, *devices);
+      for (map<pg_t,vector<int32_t> >::iterator t = p.pg_temp.begin();
+	   reuse_rows && t != p.pg_temp.end();
+	   ++t)
+	for (unsigned k = 0; reuse_rows && k < t->second.size(); ++k)
+	  reuse_rows = !moved.count(t->second[k]);
+    }
+    if (reuse_rows) {
+      p.rows = op->rows;
+    } else {
+      p.rows.reset(new vector<int32_t>(pool.get_pg_num() * p.stride()));
+      rows_work->add(i->first, pool.get_pg_num(), NULL);
+      m->num_rows_built += pool.get_pg_num();
+    }
+  }
+
+  if (raw_work->njobs)
+    run_mapping_work(builder, raw_work, crush.get());
+  if (rows_work->njobs)
+    run_mapping_work(builder, rows_work, NULL);
+  pg_mapping.set(m);
+
+  ldout(cct, 10) << __func__ << " e" << epoch << " " << num_pgs
+		 << " pgs, ran crush for " << m->num_raw_built
+		 << ", derived " << m->num_rows_built << " rows in "
+		 << (ceph_clock_now(cct) - start) << dendl;
+}
+
+void OSDMap::get_pg_mapping_stats(unsigned *raw_built,
+				  unsigned *rows_built) const
+{
+  ceph::shared_ptr<const PGMapping> m = pg_mapping.get();
+  bool have = m && m->epoch == epoch;
+  *raw_built = have ? m->num_raw_built : 0;
+  *rows_built = have ? m->num_rows_built : 0;
+}
+
+bool OSDMap::_pg_mapping_lookup(const pg_pool_t& pool, const pg_t& pg,
+				vector<int> *up, int *up_primary,
+				vector<int> *acting, int *acting_primary) const
+{
+  ceph::shared_ptr<const PGMapping> m = pg_mapping.get();
+  if (!m || m->epoch != epoch)
+    return false;
+  map<int64_t,PGMapping::Pool>::const_iterator i = m->pools.find(pg.pool());
+  if (i == m->pools.end())
+    return false;
+  const PGMapping::Pool& p = i->second;
+  unsigned ps = pool.raw_pg_to_pg(pg).ps();
+  if (ps >= p.raw->pg_num)
+    return false;
+  const int32_t *row = &(*p.rows)[ps * p.stride()];
+  if (up)
+    up->assign(row + 4, row + 4 + row[2]);
+  if (up_primary)
+    *up_primary = row[0];
+  if (acting)
+    acting->assign(row + 4 + p.width, row + 4 + p.width + row[3]);
+  if (acting_primary)
+    *acting_primary = row[1];
+  return true;
+}
+
 int OSDMap::calc_pg_rank(int osd, const vector<int>& acting, int nrep)
 {
   if (!nrep)
@@ -29,6 +29,7 @@
 #include "osd_types.h"
 #include "msg/Message.h"
 #include "common/Mutex.h"
+#include "include/Spinlock.h"
 #include "common/Clock.h"
 
 #include "include/ceph_features.h"
@@ -46,6 +47,10 @@ using namespace std;
 
 #include "include/unordered_set.h"
 
+class ThreadPool;
+class Finisher;
+class PGMappingBuilder;
+
 /*
  * we track up to two intervals during which the osd was alive and
  * healthy.  the most recent is [up_from,up_thru), where up_thru is
@@ -253,7 +258,84 @@ private:
   mutable bool crc_defined;
   mutable uint32_t crc;
 
+  /**
+   * Precomputed up and acting sets for every pg
+   *
+   * Built by build_pg_mapping() once the map is complete and consulted
+   * by _pg_to_up_acting_osds() instead of running CRUSH per lookup.  A
+   * table is immutable and only valid for the epoch it was built for;
+   * a map that has since been advanced keeps its old table around so
+   * that the next build can reuse the raw CRUSH output and up/acting
+   * rows of pools the change could not have affected.
+   */
+  struct PGMapping {
+    /// raw CRUSH output of one pool, before nonexistent osds are removed
+    struct Raw {
+      int ruleno;
+      unsigned size, type, pg_num, pgp_num;
+      bool hashpspool;
+      vector<int32_t> rows;  ///< per pg: count, then size osds
+      unsigned stride() const { return size + 1; }
+    };
+    struct Pool {
+      ceph::shared_ptr<const Raw> raw;
+      unsigned width;        ///< longest up or acting set
+      /// per pg: up_primary, acting_primary, up count, acting count,
+      /// then width slots each of up and acting
+      ceph::shared_ptr<vector<int32_t> > rows;
+      unsigned stride() const { return 4 + 2 * width; }
+      /// the pool's temps the rows were derived from
+      map<pg_t,vector<int32_t> > pg_temp;
+      map<pg_t,int32_t> primary_temp;
+      Pool() : width(0) {}
+    };
+    epoch_t epoch;
+    bufferlist crush_bl;
+    vector<__u32> osd_weight;
+    vector<uint8_t> osd_state;          ///< only exists and up
+    vector<__u32> osd_primary_affinity; ///< empty if not set
+    map<int64_t,Pool> pools;
+    unsigned num_raw_built, num_rows_built;  ///< pgs not shared
+    PGMapping() : epoch(0), num_raw_built(0), num_rows_built(0) {}
+  };
+
+  /**
+   * The current table
+   *
+   * A builder thread may install a table on a map others are already
+   * reading, so the pointer is only touched under a spinlock.
+   */
+  class PGMappingRef {
+    Spinlock lock;
+    ceph::shared_ptr<const PGMapping> m;
+  public:
+    PGMappingRef() {}
+    PGMappingRef(const PGMappingRef& o) : m(o.get()) {}
+    PGMappingRef& operator=(const PGMappingRef& o) {
+      set(o.get());
+      return *this;
+    }
+    ceph::shared_ptr<const PGMapping> get() const {
+      Spinlock::Locker l(lock);
+      return m;
+    }
+    void set(ceph::shared_ptr<const PGMapping> n) {
+      Spinlock::Locker l(lock);
+      m.swap(n);
+    }
+  };
+  mutable PGMappingRef pg_mapping;
+
   void _calc_up_osd_features();
+  bool _pg_mapping_lookup(const pg_pool_t& pool, const pg_t& pg,
+			  vector<int> *up, int *up_primary,
+			  vector<int> *acting, int *acting_primary) const;
+  void _build_pg_mapping_raw(const CrushWrapper& c, const pg_pool_t& pool,
+			     int64_t poolid, PGMapping::Raw *raw,
+			     unsigned begin, unsigned end) const;
+  void _build_pg_mapping_rows(const pg_pool_t& pool, int64_t poolid,
+			      PGMapping::Pool *p,
+			      unsigned begin, unsigned end) const;
 
  public:
   bool have_crc() const { return crc_defined; }
@@ -582,6 +664,27 @@ public:
   /// try to re-use/reference addrs in oldmap from newmap
   static void dedup(const OSDMap *oldmap, OSDMap *newmap);
 
+  /**
+   * Precompute the up and acting sets of every pg for this epoch
+   *
+   * Call once the map is complete; it may already be shared, lookups
+   * run CRUSH until the table is in place and are served from it
+   * until the map is modified (apply_incremental, decode).  Raw CRUSH
+   * output is reused from prev's table, or our own stale one, for
+   * pools whose parameters, rule and devices are unchanged, and the
+   * up/acting rows as well if no temp of the pool and no osd it maps
+   * to changed state or primary affinity.  The work runs on builder's
+   * threads, or in the caller without one.
+   */
+  void build_pg_mapping(CephContext *cct, const OSDMap *prev = NULL,
+			PGMappingBuilder *builder = NULL) const;
+  bool have_pg_mapping() const {
+    ceph::shared_ptr<const PGMapping> m = pg_mapping.get();
+    return m && m->epoch == epoch;
+  }
+  /// pgs the current table ran CRUSH for and derived up/acting rows for
+  void get_pg_mapping_stats(unsigned *raw_built, unsigned *rows_built) const;
+
   static void remove_redundant_temporaries(CephContext *cct, const OSDMap& osdmap,
 					   Incremental *pending_inc);
   static void remove_down_temps(CephContext *cct, const OSDMap& osdmap,
@@ -869,6 +972,37 @@ WRITE_CLASS_ENCODER_FEATURES(OSDMap::Incremental)
 
 typedef ceph::shared_ptr<const OSDMap> OSDMapRef;
 
+/**
+ * Persistent threads for OSDMap::build_pg_mapping()
+ *
+ * queue() builds tables in the background, one map at a time and in
+ * the order queued, so that each build can reuse the previous table.
+ */
+class PGMappingBuilder {
+public:
+  struct Work;
+private:
+  struct WQ;
+  struct C_Build;
+  CephContext *cct;
+  ThreadPool *tp;
+  WQ *wq;
+  Finisher *finisher;
+public:
+  PGMappingBuilder(CephContext *cct, int threads);
+  ~PGMappingBuilder();
+  void start();
+  void stop();
+
+  /// build map's table, reusing prev's if there is one
+  void queue(OSDMapRef map, OSDMapRef prev);
+  /// wait until everything queued so far is built
+  void wait();
+
+  /// run w's jobs on our threads and the caller's; return once all are done
+  void run(ceph::shared_ptr<Work> w);
+};
+
 inline ostream& operator<<(ostream& out, const OSDMap& m) {
   m.print_oneline_summary(out);
   return out;
@@ -753,6 +753,8 @@ void PG::generate_past_intervals()
       &debug);
     if (new_interval) {
       dout(10) << debug.str() << dendl;
+      if (cct->_conf->osd_summarize_past_intervals)
+	pg_interval_t::summarize_interval(&past_intervals, same_interval_since);
       same_interval_since = cur_epoch;
     }
   }
@@ -2740,6 +2742,10 @@ void PG::_init(ObjectStore::Transaction& t, spg_t pgid, const pg_pool_t *pool)
     ::encode(expected_num_objects_pg, hint);
     uint32_t hint_type = ObjectStore::Transaction::COLL_HINT_EXPECTED_NUM_OBJECTS;
     t.collection_hint(coll, hint_type, hint);
+
+    string alg;
+    if (pool->opts.get(pool_opts_t::COMPRESSION_ALGORITHM, &alg))
+      _hint_compression(t, coll, alg);
   }
 
   ghobject_t pgmeta_oid(pgid.make_pgmeta_oid());
@@ -2750,6 +2756,15 @@ void PG::_init(ObjectStore::Transaction& t, spg_t pgid, const pg_pool_t *pool)
   t.omap_setkeys(coll, pgmeta_oid, values);
 }
 
+void PG::_hint_compression(ObjectStore::Transaction& t, coll_t coll,
+			   const string& alg)
+{
+  bufferlist hint;
+  ::encode(alg, hint);
+  t.collection_hint(coll, ObjectStore::Transaction::COLL_HINT_COMPRESSION,
+		    hint);
+}
+
 void PG::prepare_write_info(map<string,bufferlist> *km)
 {
   info.stats.stats.add(unstable_stats);
@@ -4832,6 +4847,9 @@ void PG::start_peering_interval(
     dout(10) << __func__ << ": check_new_interval output: "
 	     << debug.str() << dendl;
     if (new_interval) {
+      if (cct->_conf->osd_summarize_past_intervals)
+	pg_interval_t::summarize_interval(&past_intervals,
+					  info.history.same_interval_since);
       dout(10) << " noting past " << past_intervals.rbegin()->second << dendl;
       dirty_info = true;
       dirty_big_info = true;
@@ -5379,7 +5397,15 @@ void PG::handle_advance_map(
 	   << " -- " << up_primary << "/" << acting_primary
 	   << dendl;
   update_osdmap_ref(osdmap);
+  string last_alg, alg;
+  pool.info.opts.get(pool_opts_t::COMPRESSION_ALGORITHM, &last_alg);
   pool.update(osdmap);
+  pool.info.opts.get(pool_opts_t::COMPRESSION_ALGORITHM, &alg);
+  if (alg != last_alg) {
+    dout(10) << __func__ << " compression_algorithm '" << last_alg << "' -> '"
+	     << alg << "'" << dendl;
+    _hint_compression(*rctx->transaction, coll, alg);
+  }
   AdvMap evt(
     osdmap, lastmap, newup, up_primary,
     newacting, acting_primary);
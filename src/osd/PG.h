@@ -892,6 +892,15 @@ public:
 	old_version,
 	t);
     }
+    void rollback_extents(
+      version_t gen,
+      uint64_t old_size,
+      interval_set<uint64_t> &extents) {
+      pg->get_pgbackend()->trim_stashed_object(
+	soid,
+	gen,
+	t);
+    }
   };
 
   struct SnapRollBacker : public ObjectModDesc::Visitor {
@@ -2163,6 +2172,8 @@ public:
   static void _create(ObjectStore::Transaction& t, spg_t pgid, int bits);
   static void _init(ObjectStore::Transaction& t,
 		    spg_t pgid, const pg_pool_t *pool);
+  static void _hint_compression(ObjectStore::Transaction& t, coll_t coll,
+				const string& alg);
 
 private:
   void prepare_write_info(map<string,bufferlist> *km);
@@ -66,6 +66,15 @@ struct RollbackVisitor : public ObjectModDesc::Visitor {
   void update_snaps(set<snapid_t> &snaps) {
     // pass
   }
+  void rollback_extents(
+    version_t gen,
+    uint64_t old_size,
+    interval_set<uint64_t> &extents) {
+    ObjectStore::Transaction temp;
+    pg->rollback_extents(hoid, gen, old_size, extents, &temp);
+    temp.append(t);
+    temp.swap(t);
+  }
 };
 
 void PGBackend::rollback(
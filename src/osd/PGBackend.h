@@ -441,6 +441,20 @@
        uint64_t off,
        uint64_t len
        ) { assert(0); }
+     /**
+      * Optional, ec-pools with partial-stripe overwrites only
+      *
+      * Unless stash_version is ghobject_t::NO_GEN, the data it replaces
+      * is first saved in that generation of hoid for rollback_extents.
+      */
+     virtual void overwrite(
+       const hobject_t &hoid, ///< [in] object to write
+       uint64_t off,          ///< [in] off at which to write
+       uint64_t len,          ///< [in] len to write from bl
+       bufferlist &bl,        ///< [in] bl to write will be claimed to len
+       uint32_t fadvise_flags, ///< [in] fadvise hint
+       version_t stash_version ///< [in] where to save the old data
+       ) { assert(0); }
 
      /// Supported on all backends
 
@@ -501,6 +515,14 @@
      uint64_t old_size,
      ObjectStore::Transaction *t);
 
+   /// Restore extents saved in generation gen to rollback overwrites
+   virtual void rollback_extents(
+     const hobject_t &hoid,
+     version_t gen,
+     uint64_t old_size,
+     const interval_set<uint64_t> &extents,
+     ObjectStore::Transaction *t) { assert(0); }
+
    /// Unstash object to rollback stash
    void rollback_stash(
      const hobject_t &hoid,
@@ -1365,6 +1365,89 @@ void ReplicatedBackend::calc_head_subsets(
 	   << "  clone_subsets " << clone_subsets << dendl;
 }
 
+/**
+ * calc_dirty_subset - can we push only what changed?
+ *
+ * If the peer has the object at some prior version and every log entry
+ * since then recorded the extents it dirtied, the union of those is
+ * all the data that differs.
+ */
+bool ReplicatedBackend::calc_dirty_subset(
+  ObjectContextRef obc, const hobject_t& soid, pg_shard_t peer,
+  interval_set<uint64_t> *data_subset,
+  eversion_t *partial_from)
+{
+  if (!cct->_conf->osd_recover_dirty_extents ||
+      !(get_parent()->min_peer_features() &
+	CEPH_FEATURE_OSD_PARTIAL_RECOVERY))
+    return false;
+
+  map<pg_shard_t, pg_missing_t>::const_iterator pm =
+    get_parent()->get_shard_missing().find(peer);
+  map<pg_shard_t, pg_info_t>::const_iterator pi =
+    get_parent()->get_shard_info().find(peer);
+  if (pm == get_parent()->get_shard_missing().end() ||
+      pi == get_parent()->get_shard_info().end() ||
+      cmp(soid, pi->second.last_backfill, get_parent()->sort_bitwise()) >= 0)
+    return false;
+  map<hobject_t, pg_missing_t::item, hobject_t::BitwiseComparator>::const_iterator m =
+    pm->second.missing.find(soid);
+  if (m == pm->second.missing.end() ||
+      m->second.need != obc->obs.oi.version)
+    return false;
+
+  if (!calc_dirty_subset(get_parent()->get_log().get_log(), soid,
+			 m->second.have, m->second.need, obc->obs.oi.size,
+			 data_subset)) {
+    dout(20) << __func__ << " " << soid << " log from " << m->second.have
+	     << " to " << m->second.need << " lacks dirty extents" << dendl;
+    return false;
+  }
+  *partial_from = m->second.have;
+  dout(10) << __func__ << " " << soid << " osd." << peer << " has "
+	   << m->second.have << ", pushing " << *data_subset
+	   << " of " << obc->obs.oi.size << dendl;
+  return true;
+}
+
+/**
+ * calc_dirty_subset - union of the extents dirtied from have to need
+ *
+ * Walks the log back from need; every entry for soid must be a modify
+ * with recorded extents and chain to the one before it, ending at have.
+ * The result is clipped to the object's current size.
+ */
+bool ReplicatedBackend::calc_dirty_subset(
+  const pg_log_t &log, const hobject_t& soid,
+  eversion_t have, eversion_t need, uint64_t size,
+  interval_set<uint64_t> *data_subset)
+{
+  if (have == eversion_t() || have < log.tail)
+    return false;
+
+  interval_set<uint64_t> dirty;
+  eversion_t want = need;
+  for (list<pg_log_entry_t>::const_reverse_iterator p = log.log.rbegin();
+       p != log.log.rend() && p->version > have;
+       ++p) {
+    if (p->soid != soid)
+      continue;
+    if (p->version != want || !p->is_modify() || !p->has_dirty_extents)
+      return false;
+    dirty.union_of(p->dirty_extents);
+    want = p->prior_version;
+  }
+  if (want != have)
+    return false;
+
+  data_subset->clear();
+  if (size) {
+    data_subset->insert(0, size);
+    data_subset->intersection_of(dirty);
+  }
+  return true;
+}
+
 void ReplicatedBackend::calc_clone_subsets(
   SnapSet& snapset, const hobject_t& soid,
   const pg_missing_t& missing,
@@ -1596,6 +1679,13 @@ void ReplicatedBackend::prep_push_to_replica(
 		       pi->second.last_backfill,
 		       data_subset, clone_subsets);
   } else if (soid.snap == CEPH_NOSNAP) {
+    eversion_t partial_from;
+    if (calc_dirty_subset(obc, soid, peer, &data_subset, &partial_from)) {
+      prep_push(obc, soid, peer, oi.version, data_subset, clone_subsets, pop,
+		cache_dont_need, partial_from);
+      return;
+    }
+
     // pushing head or unversioned object.
     // base this on partially on replica's clones?
     SnapSetContext *ssc = obc->ssc;
@@ -1632,7 +1722,8 @@ void ReplicatedBackend::prep_push(
   interval_set<uint64_t> &data_subset,
   map<hobject_t, interval_set<uint64_t>, hobject_t::BitwiseComparator>& clone_subsets,
   PushOp *pop,
-  bool cache_dont_need)
+  bool cache_dont_need,
+  eversion_t partial_from)
 {
   get_parent()->begin_peer_recover(peer, soid);
   // take note.
@@ -1644,10 +1735,12 @@ void ReplicatedBackend::prep_push(
   pi.recovery_info.soid = soid;
   pi.recovery_info.oi = obc->obs.oi;
   pi.recovery_info.version = version;
+  pi.recovery_info.partial_from = partial_from;
   pi.recovery_progress.first = true;
   pi.recovery_progress.data_recovered_to = 0;
   pi.recovery_progress.data_complete = 0;
-  pi.recovery_progress.omap_complete = 0;
+  // the peer's omap is already current if we only push dirty extents
+  pi.recovery_progress.omap_complete = partial_from != eversion_t();
 
   ObjectRecoveryProgress new_progress;
   int r = build_push_op(pi.recovery_info,
@@ -1694,6 +1787,32 @@ int ReplicatedBackend::send_pull_legacy(int prio, pg_shard_t peer,
   return 0;
 }
 
+/**
+ * prep_partial_push_target - start a partial push from our prior copy
+ *
+ * We have the object at partial_from; start from that, and clear the
+ * extents being pushed since holes in them are not sent.  The omap is
+ * already current and is left alone.
+ */
+void ReplicatedBackend::prep_partial_push_target(
+  coll_t coll,
+  const hobject_t &target_oid,
+  const ObjectRecoveryInfo &recovery_info,
+  ObjectStore::Transaction *t)
+{
+  if (target_oid != recovery_info.soid) {
+    t->remove(coll, ghobject_t(target_oid));
+    t->clone(coll, ghobject_t(recovery_info.soid), ghobject_t(target_oid));
+  }
+  t->truncate(coll, ghobject_t(target_oid), recovery_info.size);
+  t->rmattrs(coll, ghobject_t(target_oid));
+  for (interval_set<uint64_t>::const_iterator p =
+	 recovery_info.copy_subset.begin();
+       p != recovery_info.copy_subset.end();
+       ++p)
+    t->zero(coll, ghobject_t(target_oid), p.get_start(), p.get_len());
+}
+
 void ReplicatedBackend::submit_push_data(
   ObjectRecoveryInfo &recovery_info,
   bool first,
@@ -1719,7 +1838,9 @@ void ReplicatedBackend::submit_push_data(
     }
   }
 
-  if (first) {
+  if (first && recovery_info.partial_from != eversion_t()) {
+    prep_partial_push_target(coll, target_oid, recovery_info, t);
+  } else if (first) {
     t->remove(coll, ghobject_t(target_oid));
     t->touch(coll, ghobject_t(target_oid));
     t->truncate(coll, ghobject_t(target_oid), recovery_info.size);
@@ -305,7 +305,12 @@ private:
 		 interval_set<uint64_t> &data_subset,
 		 map<hobject_t, interval_set<uint64_t>, hobject_t::BitwiseComparator>& clone_subsets,
 		 PushOp *op,
-                 bool cache = false);
+                 bool cache = false,
+		 eversion_t partial_from = eversion_t());
+  bool calc_dirty_subset(ObjectContextRef obc, const hobject_t& soid,
+			 pg_shard_t peer,
+			 interval_set<uint64_t> *data_subset,
+			 eversion_t *partial_from);
   void calc_head_subsets(ObjectContextRef obc, SnapSet& snapset, const hobject_t& head,
 			 const pg_missing_t& missing,
 			 const hobject_t &last_backfill,
@@ -358,6 +363,16 @@ public:
     OpRequestRef op
     );
 
+  /// partial (dirty extent) recovery helpers
+  static bool calc_dirty_subset(const pg_log_t &log, const hobject_t& soid,
+				eversion_t have, eversion_t need,
+				uint64_t size,
+				interval_set<uint64_t> *data_subset);
+  static void prep_partial_push_target(coll_t coll,
+				       const hobject_t &target_oid,
+				       const ObjectRecoveryInfo &recovery_info,
+				       ObjectStore::Transaction *t);
+
 private:
   template<typename T, int MSGTYPE>
   Message * generate_subop(
@@ -2748,6 +2748,7 @@ void ReplicatedPG::execute_ctx(OpContext *ctx)
   // before we finally apply the resulting transaction.
   delete ctx->op_t;
   ctx->op_t = pgbackend->get_transaction();
+  ctx->ec_overwrite_extents.clear();
 
   if (op->may_write() || op->may_cache()) {
     // snap
@@ -4766,18 +4767,25 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	if (pool.info.has_flag(pg_pool_t::FLAG_WRITE_FADVISE_DONTNEED))
 	  op.flags = op.flags | CEPH_OSD_OP_FLAG_FADVISE_DONTNEED;
 
-	if (pool.info.requires_aligned_append() &&
+	// anything but an aligned append goes through read-modify-write
+	bool overwrite = can_ec_overwrite() &&
+	  (op.extent.offset != (obs.exists ? oi.size : 0) ||
+	   op.extent.offset % pool.info.required_alignment() != 0);
+
+	if (pool.info.requires_aligned_append() && !overwrite &&
 	    (op.extent.offset % pool.info.required_alignment() != 0)) {
 	  result = -EOPNOTSUPP;
 	  break;
 	}
 
 	if (!obs.exists) {
-	  if (pool.info.require_rollback() && op.extent.offset) {
+	  if (pool.info.require_rollback() && op.extent.offset && !overwrite) {
 	    result = -EOPNOTSUPP;
 	    break;
 	  }
 	  ctx->mod_desc.create();
+	} else if (overwrite) {
+	  // finish_ctx records the rollback info
 	} else if (op.extent.offset == oi.size) {
 	  ctx->mod_desc.append(oi.size);
 	} else {
@@ -4801,6 +4809,10 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	if (op.extent.truncate_seq > seq) {
 	  // write arrives before trimtrunc
 	  if (obs.exists && !oi.is_whiteout()) {
+	    if (pool.info.require_rollback()) {
+	      result = -EOPNOTSUPP;
+	      break;
+	    }
 	    dout(10) << " truncate_seq " << op.extent.truncate_seq << " > current " << seq
 		     << ", truncating to " << op.extent.truncate_size << dendl;
 	    t->truncate(soid, op.extent.truncate_size);
@@ -4821,7 +4833,9 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	result = check_offset_and_length(op.extent.offset, op.extent.length, cct->_conf->osd_max_object_size);
 	if (result < 0)
 	  break;
-	if (pool.info.require_rollback()) {
+	if (overwrite) {
+	  ec_overwrite(ctx, op.extent.offset, osd_op.indata, op.flags);
+	} else if (pool.info.require_rollback()) {
 	  t->append(soid, op.extent.offset, op.extent.length, osd_op.indata, op.flags);
 	} else {
 	  t->write(soid, op.extent.offset, op.extent.length, osd_op.indata, op.flags);
@@ -4905,7 +4919,7 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 
     case CEPH_OSD_OP_ZERO:
       tracepoint(osd, do_osd_op_pre_zero, soid.oid.name.c_str(), soid.snap.val, op.extent.offset, op.extent.length);
-      if (pool.info.require_rollback()) {
+      if (pool.info.require_rollback() && !can_ec_overwrite()) {
 	result = -EOPNOTSUPP;
 	break;
       }
@@ -4916,8 +4930,18 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	  break;
 	assert(op.extent.length);
 	if (obs.exists && !oi.is_whiteout()) {
-	  ctx->mod_desc.mark_unrollbackable();
-	  t->zero(soid, op.extent.offset, op.extent.length);
+	  if (pool.info.require_rollback()) {
+	    // zeroing does not extend the object
+	    if (op.extent.offset < oi.size) {
+	      bufferlist zeros;
+	      zeros.append_zero(
+		MIN(op.extent.length, oi.size - op.extent.offset));
+	      ec_overwrite(ctx, op.extent.offset, zeros, op.flags);
+	    }
+	  } else {
+	    ctx->mod_desc.mark_unrollbackable();
+	    t->zero(soid, op.extent.offset, op.extent.length);
+	  }
 	  interval_set<uint64_t> ch;
 	  ch.insert(op.extent.offset, op.extent.length);
 	  ctx->modified_ranges.union_of(ch);
@@ -6215,6 +6239,30 @@ void ReplicatedPG::make_writeable(OpContext *ctx)
 }
 
 
+/**
+ * ec_overwrite - overwrite data in place on an ec pool
+ *
+ * Unless the op already created or stashed the object, the backend
+ * first saves the data it replaces at the op's version so that the
+ * write can be rolled back; finish_ctx logs what was saved.
+ */
+void ReplicatedPG::ec_overwrite(OpContext *ctx, uint64_t off, bufferlist &bl,
+				uint32_t fadvise_flags)
+{
+  const hobject_t& soid = ctx->obs->oi.soid;
+  version_t gen = ghobject_t::NO_GEN;
+  if (bl.length() && !ctx->mod_desc.rollback_info_complete()) {
+    gen = ctx->at_version.version;
+    ctx->ec_overwrite_gen = gen;
+    interval_set<uint64_t> ch;
+    ch.insert(off, bl.length());
+    ctx->ec_overwrite_extents.union_of(ch);
+  }
+  dout(20) << __func__ << " " << soid << " " << off << "~" << bl.length()
+	   << " gen " << gen << dendl;
+  ctx->op_t->overwrite(soid, off, bl.length(), bl, fadvise_flags, gen);
+}
+
 void ReplicatedPG::write_update_size_and_usage(object_stat_sum_t& delta_stats, object_info_t& oi,
 					       interval_set<uint64_t>& modified, uint64_t offset,
 					       uint64_t length, bool count_bytes, bool force_changesize)
@@ -6362,6 +6410,97 @@ hobject_t ReplicatedPG::get_temp_recovery_object(eversion_t version, snapid_t sn
   return hoid;
 }
 
+/**
+ * calc_dirty_extents - data extents a client op may modify
+ *
+ * Errs on the side of too much: truncations dirty everything from the
+ * new end on.  Only the ops listed here are understood; anything else
+ * (omap, cls calls, clone_range, rollback, ...) may change the object
+ * in ways the extents do not describe, so we return false and recovery
+ * pushes it in full.
+ */
+bool ReplicatedPG::calc_dirty_extents(const vector<OSDOp>& ops,
+				      const object_info_t& oi,
+				      uint64_t new_size,
+				      interval_set<uint64_t> *dirty)
+{
+  uint64_t end = MAX(oi.size, new_size);
+  for (vector<OSDOp>::const_iterator p = ops.begin(); p != ops.end(); ++p) {
+    const ceph_osd_op& op = p->op;
+    if (op.op == CEPH_OSD_OP_WRITE || op.op == CEPH_OSD_OP_ZERO)
+      end = MAX(end, op.extent.offset + op.extent.length);
+  }
+
+  for (vector<OSDOp>::const_iterator p = ops.begin(); p != ops.end(); ++p) {
+    const ceph_osd_op& op = p->op;
+    interval_set<uint64_t> e;
+    switch (op.op) {
+    case CEPH_OSD_OP_WRITE:
+      if (op.extent.truncate_seq > oi.truncate_seq &&
+	  op.extent.truncate_size < end)
+	e.insert(op.extent.truncate_size, end - op.extent.truncate_size);
+      // fall through
+    case CEPH_OSD_OP_ZERO:
+      if (op.extent.length) {
+	interval_set<uint64_t> w;
+	w.insert(op.extent.offset, op.extent.length);
+	e.union_of(w);
+      }
+      break;
+    case CEPH_OSD_OP_WRITEFULL:
+      if (end)
+	e.insert(0, end);
+      break;
+    case CEPH_OSD_OP_APPEND:
+      // lands at or past the smaller size, or in a truncated range
+      if (end > MIN(oi.size, new_size))
+	e.insert(MIN(oi.size, new_size), end - MIN(oi.size, new_size));
+      break;
+    case CEPH_OSD_OP_TRUNCATE:
+    case CEPH_OSD_OP_TRIMTRUNC:
+      {
+	uint64_t off = op.op == CEPH_OSD_OP_TRIMTRUNC ?
+	  op.extent.truncate_size : op.extent.offset;
+	if (off < end)
+	  e.insert(off, end - off);
+      }
+      break;
+
+      // attrs only; these travel with every push
+    case CEPH_OSD_OP_CREATE:
+    case CEPH_OSD_OP_SETXATTR:
+    case CEPH_OSD_OP_RMXATTR:
+    case CEPH_OSD_OP_SETALLOCHINT:
+    case CEPH_OSD_OP_WATCH:
+      break;
+
+      // reads and asserts
+    case CEPH_OSD_OP_READ:
+    case CEPH_OSD_OP_SPARSE_READ:
+    case CEPH_OSD_OP_SYNC_READ:
+    case CEPH_OSD_OP_STAT:
+    case CEPH_OSD_OP_MAPEXT:
+    case CEPH_OSD_OP_ASSERT_VER:
+    case CEPH_OSD_OP_GETXATTR:
+    case CEPH_OSD_OP_GETXATTRS:
+    case CEPH_OSD_OP_CMPXATTR:
+    case CEPH_OSD_OP_OMAPGETKEYS:
+    case CEPH_OSD_OP_OMAPGETVALS:
+    case CEPH_OSD_OP_OMAPGETHEADER:
+    case CEPH_OSD_OP_OMAPGETVALSBYKEYS:
+    case CEPH_OSD_OP_OMAP_CMP:
+    case CEPH_OSD_OP_LIST_WATCHERS:
+    case CEPH_OSD_OP_ISDIRTY:
+      break;
+
+    default:
+      return false;
+    }
+    dirty->union_of(e);
+  }
+  return true;
+}
+
 int ReplicatedPG::prepare_transaction(OpContext *ctx)
 {
   assert(!ctx->ops.empty());
@@ -6406,6 +6545,19 @@ int ReplicatedPG::prepare_transaction(OpContext *ctx)
     }
   }
 
+  // note the data we touched so that recovery can push only that to
+  // a replica with the prior version
+  if (cct->_conf->osd_recover_dirty_extents &&
+      !pool.info.require_rollback() &&
+      soid.snap == CEPH_NOSNAP &&
+      ctx->obs->exists && !ctx->obs->oi.is_whiteout() &&
+      ctx->new_obs.exists &&
+      calc_dirty_extents(ctx->ops, ctx->obs->oi, ctx->new_obs.oi.size,
+			 &ctx->dirty_extents) &&
+      ctx->dirty_extents.num_intervals() <=
+        (unsigned)cct->_conf->osd_recover_dirty_extents_limit)
+    ctx->has_dirty_extents = true;
+
   // clone, if necessary
   if (soid.snap == CEPH_NOSNAP)
     make_writeable(ctx);
@@ -6587,7 +6739,15 @@ void ReplicatedPG::finish_ctx(OpContext *ctx, int log_op_type, bool maintain_ssc
     }
   }
 
+  if (!ctx->ec_overwrite_extents.empty())
+    ctx->mod_desc.rollback_extents(ctx->ec_overwrite_gen,
+				   ctx->obc->obs.oi.size,
+				   ctx->ec_overwrite_extents);
   ctx->log.back().mod_desc.claim(ctx->mod_desc);
+  if (log_op_type == pg_log_entry_t::MODIFY && ctx->has_dirty_extents) {
+    ctx->log.back().has_dirty_extents = true;
+    ctx->log.back().dirty_extents.swap(ctx->dirty_extents);
+  }
   if (!ctx->extra_reqids.empty()) {
     dout(20) << __func__ << "  extra_reqids " << ctx->extra_reqids << dendl;
     ctx->log.back().extra_reqids.swap(ctx->extra_reqids);
@@ -530,6 +530,12 @@ public:
     boost::optional<pg_hit_set_history_t> updated_hset_history;
 
     interval_set<uint64_t> modified_ranges;
+    bool has_dirty_extents;                ///< set dirty_extents on the log entry
+    interval_set<uint64_t> dirty_extents;
+
+    /// ec extents overwritten in place, with the old data saved at gen
+    version_t ec_overwrite_gen;
+    interval_set<uint64_t> ec_overwrite_extents;
     ObjectContextRef obc;
     map<hobject_t,ObjectContextRef, hobject_t::BitwiseComparator> src_obc;
     ObjectContextRef clone_obc;    // if we created a clone
@@ -612,6 +618,8 @@ public:
       bytes_written(0), bytes_read(0), user_at_version(0),
       current_osd_subop_num(0),
       op_t(NULL),
+      has_dirty_extents(false),
+      ec_overwrite_gen(0),
       obc(obc),
       data_off(0), reply(NULL), pg(_pg),
       num_read(0),
@@ -635,6 +643,8 @@ public:
       bytes_written(0), bytes_read(0), user_at_version(0),
       current_osd_subop_num(0),
       op_t(NULL),
+      has_dirty_extents(false),
+      ec_overwrite_gen(0),
       data_off(0), reply(NULL), pg(_pg),
       num_read(0),
       num_write(0),
@@ -1169,6 +1179,14 @@ protected:
 				   bool force_changesize=false);
   void add_interval_usage(interval_set<uint64_t>& s, object_stat_sum_t& st);
 
+  /// true if data may be overwritten in place on this ec pool
+  bool can_ec_overwrite() {
+    return pool.info.is_erasure() && pool.info.allows_ec_overwrites() &&
+      (get_min_upacting_features() & CEPH_FEATURE_OSD_EC_OVERWRITES);
+  }
+  void ec_overwrite(OpContext *ctx, uint64_t off, bufferlist &bl,
+		    uint32_t fadvise_flags);
+
 
   enum class cache_result_t {
     NOOP,
@@ -1483,6 +1501,10 @@ public:
   int do_tmapup_slow(OpContext *ctx, bufferlist::iterator& bp, OSDOp& osd_op, bufferlist& bl);
 
   void do_osd_op_effects(OpContext *ctx, const ConnectionRef& conn);
+
+  static bool calc_dirty_extents(const vector<OSDOp>& ops,
+				 const object_info_t& oi, uint64_t new_size,
+				 interval_set<uint64_t> *dirty);
 private:
   hobject_t earliest_backfill() const;
   bool check_src_targ(const hobject_t& soid, const hobject_t& toid) const;
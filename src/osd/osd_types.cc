@@ -900,7 +900,9 @@ static opt_mapping_t opt_mapping = boost::assign::map_list_of
 	   ("scrub_max_interval", pool_opts_t::opt_desc_t(
 	     pool_opts_t::SCRUB_MAX_INTERVAL, pool_opts_t::DOUBLE))
 	   ("deep_scrub_interval", pool_opts_t::opt_desc_t(
-	     pool_opts_t::DEEP_SCRUB_INTERVAL, pool_opts_t::DOUBLE));
+	     pool_opts_t::DEEP_SCRUB_INTERVAL, pool_opts_t::DOUBLE))
+	   ("compression_algorithm", pool_opts_t::opt_desc_t(
+	     pool_opts_t::COMPRESSION_ALGORITHM, pool_opts_t::STR));
 
 bool pool_opts_t::is_opt_name(const std::string& name) {
     return opt_mapping.find(name) != opt_mapping.end();
@@ -3082,6 +3084,38 @@ bool pg_interval_t::check_new_interval(
   }
 }
 
+void pg_interval_t::summarize_interval(
+  map<epoch_t, pg_interval_t> *past_intervals,
+  epoch_t first)
+{
+  map<epoch_t, pg_interval_t>::iterator p = past_intervals->find(first);
+  if (p == past_intervals->end() || p->second.maybe_went_rw)
+    return;
+
+  if (p != past_intervals->begin()) {
+    map<epoch_t, pg_interval_t>::iterator prev = p;
+    --prev;
+    if (!prev->second.maybe_went_rw &&
+	prev->second.last + 1 == p->second.first) {
+      prev->second.last = p->second.last;
+      past_intervals->erase(p);
+      p = prev;
+    }
+  }
+  map<epoch_t, pg_interval_t>::iterator next = p;
+  ++next;
+  if (next != past_intervals->end() &&
+      !next->second.maybe_went_rw &&
+      p->second.last + 1 == next->second.first) {
+    p->second.last = next->second.last;
+    past_intervals->erase(next);
+  }
+  p->second.up.clear();
+  p->second.acting.clear();
+  p->second.primary = -1;
+  p->second.up_primary = -1;
+}
+
 ostream& operator<<(ostream& out, const pg_interval_t& i)
 {
   out << "interval(" << i.first << "-" << i.last
@@ -3201,6 +3235,16 @@ void ObjectModDesc::visit(Visitor *visitor) const
 	visitor->update_snaps(snaps);
 	break;
       }
+      case ROLLBACK_EXTENTS: {
+	version_t gen;
+	uint64_t old_size;
+	interval_set<uint64_t> extents;
+	::decode(gen, bp);
+	::decode(old_size, bp);
+	::decode(extents, bp);
+	visitor->rollback_extents(gen, old_size, extents);
+	break;
+      }
       default:
 	assert(0 == "Invalid rollback code");
       }
@@ -3249,6 +3293,17 @@ struct DumpVisitor : public ObjectModDesc::Visitor {
     f->dump_stream("snaps") << snaps;
     f->close_section();
   }
+  void rollback_extents(
+    version_t gen,
+    uint64_t old_size,
+    interval_set<uint64_t> &extents) {
+    f->open_object_section("op");
+    f->dump_string("code", "ROLLBACK_EXTENTS");
+    f->dump_unsigned("gen", gen);
+    f->dump_unsigned("old_size", old_size);
+    f->dump_stream("extents") << extents;
+    f->close_section();
+  }
 };
 
 void ObjectModDesc::dump(Formatter *f) const
@@ -3284,6 +3339,12 @@ void ObjectModDesc::generate_test_instances(list<ObjectModDesc*>& o)
   o.back()->setattrs(attrs);
   o.back()->mark_unrollbackable();
   o.back()->append(1000);
+  interval_set<uint64_t> extents;
+  extents.insert(4096, 100);
+  extents.insert(16384, 8192);
+  o.push_back(new ObjectModDesc());
+  o.back()->setattrs(attrs);
+  o.back()->rollback_extents(1002, 65536, extents);
 }
 
 void ObjectModDesc::encode(bufferlist &_bl) const
@@ -3333,7 +3394,7 @@ void pg_log_entry_t::decode_with_checksum(bufferlist::iterator& p)
 
 void pg_log_entry_t::encode(bufferlist &bl) const
 {
-  ENCODE_START(10, 4, bl);
+  ENCODE_START(11, 4, bl);
   ::encode(op, bl);
   ::encode(soid, bl);
   ::encode(version, bl);
@@ -3358,12 +3419,14 @@ void pg_log_entry_t::encode(bufferlist &bl) const
   ::encode(user_version, bl);
   ::encode(mod_desc, bl);
   ::encode(extra_reqids, bl);
+  ::encode(has_dirty_extents, bl);
+  ::encode(dirty_extents, bl);
   ENCODE_FINISH(bl);
 }
 
 void pg_log_entry_t::decode(bufferlist::iterator &bl)
 {
-  DECODE_START_LEGACY_COMPAT_LEN(10, 4, 4, bl);
+  DECODE_START_LEGACY_COMPAT_LEN(11, 4, 4, bl);
   ::decode(op, bl);
   if (struct_v < 2) {
     sobject_t old_soid;
@@ -3412,6 +3475,12 @@ void pg_log_entry_t::decode(bufferlist::iterator &bl)
     mod_desc.mark_unrollbackable();
   if (struct_v >= 10)
     ::decode(extra_reqids, bl);
+  if (struct_v >= 11) {
+    ::decode(has_dirty_extents, bl);
+    ::decode(dirty_extents, bl);
+  } else {
+    has_dirty_extents = false;
+  }
 
   DECODE_FINISH(bl);
 }
@@ -3454,6 +3523,8 @@ void pg_log_entry_t::dump(Formatter *f) const
     mod_desc.dump(f);
     f->close_section();
   }
+  if (has_dirty_extents)
+    f->dump_stream("dirty_extents") << dirty_extents;
 }
 
 void pg_log_entry_t::generate_test_instances(list<pg_log_entry_t*>& o)
@@ -3463,6 +3534,11 @@ void pg_log_entry_t::generate_test_instances(list<pg_log_entry_t*>& o)
   o.push_back(new pg_log_entry_t(MODIFY, oid, eversion_t(1,2), eversion_t(3,4),
 				 1, osd_reqid_t(entity_name_t::CLIENT(777), 8, 999),
 				 utime_t(8,9)));
+  o.push_back(new pg_log_entry_t(MODIFY, oid, eversion_t(1,3), eversion_t(1,2),
+				 2, osd_reqid_t(entity_name_t::CLIENT(777), 9, 999),
+				 utime_t(8,10)));
+  o.back()->has_dirty_extents = true;
+  o.back()->dirty_extents.insert(4096, 8192);
 }
 
 ostream& operator<<(ostream& out, const pg_log_entry_t& e)
@@ -4865,7 +4941,7 @@ void ObjectRecoveryProgress::dump(Formatter *f) const
 
 void ObjectRecoveryInfo::encode(bufferlist &bl) const
 {
-  ENCODE_START(2, 1, bl);
+  ENCODE_START(3, 1, bl);
   ::encode(soid, bl);
   ::encode(version, bl);
   ::encode(size, bl);
@@ -4873,13 +4949,14 @@ void ObjectRecoveryInfo::encode(bufferlist &bl) const
   ::encode(ss, bl);
   ::encode(copy_subset, bl);
   ::encode(clone_subset, bl);
+  ::encode(partial_from, bl);
   ENCODE_FINISH(bl);
 }
 
 void ObjectRecoveryInfo::decode(bufferlist::iterator &bl,
 				int64_t pool)
 {
-  DECODE_START(2, bl);
+  DECODE_START(3, bl);
   ::decode(soid, bl);
   ::decode(version, bl);
   ::decode(size, bl);
@@ -4887,6 +4964,8 @@ void ObjectRecoveryInfo::decode(bufferlist::iterator &bl,
   ::decode(ss, bl);
   ::decode(copy_subset, bl);
   ::decode(clone_subset, bl);
+  if (struct_v >= 3)
+    ::decode(partial_from, bl);
   DECODE_FINISH(bl);
 
   if (struct_v < 2) {
@@ -4932,6 +5011,7 @@ void ObjectRecoveryInfo::dump(Formatter *f) const
   }
   f->dump_stream("copy_subset") << copy_subset;
   f->dump_stream("clone_subset") << clone_subset;
+  f->dump_stream("partial_from") << partial_from;
 }
 
 ostream& operator<<(ostream& out, const ObjectRecoveryInfo &inf)
@@ -4941,12 +5021,14 @@ ostream& operator<<(ostream& out, const ObjectRecoveryInfo &inf)
 
 ostream &ObjectRecoveryInfo::print(ostream &out) const
 {
-  return out << "ObjectRecoveryInfo("
-	     << soid << "@" << version
-	     << ", size: " << size
-	     << ", copy_subset: " << copy_subset
-	     << ", clone_subset: " << clone_subset
-	     << ")";
+  out << "ObjectRecoveryInfo("
+      << soid << "@" << version
+      << ", size: " << size
+      << ", copy_subset: " << copy_subset
+      << ", clone_subset: " << clone_subset;
+  if (partial_from != eversion_t())
+    out << ", partial_from: " << partial_from;
+  return out << ")";
 }
 
 // -- PushReplyOp --
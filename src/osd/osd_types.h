@@ -902,6 +902,7 @@ public:
     SCRUB_MIN_INTERVAL,
     SCRUB_MAX_INTERVAL,
     DEEP_SCRUB_INTERVAL,
+    COMPRESSION_ALGORITHM,
   };
 
   enum type_t {
@@ -999,6 +1000,7 @@ struct pg_pool_t {
     FLAG_WRITE_FADVISE_DONTNEED = 1<<7, // write mode with LIBRADOS_OP_FLAG_FADVISE_DONTNEED
     FLAG_NOSCRUB = 1<<8, // block periodic scrub
     FLAG_NODEEP_SCRUB = 1<<9, // block periodic deep-scrub
+    FLAG_EC_OVERWRITES = 1<<10, // ec pool allows partial-stripe overwrites
   };
 
   static const char *get_flag_name(int f) {
@@ -1013,6 +1015,7 @@ struct pg_pool_t {
     case FLAG_WRITE_FADVISE_DONTNEED: return "write_fadvise_dontneed";
     case FLAG_NOSCRUB: return "noscrub";
     case FLAG_NODEEP_SCRUB: return "nodeep-scrub";
+    case FLAG_EC_OVERWRITES: return "ec_overwrites";
     default: return "???";
     }
   }
@@ -1051,6 +1054,8 @@ struct pg_pool_t {
       return FLAG_NOSCRUB;
     if (name == "nodeep-scrub")
       return FLAG_NODEEP_SCRUB;
+    if (name == "ec_overwrites")
+      return FLAG_EC_OVERWRITES;
     return 0;
   }
 
@@ -1313,6 +1318,9 @@ public:
   }
 
   bool requires_aligned_append() const { return is_erasure(); }
+  bool allows_ec_overwrites() const {
+    return has_flag(FLAG_EC_OVERWRITES);
+  }
   uint64_t required_alignment() const { return stripe_width; }
 
   bool can_shift_osds() const {
@@ -2169,6 +2177,20 @@ struct pg_interval_t {
     map<epoch_t, pg_interval_t> *past_intervals,///< [out] intervals
     ostream *out = 0                            ///< [out] debug ostream
     );
+
+  /**
+   * Summarises the interval starting at first if it cannot have gone rw
+   *
+   * Peering skips such intervals, so we keep only their epoch range,
+   * merged with any adjacent ones.  The map still covers every epoch
+   * back to last_epoch_clean (and we need not regenerate it from old
+   * maps), but a flapping pg adds at most one entry between rw
+   * intervals instead of one per map change.
+   */
+  static void summarize_interval(
+    map<epoch_t, pg_interval_t> *past_intervals,///< [in,out] intervals
+    epoch_t first                               ///< [in] interval to summarise
+    );
 };
 WRITE_CLASS_ENCODER(pg_interval_t)
 
@@ -2260,6 +2282,10 @@ public:
     virtual void rmobject(version_t old_version) {}
     virtual void create() {}
     virtual void update_snaps(set<snapid_t> &old_snaps) {}
+    virtual void rollback_extents(
+      version_t gen,
+      uint64_t old_size,
+      interval_set<uint64_t> &extents) {}
     virtual ~Visitor() {}
   };
   void visit(Visitor *visitor) const;
@@ -2269,7 +2295,8 @@ public:
     SETATTRS = 2,
     DELETE = 3,
     CREATE = 4,
-    UPDATE_SNAPS = 5
+    UPDATE_SNAPS = 5,
+    ROLLBACK_EXTENTS = 6
   };
   ObjectModDesc() : can_local_rollback(true), rollback_info_completed(false) {}
   void claim(ObjectModDesc &other) {
@@ -2345,6 +2372,23 @@ public:
     ::encode(old_snaps, bl);
     ENCODE_FINISH(bl);
   }
+  /**
+   * Logical extents overwritten in place on an object of old_size;
+   * the overwritten data was saved in the object's gen generation.
+   */
+  void rollback_extents(
+    version_t gen,
+    uint64_t old_size,
+    const interval_set<uint64_t> &extents) {
+    if (!can_local_rollback || rollback_info_completed)
+      return;
+    ENCODE_START(1, 1, bl);
+    append_id(ROLLBACK_EXTENTS);
+    ::encode(gen, bl);
+    ::encode(old_size, bl);
+    ::encode(extents, bl);
+    ENCODE_FINISH(bl);
+  }
 
   // cannot be rolled back
   void mark_unrollbackable() {
@@ -2354,6 +2398,10 @@ public:
   bool can_rollback() const {
     return can_local_rollback;
   }
+  /// true once the object was created or stashed: later ops need no info
+  bool rollback_info_complete() const {
+    return rollback_info_completed;
+  }
   bool empty() const {
     return can_local_rollback && (bl.length() == 0);
   }
@@ -2436,9 +2484,15 @@ struct pg_log_entry_t {
 
   vector<pair<osd_reqid_t, version_t> > extra_reqids;
 
+  /// data extents this entry modified, if has_dirty_extents; lets
+  /// recovery push only those to a peer at prior_version
+  bool has_dirty_extents;
+  interval_set<uint64_t> dirty_extents;
+
   pg_log_entry_t()
     : op(0), user_version(0),
-      invalid_hash(false), invalid_pool(false), offset(0) {}
+      invalid_hash(false), invalid_pool(false), offset(0),
+      has_dirty_extents(false) {}
   pg_log_entry_t(int _op, const hobject_t& _soid, 
 		 const eversion_t& v, const eversion_t& pv,
 		 version_t uv,
@@ -2446,7 +2500,7 @@ struct pg_log_entry_t {
     : op(_op), soid(_soid), version(v),
       prior_version(pv), user_version(uv),
       reqid(rid), mtime(mt), invalid_hash(false), invalid_pool(false),
-      offset(0) {}
+      offset(0), has_dirty_extents(false) {}
       
   bool is_clone() const { return op == CLONE; }
   bool is_modify() const { return op == MODIFY; }
@@ -3663,6 +3717,9 @@ struct ObjectRecoveryInfo {
   SnapSet ss;
   interval_set<uint64_t> copy_subset;
   map<hobject_t, interval_set<uint64_t>, hobject_t::BitwiseComparator> clone_subset;
+  /// if set, the target already has the object at this version and
+  /// only copy_subset (and the attrs) differ
+  eversion_t partial_from;
 
   ObjectRecoveryInfo() : size(0) { }
 
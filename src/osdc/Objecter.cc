@@ -1105,6 +1105,8 @@ void Objecter::handle_osd_map(MOSDMap *m)
 	  continue;
 	}
 	logger->set(l_osdc_map_epoch, osdmap->get_epoch());
+	if (cct->_conf->objecter_mapping_table)
+	  osdmap->build_pg_mapping(cct);
 
 	cluster_full = cluster_full || _osdmap_full_flag();
         update_pool_full_map(pool_full_map);
@@ -1142,6 +1144,8 @@ void Objecter::handle_osd_map(MOSDMap *m)
 	ldout(cct, 3) << "handle_osd_map decoding full epoch "
 		      << m->get_last() << dendl;
 	osdmap->decode(m->maps[m->get_last()]);
+	if (cct->_conf->objecter_mapping_table)
+	  osdmap->build_pg_mapping(cct);
 
 	_scan_requests(homeless_session, false, false, NULL,
 		       need_resend, need_resend_linger,
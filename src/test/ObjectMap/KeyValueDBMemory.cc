@@ -194,6 +194,39 @@ int KeyValueDBMemory::set(const string &prefix,
   return 0;
 }
 
+int KeyValueDBMemory::rm_range_keys(const string &prefix,
+				    const string &start,
+				    const string &end) {
+  ++range_deletes;
+  map<std::pair<string,string>,bufferlist>::iterator i =
+    db.lower_bound(make_pair(prefix, start));
+  while (i != db.end() && i->first.first == prefix && i->first.second < end)
+    db.erase(i++);
+  return 0;
+}
+
+int KeyValueDBMemory::merge(const string &prefix,
+			    const string &key,
+			    const bufferlist &bl) {
+  std::map<string, ceph::shared_ptr<MergeOperator> >::iterator mop =
+    merge_ops.find(prefix);
+  assert(mop != merge_ops.end());
+  bufferlist operand = bl;
+  string new_value;
+  std::map<std::pair<string,string>,bufferlist>::iterator p =
+    db.find(make_pair(prefix, key));
+  if (p != db.end())
+    mop->second->merge(p->second.c_str(), p->second.length(),
+		       operand.c_str(), operand.length(), &new_value);
+  else
+    mop->second->merge_nonexistent(operand.c_str(), operand.length(),
+				   &new_value);
+  bufferlist v;
+  v.append(new_value);
+  db[make_pair(prefix, key)] = v;
+  return 0;
+}
+
 int KeyValueDBMemory::rmkey(const string &prefix,
 			    const string &key) {
   db.erase(make_pair(prefix,key));
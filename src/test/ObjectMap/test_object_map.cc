@@ -9,6 +9,7 @@
 #include "kv/KeyValueDB.h"
 #include "os/DBObjectMap.h"
 #include "os/HashIndex.h"
+#include "include/stringify.h"
 #include <sys/types.h>
 #include "global/global_init.h"
 #include "common/ceph_argparse.h"
@@ -612,6 +613,73 @@ TEST_F(ObjectMapTest, CreateOneObject) {
   ASSERT_EQ(attrs_got.size(), 0U);
 }
 
+TEST_F(ObjectMapTest, SeqReserve) {
+  DBObjectMap *omap = static_cast<DBObjectMap*>(db.get());
+  map<string, bufferlist> to_set;
+  to_set["key"].append("val");
+  for (unsigned i = 0; i < 10; ++i) {
+    ghobject_t hoid(hobject_t(sobject_t("seq" + stringify(i), CEPH_NOSNAP)));
+    ASSERT_EQ(0, db->set_keys(hoid, to_set));
+  }
+
+  // the persisted seq must cover every seq handed out so far
+  set<string> keys;
+  keys.insert(DBObjectMap::GLOBAL_STATE_KEY);
+  map<string, bufferlist> out;
+  ASSERT_EQ(0, omap->db->get(DBObjectMap::SYS_PREFIX, keys, &out));
+  ASSERT_EQ(1u, out.size());
+  DBObjectMap::State state;
+  bufferlist::iterator p = out.begin()->second.begin();
+  state.decode(p);
+  ASSERT_GE(state.seq, omap->state.seq);
+}
+
+TEST_F(ObjectMapTest, ClearRangeDelete) {
+  DBObjectMap *omap = static_cast<DBObjectMap*>(db.get());
+  KeyValueDBMemory *kv = dynamic_cast<KeyValueDBMemory*>(omap->db.get());
+  if (!kv)
+    return;
+  g_ceph_context->_conf->set_val("filestore_omap_range_delete_min_keys", "16");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  ghobject_t small(hobject_t(sobject_t("small", CEPH_NOSNAP)));
+  ghobject_t big(hobject_t(sobject_t("big", CEPH_NOSNAP)));
+  ghobject_t next(hobject_t(sobject_t("next", CEPH_NOSNAP)));
+  map<string, bufferlist> few, many;
+  for (unsigned i = 0; i < 32; ++i) {
+    if (i < 2)
+      few["key" + stringify(i)].append("val");
+    many["key" + stringify(i)].append("val");
+  }
+  ASSERT_EQ(0, db->set_keys(small, few));
+  ASSERT_EQ(0, db->set_xattrs(small, few));
+  ASSERT_EQ(0, db->set_keys(big, many));
+  ASSERT_EQ(0, db->set_keys(next, many));
+
+  // a small object is removed key by key
+  uint64_t range_deletes = kv->range_deletes;
+  ASSERT_EQ(0, db->clear(small));
+  ASSERT_EQ(range_deletes, kv->range_deletes);
+  bufferlist header;
+  map<string, bufferlist> got;
+  db->get(small, &header, &got);
+  ASSERT_EQ(0u, got.size());
+  set<string> xattrs;
+  db->get_all_xattrs(small, &xattrs);
+  ASSERT_EQ(0u, xattrs.size());
+
+  // a big one with one range delete, which leaves its neighbour alone
+  ASSERT_EQ(0, db->clear(big));
+  ASSERT_EQ(range_deletes + 1, kv->range_deletes);
+  db->get(big, &header, &got);
+  ASSERT_EQ(0u, got.size());
+  db->get(next, &header, &got);
+  ASSERT_EQ(many.size(), got.size());
+
+  g_ceph_context->_conf->set_val("filestore_omap_range_delete_min_keys", "1024");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
 TEST_F(ObjectMapTest, CloneOneObject) {
   ghobject_t hoid(hobject_t(sobject_t("foo", CEPH_NOSNAP)), 200, shard_id_t(0));
   ghobject_t hoid2(hobject_t(sobject_t("foo2", CEPH_NOSNAP)), 201, shard_id_t(1));
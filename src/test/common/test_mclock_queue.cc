@@ -0,0 +1,304 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "gtest/gtest.h"
+#include "common/mClockQueue.h"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <vector>
+
+
+using std::map;
+using std::pair;
+using std::vector;
+
+typedef unsigned Klass;
+typedef pair<Klass, double> Item;   // client, arrival time
+typedef mClockQueue<Item, Klass> MQ;
+
+// all the state is in the test; the queue reads it through these
+struct Classify {
+  unsigned operator()(const Klass &k, const Item &i) const {
+    return 0;
+  }
+};
+
+struct Info {
+  map<Klass, MQ::ClientInfo> *info;
+  Info(map<Klass, MQ::ClientInfo> *info) : info(info) {}
+  MQ::ClientInfo operator()(unsigned op_class, const Klass &k) const {
+    return (*info)[k];
+  }
+};
+
+struct Clock {
+  double *now;
+  Clock(double *now) : now(now) {}
+  double operator()() const {
+    return *now;
+  }
+};
+
+/**
+ * Discrete time simulation of one server draining the queue
+ *
+ * The server completes one unit cost op every 1/capacity seconds.
+ * Each client either arrives at a fixed rate or, with rate 0, keeps
+ * depth ops outstanding at all times.
+ */
+struct Sim {
+  struct Client {
+    double rate;
+    unsigned depth;
+    unsigned outstanding;
+    double next_arrival;
+    vector<double> latencies;
+    Client(double rate = 0, unsigned depth = 0)
+      : rate(rate), depth(depth), outstanding(0), next_arrival(0) {}
+  };
+
+  double now;
+  map<Klass, MQ::ClientInfo> info;
+  map<Klass, Client> clients;
+  MQ q;
+
+  Sim() : now(0), q(Classify(), Info(&info), 0, Clock(&now)) {}
+
+  void add_client(Klass k, MQ::ClientInfo i, double rate, unsigned depth) {
+    info[k] = i;
+    clients[k] = Client(rate, depth);
+  }
+
+  void run(double capacity, double seconds) {
+    const double step = 1.0 / capacity;
+    const double start = now;
+    for (unsigned n = 0; n < capacity * seconds; ++n) {
+      now = start + n * step;
+      for (map<Klass, Client>::iterator i = clients.begin();
+	   i != clients.end();
+	   ++i) {
+	Client &c = i->second;
+	if (c.rate > 0) {
+	  for (; c.next_arrival <= now; c.next_arrival += 1.0 / c.rate) {
+	    q.enqueue(i->first, 0, 0, Item(i->first, c.next_arrival));
+	    ++c.outstanding;
+	  }
+	} else {
+	  for (; c.outstanding < c.depth; ++c.outstanding)
+	    q.enqueue(i->first, 0, 0, Item(i->first, now));
+	}
+      }
+      if (q.empty())
+	continue;
+      Item item = q.dequeue();
+      Client &c = clients[item.first];
+      --c.outstanding;
+      c.latencies.push_back(now + step - item.second);
+    }
+    now = start + seconds;
+  }
+
+  void reset_stats() {
+    for (map<Klass, Client>::iterator i = clients.begin();
+	 i != clients.end();
+	 ++i)
+      i->second.latencies.clear();
+  }
+
+  double iops(Klass k, double seconds) {
+    return clients[k].latencies.size() / seconds;
+  }
+
+  double percentile(Klass k, double p) {
+    vector<double> l = clients[k].latencies;
+    if (l.empty())
+      return 0;
+    std::sort(l.begin(), l.end());
+    return l[std::min<size_t>(l.size() - 1, l.size() * p)];
+  }
+
+  void report(const char *name, double seconds) {
+    for (map<Klass, Client>::iterator i = clients.begin();
+	 i != clients.end();
+	 ++i) {
+      std::cout << name << " client " << i->first
+		<< " iops " << iops(i->first, seconds)
+		<< " p50 " << percentile(i->first, .5) * 1000 << "ms"
+		<< " p99 " << percentile(i->first, .99) * 1000 << "ms"
+		<< std::endl;
+    }
+  }
+};
+
+TEST(mClockQueue, strict_first) {
+  double now = 0;
+  map<Klass, MQ::ClientInfo> info;
+  MQ q(Classify(), Info(&info), 0, Clock(&now));
+  EXPECT_TRUE(q.empty());
+  q.enqueue(1, 0, 0, Item(1, 0));
+  q.enqueue_strict(2, 10, Item(2, 1));
+  q.enqueue_strict(2, 20, Item(2, 2));
+  EXPECT_EQ(3u, q.length());
+  EXPECT_EQ(2, q.dequeue().second);
+  EXPECT_EQ(1, q.dequeue().second);
+  EXPECT_EQ(0, q.dequeue().second);
+  EXPECT_TRUE(q.empty());
+}
+
+TEST(mClockQueue, enqueue_front) {
+  double now = 0;
+  map<Klass, MQ::ClientInfo> info;
+  MQ q(Classify(), Info(&info), 0, Clock(&now));
+  q.enqueue(1, 0, 0, Item(1, 1));
+  q.enqueue(1, 0, 0, Item(1, 2));
+  q.enqueue_front(1, 0, 0, Item(1, 0));
+  for (int i = 0; i < 3; ++i)
+    EXPECT_EQ(i, q.dequeue().second);
+}
+
+TEST(mClockQueue, remove) {
+  double now = 0;
+  map<Klass, MQ::ClientInfo> info;
+  MQ q(Classify(), Info(&info), 0, Clock(&now));
+  for (int i = 0; i < 10; ++i) {
+    q.enqueue(i % 2, 0, 0, Item(i % 2, i));
+    q.enqueue_strict(i % 2, 1, Item(i % 2, i));
+  }
+  std::list<Item> out;
+  q.remove_by_class(0, &out);
+  EXPECT_EQ(10u, out.size());
+  EXPECT_EQ(10u, q.length());
+  out.clear();
+  struct Odd {
+    bool operator()(Item i) const {
+      return (int)i.second % 4 == 1;
+    }
+  };
+  q.remove_by_filter(Odd(), &out);
+  EXPECT_EQ(6u, out.size());
+  EXPECT_EQ(4u, q.length());
+}
+
+TEST(mClockQueue, weights) {
+  Sim sim;
+  sim.add_client(1, MQ::ClientInfo(0, 1, 0), 0, 32);
+  sim.add_client(2, MQ::ClientInfo(0, 3, 0), 0, 32);
+  sim.run(1000, 10);
+  sim.report("weights", 10);
+  double ratio = sim.iops(2, 10) / sim.iops(1, 10);
+  EXPECT_NEAR(3.0, ratio, .1);
+}
+
+TEST(mClockQueue, reservation_vs_noisy_neighbor) {
+  // a tenant with a reservation keeps its rate and latency while
+  // another floods the queue with a much higher weight
+  Sim sim;
+  sim.add_client(1, MQ::ClientInfo(0, 100, 0), 0, 256);
+  sim.add_client(2, MQ::ClientInfo(100, 1, 0), 100, 0);
+  sim.run(1000, 10);
+  sim.report("reservation", 10);
+  EXPECT_NEAR(100, sim.iops(2, 10), 2);
+  EXPECT_LT(sim.percentile(2, .99), .005);
+  EXPECT_GT(sim.iops(1, 10), 880);
+}
+
+TEST(mClockQueue, limit) {
+  // a limited tenant is held to its limit while anyone else waits
+  Sim sim;
+  sim.add_client(1, MQ::ClientInfo(0, 10, 200), 0, 64);
+  sim.add_client(2, MQ::ClientInfo(0, 1, 0), 0, 64);
+  sim.run(1000, 10);
+  sim.report("limit", 10);
+  EXPECT_NEAR(200, sim.iops(1, 10), 5);
+  EXPECT_NEAR(800, sim.iops(2, 10), 5);
+}
+
+TEST(mClockQueue, limit_is_work_conserving) {
+  Sim sim;
+  sim.add_client(1, MQ::ClientInfo(0, 1, 200), 0, 64);
+  sim.run(1000, 10);
+  EXPECT_NEAR(1000, sim.iops(1, 10), 1);
+}
+
+TEST(mClockQueue, mixed) {
+  // two reserved tenants, a noisy one and backlogged recovery:
+  // reservations are met with low latency, and what is left is split
+  // by weight between the noisy tenant and recovery
+  Sim sim;
+  sim.add_client(1, MQ::ClientInfo(200, 1, 0), 150, 0);
+  sim.add_client(2, MQ::ClientInfo(100, 1, 0), 100, 0);
+  sim.add_client(3, MQ::ClientInfo(0, 90, 0), 0, 256);
+  sim.add_client(4, MQ::ClientInfo(0, 10, 0), 0, 16);  // recovery
+  sim.run(1000, 20);
+  sim.report("mixed", 20);
+  EXPECT_NEAR(150, sim.iops(1, 20), 2);
+  EXPECT_NEAR(100, sim.iops(2, 20), 2);
+  EXPECT_LT(sim.percentile(1, .99), .01);
+  EXPECT_LT(sim.percentile(2, .99), .01);
+  double ratio = sim.iops(3, 20) / sim.iops(4, 20);
+  EXPECT_NEAR(9.0, ratio, .5);
+}
+
+TEST(mClockQueue, idle_clients_are_dropped) {
+  double now = 0;
+  map<Klass, MQ::ClientInfo> info;
+  MQ q(Classify(), Info(&info), 0, Clock(&now), 16);
+  for (Klass k = 0; k < 1000; ++k) {
+    info[k] = MQ::ClientInfo(0, 1, 1);
+    for (int i = 0; i < 10; ++i)
+      q.enqueue(k, 0, 0, Item(k, now));
+  }
+  EXPECT_EQ(1000u, q.num_clients());
+  while (!q.empty())
+    q.dequeue();
+  // their limit tags are 10s ahead, but only max_idle are remembered
+  EXPECT_EQ(0u, q.num_clients());
+  EXPECT_EQ(16u, q.num_idle_clients());
+
+  // and those are forgotten once the clock passes them
+  now = 11;
+  q.enqueue(0, 0, 0, Item(0, now));
+  q.dequeue();
+  EXPECT_EQ(0u, q.num_clients());
+  EXPECT_EQ(0u, q.num_idle_clients());
+}
+
+TEST(mClockQueue, idle_client_keeps_its_limit) {
+  double now = 0;
+  map<Klass, MQ::ClientInfo> info;
+  info[1] = MQ::ClientInfo(0, 100, 10);
+  info[2] = MQ::ClientInfo(0, 1, 0);
+  MQ q(Classify(), Info(&info), 0, Clock(&now));
+  // client 1 runs ahead of its limit with nobody else around
+  for (int i = 0; i < 10; ++i)
+    q.enqueue(1, 0, 0, Item(1, now));
+  while (!q.empty())
+    q.dequeue();
+  EXPECT_EQ(0u, q.num_clients());
+  EXPECT_EQ(1u, q.num_idle_clients());
+
+  // and can't get around it by pausing
+  now = .5;
+  q.enqueue(2, 0, 0, Item(2, now));
+  q.enqueue(1, 0, 0, Item(1, now));
+  EXPECT_EQ(2u, q.dequeue().first);
+  EXPECT_EQ(1u, q.dequeue().first);
+}
+
+TEST(mClockQueue, update_client_info) {
+  Sim sim;
+  sim.add_client(1, MQ::ClientInfo(0, 1, 0), 0, 32);
+  sim.add_client(2, MQ::ClientInfo(0, 1, 0), 0, 32);
+  sim.run(1000, 10);
+  EXPECT_NEAR(1.0, sim.iops(2, 10) / sim.iops(1, 10), .1);
+
+  sim.info[2] = MQ::ClientInfo(0, 3, 0);
+  sim.q.update_client_info();
+  sim.run(1000, 1);
+  sim.reset_stats();
+  sim.run(1000, 10);
+  sim.report("update_client_info", 10);
+  EXPECT_NEAR(3.0, sim.iops(2, 10) / sim.iops(1, 10), .1);
+}
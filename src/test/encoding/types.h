@@ -139,6 +139,18 @@ TYPE(LevelDBStoreStats)
 TYPE(DBObjectMap::_Header)
 TYPE(DBObjectMap::State)
 
+#ifdef HAVE_LIBAIO
+#include "os/newstore/newstore_types.h"
+TYPE(cnode_t)
+TYPE(fid_t)
+TYPE(fragment_t)
+TYPE(extent_t)
+TYPE(overlay_t)
+TYPE(onode_t)
+TYPE(wal_op_t)
+TYPE(wal_transaction_t)
+#endif
+
 #include "mds/JournalPointer.h"
 TYPE(JournalPointer)
 
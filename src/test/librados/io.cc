@@ -978,6 +978,52 @@ TEST_F(LibRadosIoECPP, TruncTestPP) {
   ASSERT_EQ(0, memcmp(bl2.c_str(), buf, sizeof(buf)));
 }
 
+TEST(LibRadosIoECOverwritePP, OverwriteRoundTripPP) {
+  Rados cluster;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_ec_pool_pp(pool_name, cluster));
+  bufferlist inbl;
+  ASSERT_EQ(0, cluster.mon_command(
+    "{\"prefix\": \"osd pool set\", \"pool\": \"" + pool_name +
+    "\", \"var\": \"ec_overwrites\", \"val\": \"true\"}",
+    inbl, NULL, NULL));
+  cluster.wait_for_latest_osdmap();
+  IoCtx ioctx;
+  ASSERT_EQ(0, cluster.ioctx_create(pool_name.c_str(), ioctx));
+
+  int alignment = ioctx.pool_required_alignment();
+  int len = alignment * 3;
+  char *buf = new char[len];
+  memset(buf, 0xcc, len);
+  bufferlist bl1;
+  bl1.append(buf, len);
+  ASSERT_EQ(0, ioctx.write("foo", bl1, len, 0));
+
+  // unaligned, across a stripe boundary
+  char buf2[200];
+  memset(buf2, 0xdd, sizeof(buf2));
+  bufferlist bl2;
+  bl2.append(buf2, sizeof(buf2));
+  ASSERT_EQ(0, ioctx.write("foo", bl2, sizeof(buf2), alignment - 100));
+  memcpy(buf + alignment - 100, buf2, sizeof(buf2));
+
+  // inside the last stripe, and past the end which must not extend it
+  ObjectWriteOperation op;
+  op.zero(2 * alignment + 10, 50);
+  op.zero(len - 10, 100);
+  ASSERT_EQ(0, ioctx.operate("foo", &op));
+  memset(buf + 2 * alignment + 10, 0, 50);
+  memset(buf + len - 10, 0, 10);
+
+  bufferlist bl3;
+  ASSERT_EQ(len, ioctx.read("foo", bl3, len * 2, 0));
+  ASSERT_EQ(0, memcmp(bl3.c_str(), buf, len));
+
+  delete[] buf;
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_ec_pool_pp(pool_name, cluster));
+}
+
 TEST_F(LibRadosIoEC, RemoveTest) {
   char buf[128];
   char buf2[sizeof(buf)];
@@ -0,0 +1,210 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2015 Red Hat
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "os/newstore/FreelistManager.h"
+#include "include/interval_set.h"
+#include "test/ObjectMap/KeyValueDBMemory.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include <gtest/gtest.h>
+
+static const string PREFIX = "B";
+
+static uint64_t sum(const vector<extent_t>& v)
+{
+  uint64_t t = 0;
+  for (vector<extent_t>::const_iterator p = v.begin(); p != v.end(); ++p)
+    t += p->length;
+  return t;
+}
+
+TEST(FreelistManager, create_and_reload) {
+  KeyValueDBMemory db;
+  FreelistManager fl;
+  ASSERT_EQ(0, fl.init(&db, PREFIX));
+  ASSERT_EQ(0u, fl.get_total_free());
+
+  KeyValueDB::Transaction t = db.get_transaction();
+  fl.create(4096, 1024*4096, t);
+  db.submit_transaction(t);
+  ASSERT_EQ(1024u*4096u, fl.get_total_free());
+
+  FreelistManager fl2;
+  ASSERT_EQ(0, fl2.init(&db, PREFIX));
+  ASSERT_EQ(1024u*4096u, fl2.get_total_free());
+}
+
+TEST(FreelistManager, allocate_release) {
+  KeyValueDBMemory db;
+  FreelistManager fl;
+  ASSERT_EQ(0, fl.init(&db, PREFIX));
+  KeyValueDB::Transaction t = db.get_transaction();
+  fl.create(0, 64*4096, t);
+  db.submit_transaction(t);
+
+  vector<extent_t> a, b, none;
+  ASSERT_EQ(0, fl.allocate(3*4096, 4096, 0, &a));
+  ASSERT_EQ(0, fl.allocate(5000, 4096, 0, &b));
+  t = db.get_transaction();
+  fl.apply(a, none, t);
+  fl.apply(b, none, t);
+  db.submit_transaction(t);
+  ASSERT_EQ(3u*4096u, sum(a));
+  ASSERT_EQ(2u*4096u, sum(b));
+  ASSERT_EQ(59u*4096u, fl.get_total_free());
+
+  // released space is not reusable until it is committed
+  t = db.get_transaction();
+  fl.apply(none, a, t);
+  db.submit_transaction(t);
+  ASSERT_EQ(59u*4096u, fl.get_total_free());
+  for (vector<extent_t>::iterator p = a.begin(); p != a.end(); ++p)
+    fl.release_committed(p->offset, p->length);
+  ASSERT_EQ(62u*4096u, fl.get_total_free());
+
+  // and the kv copy agrees
+  FreelistManager fl2;
+  ASSERT_EQ(0, fl2.init(&db, PREFIX));
+  ASSERT_EQ(62u*4096u, fl2.get_total_free());
+}
+
+TEST(FreelistManager, max_extent_and_enospc) {
+  KeyValueDBMemory db;
+  FreelistManager fl;
+  ASSERT_EQ(0, fl.init(&db, PREFIX));
+  KeyValueDB::Transaction t = db.get_transaction();
+  fl.create(0, 16*4096, t);
+  db.submit_transaction(t);
+
+  vector<extent_t> a, none;
+  ASSERT_EQ(0, fl.allocate(8*4096, 4096, 2*4096, &a));
+  ASSERT_EQ(4u, a.size());
+  for (vector<extent_t>::iterator p = a.begin(); p != a.end(); ++p)
+    ASSERT_EQ(2u*4096u, p->length);
+
+  vector<extent_t> b;
+  ASSERT_EQ(-ENOSPC, fl.allocate(9*4096, 4096, 0, &b));
+  ASSERT_TRUE(b.empty());
+  ASSERT_EQ(0, fl.allocate(8*4096, 4096, 0, &b));
+  t = db.get_transaction();
+  fl.apply(a, none, t);
+  fl.apply(b, none, t);
+  db.submit_transaction(t);
+  ASSERT_EQ(0u, fl.get_total_free());
+
+  FreelistManager fl2;
+  ASSERT_EQ(0, fl2.init(&db, PREFIX));
+  ASSERT_EQ(0u, fl2.get_total_free());
+}
+
+/// allocate everything fl2 has and check nothing overlaps
+static void check_no_overlap(FreelistManager *fl, uint64_t expect_free,
+			     const vector<extent_t>& in_use)
+{
+  ASSERT_EQ(expect_free, fl->get_total_free());
+  vector<extent_t> all;
+  ASSERT_EQ(0, fl->allocate(expect_free, 4096, 0, &all));
+  interval_set<uint64_t> s;
+  for (vector<extent_t>::const_iterator p = all.begin(); p != all.end(); ++p)
+    s.insert(p->offset, p->length);
+  for (vector<extent_t>::const_iterator p = in_use.begin();
+       p != in_use.end();
+       ++p) {
+    interval_set<uint64_t> u;
+    u.insert(p->offset, p->length);
+    u.intersection_of(s);
+    ASSERT_TRUE(u.empty());
+  }
+}
+
+TEST(FreelistManager, commit_order) {
+  KeyValueDBMemory db;
+  FreelistManager fl;
+  ASSERT_EQ(0, fl.init(&db, PREFIX));
+  KeyValueDB::Transaction t = db.get_transaction();
+  fl.create(0, 64*4096, t);
+  db.submit_transaction(t);
+
+  // old data that the later transactions replace
+  vector<extent_t> old_a, old_b, none;
+  ASSERT_EQ(0, fl.allocate(2*4096, 4096, 0, &old_a));
+  ASSERT_EQ(0, fl.allocate(2*4096, 4096, 0, &old_b));
+  t = db.get_transaction();
+  fl.apply(old_a, none, t);
+  fl.apply(old_b, none, t);
+  db.submit_transaction(t);
+
+  // two transactions, from different sequencers, are prepared in one
+  // order and reach kv in the other
+  vector<extent_t> a, b;
+  ASSERT_EQ(0, fl.allocate(4*4096, 4096, 0, &a));
+  ASSERT_EQ(0, fl.allocate(3*4096, 4096, 0, &b));
+
+  t = db.get_transaction();
+  fl.apply(b, old_b, t);
+  db.submit_transaction(t);
+  for (vector<extent_t>::iterator p = old_b.begin(); p != old_b.end(); ++p)
+    fl.release_committed(p->offset, p->length);
+
+  t = db.get_transaction();
+  fl.apply(a, old_a, t);
+  db.submit_transaction(t);
+  for (vector<extent_t>::iterator p = old_a.begin(); p != old_a.end(); ++p)
+    fl.release_committed(p->offset, p->length);
+
+  vector<extent_t> in_use(a);
+  in_use.insert(in_use.end(), b.begin(), b.end());
+  ASSERT_EQ(57u*4096u, fl.get_total_free());
+
+  FreelistManager fl2;
+  ASSERT_EQ(0, fl2.init(&db, PREFIX));
+  check_no_overlap(&fl2, 57u*4096u, in_use);
+}
+
+TEST(FreelistManager, allocate_and_release_in_one_txn) {
+  KeyValueDBMemory db;
+  FreelistManager fl;
+  ASSERT_EQ(0, fl.init(&db, PREFIX));
+  KeyValueDB::Transaction t = db.get_transaction();
+  fl.create(0, 16*4096, t);
+  db.submit_transaction(t);
+
+  // a write that is overwritten again before its txn commits
+  vector<extent_t> a, b;
+  ASSERT_EQ(0, fl.allocate(2*4096, 4096, 0, &a));
+  ASSERT_EQ(0, fl.allocate(2*4096, 4096, 0, &b));
+  t = db.get_transaction();
+  vector<extent_t> allocated(a);
+  allocated.insert(allocated.end(), b.begin(), b.end());
+  fl.apply(allocated, a, t);
+  db.submit_transaction(t);
+  for (vector<extent_t>::iterator p = a.begin(); p != a.end(); ++p)
+    fl.release_committed(p->offset, p->length);
+
+  FreelistManager fl2;
+  ASSERT_EQ(0, fl2.init(&db, PREFIX));
+  check_no_overlap(&fl2, 14u*4096u, b);
+}
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
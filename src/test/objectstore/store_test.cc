@@ -27,6 +27,7 @@
 #include "common/Cond.h"
 #include "common/errno.h"
 #include "include/stringify.h"
+#include "common/ceph_json.h"
 #include <boost/scoped_ptr.hpp>
 #include <boost/random/mersenne_twister.hpp>
 #include <boost/random/uniform_int.hpp>
@@ -44,6 +45,22 @@ public:
 
   StoreTest() : store(0) {}
   virtual void SetUp() {
+    string type = GetParam();
+    if (type == "newstore_block") {
+      // newstore with object data on a (file backed) block device.  the
+      // freelist is only created by a fresh mkfs.  the path is linked
+      // from the store dir, so make it absolute.
+      EXPECT_EQ(0, ::system("rm -rf store_test_temp_dir store_test_temp_block"));
+      char cwd[PATH_MAX];
+      ASSERT_TRUE(::getcwd(cwd, sizeof(cwd)) != NULL);
+      g_ceph_context->_conf->set_val("newstore_block_path",
+				     string(cwd) + "/store_test_temp_block");
+      g_ceph_context->_conf->set_val("newstore_block_create_size",
+				     "1073741824");
+      g_ceph_context->_conf->apply_changes(NULL);
+      type = "newstore";
+    }
+
     int r = ::mkdir("store_test_temp_dir", 0777);
     if (r < 0 && errno != EEXIST) {
       r = -errno;
@@ -52,7 +69,7 @@ public:
     }
 
     ObjectStore *store_ = ObjectStore::create(g_ceph_context,
-                                              string(GetParam()),
+                                              type,
                                               string("store_test_temp_dir"),
                                               string("store_test_temp_journal"));
     if (!store_) {
@@ -67,6 +84,10 @@ public:
   virtual void TearDown() {
     if (store)
       store->umount();
+    if (GetParam() == string("newstore_block")) {
+      g_ceph_context->_conf->set_val("newstore_block_path", "");
+      g_ceph_context->_conf->apply_changes(NULL);
+    }
   }
 };
 
@@ -2549,6 +2570,551 @@ TEST_P(StoreTest, SetAllocHint) {
   }
 }
 
+TEST_P(StoreTest, BlockChecksumDetectsCorruption) {
+  if (GetParam() != string("newstore_block"))
+    return;
+  ObjectStore::Sequencer osr("test");
+  coll_t cid;
+  ghobject_t hoid(hobject_t(sobject_t("csum object", CEPH_NOSNAP)));
+  int r;
+  const unsigned block = 4096, len = 32 * block;
+  bufferlist data;
+  for (unsigned i = 0; i < len / block; ++i) {
+    string b = "csum test block " + stringify(i) + " ";
+    while (b.length() < block)
+      b += b.substr(0, block - b.length());
+    data.append(b);
+  }
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    t.write(cid, hoid, 0, data.length(), data);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  store->umount();
+
+  // find block 5 on the device and flip a bit in it
+  {
+    string victim(data.c_str() + 5 * block, block);
+    int fd = ::open(g_conf->newstore_block_path.c_str(), O_RDWR);
+    ASSERT_LE(0, fd);
+    struct stat st;
+    ASSERT_EQ(0, ::fstat(fd, &st));
+    const unsigned chunk = 1 << 20;
+    bufferptr bp = buffer::create_page_aligned(chunk);
+    off_t found = -1;
+    for (off_t pos = 0; pos < st.st_size && found < 0; pos += chunk) {
+      ssize_t got = ::pread(fd, bp.c_str(), chunk, pos);
+      ASSERT_LT(0, got);
+      for (ssize_t o = 0; o + block <= (size_t)got; o += block) {
+	if (memcmp(bp.c_str() + o, victim.data(), block) == 0) {
+	  found = pos + o;
+	  break;
+	}
+      }
+    }
+    ASSERT_LE(0, found);
+    char c;
+    ASSERT_EQ(1, ::pread(fd, &c, 1, found + 100));
+    c ^= 1;
+    ASSERT_EQ(1, ::pwrite(fd, &c, 1, found + 100));
+    ::close(fd);
+  }
+
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  {
+    bufferlist in;
+    r = store->read(cid, hoid, 0, len, in);
+    ASSERT_EQ(-EIO, r);
+    in.clear();
+    r = store->read(cid, hoid, 5 * block + 10, 20, in);
+    ASSERT_EQ(-EIO, r);
+  }
+  {
+    // the blocks around it still read fine
+    bufferlist in, exp;
+    r = store->read(cid, hoid, 0, 5 * block, in);
+    ASSERT_EQ((int)(5 * block), r);
+    exp.substr_of(data, 0, 5 * block);
+    ASSERT_TRUE(in.contents_equal(exp));
+    in.clear();
+    r = store->read(cid, hoid, 6 * block, 26 * block, in);
+    ASSERT_EQ((int)(26 * block), r);
+    exp.substr_of(data, 6 * block, 26 * block);
+    ASSERT_TRUE(in.contents_equal(exp));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+}
+
+static bufferlist compressible(unsigned len, char seed)
+{
+  bufferlist bl;
+  for (unsigned i = 0; i < len; ++i)
+    bl.append((char)(seed + (i / 512) % 8));
+  return bl;
+}
+
+TEST_P(StoreTest, CompressionHintRoundTrip) {
+  // stores that do not compress just ignore the hint
+  ObjectStore::Sequencer osr("test");
+  coll_t cid;
+  ghobject_t hoid(hobject_t(sobject_t("compressed object", CEPH_NOSNAP)));
+  int r;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    bufferlist hint;
+    ::encode(string("snappy"), hint);
+    t.collection_hint(cid, ObjectStore::Transaction::COLL_HINT_COMPRESSION,
+		      hint);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  bufferlist expected = compressible(300000, 'a');
+  {
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, 0, expected.length(), expected);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  {
+    bufferlist in;
+    r = store->read(cid, hoid, 0, expected.length(), in);
+    ASSERT_EQ((int)expected.length(), r);
+    ASSERT_TRUE(in.contents_equal(expected));
+  }
+  {
+    // overwrite part of a compressed blob, across a blob boundary
+    bufferlist over = compressible(20000, 'A');
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, 60000, over.length(), over);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+    bufferlist head, tail;
+    head.substr_of(expected, 0, 60000);
+    tail.substr_of(expected, 80000, expected.length() - 80000);
+    expected.clear();
+    expected.append(head);
+    expected.append(over);
+    expected.append(tail);
+  }
+  {
+    // read back a piece from the middle of a blob
+    bufferlist in, exp;
+    r = store->read(cid, hoid, 70000, 30000, in);
+    ASSERT_EQ(30000, r);
+    exp.substr_of(expected, 70000, 30000);
+    ASSERT_TRUE(in.contents_equal(exp));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.zero(cid, hoid, 150000, 10000);
+    t.truncate(cid, hoid, 250000);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+    bufferlist head, tail, trimmed;
+    head.substr_of(expected, 0, 150000);
+    tail.substr_of(expected, 160000, 90000);
+    trimmed.append(head);
+    trimmed.append_zero(10000);
+    trimmed.append(tail);
+    expected.swap(trimmed);
+  }
+  store->umount();
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  {
+    bufferlist in;
+    r = store->read(cid, hoid, 0, 300000, in);
+    ASSERT_EQ((int)expected.length(), r);
+    ASSERT_TRUE(in.contents_equal(expected));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+}
+
+static uint64_t get_perf_counter(const char *logger, const char *counter)
+{
+  JSONFormatter f;
+  g_ceph_context->get_perfcounters_collection()->dump_formatted(
+    &f, false, logger, counter);
+  stringstream ss;
+  f.flush(ss);
+  JSONParser parser;
+  string s = ss.str();
+  assert(parser.parse(s.c_str(), s.length()));
+  JSONObj *o = parser.find_obj(logger);
+  assert(o);
+  uint64_t v = 0;
+  JSONDecoder::decode_json(counter, v, o, true);
+  return v;
+}
+
+TEST_P(StoreTest, OnodeCacheGrowth) {
+  if (string(GetParam()).find("newstore") != 0)
+    return;
+  // the cache budget is fixed when the store is created
+  store->umount();
+  store.reset();
+  g_ceph_context->_conf->set_val("newstore_onode_cache_bytes", "1048576");
+  g_ceph_context->_conf->set_val("newstore_onode_cache_shards", "1");
+  g_ceph_context->_conf->apply_changes(NULL);
+  store.reset(ObjectStore::create(g_ceph_context, "newstore",
+				  "store_test_temp_dir",
+				  "store_test_temp_journal"));
+  g_ceph_context->_conf->set_val("newstore_onode_cache_bytes", "268435456");
+  g_ceph_context->_conf->set_val("newstore_onode_cache_shards", "0");
+  g_ceph_context->_conf->apply_changes(NULL);
+  ASSERT_EQ(0, store->mount());
+
+  ObjectStore::Sequencer osr("test");
+  coll_t cid;
+  ghobject_t hoid(hobject_t(sobject_t("cached object", CEPH_NOSNAP)));
+  int r;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    t.touch(cid, hoid);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+    osr.flush();
+  }
+  uint64_t trims = get_perf_counter("newstore", "onode_trims");
+
+  // a small onode is charged a small amount, so it stays cached ...
+  bufferlist small;
+  small.append("small");
+  {
+    ObjectStore::Transaction t;
+    t.setattr(cid, hoid, "small", small);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+    osr.flush();  // the cache is trimmed as txcs are reaped
+  }
+  ASSERT_EQ(trims, get_perf_counter("newstore", "onode_trims"));
+
+  // ... but once it grows past the whole budget it is charged for that
+  // and trimmed
+  bufferlist big;
+  big.append(string(2 << 20, 'x'));
+  {
+    ObjectStore::Transaction t;
+    t.setattr(cid, hoid, "big", big);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+    osr.flush();
+  }
+  ASSERT_LT(trims, get_perf_counter("newstore", "onode_trims"));
+
+  {
+    bufferptr bp;
+    r = store->getattr(cid, hoid, "big", bp);
+    ASSERT_EQ(0, r);
+    bufferlist bl;
+    bl.append(bp);
+    ASSERT_TRUE(bl.contents_equal(big));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTest, MemStorePerfCounterNames) {
+  if (GetParam() != string("memstore"))
+    return;
+  // a second memstore in the same process registers its own counters
+  ASSERT_EQ(0, ::system("rm -rf store_test_temp_dir2"));
+  ASSERT_EQ(0, ::mkdir("store_test_temp_dir2", 0777));
+  boost::scoped_ptr<ObjectStore> other(
+    ObjectStore::create(g_ceph_context, "memstore", "store_test_temp_dir2",
+			"store_test_temp_journal2"));
+  ASSERT_EQ(0, other->mkfs());
+  ASSERT_EQ(0, other->mount());
+
+  JSONFormatter f;
+  g_ceph_context->get_perfcounters_collection()->dump_formatted(&f, false);
+  stringstream ss;
+  f.flush(ss);
+  JSONParser parser;
+  string js = ss.str();
+  ASSERT_TRUE(parser.parse(js.c_str(), js.length()));
+  set<string> names;
+  for (JSONObjIter p = parser.find_first(); !p.end(); ++p) {
+    string name = (*p)->get_name();
+    if (name.find("memstore") == 0) {
+      // not disambiguated by the collection, which appends a pointer
+      ASSERT_EQ(string::npos, name.find("0x"));
+      names.insert(name);
+    }
+  }
+  ASSERT_EQ(2u, names.size());
+
+  other->umount();
+  other.reset();
+  ASSERT_EQ(0, ::system("rm -rf store_test_temp_dir2"));
+}
+
+static void check_contents(ObjectStore *store, coll_t cid, ghobject_t hoid,
+			   bufferlist& expected)
+{
+  bufferlist bl;
+  ASSERT_EQ((int)expected.length(),
+	    store->read(cid, hoid, 0, expected.length(), bl));
+  ASSERT_TRUE(bl.contents_equal(expected));
+}
+
+TEST_P(StoreTest, KeyValueStoreCoalesce) {
+  if (GetParam() != string("keyvaluestore"))
+    return;
+  ObjectStore::Sequencer osr("test");
+  coll_t cid;
+  ghobject_t a(hobject_t(sobject_t("a", CEPH_NOSNAP)));
+  ghobject_t b(hobject_t(sobject_t("b", CEPH_NOSNAP)));
+  ghobject_t c(hobject_t(sobject_t("c", CEPH_NOSNAP)));
+  ghobject_t d(hobject_t(sobject_t("d", CEPH_NOSNAP)));
+  ghobject_t e(hobject_t(sobject_t("e", CEPH_NOSNAP)));
+  const unsigned strip = 4096;
+  int r;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+
+  bufferlist bl[10];
+  for (unsigned i = 0; i < 10; ++i)
+    bl[i].append(string(strip, 'a' + i));
+  uint64_t coalesced = get_perf_counter("keyvaluestore", "kv_coalesced_bytes");
+  {
+    ObjectStore::Transaction t;
+    // the same strip and attr, over and over; only the last one counts
+    for (unsigned i = 0; i < 10; ++i) {
+      t.write(cid, a, 0, strip, bl[i]);
+      t.setattr(cid, a, "attr", bl[i]);
+    }
+    // a clone sees the source as it is at that point in the transaction
+    t.write(cid, b, 0, strip, bl[1]);
+    t.clone(cid, b, c);
+    t.write(cid, b, 0, strip, bl[2]);
+    // a removed object takes its pending writes with it
+    t.write(cid, d, 0, strip, bl[3]);
+    t.remove(cid, d);
+    // and a renamed one brings them along
+    t.write(cid, e, 0, strip, bl[4]);
+    t.collection_move_rename(cid, e, cid, d);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_LE(coalesced + 18 * strip,
+	    get_perf_counter("keyvaluestore", "kv_coalesced_bytes"));
+
+  check_contents(store.get(), cid, a, bl[9]);
+  bufferptr bp;
+  ASSERT_EQ((int)strip, store->getattr(cid, a, "attr", bp));
+  ASSERT_EQ(0, memcmp(bp.c_str(), bl[9].c_str(), strip));
+  check_contents(store.get(), cid, b, bl[2]);
+  check_contents(store.get(), cid, c, bl[1]);
+  check_contents(store.get(), cid, d, bl[4]);
+  ASSERT_FALSE(store->exists(cid, e));
+
+  // and all of it survives a remount
+  store->umount();
+  ASSERT_EQ(0, store->mount());
+  check_contents(store.get(), cid, a, bl[9]);
+  check_contents(store.get(), cid, b, bl[2]);
+  check_contents(store.get(), cid, c, bl[1]);
+  check_contents(store.get(), cid, d, bl[4]);
+  ASSERT_FALSE(store->exists(cid, e));
+
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, a);
+    t.remove(cid, b);
+    t.remove(cid, c);
+    t.remove(cid, d);
+    t.remove_collection(cid);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+}
+
+/// count completions, and check they come back in submission order
+class C_Ordered : public Context {
+public:
+  Mutex *lock;
+  Cond *cond;
+  vector<unsigned> *order;
+  unsigned i;
+  ObjectStore::Transaction *t;
+  C_Ordered(Mutex *lock, Cond *cond, vector<unsigned> *order, unsigned i,
+	    ObjectStore::Transaction *t)
+    : lock(lock), cond(cond), order(order), i(i), t(t) {}
+  void finish(int r) {
+    Mutex::Locker l(*lock);
+    assert(r == 0);
+    order->push_back(i);
+    delete t;
+    cond->Signal();
+  }
+};
+
+TEST_P(StoreTest, KeyValueStoreBatch) {
+  if (GetParam() != string("keyvaluestore"))
+    return;
+  ObjectStore::Sequencer osr("test");
+  coll_t cid;
+  ghobject_t hoid(hobject_t(sobject_t("batched", CEPH_NOSNAP)));
+  const unsigned strip = 4096, num = 200;
+  int r;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    t.touch(cid, hoid);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+
+  // many small ops queued back to back on one sequencer, each
+  // rewriting the same head strip and one of its own
+  Mutex lock("KeyValueStoreBatch::lock");
+  Cond cond;
+  vector<unsigned> order;
+  bufferlist head, mine;
+  for (unsigned i = 0; i < num; ++i) {
+    head.clear();
+    head.append(string(strip, 'a' + i % 26));
+    bufferlist m;
+    m.append(string(strip, 'A' + i % 26));
+    mine.append(m);
+    ObjectStore::Transaction *t = new ObjectStore::Transaction;
+    t->write(cid, hoid, 0, strip, head);
+    t->write(cid, hoid, (i + 1) * strip, strip, m);
+    r = store->queue_transaction(&osr, t,
+				 new C_Ordered(&lock, &cond, &order, i, t));
+    ASSERT_EQ(r, 0);
+  }
+  {
+    Mutex::Locker l(lock);
+    while (order.size() < num)
+      cond.Wait(lock);
+  }
+  for (unsigned i = 0; i < num; ++i)
+    ASSERT_EQ(i, order[i]);
+  // whichever ops shared a kv transaction, the last head write wins
+  bufferlist expected;
+  expected.append(head);
+  expected.append(mine);
+  check_contents(store.get(), cid, hoid, expected);
+
+  store->umount();
+  ASSERT_EQ(0, store->mount());
+  check_contents(store.get(), cid, hoid, expected);
+
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+}
+
+#ifdef HAVE_POSIX_FADVISE
+/// read [off, end) of an object in chunk sized steps
+static void read_seq(ObjectStore *store, coll_t cid, ghobject_t hoid,
+		     uint64_t off, uint64_t end, uint64_t chunk)
+{
+  for (; off < end; off += chunk) {
+    bufferlist bl;
+    ASSERT_EQ((int)chunk, store->read(cid, hoid, off, chunk, bl));
+  }
+}
+
+TEST_P(StoreTest, FileStoreReadahead) {
+  if (GetParam() != string("filestore"))
+    return;
+  ObjectStore::Sequencer osr("test");
+  coll_t cid;
+  ghobject_t hoid(hobject_t(sobject_t("seq object", CEPH_NOSNAP)));
+  ghobject_t hoid2(hobject_t(sobject_t("skip object", CEPH_NOSNAP)));
+  const uint64_t size = 4 << 20, chunk = 64 << 10;
+  int r;
+  {
+    bufferlist bl;
+    bl.append(string(size, 'r'));
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    t.write(cid, hoid, 0, size, bl);
+    t.write(cid, hoid2, 0, size, bl);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+
+  // a sequential reader gets prefetched, and reads what was prefetched
+  uint64_t ra = get_perf_counter("filestore", "readahead_bytes");
+  uint64_t hit = get_perf_counter("filestore", "readahead_hit_bytes");
+  uint64_t waste = get_perf_counter("filestore", "readahead_waste_bytes");
+  read_seq(store.get(), cid, hoid, 0, size, chunk);
+  uint64_t ra_bytes = get_perf_counter("filestore", "readahead_bytes") - ra;
+  uint64_t hit_bytes =
+    get_perf_counter("filestore", "readahead_hit_bytes") - hit;
+  ASSERT_LT(0u, ra_bytes);
+  ASSERT_GE(size, ra_bytes);   // never past the end of the object
+  ASSERT_LT(0u, hit_bytes);
+  ASSERT_GE(ra_bytes, hit_bytes);
+  ASSERT_EQ(waste, get_perf_counter("filestore", "readahead_waste_bytes"));
+
+  // a random (here, backwards) reader does not trigger anything
+  ra += ra_bytes;
+  for (uint64_t off = size; off > 0; off -= chunk) {
+    bufferlist bl;
+    ASSERT_EQ((int)chunk, store->read(cid, hoid, off - chunk, chunk, bl));
+  }
+  ASSERT_EQ(ra, get_perf_counter("filestore", "readahead_bytes"));
+
+  // nor does a sequential one with readahead off
+  g_ceph_context->_conf->set_val("filestore_readahead_max_bytes", "0");
+  g_ceph_context->_conf->apply_changes(NULL);
+  read_seq(store.get(), cid, hoid, 0, size, chunk);
+  g_ceph_context->_conf->set_val("filestore_readahead_max_bytes", "2097152");
+  g_ceph_context->_conf->apply_changes(NULL);
+  ASSERT_EQ(ra, get_perf_counter("filestore", "readahead_bytes"));
+
+  // a reader that jumps past its window wasted the rest of it
+  read_seq(store.get(), cid, hoid2, 0, 8 * chunk, chunk);
+  ASSERT_LT(ra, get_perf_counter("filestore", "readahead_bytes"));
+  read_seq(store.get(), cid, hoid2, size / 2, size / 2 + 8 * chunk, chunk);
+  ASSERT_LT(waste, get_perf_counter("filestore", "readahead_waste_bytes"));
+
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove(cid, hoid2);
+    t.remove_collection(cid);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+}
+#endif
+
 INSTANTIATE_TEST_CASE_P(
   ObjectStore,
   StoreTest,
@@ -2556,7 +3122,8 @@ INSTANTIATE_TEST_CASE_P(
     "memstore",
     "filestore",
     "keyvaluestore",
-    "newstore"));
+    "newstore",
+    "newstore_block"));
 
 #else
 
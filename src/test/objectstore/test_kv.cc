@@ -146,6 +146,235 @@ TEST_P(KVTest, BenchCommit) {
        << std::endl;
 }
 
+TEST_P(KVTest, RmRangeKeys) {
+  ASSERT_EQ(0, db->create_and_open(cout));
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    bufferlist value;
+    value.append("value");
+    for (unsigned i = 0; i < 10; ++i) {
+      t->set("range", stringify(i), value);
+      t->set("other", stringify(i), value);
+    }
+    db->submit_transaction_sync(t);
+  }
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    t->rm_range_keys("range", "3", "7");
+    t->rmkeys_by_prefix("other");
+    db->submit_transaction_sync(t);
+  }
+  for (unsigned i = 0; i < 10; ++i) {
+    bufferlist v;
+    ASSERT_EQ((i >= 3 && i < 7) ? -ENOENT : 0,
+	      db->get("range", stringify(i), &v));
+    ASSERT_EQ(-ENOENT, db->get("other", stringify(i), &v));
+  }
+  KeyValueDB::Iterator it = db->get_iterator("range");
+  unsigned n = 0;
+  for (it->seek_to_first(); it->valid(); it->next())
+    ++n;
+  ASSERT_EQ(6u, n);
+  fini();
+}
+
+// adds little-endian 64-bit deltas
+struct AddOperator : public KeyValueDB::MergeOperator {
+  void merge_nonexistent(const char *rdata, size_t rlen, std::string *new_value) {
+    *new_value = std::string(rdata, rlen);
+  }
+  void merge(const char *ldata, size_t llen, const char *rdata, size_t rlen,
+	     std::string *new_value) {
+    assert(llen == sizeof(uint64_t) && rlen == sizeof(uint64_t));
+    uint64_t l, r;
+    memcpy(&l, ldata, llen);
+    memcpy(&r, rdata, rlen);
+    l += r;
+    *new_value = std::string((char *)&l, sizeof(l));
+  }
+  std::string name() const {
+    return "add";
+  }
+};
+
+static bufferlist encode_u64(uint64_t v)
+{
+  bufferlist bl;
+  bl.append((char *)&v, sizeof(v));
+  return bl;
+}
+
+static uint64_t get_u64(KeyValueDB *db, const string &prefix, const string &key)
+{
+  bufferlist bl;
+  if (db->get(prefix, key, &bl) < 0)
+    return (uint64_t)-1;
+  assert(bl.length() == sizeof(uint64_t));
+  uint64_t v;
+  memcpy(&v, bl.c_str(), sizeof(v));
+  return v;
+}
+
+TEST_P(KVTest, MultiGet) {
+  ASSERT_EQ(0, db->create_and_open(cout));
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    t->rmkeys_by_prefix("multi");
+    for (unsigned i = 0; i < 100; i += 2) {
+      bufferlist value;
+      value.append(stringify(i));
+      t->set("multi", stringify(1000 + i), value);
+    }
+    db->submit_transaction_sync(t);
+  }
+  set<string> keys;
+  for (unsigned i = 0; i < 100; i += 3)
+    keys.insert(stringify(1000 + i));
+  keys.insert("0");
+  keys.insert("9999");
+  map<string, bufferlist> out;
+  ASSERT_EQ(0, db->get("multi", keys, &out));
+  ASSERT_EQ(17u, out.size());
+  for (map<string, bufferlist>::iterator p = out.begin(); p != out.end(); ++p) {
+    unsigned i = atoi(p->first.c_str()) - 1000;
+    ASSERT_EQ(0u, i % 6);
+    ASSERT_EQ(stringify(i), string(p->second.c_str(), p->second.length()));
+  }
+  fini();
+}
+
+TEST_P(KVTest, Merge) {
+  ceph::shared_ptr<KeyValueDB::MergeOperator> op(new AddOperator);
+  ASSERT_EQ(0, db->set_merge_operator("counter", op));
+  ASSERT_EQ(0, db->create_and_open(cout));
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    t->rmkeys_by_prefix("counter");  // left over from an earlier run
+    t->merge("counter", "a", encode_u64(1));
+    t->merge("counter", "a", encode_u64(2));
+    t->set("counter", "b", encode_u64(10));
+    db->submit_transaction_sync(t);
+  }
+  ASSERT_EQ(3u, get_u64(db.get(), "counter", "a"));
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    t->merge("counter", "a", encode_u64(4));
+    t->merge("counter", "b", encode_u64(5));
+    t->rmkey("counter", "a");
+    t->merge("counter", "a", encode_u64(100));
+    db->submit_transaction_sync(t);
+  }
+  ASSERT_EQ(100u, get_u64(db.get(), "counter", "a"));
+  ASSERT_EQ(15u, get_u64(db.get(), "counter", "b"));
+  fini();
+
+  init();
+  ASSERT_EQ(0, db->set_merge_operator("counter", op));
+  ASSERT_EQ(0, db->open(cout));
+  ASSERT_EQ(100u, get_u64(db.get(), "counter", "a"));
+  ASSERT_EQ(15u, get_u64(db.get(), "counter", "b"));
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    t->merge("counter", "b", encode_u64(1));
+    db->submit_transaction_sync(t);
+  }
+  ASSERT_EQ(16u, get_u64(db.get(), "counter", "b"));
+  fini();
+}
+
+TEST_P(KVTest, MergeInterleaved) {
+  ceph::shared_ptr<KeyValueDB::MergeOperator> op(new AddOperator);
+  ASSERT_EQ(0, db->set_merge_operator("counter", op));
+  ASSERT_EQ(0, db->create_and_open(cout));
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    t->set("counter", "a", encode_u64(1));
+    db->submit_transaction_sync(t);
+  }
+  // both are built before either is submitted; neither may lose the
+  // other's update
+  KeyValueDB::Transaction t1 = db->get_transaction();
+  t1->merge("counter", "a", encode_u64(2));
+  KeyValueDB::Transaction t2 = db->get_transaction();
+  t2->merge("counter", "a", encode_u64(3));
+  t2->merge("counter", "a", encode_u64(4));
+  db->submit_transaction_sync(t1);
+  ASSERT_EQ(3u, get_u64(db.get(), "counter", "a"));
+  db->submit_transaction(t2);
+  ASSERT_EQ(10u, get_u64(db.get(), "counter", "a"));
+  fini();
+}
+TEST_P(KVTest, ColumnFamilies) {
+  if (string(GetParam()) != "rocksdb")
+    return;
+  fini();
+  ASSERT_EQ(0, ::system("rm -rf kv_test_temp_dir_cf"));
+  ASSERT_EQ(0, ::mkdir("kv_test_temp_dir_cf", 0777));
+  g_ceph_context->_conf->set_val("rocksdb_column_families",
+				 "b c=write_buffer_size=1048576");
+  g_ceph_context->_conf->apply_changes(NULL);
+  db.reset(KeyValueDB::create(g_ceph_context, "rocksdb",
+			      "kv_test_temp_dir_cf"));
+  ASSERT_EQ(0, db->create_and_open(cout));
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    bufferlist value;
+    value.append("value");
+    const char *prefixes[] = { "a", "b", "c", "d" };
+    for (unsigned i = 0; i < 4; ++i) {
+      t->set(prefixes[i], "1", value);
+      t->set(prefixes[i], "2", value);
+    }
+    db->submit_transaction_sync(t);
+  }
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    t->rmkeys_by_prefix("c");
+    t->rmkey("b", "1");
+    db->submit_transaction_sync(t);
+  }
+
+  // the whole space is walked in key order across families
+  const char *expected[][2] = { {"a", "1"}, {"a", "2"}, {"b", "2"},
+				{"d", "1"}, {"d", "2"} };
+  KeyValueDB::WholeSpaceIterator it = db->get_iterator();
+  unsigned n = 0;
+  for (it->seek_to_first(); it->valid(); it->next(), ++n) {
+    ASSERT_LT(n, 5u);
+    ASSERT_EQ(make_pair(string(expected[n][0]), string(expected[n][1])),
+	      it->raw_key());
+  }
+  ASSERT_EQ(5u, n);
+  for (it->seek_to_last(); it->valid(); it->prev()) {
+    ASSERT_GT(n, 0u);
+    --n;
+    ASSERT_EQ(make_pair(string(expected[n][0]), string(expected[n][1])),
+	      it->raw_key());
+  }
+  ASSERT_EQ(0u, n);
+
+  // the layout is kept even if the configuration goes away
+  fini();
+  g_ceph_context->_conf->set_val("rocksdb_column_families", "");
+  g_ceph_context->_conf->apply_changes(NULL);
+  db.reset(KeyValueDB::create(g_ceph_context, "rocksdb",
+			      "kv_test_temp_dir_cf"));
+  ASSERT_EQ(0, db->open(cout));
+  {
+    bufferlist v;
+    ASSERT_EQ(0, db->get("b", "2", &v));
+    ASSERT_EQ(-ENOENT, db->get("b", "1", &v));
+    ASSERT_EQ(-ENOENT, db->get("c", "1", &v));
+    ASSERT_EQ(0, db->get("d", "1", &v));
+    KeyValueDB::Iterator pit = db->get_iterator("b");
+    pit->seek_to_first();
+    ASSERT_TRUE(pit->valid());
+    ASSERT_EQ("2", pit->key());
+    pit->next();
+    ASSERT_FALSE(pit->valid());
+  }
+  fini();
+}
 
 INSTANTIATE_TEST_CASE_P(
   KeyValueDB,
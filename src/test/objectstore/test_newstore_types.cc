@@ -0,0 +1,148 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2015 Red Hat
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "os/newstore/newstore_types.h"
+#include "include/encoding.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include <gtest/gtest.h>
+
+static bufferlist make_data(unsigned len)
+{
+  bufferlist bl;
+  for (unsigned i = 0; i < len; ++i)
+    bl.append((char)(i * 7 + i / 4096));
+  return bl;
+}
+
+TEST(extent_t, csum_none) {
+  extent_t e(0, 8192);
+  bufferlist bl = make_data(8192);
+  e.calc_csum(extent_t::CSUM_NONE, 4096, bl);
+  ASSERT_FALSE(e.has_csum());
+  bl.c_str()[10] ^= 1;
+  ASSERT_EQ(0, e.verify_csum(0, bl, NULL));
+}
+
+TEST(extent_t, csum_crc32c) {
+  extent_t e(65536, 4 * 4096);
+  bufferlist bl = make_data(4 * 4096);
+  e.calc_csum(extent_t::CSUM_CRC32C, 4096, bl);
+  ASSERT_TRUE(e.has_csum());
+  ASSERT_EQ(4u, e.csum.size());
+  ASSERT_EQ(4096u, e.get_csum_block_size());
+
+  // the whole extent, and any aligned piece of it
+  uint32_t bad_off = 0;
+  ASSERT_EQ(0, e.verify_csum(0, bl, &bad_off));
+  bufferlist piece;
+  piece.substr_of(bl, 4096, 8192);
+  ASSERT_EQ(0, e.verify_csum(4096, piece, &bad_off));
+
+  // a flipped bit is caught, and located
+  bufferlist bad;
+  bad.append(bl.c_str(), bl.length());
+  bad.c_str()[2 * 4096 + 17] ^= 1;
+  ASSERT_EQ(-EIO, e.verify_csum(0, bad, &bad_off));
+  ASSERT_EQ(2u * 4096u, bad_off);
+  bufferlist bad_piece;
+  bad_piece.substr_of(bad, 2 * 4096, 4096);
+  ASSERT_EQ(-EIO, e.verify_csum(2 * 4096, bad_piece, NULL));
+
+  // the same data checked against the wrong block does not pass
+  piece.substr_of(bl, 0, 4096);
+  ASSERT_EQ(-EIO, e.verify_csum(4096, piece, NULL));
+}
+
+TEST(extent_t, csum_split) {
+  extent_t e(65536, 4 * 4096);
+  bufferlist bl = make_data(4 * 4096);
+  e.calc_csum(extent_t::CSUM_CRC32C, 4096, bl);
+
+  extent_t s;
+  e.split(4096, 2 * 4096, &s);
+  ASSERT_EQ(65536u + 4096u, s.offset);
+  ASSERT_EQ(2u * 4096u, s.length);
+  ASSERT_EQ((int)extent_t::CSUM_CRC32C, (int)s.csum_type);
+  ASSERT_EQ(2u, s.csum.size());
+  ASSERT_EQ(e.csum[1], s.csum[0]);
+  ASSERT_EQ(e.csum[2], s.csum[1]);
+
+  // the split extent still verifies its own data
+  bufferlist piece;
+  piece.substr_of(bl, 4096, 2 * 4096);
+  ASSERT_EQ(0, s.verify_csum(0, piece, NULL));
+  bufferlist other;
+  other.substr_of(bl, 0, 2 * 4096);
+  ASSERT_EQ(-EIO, s.verify_csum(0, other, NULL));
+}
+
+TEST(extent_t, encode_decode) {
+  extent_t e(65536, 2 * 4096);
+  bufferlist data = make_data(2 * 4096);
+  e.calc_csum(extent_t::CSUM_CRC32C, 4096, data);
+
+  bufferlist bl;
+  ::encode(e, bl);
+  extent_t d;
+  bufferlist::iterator p = bl.begin();
+  ::decode(d, p);
+  ASSERT_EQ(e.offset, d.offset);
+  ASSERT_EQ(e.length, d.length);
+  ASSERT_EQ(e.csum_type, d.csum_type);
+  ASSERT_EQ(e.csum, d.csum);
+  ASSERT_EQ(0, d.verify_csum(0, data, NULL));
+}
+
+TEST(extent_t, decode_v1) {
+  // extents written before checksums existed have none
+  bufferlist bl;
+  ENCODE_START(1, 1, bl);
+  ::encode((uint64_t)8192, bl);
+  ::encode((uint32_t)4096, bl);
+  ENCODE_FINISH(bl);
+
+  extent_t d;
+  d.csum_type = extent_t::CSUM_CRC32C;
+  d.csum.push_back(1);
+  bufferlist::iterator p = bl.begin();
+  ::decode(d, p);
+  ASSERT_EQ(8192u, d.offset);
+  ASSERT_EQ(4096u, d.length);
+  ASSERT_EQ((int)extent_t::CSUM_NONE, (int)d.csum_type);
+  ASSERT_FALSE(d.has_csum());
+  ASSERT_FALSE(d.is_compressed());
+}
+
+TEST(extent_t, csum_type_names) {
+  ASSERT_EQ((int)extent_t::CSUM_NONE, extent_t::get_csum_type_by_name("none"));
+  ASSERT_EQ((int)extent_t::CSUM_CRC32C,
+	    extent_t::get_csum_type_by_name("crc32c"));
+  ASSERT_EQ(-EINVAL, extent_t::get_csum_type_by_name("xxhash"));
+  ASSERT_EQ(string("crc32c"),
+	    extent_t::get_csum_type_name(extent_t::CSUM_CRC32C));
+}
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,273 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2015 Red Hat
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "os/ObjectStore.h"
+#include "include/stringify.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include <gtest/gtest.h>
+
+typedef ObjectStore::Transaction Transaction;
+
+/// what we expect the iterator to hand back for one op
+struct expect_op {
+  uint32_t op;
+  coll_t cid;
+  ghobject_t oid;
+  string name;
+  bufferlist data;
+  expect_op(uint32_t op, coll_t cid, ghobject_t oid)
+    : op(op), cid(cid), oid(oid) {}
+};
+
+class TransactionTest : public ::testing::Test {
+public:
+  coll_t c1, c2;
+  vector<expect_op> expect;
+
+  TransactionTest()
+    : c1(spg_t(pg_t(1, 2), shard_id_t::NO_SHARD)),
+      c2(spg_t(pg_t(4, 5), shard_id_t::NO_SHARD)) {}
+
+  static ghobject_t obj(unsigned i) {
+    return ghobject_t(hobject_t("obj" + stringify(i), "", 123, 456, -1, ""));
+  }
+
+  static bufferlist payload(unsigned len, char seed) {
+    bufferptr bp(len);
+    for (unsigned i = 0; i < len; ++i)
+      bp.c_str()[i] = seed + i / 7;
+    bufferlist bl;
+    bl.append(bp);
+    return bl;
+  }
+
+  void touch(Transaction& t, coll_t c, ghobject_t o) {
+    t.touch(c, o);
+    expect.push_back(expect_op(Transaction::OP_TOUCH, c, o));
+  }
+  void write(Transaction& t, coll_t c, ghobject_t o, bufferlist bl) {
+    t.write(c, o, 0, bl.length(), bl);
+    expect.push_back(expect_op(Transaction::OP_WRITE, c, o));
+    expect.back().data = bl;
+  }
+  void setattr(Transaction& t, coll_t c, ghobject_t o, string name,
+	       bufferlist bl) {
+    t.setattr(c, o, name, bl);
+    expect.push_back(expect_op(Transaction::OP_SETATTR, c, o));
+    expect.back().name = name;
+    expect.back().data = bl;
+  }
+
+  /// a mix of ops spanning several OPS_PER_PTR chunks of op_bl
+  void build(Transaction& t, unsigned num) {
+    for (unsigned i = 0; i < num; ++i) {
+      if (i % 10 == 3)
+	write(t, c1, obj(i / 2), payload(100 + i, 'a' + i % 26));
+      else if (i % 10 == 7)
+	setattr(t, c2, obj(i), "attr" + stringify(i), payload(10, 'A'));
+      else
+	touch(t, i % 2 ? c1 : c2, obj(i / 2));
+    }
+  }
+
+  void check(Transaction& t) {
+    ASSERT_EQ((int)expect.size(), t.get_num_ops());
+    Transaction::iterator i = t.begin();
+    for (vector<expect_op>::iterator p = expect.begin();
+	 p != expect.end();
+	 ++p) {
+      SCOPED_TRACE(p - expect.begin());
+      ASSERT_TRUE(i.have_op());
+      Transaction::Op *op = i.decode_op();
+      ASSERT_EQ(p->op, (uint32_t)op->op);
+      ASSERT_EQ(p->cid, i.get_cid(op->cid));
+      ASSERT_EQ(p->oid, i.get_oid(op->oid));
+      bufferlist bl;
+      switch (p->op) {
+      case Transaction::OP_WRITE:
+	ASSERT_EQ(p->data.length(), (uint64_t)op->len);
+	i.decode_bl(bl);
+	ASSERT_TRUE(bl.contents_equal(p->data));
+	break;
+      case Transaction::OP_SETATTR:
+	ASSERT_EQ(p->name, i.decode_string());
+	i.decode_bl(bl);
+	ASSERT_TRUE(bl.contents_equal(p->data));
+	break;
+      }
+    }
+    ASSERT_FALSE(i.have_op());
+  }
+};
+
+/// copy bl into segments of at most len bytes
+static bufferlist rechunk(bufferlist& bl, unsigned len)
+{
+  bufferlist out;
+  for (unsigned off = 0; off < bl.length(); off += len) {
+    unsigned n = MIN(len, bl.length() - off);
+    bufferptr bp(n);
+    bl.copy(off, n, bp.c_str());
+    out.append(bp);
+  }
+  return out;
+}
+
+TEST_F(TransactionTest, iterate) {
+  Transaction t;
+  build(t, 3 * OPS_PER_PTR + 5);
+  check(t);
+  // walking the ops leaves the transaction as it was
+  check(t);
+}
+
+TEST_F(TransactionTest, encode_decode) {
+  Transaction t;
+  build(t, 3 * OPS_PER_PTR + 5);
+  bufferlist bl;
+  ::encode(t, bl);
+
+  // a decoded op_bl may come in arbitrary pieces, with ops straddling
+  // segment boundaries
+  unsigned chunk[] = { 1, 7, sizeof(Transaction::Op) - 1,
+		       sizeof(Transaction::Op) + 3, 4096, bl.length() };
+  for (unsigned n = 0; n < sizeof(chunk) / sizeof(chunk[0]); ++n) {
+    SCOPED_TRACE(chunk[n]);
+    bufferlist in = rechunk(bl, chunk[n]);
+    bufferlist::iterator p = in.begin();
+    Transaction d;
+    ::decode(d, p);
+    ASSERT_FALSE(d.get_use_tbl());
+    check(d);
+    check(d);
+
+    // and re-encodes to the same bytes
+    bufferlist again;
+    ::encode(d, again);
+    ASSERT_TRUE(again.contents_equal(bl));
+  }
+}
+
+TEST_F(TransactionTest, append_same_index) {
+  // the other side's coll and object ids line up with ours, so its
+  // ops are shared rather than renumbered
+  Transaction a, b;
+  touch(a, c1, obj(1));
+  touch(b, c1, obj(1));
+  write(b, c1, obj(1), payload(4096, 'x'));
+  touch(b, c2, obj(2));
+  a.append(b);
+  check(a);
+}
+
+TEST_F(TransactionTest, append_remap) {
+  Transaction a, b;
+  touch(a, c2, obj(2));
+  write(a, c2, obj(3), payload(100, 'y'));
+  touch(b, c1, obj(1));
+  write(b, c1, obj(1), payload(4096, 'x'));
+  touch(b, c2, obj(3));
+  a.append(b);
+  check(a);
+
+  bufferlist bl;
+  ::encode(a, bl);
+  Transaction d(bl);
+  check(d);
+}
+
+TEST_F(TransactionTest, append_empty) {
+  Transaction a, b;
+  build(b, OPS_PER_PTR + 1);
+  a.append(b);
+  check(a);
+}
+
+/// the journal aligns the largest write by where it lands in the encoding
+static void check_data_offset(Transaction& t, bufferlist& data)
+{
+  ASSERT_EQ(data.length(), t.get_data_length());
+  bufferlist bl;
+  ::encode(t, bl);
+  unsigned off = t.get_data_offset();
+  ASSERT_LT(0u, off);
+  ASSERT_GE(bl.length(), off + data.length());
+  bufferlist found;
+  found.substr_of(bl, off, data.length());
+  ASSERT_TRUE(found.contents_equal(data));
+  ASSERT_EQ((int)((0 - off) & ~CEPH_PAGE_MASK), t.get_data_alignment());
+}
+
+TEST_F(TransactionTest, data_offset) {
+  bufferlist big = payload(65536, 'b');
+  for (int use_tbl = 0; use_tbl < 2; ++use_tbl) {
+    SCOPED_TRACE(use_tbl ? "tbl" : "no tbl");
+    Transaction t;
+    t.set_use_tbl(use_tbl);
+    ASSERT_EQ(-1, t.get_data_alignment());
+    setattr(t, c1, obj(1), "a", payload(10, 'a'));
+    write(t, c1, obj(1), payload(100, 'c'));
+    write(t, c1, obj(2), big);
+    write(t, c1, obj(3), payload(200, 'd'));
+    check_data_offset(t, big);
+
+    // the largest write coming from an appended transaction
+    Transaction a;
+    a.set_use_tbl(use_tbl);
+    setattr(a, c2, obj(4), "b", payload(30, 'e'));
+    write(a, c2, obj(4), payload(300, 'f'));
+    a.append(t);
+    check_data_offset(a, big);
+    expect.clear();
+  }
+}
+
+TEST_F(TransactionTest, tbl_compat) {
+  // transactions from older peers and journals use the tbl encoding
+  Transaction t;
+  t.set_use_tbl(true);
+  build(t, OPS_PER_PTR + 5);
+  bufferlist bl;
+  ::encode(t, bl);
+  for (unsigned n = 0; n < 2; ++n) {
+    bufferlist in = n ? rechunk(bl, 5) : bl;
+    bufferlist::iterator p = in.begin();
+    Transaction d;
+    ::decode(d, p);
+    ASSERT_TRUE(d.get_use_tbl());
+    check(d);
+  }
+
+  // and the new encoding is not mistaken for it
+  Transaction n;
+  build(n, 3);
+  bufferlist nbl;
+  ::encode(n, nbl);
+  Transaction d(nbl);
+  ASSERT_FALSE(d.get_use_tbl());
+}
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,182 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2015 Red Hat
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+#include "os/fs/FS.h"
+#include "common/Thread.h"
+#include "include/atomic.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include <gtest/gtest.h>
+
+#if defined(HAVE_LIBAIO)
+
+/// reap from another thread while the test submits
+class Reaper : public Thread {
+  FS::aio_queue_t *q;
+  unsigned want;
+public:
+  atomic_t stop;
+  vector<FS::aio_t*> done;
+  Reaper(FS::aio_queue_t *q, unsigned want) : q(q), want(want), stop(0) {}
+  void *entry() {
+    FS::aio_t *aio[16];
+    while (done.size() < want && !stop.read()) {
+      int r = q->get_next_completed(1000, aio, 16);
+      if (r < 0)
+	break;
+      done.insert(done.end(), aio, aio + r);
+    }
+    return 0;
+  }
+};
+
+class AioQueueTest : public ::testing::TestWithParam<const char*> {
+public:
+  static const unsigned depth = 8;
+  FS::aio_queue_t *q;
+  int fd;
+
+  AioQueueTest() : q(NULL), fd(-1) {}
+
+  virtual void SetUp() {
+    ASSERT_EQ(0, FS::create_aio_queue(GetParam(), depth, &q));
+    fd = ::open("aio_queue_test", O_CREAT|O_TRUNC|O_RDWR, 0644);
+    ASSERT_LE(0, fd);
+  }
+  virtual void TearDown() {
+    if (q) {
+      q->shutdown();
+      delete q;
+    }
+    if (fd >= 0)
+      ::close(fd);
+    ::unlink("aio_queue_test");
+  }
+
+  /// false if we fell back to another engine
+  bool have_engine() {
+    if (strcmp(q->get_name(), GetParam()) == 0)
+      return true;
+    std::cout << "SKIP: " << GetParam() << " is not available" << std::endl;
+    return false;
+  }
+};
+
+TEST_P(AioQueueTest, submit_more_than_depth) {
+  if (!have_engine())
+    return;
+  // well past the depth of the rings.  io_uring batches are larger
+  // than its completion ring so a single submit_batch has to wait for
+  // the reaper; libaio would just return EAGAIN for those.
+  bool uring = strcmp(GetParam(), "io_uring") == 0;
+  const unsigned num = 32 * depth, len = 4096;
+  const unsigned batch = uring ? 4 * depth : depth;
+  vector<bufferptr> bufs;
+  vector<FS::aio_t> aios;
+  aios.reserve(num);
+  for (unsigned i = 0; i < num; ++i) {
+    bufs.push_back(buffer::create_page_aligned(len));
+    memset(bufs.back().c_str(), 'a' + i % 26, len);
+    aios.push_back(FS::aio_t(NULL, fd));
+    iovec iov = { bufs.back().c_str(), len };
+    aios.back().iov.push_back(iov);
+    aios.back().pwritev(i * len);
+  }
+
+  Reaper reaper(q, num);
+  reaper.create();
+  int retries = 0;
+  int r = 0;
+  for (unsigned i = 0; i < num && r == 0; i += batch) {
+    vector<FS::aio_t*> p;
+    for (unsigned j = i; j < i + batch; ++j)
+      p.push_back(&aios[j]);
+    r = q->submit_batch(&p[0], p.size(), &retries);
+  }
+  if (r < 0)
+    reaper.stop.set(1);
+  reaper.join();
+  ASSERT_EQ(0, r);
+  if (uring)
+    ASSERT_LT(0, retries);
+
+  ASSERT_EQ(num, reaper.done.size());
+  set<FS::aio_t*> seen(reaper.done.begin(), reaper.done.end());
+  ASSERT_EQ(num, seen.size());
+  for (unsigned i = 0; i < num; ++i)
+    ASSERT_EQ((long)len, aios[i].rval);
+  char buf[len];
+  for (unsigned i = 0; i < num; ++i) {
+    ASSERT_EQ((ssize_t)len, ::pread(fd, buf, len, i * len));
+    ASSERT_EQ(0, memcmp(buf, bufs[i].c_str(), len));
+  }
+}
+
+TEST_P(AioQueueTest, completion_result) {
+  if (!have_engine())
+    return;
+  // a write to a read only fd fails, and says so in rval
+  int rfd = ::open("aio_queue_test", O_RDONLY);
+  ASSERT_LE(0, rfd);
+  bufferptr bp = buffer::create_page_aligned(4096);
+  FS::aio_t aio(NULL, rfd);
+  iovec iov = { bp.c_str(), 4096 };
+  aio.iov.push_back(iov);
+  aio.pwritev(0);
+  int retries = 0;
+  int r = q->submit(aio, &retries);
+  if (r == 0) {
+    FS::aio_t *done = NULL;
+    ASSERT_EQ(1, q->get_next_completed(-1, &done, 1));
+    ASSERT_EQ(&aio, done);
+    ASSERT_EQ(-EBADF, aio.rval);
+  } else {
+    // libaio checks the fd at submit time
+    ASSERT_EQ(-EBADF, r);
+  }
+  ::close(rfd);
+}
+
+INSTANTIATE_TEST_CASE_P(
+  AioQueue,
+  AioQueueTest,
+  ::testing::Values("libaio", "io_uring"));
+
+#else
+
+// Google Test may not support value-parameterized tests with some
+// compilers. If we use conditional compilation to compile out all
+// code referring to the gtest_main library, MSVC linker will not link
+// that library at all and consequently complain about missing entry
+// point defined in that library (fatal error LNK1561: entry point
+// must be defined). This dummy test keeps gtest_main linked in.
+TEST(DummyTest, ValueParameterizedTestsAreNotSupportedOnThisPlatform) {}
+
+#endif
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
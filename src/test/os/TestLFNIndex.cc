@@ -22,7 +22,9 @@
 #include <stdio.h>
 #include <signal.h>
 #include "os/LFNIndex.h"
+#include "os/HashIndex.h"
 #include "os/chain_xattr.h"
+#include "include/stringify.h"
 #include "common/ceph_argparse.h"
 #include "global/global_init.h"
 #include <gtest/gtest.h>
@@ -439,6 +441,224 @@ TEST_F(TestLFNIndex, get_mangled_name) {
   }
 }
 
+TEST(HashIndex, background_split) {
+  ASSERT_EQ(0, ::system("rm -fr PATH_2"));
+  ASSERT_EQ(0, ::mkdir("PATH_2", 0700));
+  // leaves split past 16 objects
+  HashIndex index(coll_t(), "PATH_2", 1, 1,
+		  CollectionIndex::HOBJECT_WITH_POOL, 0, true);
+  ASSERT_EQ(0, index.init());
+
+  // everything hashes to DIR_A; the root still splits inline at 17,
+  // then DIR_A overflows and is left to the background
+  vector<ghobject_t> oids;
+  for (unsigned i = 0; i < 25; ++i) {
+    ghobject_t oid(hobject_t(object_t("obj" + stringify(i)), "", CEPH_NOSNAP,
+			     (i << 4) | 0xA, 1, ""));
+    CollectionIndex::IndexedPath path;
+    int exists;
+    ASSERT_EQ(0, index.lookup(oid, &path, &exists));
+    ASSERT_EQ(0, exists);
+    ASSERT_EQ(0, ::close(::creat(path->path(), 0600)));
+    ASSERT_EQ(0, index.created(oid, path->path()));
+    oids.push_back(oid);
+  }
+  ASSERT_TRUE(index.has_background_work());
+  ASSERT_EQ(0, index.do_background_work());
+  ASSERT_FALSE(index.has_background_work());
+
+  for (vector<ghobject_t>::iterator i = oids.begin(); i != oids.end(); ++i) {
+    CollectionIndex::IndexedPath path;
+    int exists;
+    ASSERT_EQ(0, index.lookup(*i, &path, &exists));
+    ASSERT_EQ(1, exists);
+    ASSERT_NE(string::npos, string(path->path()).find("/DIR_A/DIR_"));
+  }
+  EXPECT_EQ(-1, ::access("PATH_2/.split_DIR_A", F_OK));
+  EXPECT_EQ(-1, ::access("PATH_2/.old_DIR_A", F_OK));
+  ASSERT_EQ(0, ::system("rm -fr PATH_2"));
+}
+
+class TestHashIndex : public HashIndex {
+public:
+  explicit TestHashIndex(const char *base_path)
+    : HashIndex(coll_t(), base_path, 1, 1,
+		CollectionIndex::HOBJECT_WITH_POOL, 0, true) {}
+
+  bg_split_t split;
+
+  int split_start() {
+    return bg_split_start(vector<string>(1, "A"), &split);
+  }
+  int split_link() { return bg_split_link(&split); }
+  int split_swap() { return bg_split_swap(&split); }
+  int split_finish() { return bg_split_finish(&split); }
+
+  /// @return true if we crashed between the two renames
+  bool split_swap_crash() {
+    // the first injection point passes, the second one fires
+    error_injection_on = true;
+    error_injection_probability = 1;
+    bool crashed = false;
+    try {
+      bg_split_swap(&split);
+    } catch (RetryException) {
+      complete_inject_failure();
+      crashed = true;
+    }
+    error_injection_on = false;
+    return crashed;
+  }
+};
+
+static ghobject_t bg_split_oid(unsigned i) {
+  // everything hashes to DIR_A
+  return ghobject_t(hobject_t(object_t("obj" + stringify(i)), "", CEPH_NOSNAP,
+			      (i << 4) | 0xA, 1, ""));
+}
+
+static void bg_split_create(HashIndex *index, const ghobject_t &oid) {
+  CollectionIndex::IndexedPath path;
+  int exists;
+  ASSERT_EQ(0, index->lookup(oid, &path, &exists));
+  ASSERT_EQ(0, exists);
+  ASSERT_EQ(0, ::close(::creat(path->path(), 0600)));
+  ASSERT_EQ(0, index->created(oid, path->path()));
+}
+
+TEST(HashIndex, background_split_create_unlink) {
+  ASSERT_EQ(0, ::system("rm -fr PATH_4"));
+  ASSERT_EQ(0, ::mkdir("PATH_4", 0700));
+  TestHashIndex index("PATH_4");
+  ASSERT_EQ(0, index.init());
+  for (unsigned i = 0; i < 25; ++i)
+    bg_split_create(&index, bg_split_oid(i));
+  ASSERT_EQ(0, index.split_start());
+  ASSERT_EQ(0, index.split_link());
+
+  // behind the snapshot: new objects, removed ones and a replaced one
+  set<unsigned> live;
+  for (unsigned i = 3; i < 28; ++i)
+    live.insert(i);
+  for (unsigned i = 25; i < 28; ++i)
+    bg_split_create(&index, bg_split_oid(i));
+  for (unsigned i = 0; i < 4; ++i)
+    ASSERT_EQ(0, index.unlink(bg_split_oid(i)));
+  bg_split_create(&index, bg_split_oid(3));
+
+  ASSERT_EQ(0, index.split_swap());
+  ASSERT_EQ(0, index.split_finish());
+  for (unsigned i = 0; i < 28; ++i) {
+    ghobject_t oid = bg_split_oid(i);
+    CollectionIndex::IndexedPath path;
+    int exists;
+    ASSERT_EQ(0, index.lookup(oid, &path, &exists));
+    ASSERT_NE(string::npos, string(path->path()).find("/DIR_A/DIR_"));
+    ASSERT_EQ(live.count(i) ? 1 : 0, exists);
+    ASSERT_EQ(exists ? 0 : -1, ::access(path->path(), F_OK));
+  }
+  vector<ghobject_t> ls;
+  ASSERT_EQ(0, index.collection_list_partial(ghobject_t(), ghobject_t::get_max(),
+					     true, INT_MAX, &ls, NULL));
+  ASSERT_EQ(live.size(), ls.size());
+  EXPECT_EQ(-1, ::access("PATH_4/.split_DIR_A", F_OK));
+  EXPECT_EQ(-1, ::access("PATH_4/.old_DIR_A", F_OK));
+  ASSERT_EQ(0, ::system("rm -fr PATH_4"));
+}
+
+TEST(HashIndex, background_split_prep_delete) {
+  ASSERT_EQ(0, ::system("rm -fr PATH_5"));
+  ASSERT_EQ(0, ::mkdir("PATH_5", 0700));
+  TestHashIndex index("PATH_5");
+  ASSERT_EQ(0, index.init());
+  for (unsigned i = 0; i < 25; ++i)
+    bg_split_create(&index, bg_split_oid(i));
+  ASSERT_EQ(0, index.split_start());
+  ASSERT_EQ(0, index.split_link());
+
+  // the collection goes away under the split, as _destroy_collection does
+  for (unsigned i = 0; i < 25; ++i)
+    ASSERT_EQ(0, index.unlink(bg_split_oid(i)));
+  ASSERT_EQ(0, index.prep_delete());
+  ASSERT_EQ(-1, ::access("PATH_5", F_OK));
+
+  // the remaining steps give up without recreating anything
+  ASSERT_EQ(1, index.split_swap());
+  ASSERT_EQ(1, index.split_finish());
+  ASSERT_EQ(-1, ::access("PATH_5", F_OK));
+  ASSERT_FALSE(index.has_background_work());
+}
+
+TEST(HashIndex, background_split_crash) {
+  ASSERT_EQ(0, ::system("rm -fr PATH_6"));
+  ASSERT_EQ(0, ::mkdir("PATH_6", 0700));
+  vector<ghobject_t> oids;
+  {
+    TestHashIndex index("PATH_6");
+    ASSERT_EQ(0, index.init());
+    for (unsigned i = 0; i < 25; ++i) {
+      oids.push_back(bg_split_oid(i));
+      bg_split_create(&index, oids.back());
+    }
+    ASSERT_EQ(0, index.split_start());
+    ASSERT_EQ(0, index.split_link());
+    ASSERT_TRUE(index.split_swap_crash());
+  }
+  // the old leaf is retired but the shadow is not in place yet
+  ASSERT_EQ(-1, ::access("PATH_6/DIR_A", F_OK));
+  ASSERT_EQ(0, ::access("PATH_6/.old_DIR_A", F_OK));
+  ASSERT_EQ(0, ::access("PATH_6/.split_DIR_A", F_OK));
+
+  // on restart cleanup() puts the old leaf back
+  TestHashIndex index("PATH_6");
+  ASSERT_EQ(0, index.cleanup());
+  for (vector<ghobject_t>::iterator i = oids.begin(); i != oids.end(); ++i) {
+    CollectionIndex::IndexedPath path;
+    int exists;
+    ASSERT_EQ(0, index.lookup(*i, &path, &exists));
+    ASSERT_EQ(1, exists);
+    ASSERT_NE(string::npos, string(path->path()).find("/DIR_A/"));
+    ASSERT_EQ(string::npos, string(path->path()).find("/DIR_A/DIR_"));
+  }
+  EXPECT_EQ(-1, ::access("PATH_6/.split_DIR_A", F_OK));
+  EXPECT_EQ(-1, ::access("PATH_6/.old_DIR_A", F_OK));
+  ASSERT_EQ(0, ::system("rm -fr PATH_6"));
+}
+
+TEST(HashIndex, lfn_cache) {
+  ASSERT_EQ(0, ::system("rm -fr PATH_3"));
+  ASSERT_EQ(0, ::mkdir("PATH_3", 0700));
+  HashIndex index(coll_t(), "PATH_3", 1, 1,
+		  CollectionIndex::HOBJECT_WITH_POOL);
+  index.set_lfn_cache(2, NULL);
+  ASSERT_EQ(0, index.init());
+
+  const std::string object_name(1024, 'A');
+  ghobject_t oid(hobject_t(sobject_t(object_name, CEPH_NOSNAP)));
+  CollectionIndex::IndexedPath path;
+  int exists;
+  ASSERT_EQ(0, index.lookup(oid, &path, &exists));
+  ASSERT_EQ(0, exists);
+  ASSERT_NE(string::npos, string(path->path()).find("_long"));
+  ASSERT_EQ(0, ::close(::creat(path->path(), 0600)));
+  ASSERT_EQ(0, index.created(oid, path->path()));
+  string created_path = path->path();
+
+  // twice, the second from the cache
+  for (int i = 0; i < 2; ++i) {
+    CollectionIndex::IndexedPath p;
+    ASSERT_EQ(0, index.lookup(oid, &p, &exists));
+    ASSERT_EQ(1, exists);
+    ASSERT_EQ(created_path, p->path());
+  }
+
+  // unlink drops the cached entry
+  ASSERT_EQ(0, index.unlink(oid));
+  ASSERT_EQ(0, index.lookup(oid, &path, &exists));
+  ASSERT_EQ(0, exists);
+  ASSERT_EQ(0, ::system("rm -fr PATH_3"));
+}
+
 int main(int argc, char **argv) {
   int fd = ::creat("detect", 0600);
   int ret = chain_fsetxattr(fd, "user.test", "A", 1);
@@ -0,0 +1,140 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2015 Red Hat
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "os/WBThrottle.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include <gtest/gtest.h>
+
+static const uint64_t MB = 1 << 20;
+
+class WBThrottleTest : public ::testing::Test {
+public:
+  virtual void SetUp() {
+    // start limits are a tenth of the hard limits
+    set("filestore_wbthrottle_xfs_bytes_start_flusher", "10485760");
+    set("filestore_wbthrottle_xfs_bytes_hard_limit", "104857600");
+    set("filestore_wbthrottle_xfs_ios_start_flusher", "100");
+    set("filestore_wbthrottle_xfs_ios_hard_limit", "1000");
+    set("filestore_wbthrottle_adaptive", "true");
+    set("filestore_wbthrottle_adaptive_target", "1");
+  }
+
+  void set(const char *key, const char *val) {
+    g_ceph_context->_conf->set_val(key, val);
+    g_ceph_context->_conf->apply_changes(NULL);
+  }
+
+  void drained(WBThrottle &wbt, uint64_t bytes, uint64_t ios, double secs) {
+    Mutex::Locker l(wbt.lock);
+    wbt.update_drain_rate(bytes, ios, secs);
+  }
+  pair<uint64_t, uint64_t> size_limits(WBThrottle &wbt) {
+    Mutex::Locker l(wbt.lock);
+    return wbt.size_limits;
+  }
+  pair<uint64_t, uint64_t> io_limits(WBThrottle &wbt) {
+    Mutex::Locker l(wbt.lock);
+    return wbt.io_limits;
+  }
+  double drain_bytes_sec(WBThrottle &wbt) {
+    Mutex::Locker l(wbt.lock);
+    return wbt.drain_bytes_sec;
+  }
+};
+
+TEST_F(WBThrottleTest, static_until_measured) {
+  WBThrottle wbt(g_ceph_context);
+  wbt.set_fs(WBThrottle::XFS);
+  ASSERT_EQ(make_pair(10 * MB, 100 * MB), size_limits(wbt));
+  ASSERT_EQ(make_pair((uint64_t)100, (uint64_t)1000), io_limits(wbt));
+
+  // nothing to learn from an empty interval
+  drained(wbt, 10 * MB, 10, 0);
+  ASSERT_EQ(0, drain_bytes_sec(wbt));
+  ASSERT_EQ(make_pair(10 * MB, 100 * MB), size_limits(wbt));
+}
+
+TEST_F(WBThrottleTest, not_adaptive) {
+  set("filestore_wbthrottle_adaptive", "false");
+  WBThrottle wbt(g_ceph_context);
+  wbt.set_fs(WBThrottle::XFS);
+  drained(wbt, 20 * MB, 200, 1);
+  ASSERT_EQ(20 * MB, drain_bytes_sec(wbt));
+  ASSERT_EQ(make_pair(10 * MB, 100 * MB), size_limits(wbt));
+  ASSERT_EQ(make_pair((uint64_t)100, (uint64_t)1000), io_limits(wbt));
+}
+
+TEST_F(WBThrottleTest, adapts_to_drain_rate) {
+  WBThrottle wbt(g_ceph_context);
+  wbt.set_fs(WBThrottle::XFS);
+
+  // one second of writeback at 40MB/s and 400 ios/s
+  drained(wbt, 20 * MB, 200, .5);
+  ASSERT_EQ(make_pair(4 * MB, 40 * MB), size_limits(wbt));
+  ASSERT_EQ(make_pair((uint64_t)40, (uint64_t)400), io_limits(wbt));
+
+  // a moving average: 40 * .75 + 80 * .25 = 50
+  drained(wbt, 80 * MB, 800, 1);
+  ASSERT_EQ(50 * MB, drain_bytes_sec(wbt));
+  ASSERT_EQ(make_pair(5 * MB, 50 * MB), size_limits(wbt));
+  ASSERT_EQ(make_pair((uint64_t)50, (uint64_t)500), io_limits(wbt));
+
+  // and the target scales it
+  set("filestore_wbthrottle_adaptive_target", "1.5");
+  ASSERT_EQ(make_pair(15 * MB / 2, 75 * MB), size_limits(wbt));
+  ASSERT_EQ(make_pair((uint64_t)75, (uint64_t)750), io_limits(wbt));
+
+  // turning it off brings back the configured limits
+  set("filestore_wbthrottle_adaptive", "false");
+  ASSERT_EQ(make_pair(10 * MB, 100 * MB), size_limits(wbt));
+  ASSERT_EQ(make_pair((uint64_t)100, (uint64_t)1000), io_limits(wbt));
+}
+
+TEST_F(WBThrottleTest, clamped_to_configured_limits) {
+  WBThrottle wbt(g_ceph_context);
+  wbt.set_fs(WBThrottle::XFS);
+
+  // a very slow disk can't push the hard limit below the start limit
+  drained(wbt, 1 * MB, 1, 1);
+  ASSERT_EQ(make_pair(1 * MB, 10 * MB), size_limits(wbt));
+  ASSERT_EQ(make_pair((uint64_t)10, (uint64_t)100), io_limits(wbt));
+}
+
+TEST_F(WBThrottleTest, clamped_to_hard_limits) {
+  WBThrottle wbt(g_ceph_context);
+  wbt.set_fs(WBThrottle::XFS);
+
+  // nor can a fast one raise it past the configured hard limit
+  drained(wbt, 10000 * MB, 100000, 1);
+  ASSERT_EQ(make_pair(10 * MB, 100 * MB), size_limits(wbt));
+  ASSERT_EQ(make_pair((uint64_t)100, (uint64_t)1000), io_limits(wbt));
+
+  // and that holds when the configured limits change under it
+  set("filestore_wbthrottle_xfs_bytes_hard_limit", "209715200");
+  ASSERT_EQ(make_pair(10 * MB, 200 * MB), size_limits(wbt));
+}
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
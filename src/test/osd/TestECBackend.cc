@@ -16,7 +16,13 @@
 #include <sstream>
 #include <errno.h>
 #include <signal.h>
+#include <sys/stat.h>
+#include <boost/scoped_ptr.hpp>
 #include "osd/ECBackend.h"
+#include "erasure-code/ErasureCode.h"
+#include "os/ObjectStore.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
 #include "gtest/gtest.h"
 
 TEST(ECUtil, stripe_info_t)
@@ -58,3 +64,373 @@ TEST(ECUtil, stripe_info_t)
             make_pair((uint64_t)0, 2*swidth));
 }
 
+
+TEST(ECUtil, extents_to_chunk_ranges)
+{
+  const uint64_t swidth = 4096;
+  const uint64_t ssize = 4;
+
+  ECUtil::stripe_info_t s(ssize, swidth);
+  const uint64_t csize = s.get_chunk_size();
+
+  interval_set<uint64_t> extents;
+  extents.insert(100, 10);              // inside stripe 0
+  extents.insert(swidth - 1, 2);        // stripes 0 and 1
+  extents.insert(5 * swidth + 1, 10);   // stripe 5, past the end
+  interval_set<uint64_t> out;
+  s.extents_to_chunk_ranges(4 * swidth + 1, extents, &out);
+  ASSERT_EQ(1u, out.num_intervals());
+  ASSERT_EQ(0u, out.range_start());
+  ASSERT_EQ(2 * csize, out.range_end());
+
+  // clipped at the end of the last, partial, stripe
+  extents.clear();
+  extents.insert(3 * swidth + 10, 3 * swidth);
+  out.clear();
+  s.extents_to_chunk_ranges(4 * swidth + 1, extents, &out);
+  ASSERT_EQ(1u, out.num_intervals());
+  ASSERT_EQ(3 * csize, out.range_start());
+  ASSERT_EQ(5 * csize, out.range_end());
+}
+
+TEST(ECTransaction, get_rmw_stripes)
+{
+  const uint64_t swidth = 4096;
+  const uint64_t ssize = 2;
+  ECUtil::stripe_info_t s(ssize, swidth);
+
+  // two stripes on disk
+  ECUtil::HashInfoRef hinfo(new ECUtil::HashInfo(3));
+  map<int, bufferlist> buffers;
+  for (int i = 0; i < 3; ++i)
+    buffers[i].append_zero(2 * s.get_chunk_size());
+  hinfo->append(0, buffers);
+
+  hobject_t a(sobject_t("a", CEPH_NOSNAP));
+  hobject_t b(sobject_t("b", CEPH_NOSNAP));
+  map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator> hash_infos;
+  hash_infos[a] = hinfo;
+  hash_infos[b].reset(new ECUtil::HashInfo(*hinfo));
+
+  ECTransaction t;
+  bufferlist bl;
+  bl.append_zero(200);
+  t.overwrite(a, 100, bl.length(), bl, 0, 1);          // head of stripe 0
+  t.overwrite(a, swidth - 100, bl.length(), bl, 0, 1); // stripe 0 again, 1
+  t.overwrite(a, 3 * swidth - 10, bl.length(), bl, 0, 1); // past the end
+  t.stash(b, 1);
+  t.overwrite(b, 100, bl.length(), bl, 0, ghobject_t::NO_GEN); // nothing left
+  bufferlist full;
+  full.append_zero(swidth);
+  t.overwrite(b, swidth, full.length(), full, 0, ghobject_t::NO_GEN);
+
+  map<hobject_t, set<uint64_t>, hobject_t::BitwiseComparator> stripes;
+  t.get_rmw_stripes(hash_infos, s, &stripes);
+  ASSERT_EQ(1u, stripes.size());
+  set<uint64_t> expected;
+  expected.insert(0);
+  expected.insert(swidth);
+  ASSERT_EQ(expected, stripes[a]);
+}
+
+/// k=2 m=1, the coding chunk is the xor of the data chunks
+class ErasureCodeXor : public ErasureCode {
+public:
+  virtual int init(ErasureCodeProfile &profile, ostream *ss) {
+    return 0;
+  }
+  virtual unsigned int get_chunk_count() const { return 3; }
+  virtual unsigned int get_data_chunk_count() const { return 2; }
+  virtual unsigned int get_chunk_size(unsigned int object_size) const {
+    return object_size / 2;
+  }
+  virtual int encode_chunks(const set<int> &want_to_encode,
+			    map<int, bufferlist> *encoded) {
+    char *a = (*encoded)[0].c_str();
+    char *b = (*encoded)[1].c_str();
+    char *p = (*encoded)[2].c_str();
+    for (unsigned i = 0; i < (*encoded)[0].length(); ++i)
+      p[i] = a[i] ^ b[i];
+    return 0;
+  }
+  virtual int create_ruleset(const string &name,
+			     CrushWrapper &crush,
+			     ostream *ss) const { return 0; }
+};
+
+static string to_str(bufferlist bl)
+{
+  return string(bl.c_str(), bl.length());
+}
+
+class ECOverwriteTest : public ::testing::Test {
+public:
+  static const uint64_t swidth = 4096;
+  static const uint64_t csize = swidth / 2;
+
+  boost::scoped_ptr<ObjectStore> store;
+  ObjectStore::Sequencer osr;
+  ErasureCodeInterfaceRef ec_impl;
+  ECUtil::stripe_info_t sinfo;
+  pg_t pgid;
+  hobject_t oid;
+  map<hobject_t, ECUtil::HashInfoRef, hobject_t::BitwiseComparator> hash_infos;
+
+  ECOverwriteTest()
+    : osr("ec_overwrite"),
+      ec_impl(new ErasureCodeXor),
+      sinfo(2, swidth),
+      pgid(0, 1),
+      oid(object_t("foo"), "", CEPH_NOSNAP, 0, 1, "") {}
+
+  virtual void SetUp() {
+    int r = ::mkdir("ec_backend_temp_dir", 0777);
+    ASSERT_TRUE(r == 0 || errno == EEXIST);
+    store.reset(ObjectStore::create(g_ceph_context, "memstore",
+				    "ec_backend_temp_dir",
+				    "ec_backend_temp_journal"));
+    ASSERT_TRUE(store);
+    ASSERT_EQ(0, store->mkfs());
+    ASSERT_EQ(0, store->mount());
+    ObjectStore::Transaction t;
+    for (int i = 0; i < 3; ++i)
+      t.create_collection(coll(i), 0);
+    ASSERT_EQ(0u, store->apply_transaction(&osr, t));
+  }
+
+  virtual void TearDown() {
+    if (store)
+      store->umount();
+  }
+
+  coll_t coll(int shard) {
+    return coll_t(spg_t(pgid, shard_id_t(shard)));
+  }
+  ghobject_t shard_obj(int shard, version_t gen = ghobject_t::NO_GEN) {
+    return ghobject_t(oid, gen, shard_id_t(shard));
+  }
+  bufferlist read_shard(int shard, version_t gen = ghobject_t::NO_GEN) {
+    bufferlist bl;
+    store->read(coll(shard), shard_obj(shard, gen), 0, 0, bl);
+    return bl;
+  }
+  /// the data chunks interleaved back into the object
+  string read_logical() {
+    bufferlist d0 = read_shard(0), d1 = read_shard(1);
+    string out;
+    for (uint64_t off = 0; off < d0.length(); off += csize) {
+      bufferlist a, b;
+      a.substr_of(d0, off, csize);
+      b.substr_of(d1, off, csize);
+      out += to_str(a) + to_str(b);
+    }
+    return out;
+  }
+  bufferlist read_hinfo_bl(int shard, version_t gen = ghobject_t::NO_GEN) {
+    bufferlist bl;
+    store->getattr(coll(shard), shard_obj(shard, gen),
+		   ECUtil::get_hinfo_key(), bl);
+    return bl;
+  }
+  ECUtil::HashInfo read_hinfo(int shard) {
+    bufferlist bl = read_hinfo_bl(shard);
+    bufferlist::iterator p = bl.begin();
+    ECUtil::HashInfo hinfo;
+    ::decode(hinfo, p);
+    return hinfo;
+  }
+
+  /// what ECBackend does between submit_transaction and start_write
+  void apply(ECTransaction &t) {
+    map<hobject_t, set<uint64_t>, hobject_t::BitwiseComparator> to_read;
+    t.get_rmw_stripes(hash_infos, sinfo, &to_read);
+    ECTransaction::stripe_map_t stripes;
+    if (to_read.count(oid)) {
+      string obj = read_logical();
+      for (set<uint64_t>::iterator i = to_read[oid].begin();
+	   i != to_read[oid].end();
+	   ++i)
+	stripes[oid][*i].append(obj.substr(*i, swidth));
+    }
+    map<shard_id_t, ObjectStore::Transaction> trans;
+    for (int i = 0; i < 3; ++i)
+      trans[shard_id_t(i)];
+    set<hobject_t, hobject_t::BitwiseComparator> temp_added, temp_removed;
+    t.generate_transactions(hash_infos, stripes, ec_impl, pgid, sinfo,
+			    &trans, &temp_added, &temp_removed);
+    for (map<shard_id_t, ObjectStore::Transaction>::iterator i = trans.begin();
+	 i != trans.end();
+	 ++i)
+      ASSERT_EQ(0u, store->apply_transaction(&osr, i->second));
+  }
+  void create(uint64_t stripes, char c, uint64_t stripe_chunk_size) {
+    hash_infos[oid].reset(new ECUtil::HashInfo(3, stripe_chunk_size));
+    ECTransaction t;
+    bufferlist bl;
+    bl.append(string(stripes * swidth, c));
+    t.append(oid, 0, bl.length(), bl, 0);
+    apply(t);
+  }
+  void overwrite(ECTransaction *t, uint64_t off, uint64_t len, char c,
+		 version_t stash_version) {
+    bufferlist bl;
+    bl.append(string(len, c));
+    t->overwrite(oid, off, len, bl, 0, stash_version);
+  }
+};
+const uint64_t ECOverwriteTest::swidth;
+const uint64_t ECOverwriteTest::csize;
+
+TEST_F(ECOverwriteTest, splice_head_and_tail)
+{
+  create(2, 'a', csize);
+  bufferlist orig[3];
+  for (int i = 0; i < 3; ++i)
+    orig[i] = read_shard(i);
+
+  ECTransaction t;
+  overwrite(&t, swidth - 100, 200, 'b', 1);
+  map<hobject_t, set<uint64_t>, hobject_t::BitwiseComparator> to_read;
+  t.get_rmw_stripes(hash_infos, sinfo, &to_read);
+  set<uint64_t> expected;
+  expected.insert(0);
+  expected.insert(swidth);
+  ASSERT_EQ(expected, to_read[oid]);
+  apply(t);
+
+  ASSERT_EQ(string(swidth - 100, 'a') + string(200, 'b') +
+	    string(swidth - 100, 'a'),
+	    read_logical());
+  // both stripes were cloned to the stash before being overwritten
+  for (int i = 0; i < 3; ++i)
+    ASSERT_TRUE(orig[i].contents_equal(read_shard(i, 1)));
+
+  ECUtil::HashInfo hinfo = read_hinfo(0);
+  ASSERT_FALSE(hinfo.has_chunk_hash());
+  ASSERT_TRUE(hinfo.has_stripe_hashes());
+  ASSERT_EQ(2 * csize, hinfo.get_total_chunk_size());
+  uint64_t bad_off = 0;
+  for (int i = 0; i < 3; ++i)
+    ASSERT_TRUE(hinfo.check_stripe_hashes(i, 0, read_shard(i), &bad_off));
+  string corrupt = to_str(read_shard(1));
+  corrupt[csize + 5] ^= 1;
+  bufferlist corrupt_bl;
+  corrupt_bl.append(corrupt);
+  ASSERT_FALSE(hinfo.check_stripe_hashes(1, 0, corrupt_bl, &bad_off));
+  ASSERT_EQ(csize, bad_off);
+}
+
+TEST_F(ECOverwriteTest, first_overwrite_hashes_every_stripe)
+{
+  create(3, 'a', 0);
+  ASSERT_TRUE(hash_infos[oid]->has_chunk_hash());
+  ASSERT_FALSE(hash_infos[oid]->has_stripe_hashes());
+
+  ECTransaction t;
+  overwrite(&t, swidth + 10, 100, 'b', 1);
+  map<hobject_t, set<uint64_t>, hobject_t::BitwiseComparator> to_read;
+  t.get_rmw_stripes(hash_infos, sinfo, &to_read);
+  set<uint64_t> expected;
+  expected.insert(0);
+  expected.insert(swidth);
+  expected.insert(2 * swidth);
+  ASSERT_EQ(expected, to_read[oid]);
+  apply(t);
+
+  ASSERT_EQ(string(swidth + 10, 'a') + string(100, 'b') +
+	    string(2 * swidth - 110, 'a'),
+	    read_logical());
+  ECUtil::HashInfo hinfo = read_hinfo(0);
+  ASSERT_TRUE(hinfo.has_stripe_hashes());
+  ASSERT_EQ(3 * csize, hinfo.get_total_chunk_size());
+  uint64_t bad_off = 0;
+  for (int i = 0; i < 3; ++i)
+    ASSERT_TRUE(hinfo.check_stripe_hashes(i, 0, read_shard(i), &bad_off));
+}
+
+TEST_F(ECOverwriteTest, restore_saved_before_stash)
+{
+  create(2, 'a', csize);
+  bufferlist orig[3];
+  for (int i = 0; i < 3; ++i)
+    orig[i] = read_shard(i);
+  bufferlist orig_hinfo = read_hinfo_bl(0);
+
+  ECTransaction t;
+  overwrite(&t, 10, 100, 'b', 1);
+  t.stash(oid, 2);
+  apply(t);
+
+  // the stash holds the object as of the start of the transaction
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_FALSE(store->exists(coll(i), shard_obj(i)));
+    ASSERT_FALSE(store->exists(coll(i), shard_obj(i, 1)));
+    ASSERT_TRUE(orig[i].contents_equal(read_shard(i, 2)));
+    ASSERT_TRUE(orig_hinfo.contents_equal(read_hinfo_bl(i, 2)));
+  }
+  ASSERT_EQ(0u, hash_infos[oid]->get_total_chunk_size());
+}
+
+TEST_F(ECOverwriteTest, restore_saved_before_remove)
+{
+  create(2, 'a', csize);
+
+  ECTransaction t;
+  overwrite(&t, 10, 100, 'b', 1);
+  t.remove(oid);
+  apply(t);
+
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_FALSE(store->exists(coll(i), shard_obj(i)));
+    ASSERT_FALSE(store->exists(coll(i), shard_obj(i, 1)));
+  }
+}
+
+TEST_F(ECOverwriteTest, rollback_extents)
+{
+  create(2, 'a', csize);
+  bufferlist orig[3];
+  for (int i = 0; i < 3; ++i)
+    orig[i] = read_shard(i);
+  bufferlist orig_hinfo = read_hinfo_bl(0);
+
+  // across the stripe boundary, and extending the object
+  ECTransaction t;
+  overwrite(&t, swidth - 100, 200, 'b', 1);
+  overwrite(&t, 2 * swidth + 10, 100, 'c', 1);
+  apply(t);
+  ASSERT_EQ(3 * csize, read_shard(0).length());
+
+  // as PGBackend::rollback: the extents, then the old hinfo
+  interval_set<uint64_t> extents;
+  extents.insert(swidth - 100, 200);
+  extents.insert(2 * swidth + 10, 100);
+  for (int i = 0; i < 3; ++i) {
+    ObjectStore::Transaction rt;
+    ECBackend::generate_rollback_extents(
+      sinfo, coll(i), oid, shard_id_t(i), 1, 2 * swidth, extents, &rt);
+    rt.setattr(coll(i), shard_obj(i), ECUtil::get_hinfo_key(), orig_hinfo);
+    ASSERT_EQ(0u, store->apply_transaction(&osr, rt));
+  }
+
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(orig[i].contents_equal(read_shard(i)));
+    ASSERT_TRUE(orig_hinfo.contents_equal(read_hinfo_bl(i)));
+    ASSERT_FALSE(store->exists(coll(i), shard_obj(i, 1)));
+  }
+  ECUtil::HashInfo hinfo = read_hinfo(0);
+  uint64_t bad_off = 0;
+  for (int i = 0; i < 3; ++i)
+    ASSERT_TRUE(hinfo.check_stripe_hashes(i, 0, read_shard(i), &bad_off));
+}
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
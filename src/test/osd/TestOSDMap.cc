@@ -6,6 +6,7 @@
 #include "global/global_init.h"
 #include "common/common_init.h"
 
+#include <algorithm>
 #include <iostream>
 
 using namespace std;
@@ -400,3 +401,163 @@ TEST_F(OSDMapTest, PrimaryAffinity) {
     osdmap.set_primary_affinity(1, 0x10000);
   }
 }
+
+TEST_F(OSDMapTest, PGMappingTable) {
+  set_up_map();
+  PGMappingBuilder builder(g_ceph_context, 3);
+  builder.start();
+
+  // the table must agree with running CRUSH, for actual and raw pgs
+  struct Check {
+    static void matches(const OSDMap& m) {
+      ASSERT_TRUE(m.have_pg_mapping());
+      bufferlist bl;
+      m.encode(bl, CEPH_FEATURES_ALL);
+      OSDMap plain;
+      plain.decode(bl);
+      ASSERT_FALSE(plain.have_pg_mapping());
+      for (map<int64_t,pg_pool_t>::const_iterator p = m.get_pools().begin();
+	   p != m.get_pools().end();
+	   ++p) {
+	for (unsigned ps = 0; ps < p->second.get_pg_num() * 3; ++ps) {
+	  pg_t pgid(ps * 2654435761u, p->first);
+	  if (ps < p->second.get_pg_num())
+	    pgid = pg_t(ps, p->first);
+	  vector<int> up, acting, up2, acting2;
+	  int up_primary, acting_primary, up_primary2, acting_primary2;
+	  m.pg_to_up_acting_osds(pgid, &up, &up_primary,
+				 &acting, &acting_primary);
+	  plain.pg_to_up_acting_osds(pgid, &up2, &up_primary2,
+				     &acting2, &acting_primary2);
+	  ASSERT_EQ(up2, up);
+	  ASSERT_EQ(up_primary2, up_primary);
+	  ASSERT_EQ(acting2, acting);
+	  ASSERT_EQ(acting_primary2, acting_primary);
+	}
+      }
+    }
+  };
+
+  osdmap.build_pg_mapping(g_ceph_context, NULL, &builder);
+  Check::matches(osdmap);
+
+  // a stale table is not used
+  OSDMap::Incremental down(osdmap.get_epoch() + 1);
+  down.new_state[1] = CEPH_OSD_UP;
+  osdmap.apply_incremental(down);
+  ASSERT_FALSE(osdmap.have_pg_mapping());
+  osdmap.build_pg_mapping(g_ceph_context, NULL, &builder);
+  Check::matches(osdmap);
+
+  // reweight, temps and primary affinity, built from a previous map
+  OSDMap next;
+  next.deepish_copy_from(osdmap);
+  OSDMap::Incremental inc(next.get_epoch() + 1);
+  inc.new_weight[2] = CEPH_OSD_OUT;
+  inc.new_weight[3] = 0x8000;
+  inc.new_primary_affinity[4] = 0x4000;
+  pg_t pgid(0, 0);
+  vector<int> up;
+  int primary;
+  osdmap.pg_to_raw_up(pgid, &up, &primary);
+  vector<int> temp(up.rbegin(), up.rend());
+  temp.push_back(5);
+  inc.new_pg_temp[pgid] = temp;
+  inc.new_primary_temp[pg_t(1, 0)] = 0;
+  next.apply_incremental(inc);
+  next.build_pg_mapping(g_ceph_context, &osdmap, &builder);
+  Check::matches(next);
+
+  // pg_num changes
+  OSDMap::Incremental split(next.get_epoch() + 1);
+  pg_pool_t pool = *next.get_pg_pool(0);
+  pool.set_pg_num(pool.get_pg_num() * 2);
+  split.new_pools[0] = pool;
+  next.apply_incremental(split);
+  next.build_pg_mapping(g_ceph_context);
+  Check::matches(next);
+  builder.stop();
+}
+
+TEST_F(OSDMapTest, PGMappingTableShared) {
+  set_up_map();
+  unsigned num_pgs = 0;
+  for (map<int64_t,pg_pool_t>::const_iterator p = osdmap.get_pools().begin();
+       p != osdmap.get_pools().end();
+       ++p)
+    num_pgs += p->second.get_pg_num();
+  ASSERT_LT(osdmap.get_pg_pool(0)->get_pg_num(), num_pgs);
+
+  unsigned raw, rows;
+  osdmap.build_pg_mapping(g_ceph_context);
+  osdmap.get_pg_mapping_stats(&raw, &rows);
+  ASSERT_EQ(num_pgs, raw);
+  ASSERT_EQ(num_pgs, rows);
+
+  // nothing that matters changed: everything is shared
+  OSDMap next;
+  next.deepish_copy_from(osdmap);
+  OSDMap::Incremental nop(next.get_epoch() + 1);
+  nop.new_flags = next.get_flags() | CEPH_OSDMAP_NOSCRUB;
+  next.apply_incremental(nop);
+  next.build_pg_mapping(g_ceph_context, &osdmap);
+  next.get_pg_mapping_stats(&raw, &rows);
+  ASSERT_EQ(0u, raw);
+  ASSERT_EQ(0u, rows);
+
+  // a temp only rederives the rows of its own pool
+  OSDMap temp;
+  temp.deepish_copy_from(next);
+  OSDMap::Incremental inc(temp.get_epoch() + 1);
+  inc.new_primary_temp[pg_t(1, 0)] = 0;
+  temp.apply_incremental(inc);
+  temp.build_pg_mapping(g_ceph_context, &next);
+  temp.get_pg_mapping_stats(&raw, &rows);
+  ASSERT_EQ(0u, raw);
+  ASSERT_EQ(temp.get_pg_pool(0)->get_pg_num(), rows);
+  int primary;
+  temp.pg_to_acting_osds(pg_t(1, 0), NULL, &primary);
+  ASSERT_EQ(0, primary);
+
+  // an osd going down moves no CRUSH output but every row naming it
+  OSDMap down;
+  down.deepish_copy_from(temp);
+  OSDMap::Incremental d(down.get_epoch() + 1);
+  d.new_state[1] = CEPH_OSD_UP;
+  down.apply_incremental(d);
+  down.build_pg_mapping(g_ceph_context, &temp);
+  down.get_pg_mapping_stats(&raw, &rows);
+  ASSERT_EQ(0u, raw);
+  ASSERT_EQ(num_pgs, rows);
+  vector<int> acting;
+  for (unsigned ps = 0; ps < down.get_pg_pool(0)->get_pg_num(); ++ps) {
+    down.pg_to_acting_osds(pg_t(ps, 0), &acting, &primary);
+    ASSERT_EQ(acting.end(), std::find(acting.begin(), acting.end(), 1));
+  }
+}
+
+TEST_F(OSDMapTest, PGMappingBuilderQueue) {
+  set_up_map();
+  PGMappingBuilder builder(g_ceph_context, 2);
+  builder.start();
+
+  // built in the background, in order, each from the one before
+  OSDMapRef first(new OSDMap);
+  const_cast<OSDMap*>(first.get())->deepish_copy_from(osdmap);
+  OSDMap *n = new OSDMap;
+  n->deepish_copy_from(osdmap);
+  OSDMap::Incremental nop(n->get_epoch() + 1);
+  nop.new_flags = n->get_flags() | CEPH_OSDMAP_NOSCRUB;
+  n->apply_incremental(nop);
+  OSDMapRef second(n);
+  builder.queue(first, OSDMapRef());
+  builder.queue(second, first);
+  builder.wait();
+  ASSERT_TRUE(first->have_pg_mapping());
+  ASSERT_TRUE(second->have_pg_mapping());
+  unsigned raw, rows;
+  second->get_pg_mapping_stats(&raw, &rows);
+  ASSERT_EQ(0u, raw);
+  ASSERT_EQ(0u, rows);
+  builder.stop();
+}
@@ -0,0 +1,313 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <boost/scoped_ptr.hpp>
+#include "osd/ReplicatedPG.h"
+#include "osd/ReplicatedBackend.h"
+#include "os/ObjectStore.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include <gtest/gtest.h>
+
+static OSDOp make_op(int op, uint64_t off = 0, uint64_t len = 0)
+{
+  OSDOp o;
+  o.op.op = op;
+  o.op.extent.offset = off;
+  o.op.extent.length = len;
+  return o;
+}
+
+static interval_set<uint64_t> make_set(uint64_t off, uint64_t len)
+{
+  interval_set<uint64_t> s;
+  s.insert(off, len);
+  return s;
+}
+
+TEST(ReplicatedPG, calc_dirty_extents)
+{
+  object_info_t oi;
+  oi.size = 8192;
+
+  // overwrite in place
+  {
+    vector<OSDOp> ops;
+    ops.push_back(make_op(CEPH_OSD_OP_WRITE, 4096, 100));
+    interval_set<uint64_t> dirty;
+    ASSERT_TRUE(ReplicatedPG::calc_dirty_extents(ops, oi, 8192, &dirty));
+    ASSERT_EQ(make_set(4096, 100), dirty);
+  }
+
+  // reads and xattrs alongside a write add nothing
+  {
+    vector<OSDOp> ops;
+    ops.push_back(make_op(CEPH_OSD_OP_CMPXATTR));
+    ops.push_back(make_op(CEPH_OSD_OP_READ, 0, 8192));
+    ops.push_back(make_op(CEPH_OSD_OP_ZERO, 0, 512));
+    ops.push_back(make_op(CEPH_OSD_OP_SETXATTR));
+    interval_set<uint64_t> dirty;
+    ASSERT_TRUE(ReplicatedPG::calc_dirty_extents(ops, oi, 8192, &dirty));
+    ASSERT_EQ(make_set(0, 512), dirty);
+  }
+
+  // extending write, then a truncate back below the old size
+  {
+    vector<OSDOp> ops;
+    ops.push_back(make_op(CEPH_OSD_OP_WRITE, 8192, 4096));
+    ops.push_back(make_op(CEPH_OSD_OP_TRUNCATE, 6000));
+    interval_set<uint64_t> dirty;
+    ASSERT_TRUE(ReplicatedPG::calc_dirty_extents(ops, oi, 6000, &dirty));
+    ASSERT_EQ(make_set(6000, 12288 - 6000), dirty);
+  }
+
+  // writefull covers old and new size
+  {
+    vector<OSDOp> ops;
+    ops.push_back(make_op(CEPH_OSD_OP_WRITEFULL, 0, 100));
+    interval_set<uint64_t> dirty;
+    ASSERT_TRUE(ReplicatedPG::calc_dirty_extents(ops, oi, 100, &dirty));
+    ASSERT_EQ(make_set(0, 8192), dirty);
+  }
+
+  // append
+  {
+    vector<OSDOp> ops;
+    ops.push_back(make_op(CEPH_OSD_OP_APPEND, 0, 10));
+    interval_set<uint64_t> dirty;
+    ASSERT_TRUE(ReplicatedPG::calc_dirty_extents(ops, oi, 8202, &dirty));
+    ASSERT_EQ(make_set(8192, 10), dirty);
+  }
+
+  // anything we do not know about, even if it is flagged as a read,
+  // may change the object behind our back
+  int opaque[] = {
+    CEPH_OSD_OP_CALL,
+    CEPH_OSD_OP_OMAPSETVALS,
+    CEPH_OSD_OP_OMAPRMKEYS,
+    CEPH_OSD_OP_OMAPCLEAR,
+    CEPH_OSD_OP_TMAPUP,
+    CEPH_OSD_OP_CLONERANGE,
+    CEPH_OSD_OP_ROLLBACK,
+    CEPH_OSD_OP_COPY_FROM,
+    CEPH_OSD_OP_MASKTRUNC,
+  };
+  for (unsigned i = 0; i < sizeof(opaque) / sizeof(opaque[0]); ++i) {
+    vector<OSDOp> ops;
+    ops.push_back(make_op(CEPH_OSD_OP_WRITE, 0, 10));
+    ops.push_back(make_op(opaque[i]));
+    interval_set<uint64_t> dirty;
+    EXPECT_FALSE(ReplicatedPG::calc_dirty_extents(ops, oi, 8192, &dirty))
+      << ceph_osd_op_name(opaque[i]);
+  }
+}
+
+static pg_log_entry_t make_entry(const hobject_t &oid, eversion_t v,
+				 eversion_t prior, uint64_t off, uint64_t len)
+{
+  pg_log_entry_t e(pg_log_entry_t::MODIFY, oid, v, prior, 0,
+		   osd_reqid_t(), utime_t());
+  e.has_dirty_extents = true;
+  if (len)
+    e.dirty_extents.insert(off, len);
+  return e;
+}
+
+TEST(ReplicatedBackend, calc_dirty_subset)
+{
+  hobject_t oid(object_t("foo"), "", CEPH_NOSNAP, 1, 1, "");
+  hobject_t other(object_t("bar"), "", CEPH_NOSNAP, 2, 1, "");
+
+  pg_log_t log;
+  log.tail = eversion_t(1, 1);
+  log.log.push_back(make_entry(oid, eversion_t(1, 2), eversion_t(1, 1),
+			       0, 4096));
+  log.log.push_back(make_entry(other, eversion_t(1, 3), eversion_t(), 0, 1));
+  log.log.push_back(make_entry(oid, eversion_t(1, 4), eversion_t(1, 2),
+			       65536, 4096));
+  log.log.push_back(make_entry(oid, eversion_t(1, 5), eversion_t(1, 4),
+			       2048, 4096));
+  log.head = eversion_t(1, 5);
+
+  interval_set<uint64_t> subset;
+
+  // union of everything since have, clipped to the size
+  ASSERT_TRUE(ReplicatedBackend::calc_dirty_subset(
+		log, oid, eversion_t(1, 1), eversion_t(1, 5), 65536 + 1024,
+		&subset));
+  interval_set<uint64_t> expected;
+  expected.insert(0, 6144);
+  expected.insert(65536, 1024);
+  ASSERT_EQ(expected, subset);
+
+  // only the newest entry
+  ASSERT_TRUE(ReplicatedBackend::calc_dirty_subset(
+		log, oid, eversion_t(1, 4), eversion_t(1, 5), 1 << 20,
+		&subset));
+  ASSERT_EQ(make_set(2048, 4096), subset);
+
+  // nothing to start from
+  ASSERT_FALSE(ReplicatedBackend::calc_dirty_subset(
+		 log, oid, eversion_t(), eversion_t(1, 5), 1 << 20, &subset));
+
+  // have is older than the log
+  ASSERT_FALSE(ReplicatedBackend::calc_dirty_subset(
+		 log, oid, eversion_t(1, 0), eversion_t(1, 5), 1 << 20,
+		 &subset));
+
+  // have is not on the chain for this object
+  ASSERT_FALSE(ReplicatedBackend::calc_dirty_subset(
+		 log, oid, eversion_t(1, 3), eversion_t(1, 5), 1 << 20,
+		 &subset));
+
+  // an entry without extents in the middle
+  log.log.push_back(make_entry(oid, eversion_t(1, 6), eversion_t(1, 5),
+			       0, 0));
+  log.log.back().has_dirty_extents = false;
+  log.log.push_back(make_entry(oid, eversion_t(1, 7), eversion_t(1, 6),
+			       0, 10));
+  log.head = eversion_t(1, 7);
+  ASSERT_FALSE(ReplicatedBackend::calc_dirty_subset(
+		 log, oid, eversion_t(1, 5), eversion_t(1, 7), 1 << 20,
+		 &subset));
+  ASSERT_TRUE(ReplicatedBackend::calc_dirty_subset(
+		log, oid, eversion_t(1, 6), eversion_t(1, 7), 1 << 20,
+		&subset));
+  ASSERT_EQ(make_set(0, 10), subset);
+}
+
+class PartialPushTest : public ::testing::Test {
+public:
+  boost::scoped_ptr<ObjectStore> store;
+  ObjectStore::Sequencer osr;
+  coll_t cid;
+  hobject_t soid;
+
+  PartialPushTest()
+    : osr("partial_push"),
+      cid(spg_t(pg_t(0, 1), shard_id_t::NO_SHARD)),
+      soid(object_t("foo"), "", CEPH_NOSNAP, 0, 1, "") {}
+
+  virtual void SetUp() {
+    int r = ::mkdir("replicated_backend_temp_dir", 0777);
+    ASSERT_TRUE(r == 0 || errno == EEXIST);
+    store.reset(ObjectStore::create(g_ceph_context, "memstore",
+				    "replicated_backend_temp_dir",
+				    "replicated_backend_temp_journal"));
+    ASSERT_TRUE(store);
+    ASSERT_EQ(0, store->mkfs());
+    ASSERT_EQ(0, store->mount());
+
+    // the replica's copy at the prior version
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    bufferlist old;
+    old.append(string(16384, 'a'));
+    t.write(cid, ghobject_t(soid), 0, old.length(), old);
+    map<string, bufferlist> attrs;
+    attrs["_"].append("old oi");
+    attrs["_stale"].append("x");
+    t.setattrs(cid, ghobject_t(soid), attrs);
+    map<string, bufferlist> omap;
+    omap["key"].append("value");
+    t.omap_setkeys(cid, ghobject_t(soid), omap);
+    ASSERT_EQ(0u, store->apply_transaction(&osr, t));
+  }
+
+  virtual void TearDown() {
+    if (store)
+      store->umount();
+  }
+
+  /**
+   * Push the new version: 12288 bytes, 'b' at 4096~4096, a hole at
+   * 0~1024 (which is not sent) and the rest as before.
+   */
+  void push(const hobject_t &target) {
+    ObjectRecoveryInfo info;
+    info.soid = soid;
+    info.size = 12288;
+    info.partial_from = eversion_t(1, 1);
+    info.copy_subset.insert(0, 1024);
+    info.copy_subset.insert(4096, 4096);
+
+    ObjectStore::Transaction t;
+    ReplicatedBackend::prep_partial_push_target(cid, target, info, &t);
+    bufferlist data;
+    data.append(string(4096, 'b'));
+    t.write(cid, ghobject_t(target), 4096, data.length(), data);
+    map<string, bufferlist> attrs;
+    attrs["_"].append("new oi");
+    t.setattrs(cid, ghobject_t(target), attrs);
+    if (target != soid) {
+      t.remove(cid, ghobject_t(soid));
+      t.collection_move_rename(cid, ghobject_t(target),
+			       cid, ghobject_t(soid));
+    }
+    ASSERT_EQ(0u, store->apply_transaction(&osr, t));
+  }
+
+  void verify() {
+    bufferlist expected;
+    expected.append_zero(1024);
+    expected.append(string(3072, 'a'));
+    expected.append(string(4096, 'b'));
+    expected.append(string(4096, 'a'));
+
+    bufferlist bl;
+    ASSERT_EQ(12288, store->read(cid, ghobject_t(soid), 0, 1 << 20, bl));
+    ASSERT_TRUE(bl.contents_equal(expected));
+
+    map<string, bufferlist> attrs;
+    ASSERT_EQ(0, store->getattrs(cid, ghobject_t(soid), attrs));
+    ASSERT_EQ(1u, attrs.size());
+    ASSERT_EQ(string("new oi"), string(attrs["_"].c_str(), attrs["_"].length()));
+
+    bufferlist header;
+    map<string, bufferlist> omap;
+    ASSERT_EQ(0, store->omap_get(cid, ghobject_t(soid), &header, &omap));
+    ASSERT_EQ(1u, omap.size());
+    ASSERT_EQ(string("value"), string(omap["key"].c_str(), omap["key"].length()));
+  }
+};
+
+TEST_F(PartialPushTest, in_place)
+{
+  push(soid);
+  verify();
+}
+
+TEST_F(PartialPushTest, via_temp_object)
+{
+  hobject_t temp = spg_t(pg_t(0, 1), shard_id_t::NO_SHARD).make_temp_object(
+    "temp_recovering_foo");
+  push(temp);
+  verify();
+  ASSERT_FALSE(store->exists(cid, ghobject_t(temp)));
+}
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+// Local Variables:
+// compile-command: "cd ../.. ; make unittest_replicatedbackend ; ./unittest_replicatedbackend # --gtest_filter=*.* "
+// End:
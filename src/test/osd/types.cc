@@ -617,6 +617,57 @@ TEST(pg_interval_t, check_new_interval)
   }
 }
 
+TEST(pg_interval_t, summarize_interval)
+{
+  map<epoch_t, pg_interval_t> past_intervals;
+  // 10-19 rw, then 20-29, 30-34, 35-39 not rw, then 40-49 rw
+  epoch_t bounds[] = { 10, 20, 30, 35, 40, 50 };
+  for (unsigned i = 0; i < 5; ++i) {
+    pg_interval_t &interval = past_intervals[bounds[i]];
+    interval.first = bounds[i];
+    interval.last = bounds[i + 1] - 1;
+    interval.maybe_went_rw = (i == 0 || i == 4);
+    interval.acting.push_back(i);
+    interval.up.push_back(i);
+    interval.primary = i;
+    interval.up_primary = i;
+  }
+
+  // rw intervals are left alone
+  pg_interval_t::summarize_interval(&past_intervals, 10);
+  pg_interval_t::summarize_interval(&past_intervals, 40);
+  ASSERT_EQ(5u, past_intervals.size());
+  ASSERT_EQ(1u, past_intervals[10].acting.size());
+
+  // non rw intervals are stripped and merged with their neighbours
+  pg_interval_t::summarize_interval(&past_intervals, 30);
+  ASSERT_EQ(3u, past_intervals.size());
+  ASSERT_EQ(20u, past_intervals[20].first);
+  ASSERT_EQ(39u, past_intervals[20].last);
+  ASSERT_FALSE(past_intervals[20].maybe_went_rw);
+  ASSERT_TRUE(past_intervals[20].acting.empty());
+  ASSERT_TRUE(past_intervals[20].up.empty());
+  ASSERT_EQ(-1, past_intervals[20].primary);
+  ASSERT_EQ(-1, past_intervals[20].up_primary);
+  ASSERT_EQ(49u, past_intervals[40].last);
+  ASSERT_TRUE(past_intervals[40].maybe_went_rw);
+  ASSERT_EQ(1u, past_intervals[40].acting.size());
+
+  // a non rw interval after a rw one starts a new summary
+  pg_interval_t &interval = past_intervals[50];
+  interval.first = 50;
+  interval.last = 59;
+  interval.acting.push_back(1);
+  pg_interval_t::summarize_interval(&past_intervals, 50);
+  ASSERT_EQ(4u, past_intervals.size());
+  ASSERT_TRUE(past_intervals[50].acting.empty());
+  ASSERT_EQ(59u, past_intervals[50].last);
+
+  // unknown epochs are ignored
+  pg_interval_t::summarize_interval(&past_intervals, 12);
+  ASSERT_EQ(4u, past_intervals.size());
+}
+
 TEST(pg_t, get_ancestor)
 {
   ASSERT_EQ(pg_t(0, 0, -1), pg_t(16, 0, -1).get_ancestor(16));
@@ -1256,6 +1307,32 @@ TEST_F(ObjectContextTest, read_write_lock)
 
 }
 
+TEST(pg_log_entry_t, dirty_extents) {
+  hobject_t oid(object_t("objname"), "key", 123, 456, 0, "");
+  pg_log_entry_t e(pg_log_entry_t::MODIFY, oid, eversion_t(1,3),
+		   eversion_t(1,2), 2, osd_reqid_t(), utime_t());
+  e.has_dirty_extents = true;
+  e.dirty_extents.insert(0, 4096);
+  e.dirty_extents.insert(65536, 512);
+
+  bufferlist bl;
+  ::encode(e, bl);
+  pg_log_entry_t d;
+  bufferlist::iterator p = bl.begin();
+  ::decode(d, p);
+  EXPECT_TRUE(d.has_dirty_extents);
+  EXPECT_EQ(e.dirty_extents, d.dirty_extents);
+
+  pg_log_entry_t none(pg_log_entry_t::MODIFY, oid, eversion_t(1,4),
+		      eversion_t(1,3), 3, osd_reqid_t(), utime_t());
+  bl.clear();
+  ::encode(none, bl);
+  p = bl.begin();
+  ::decode(d, p);
+  EXPECT_FALSE(d.has_dirty_extents);
+  EXPECT_TRUE(d.dirty_extents.empty());
+}
+
 TEST(pg_pool_t_test, get_pg_num_divisor) {
   pg_pool_t p;
   p.set_pg_num(16);
@@ -1447,6 +1524,33 @@ TEST(pool_opts_t, deep_scrub_interval) {
   EXPECT_FALSE(opts.is_set(pool_opts_t::DEEP_SCRUB_INTERVAL));
 }
 
+TEST(pool_opts_t, compression_algorithm) {
+  EXPECT_TRUE(pool_opts_t::is_opt_name("compression_algorithm"));
+  EXPECT_EQ(pool_opts_t::get_opt_desc("compression_algorithm"),
+            pool_opts_t::opt_desc_t(pool_opts_t::COMPRESSION_ALGORITHM,
+                                    pool_opts_t::STR));
+
+  pool_opts_t opts;
+  EXPECT_FALSE(opts.is_set(pool_opts_t::COMPRESSION_ALGORITHM));
+  string val;
+  EXPECT_FALSE(opts.get(pool_opts_t::COMPRESSION_ALGORITHM, &val));
+  opts.set(pool_opts_t::COMPRESSION_ALGORITHM, string("snappy"));
+  EXPECT_TRUE(opts.get(pool_opts_t::COMPRESSION_ALGORITHM, &val));
+  EXPECT_EQ("snappy", val);
+
+  bufferlist bl;
+  ::encode(opts, bl);
+  pool_opts_t opts2;
+  bufferlist::iterator p = bl.begin();
+  ::decode(opts2, p);
+  val.clear();
+  EXPECT_TRUE(opts2.get(pool_opts_t::COMPRESSION_ALGORITHM, &val));
+  EXPECT_EQ("snappy", val);
+
+  opts.unset(pool_opts_t::COMPRESSION_ALGORITHM);
+  EXPECT_FALSE(opts.is_set(pool_opts_t::COMPRESSION_ALGORITHM));
+}
+
 /*
  * Local Variables:
  * compile-command: "cd ../.. ;
@@ -13,6 +13,7 @@
 #include "common/Mutex.h"
 #include "common/safe_io.h"
 #include "os/JournalingObjectStore.h"
+#include "include/stringify.h"
 
 Finisher *finisher;
 Cond sync_cond;
@@ -62,6 +63,26 @@ public:
   }
 };
 
+/// set a config option for the scope of a test
+class ConfGuard {
+  string key;
+  string old;
+public:
+  ConfGuard(const char *k, const char *v) : key(k) {
+    char buf[256];
+    char *p = buf;
+    int r = g_ceph_context->_conf->get_val(k, &p, sizeof(buf));
+    assert(r == 0);
+    old = buf;
+    g_ceph_context->_conf->set_val(k, v);
+    g_ceph_context->_conf->apply_changes(NULL);
+  }
+  ~ConfGuard() {
+    g_ceph_context->_conf->set_val(key.c_str(), old.c_str());
+    g_ceph_context->_conf->apply_changes(NULL);
+  }
+};
+
 unsigned size_mb = 200;
 //Gtest argument prefix
 const char GTEST_PRFIX[] = "--gtest_";
@@ -665,3 +686,193 @@ TEST(TestFileJournal, ReplayDetectCorruptHeader) {
     ::close(fd);
   }
 }
+
+TEST(TestFileJournal, ReplayDax) {
+  g_ceph_context->_conf->set_val("journal_ignore_corruption", "false");
+  g_ceph_context->_conf->set_val("journal_write_header_frequency", "0");
+  g_ceph_context->_conf->apply_changes(NULL);
+  ConfGuard dax("journal_dax", "true");
+
+  list<ObjectStore::Transaction*> tls;
+  fsid.generate_random();
+  FileJournal j(fsid, finisher, &sync_cond, path, false, false, false);
+  ASSERT_EQ(0, j.create());
+  j.make_writeable();
+
+  C_GatherBuilder gb(g_ceph_context, new C_SafeCond(&wait_lock, &cond, &done));
+
+  bufferlist bl;
+  bl.append("small");
+  int orig_len = j.prepare_entry(tls, &bl);
+  j.submit_entry(1, bl, orig_len, gb.new_sub());
+  bl.append("small");
+  orig_len = j.prepare_entry(tls, &bl);
+  j.submit_entry(2, bl, orig_len, gb.new_sub());
+  gb.activate();
+  wait();
+
+  j.close();
+
+  j.open(0);
+
+  bufferlist inbl;
+  string v;
+  uint64_t seq = 0;
+  ASSERT_EQ(true, j.read_entry(inbl, seq));
+  ASSERT_EQ(seq, 1ull);
+  inbl.copy(0, inbl.length(), v);
+  ASSERT_EQ("small", v);
+  inbl.clear();
+  v.clear();
+
+  ASSERT_EQ(true, j.read_entry(inbl, seq));
+  ASSERT_EQ(seq, 2ull);
+  inbl.copy(0, inbl.length(), v);
+  ASSERT_EQ("small", v);
+  inbl.clear();
+
+  ASSERT_TRUE(!j.read_entry(inbl, seq));
+
+  j.make_writeable();
+  j.close();
+}
+
+TEST(TestFileJournal, WriteTrimDax) {
+  g_ceph_context->_conf->set_val("journal_ignore_corruption", "false");
+  g_ceph_context->_conf->set_val("journal_write_header_frequency", "0");
+  g_ceph_context->_conf->apply_changes(NULL);
+  ConfGuard dax("journal_dax", "true");
+
+  // directio and aio are asked for, but dax turns them off on open
+  fsid.generate_random();
+  FileJournal j(fsid, finisher, &sync_cond, path, true, true, true);
+  ASSERT_EQ(0, j.create());
+  j.make_writeable();
+
+  list<C_Sync*> ls;
+
+  bufferlist bl;
+  char foo[1024*1024];
+  memset(foo, 1, sizeof(foo));
+
+  uint64_t seq = 1, committed = 0;
+  list<ObjectStore::Transaction*> tls;
+
+  // enough to wrap around the journal a couple of times
+  for (unsigned i=0; i<size_mb*2; i++) {
+    bl.clear();
+    bl.push_back(buffer::copy(foo, sizeof(foo)));
+    ls.push_back(new C_Sync);
+    int orig_len = j.prepare_entry(tls, &bl);
+    j.submit_entry(seq++, bl, orig_len, ls.back()->c);
+
+    while (ls.size() > size_mb/2) {
+      delete ls.front();
+      ls.pop_front();
+      committed++;
+      j.committed_thru(committed);
+    }
+  }
+
+  while (ls.size()) {
+    delete ls.front();
+    ls.pop_front();
+    j.committed_thru(++committed);
+  }
+
+  ASSERT_TRUE(j.journalq_empty());
+
+  j.close();
+}
+
+TEST(TestFileJournal, GroupCommit) {
+  g_ceph_context->_conf->set_val("journal_ignore_corruption", "false");
+  g_ceph_context->_conf->set_val("journal_write_header_frequency", "0");
+  g_ceph_context->_conf->apply_changes(NULL);
+  ConfGuard max_wait("journal_group_commit_max_wait_us", "100000");
+  ConfGuard entries("journal_max_write_entries", "10");
+
+  list<ObjectStore::Transaction*> tls;
+
+  for (unsigned i = 0 ; i < 3; ++i) {
+    SCOPED_TRACE(subtests[i].description);
+    fsid.generate_random();
+    FileJournal j(fsid, finisher, &sync_cond, path, subtests[i].directio,
+		  subtests[i].aio, subtests[i].faio);
+    ASSERT_EQ(0, j.create());
+    j.make_writeable();
+
+    // a steady trickle, so the writer holds writes open, then a burst
+    // larger than journal_max_write_entries
+    C_GatherBuilder gb(g_ceph_context, new C_SafeCond(&wait_lock, &cond, &done));
+    uint64_t seq = 1;
+    for (; seq <= 20; ++seq) {
+      bufferlist bl;
+      bl.append(stringify(seq));
+      int orig_len = j.prepare_entry(tls, &bl);
+      j.submit_entry(seq, bl, orig_len, gb.new_sub());
+      usleep(1000);
+    }
+    for (; seq <= 100; ++seq) {
+      bufferlist bl;
+      bl.append(stringify(seq));
+      int orig_len = j.prepare_entry(tls, &bl);
+      j.submit_entry(seq, bl, orig_len, gb.new_sub());
+    }
+    gb.activate();
+    wait();
+
+    j.close();
+
+    // every entry made it, in order
+    j.open(0);
+    for (uint64_t expect = 1; expect < seq; ++expect) {
+      bufferlist inbl;
+      uint64_t s = 0;
+      ASSERT_TRUE(j.read_entry(inbl, s));
+      ASSERT_EQ(expect, s);
+      string v;
+      inbl.copy(0, inbl.length(), v);
+      ASSERT_EQ(stringify(expect), v);
+    }
+    bufferlist inbl;
+    uint64_t s = 0;
+    ASSERT_FALSE(j.read_entry(inbl, s));
+    j.make_writeable();
+    j.close();
+  }
+}
+
+TEST(TestFileJournal, GroupCommitSerialWriter) {
+  g_ceph_context->_conf->set_val("journal_ignore_corruption", "false");
+  g_ceph_context->_conf->set_val("journal_write_header_frequency", "0");
+  g_ceph_context->_conf->apply_changes(NULL);
+  ConfGuard max_wait("journal_group_commit_max_wait_us", "10000000");
+
+  list<ObjectStore::Transaction*> tls;
+
+  for (unsigned i = 0 ; i < 3; ++i) {
+    SCOPED_TRACE(subtests[i].description);
+    fsid.generate_random();
+    FileJournal j(fsid, finisher, &sync_cond, path, subtests[i].directio,
+		  subtests[i].aio, subtests[i].faio);
+    ASSERT_EQ(0, j.create());
+    j.make_writeable();
+
+    // a writer that waits for each commit never has company; the time
+    // the journal spends waiting for one must not feed back into ever
+    // longer waits
+    utime_t start = ceph_clock_now(g_ceph_context);
+    for (uint64_t seq = 1; seq <= 200; ++seq) {
+      C_Sync s;
+      bufferlist bl;
+      bl.append("small");
+      int orig_len = j.prepare_entry(tls, &bl);
+      j.submit_entry(seq, bl, orig_len, s.c);
+    }
+    utime_t elapsed = ceph_clock_now(g_ceph_context) - start;
+    ASSERT_GT(10.0, (double)elapsed);
+
+    j.close();
+  }
+}
@@ -269,3 +269,37 @@ TEST(PageSet, FreeHoles)
   pages.get_range(0, 8, range);
   ASSERT_EQ(0u, range.size());
 }
+
+TEST(PageSet, Arena)
+{
+  PageArena *arena = PageSet::get_arena(4096);
+  ASSERT_EQ(arena, PageSet::get_arena(4096));
+  PageArena::Stats before = arena->get_stats();
+  {
+    PageSet pages(4096, arena);
+    PageSet::page_vector range;
+    pages.alloc_range(0, 16 * 4096, range);
+    ASSERT_EQ(16u, range.size());
+    for (auto &p : range) {
+      // data blocks stay page aligned
+      ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(p->data) % 4096);
+      std::fill(p->data, p->data + 4096, 'a');
+    }
+    PageArena::Stats s = arena->get_stats();
+    ASSERT_LT(before.used_bytes, s.used_bytes);
+    ASSERT_LE(s.used_bytes, s.slab_bytes);
+
+    // round trip through encode/decode into arena pages
+    bufferlist bl;
+    pages.encode(bl);
+    PageSet copy(4096, arena);
+    bufferlist::iterator i = bl.begin();
+    copy.decode(i);
+    range.clear();
+    copy.get_range(0, 16 * 4096, range);
+    ASSERT_EQ(16u, range.size());
+    ASSERT_EQ('a', range[15]->data[4095]);
+  }
+  // everything went back to the arena
+  ASSERT_EQ(before.used_bytes, arena->get_stats().used_bytes);
+}